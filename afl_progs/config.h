@@ -266,6 +266,11 @@
 
 #define SHM_ENV_VAR         "__AFL_SHM_ID"
 
+/* Environment variable used instead of SHM_ENV_VAR to pass the file
+   descriptor of a memfd-backed map to the called program. */
+
+#define SHM_FD_ENV_VAR      "__AFL_SHM_FD"
+
 /* Other less interesting, internal-only variables. */
 
 #define CLANG_ENV_VAR       "__AFL_CLANG_MODE"
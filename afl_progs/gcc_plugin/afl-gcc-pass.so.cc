@@ -0,0 +1,287 @@
+/*
+   american fuzzy lop - GCC plugin instrumentation pass
+   ----------------------------------------------------
+
+   Based on the LLVM-mode instrumentation pass written by
+   Laszlo Szekeres <lszekeres@google.com> and
+   Michal Zalewski <lcamtuf@google.com>
+
+   Copyright 2015, 2016 Google Inc. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   This plugin is loaded into GCC when invoking gcc through afl-gcc-fast.
+   Instead of rewriting the assembly output the way afl-as does, it emits the
+   map update directly as GIMPLE at the start of every basic block, so the
+   compiler can allocate registers around it and optimize it like any other
+   code. The instrumented program talks to the same __afl_area_ptr and
+   __afl_prev_loc runtime as the LLVM mode (see ../llvm_mode/afl-llvm-rt.o.c).
+
+ */
+
+#define AFL_GCC_PASS
+
+#include "../config.h"
+#include "../debug.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+/* GCC has its own likely() / unlikely(). */
+
+#undef likely
+#undef unlikely
+
+#include <gcc-plugin.h>
+#include <plugin-version.h>
+#include <tree.h>
+#include <tree-pass.h>
+#include <context.h>
+#include <basic-block.h>
+#include <gimple-expr.h>
+#include <gimple.h>
+#include <gimple-iterator.h>
+#include <stringpool.h>
+#include <varasm.h>
+#include <ggc.h>
+
+/* Required by GCC before it agrees to load the plugin. */
+
+int plugin_is_GPL_compatible = 1;
+
+static struct plugin_info afl_plugin_info = {
+  VERSION,
+  "AFL instrumentation plugin, use through afl-gcc-fast"
+};
+
+
+static unsigned int inst_ratio = 100;   /* AFL_INST_RATIO                    */
+static unsigned int inst_blocks;        /* Number of instrumented locations  */
+static char be_quiet;                   /* AFL_QUIET or no tty               */
+
+static tree map_ptr_g;                  /* __afl_area_ptr declaration        */
+static tree prev_loc_g;                 /* __afl_prev_loc declaration        */
+
+/* The declarations are built once per translation unit and kept across
+   functions, so they need to be GC roots. */
+
+static const struct ggc_root_tab afl_ggc_roots[] = {
+
+  { &map_ptr_g, 1, sizeof(map_ptr_g), &gt_ggc_mx_tree_node,
+    &gt_pch_nx_tree_node },
+  { &prev_loc_g, 1, sizeof(prev_loc_g), &gt_ggc_mx_tree_node,
+    &gt_pch_nx_tree_node },
+  LAST_GGC_ROOT_TAB
+
+};
+
+
+/* The pass is run right after the CFG is built and before the code is put in
+   SSA form, so plain temporaries can be used and the "ssa" pass takes care of
+   renaming them. */
+
+static const struct pass_data afl_pass_data = {
+
+  GIMPLE_PASS,                          /* type                              */
+  "afl",                                /* name                              */
+  OPTGROUP_NONE,                        /* optinfo_flags                     */
+  TV_NONE,                              /* tv_id                             */
+  PROP_cfg,                             /* properties_required               */
+  0,                                    /* properties_provided               */
+  0,                                    /* properties_destroyed              */
+  0,                                    /* todo_flags_start                  */
+  0                                     /* todo_flags_finish                 */
+
+};
+
+
+/* Declare one of the runtime's globals as an external variable. */
+
+static tree build_afl_global(const char* name, tree type, bool tls) {
+
+  tree decl = build_decl(UNKNOWN_LOCATION, VAR_DECL, get_identifier(name),
+                         type);
+
+  TREE_PUBLIC(decl)   = 1;
+  DECL_EXTERNAL(decl) = 1;
+  DECL_ARTIFICIAL(decl) = 1;
+  TREE_USED(decl)     = 1;
+
+  if (tls) set_decl_tls_model(decl, decl_default_tls_model(decl));
+
+  rest_of_decl_compilation(decl, 1, 0);
+
+  return decl;
+
+}
+
+
+namespace {
+
+  class AFLCoverage : public gimple_opt_pass {
+
+    public:
+
+      AFLCoverage(gcc::context* ctxt) : gimple_opt_pass(afl_pass_data, ctxt) { }
+
+      unsigned int execute(function* fun) override;
+
+  };
+
+}
+
+
+unsigned int AFLCoverage::execute(function* fun) {
+
+  tree map_type = build_pointer_type(unsigned_char_type_node);
+  basic_block bb;
+
+  /* Get globals for the SHM region and the previous location, the first time
+     a function in this translation unit is instrumented. Note that
+     __afl_prev_loc is thread-local. */
+
+  if (!map_ptr_g) {
+
+    map_ptr_g  = build_afl_global("__afl_area_ptr", map_type, false);
+    prev_loc_g = build_afl_global("__afl_prev_loc", uint32_type_node, true);
+
+  }
+
+  /* Instrument all the things! */
+
+  FOR_EACH_BB_FN(bb, fun) {
+
+    gimple_seq seq = NULL;
+    gimple_stmt_iterator gsi;
+
+    if (AFL_R(100) >= inst_ratio) continue;
+
+    /* Make up cur_loc */
+
+    unsigned int cur_loc = AFL_R(MAP_SIZE);
+
+    /* Load prev_loc and compute the map offset */
+
+    tree prev_loc = create_tmp_var(uint32_type_node, "afl_prev_loc");
+    gimple_seq_add_stmt(&seq, gimple_build_assign(prev_loc, prev_loc_g));
+
+    tree area_off = create_tmp_var(uint32_type_node, "afl_area_off");
+    gimple_seq_add_stmt(&seq, gimple_build_assign(area_off, BIT_XOR_EXPR,
+                        prev_loc, build_int_cst(uint32_type_node, cur_loc)));
+
+    tree area_idx = create_tmp_var(sizetype, "afl_area_idx");
+    gimple_seq_add_stmt(&seq, gimple_build_assign(area_idx, NOP_EXPR,
+                                                  area_off));
+
+    /* Load SHM pointer */
+
+    tree map_ptr = create_tmp_var(map_type, "afl_map_ptr");
+    gimple_seq_add_stmt(&seq, gimple_build_assign(map_ptr, map_ptr_g));
+
+    tree map_ent = create_tmp_var(map_type, "afl_map_ent");
+    gimple_seq_add_stmt(&seq, gimple_build_assign(map_ent, POINTER_PLUS_EXPR,
+                                                  map_ptr, area_idx));
+
+    /* Update bitmap */
+
+    tree counter = create_tmp_var(unsigned_char_type_node, "afl_counter");
+    gimple_seq_add_stmt(&seq, gimple_build_assign(counter,
+                        build2(MEM_REF, unsigned_char_type_node, map_ent,
+                               build_int_cst(map_type, 0))));
+
+    tree incr = create_tmp_var(unsigned_char_type_node, "afl_incr");
+    gimple_seq_add_stmt(&seq, gimple_build_assign(incr, PLUS_EXPR, counter,
+                        build_int_cst(unsigned_char_type_node, 1)));
+
+    gimple_seq_add_stmt(&seq, gimple_build_assign(
+                        build2(MEM_REF, unsigned_char_type_node, map_ent,
+                               build_int_cst(map_type, 0)), incr));
+
+    /* Set prev_loc to cur_loc >> 1 */
+
+    gimple_seq_add_stmt(&seq, gimple_build_assign(prev_loc_g,
+                        build_int_cst(uint32_type_node, cur_loc >> 1)));
+
+    gsi = gsi_after_labels(bb);
+    gsi_insert_seq_before(&gsi, seq, GSI_SAME_STMT);
+
+    inst_blocks++;
+
+  }
+
+  return 0;
+
+}
+
+
+/* Say something nice once the whole translation unit is done. */
+
+static void afl_finish(void* gcc_data, void* user_data) {
+
+  if (be_quiet) return;
+
+  if (!inst_blocks) WARNF("No instrumentation targets found.");
+  else OKF("Instrumented %u locations (%s mode, ratio %u%%).",
+           inst_blocks, getenv("AFL_HARDEN") ? "hardened" :
+           (getenv("AFL_USE_ASAN") ? "ASAN" : "non-hardened"), inst_ratio);
+
+}
+
+
+int plugin_init(struct plugin_name_args* plugin_info,
+                struct plugin_gcc_version* version) {
+
+  struct register_pass_info afl_pass_info;
+  struct timeval tv;
+  char* inst_ratio_str = getenv("AFL_INST_RATIO");
+
+  if (!plugin_default_version_check(version, &gcc_version))
+    FATAL("Incompatible GCC version, afl-gcc-pass.so was built for GCC %s",
+          gcc_version.basever);
+
+  /* Show a banner */
+
+  if (isatty(2) && !getenv("AFL_QUIET")) {
+
+    SAYF(cCYA "afl-gcc-pass " cBRI VERSION cRST "\n");
+
+  } else be_quiet = 1;
+
+  /* Decide instrumentation ratio */
+
+  if (inst_ratio_str) {
+
+    if (sscanf(inst_ratio_str, "%u", &inst_ratio) != 1 || !inst_ratio ||
+        inst_ratio > 100)
+      FATAL("Bad value of AFL_INST_RATIO (must be between 1 and 100)");
+
+  }
+
+  /* Unlike the LLVM pass, make sure each compiler invocation picks its own
+     block IDs, so locations from different translation units don't line up. */
+
+  gettimeofday(&tv, NULL);
+  srandom(tv.tv_sec ^ tv.tv_usec ^ getpid());
+
+  afl_pass_info.pass = new AFLCoverage(g);
+  afl_pass_info.reference_pass_name = "cfg";
+  afl_pass_info.ref_pass_instance_number = 1;
+  afl_pass_info.pos_op = PASS_POS_INSERT_AFTER;
+
+  register_callback(plugin_info->base_name, PLUGIN_INFO, NULL,
+                    &afl_plugin_info);
+  register_callback(plugin_info->base_name, PLUGIN_PASS_MANAGER_SETUP, NULL,
+                    &afl_pass_info);
+  register_callback(plugin_info->base_name, PLUGIN_REGISTER_GGC_ROOTS, NULL,
+                    (void*)afl_ggc_roots);
+  register_callback(plugin_info->base_name, PLUGIN_FINISH, afl_finish, NULL);
+
+  return 0;
+
+}
@@ -203,6 +203,9 @@ static void edit_params(u32 argc, char** argv) {
   if (getenv("AFL_INST_RATIO"))
     FATAL("AFL_INST_RATIO not available at compile time with 'trace-pc'.");
 
+  if (getenv("AFL_LLVM_ALLOWLIST") || getenv("AFL_LLVM_DENYLIST"))
+    FATAL("AFL_LLVM_ALLOWLIST/AFL_LLVM_DENYLIST not available with 'trace-pc'.");
+
 #endif /* USE_TRACE_PC */
 
   if (!getenv("AFL_DONT_OPTIMIZE")) {
@@ -211,6 +214,12 @@ static void edit_params(u32 argc, char** argv) {
     cc_params[cc_par_cnt++] = "-O3";
     cc_params[cc_par_cnt++] = "-funroll-loops";
 
+  } else if (getenv("AFL_LLVM_ALLOWLIST") || getenv("AFL_LLVM_DENYLIST")) {
+
+    /* The lists match source files through debug locations. */
+
+    cc_params[cc_par_cnt++] = "-g";
+
   }
 
   if (getenv("AFL_NO_BUILTIN")) {
@@ -27,16 +27,29 @@
 #include "../config.h"
 #include "../debug.h"
 
+#include <fnmatch.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <fstream>
+#include <list>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
 
 using namespace llvm;
 
@@ -47,10 +60,28 @@ namespace {
     public:
 
       static char ID;
-      AFLCoverage() : ModulePass(ID) { }
+      AFLCoverage() : ModulePass(ID) {
+
+        loadList("AFL_LLVM_ALLOWLIST", AllowFun, AllowSrc);
+        loadList("AFL_LLVM_DENYLIST", DenyFun, DenySrc);
+
+      }
 
       bool runOnModule(Module &M) override;
 
+    protected:
+
+      std::list<std::string> AllowFun, AllowSrc;
+      std::list<std::string> DenyFun, DenySrc;
+
+      static void loadList(const char *env_var, std::list<std::string> &Fun,
+                           std::list<std::string> &Src);
+      static bool matchList(const std::list<std::string> &List,
+                            const std::string &Name, bool is_path);
+      bool shouldInstrument(Module &M, Function &F);
+      int instrumentEdges(Module &M, Function &F, GlobalVariable *AFLMapPtr,
+                          unsigned int inst_ratio);
+
       // StringRef getPassName() const override {
       //  return "American Fuzzy Lop Instrumentation";
       // }
@@ -63,6 +94,322 @@ namespace {
 char AFLCoverage::ID = 0;
 
 
+/* Read an allowlist or denylist named by env_var. Each line is either
+   "fun:<pattern>" to match a function name or "src:<pattern>" to match a
+   source file; lines without a prefix are treated as source files. Patterns
+   use fnmatch() syntax, blank lines and lines starting with '#' are ignored. */
+
+void AFLCoverage::loadList(const char *env_var, std::list<std::string> &Fun,
+                           std::list<std::string> &Src) {
+
+  char* list_filename = getenv(env_var);
+  std::ifstream list_file;
+  std::string line;
+
+  if (!list_filename) return;
+
+  list_file.open(list_filename);
+  if (!list_file) FATAL("Unable to open %s ('%s')", env_var, list_filename);
+
+  while (getline(list_file, line)) {
+
+    size_t start = line.find_first_not_of(" \t");
+    size_t end = line.find_last_not_of(" \t\r");
+
+    if (start == std::string::npos || line[start] == '#') continue;
+    line = line.substr(start, end - start + 1);
+
+    if (!line.compare(0, 4, "fun:")) Fun.push_back(line.substr(4));
+    else if (!line.compare(0, 4, "src:")) Src.push_back(line.substr(4));
+    else Src.push_back(line);
+
+  }
+
+}
+
+
+/* Check Name against every pattern in List. Source paths are also matched by
+   their basename, so "src:parser.c" works regardless of the build directory. */
+
+bool AFLCoverage::matchList(const std::list<std::string> &List,
+                            const std::string &Name, bool is_path) {
+
+  const char* base = strrchr(Name.c_str(), '/');
+
+  base = base ? base + 1 : Name.c_str();
+
+  for (auto &Pattern : List) {
+
+    if (!fnmatch(Pattern.c_str(), Name.c_str(), 0)) return true;
+    if (is_path && !fnmatch(Pattern.c_str(), base, 0)) return true;
+
+  }
+
+  return false;
+
+}
+
+
+/* Decide whether F should be instrumented according to AFL_LLVM_ALLOWLIST
+   and AFL_LLVM_DENYLIST. The source file comes from the debug location of
+   the first instruction that has one, falling back to the module name. */
+
+bool AFLCoverage::shouldInstrument(Module &M, Function &F) {
+
+  std::string FuncName = F.getName().str();
+  std::string SrcName = M.getModuleIdentifier();
+  bool found_loc = false;
+
+  if (AllowFun.empty() && AllowSrc.empty() && DenyFun.empty() &&
+      DenySrc.empty())
+    return true;
+
+  for (auto &BB : F) {
+
+    for (auto &I : BB) {
+
+      if (found_loc) break;
+
+      DILocation *Loc = dyn_cast_or_null<DILocation>(
+          I.getDebugLoc().getAsMDNode());
+
+      if (!Loc) continue;
+
+      /* Code inlined from elsewhere may have an empty filename. */
+
+      if (Loc->getFilename().empty() && Loc->getInlinedAt())
+        Loc = Loc->getInlinedAt();
+
+      if (!Loc->getFilename().empty()) {
+
+        SrcName = Loc->getFilename().str();
+        found_loc = true;
+
+      }
+
+    }
+
+    if (found_loc) break;
+
+  }
+
+  if ((!AllowFun.empty() || !AllowSrc.empty()) &&
+      !matchList(AllowFun, FuncName, false) &&
+      !matchList(AllowSrc, SrcName, true))
+    return false;
+
+  if (matchList(DenyFun, FuncName, false) ||
+      matchList(DenySrc, SrcName, true))
+    return false;
+
+  return true;
+
+}
+
+
+/* An edge of the CFG considered by instrumentEdges(). Exit blocks also get a
+   virtual edge back to the entry block, which makes every block's incoming
+   and outgoing counts equal. */
+
+struct AFLEdge {
+
+  BasicBlock *Src, *Dst;
+  unsigned int SuccNum;
+  bool Virtual;
+
+  enum { PLACE_NONE, PLACE_SRC_END, PLACE_DST_START, PLACE_SPLIT } Place;
+  enum { RANK_FORCED, RANK_VIRTUAL, RANK_BACK_EDGE, RANK_OTHER } Rank;
+
+};
+
+
+static unsigned int findRoot(std::vector<unsigned int> &Parent,
+                             unsigned int Node) {
+
+  while (Parent[Node] != Node) {
+
+    Parent[Node] = Parent[Parent[Node]];
+    Node = Parent[Node];
+
+  }
+
+  return Node;
+
+}
+
+
+/* Instrument F with the minimal set of edge counters (AFL_LLVM_OPT_EDGES).
+   A spanning tree of the CFG is built, and only the edges left out of it get a
+   counter. Because every block is entered as often as it is left, the count of
+   each tree edge follows from the counts of the others, so the counters still
+   determine how often every edge ran. Virtual and back edges go into the tree
+   first, so function entries and loop iterations don't need a counter.
+
+   Counters on edges that can't be given their own location (out of an
+   indirectbr or into an EH pad) aren't possible, so such edges must go into
+   the tree. If they form a cycle, -1 is returned and F should be instrumented
+   per block instead. Otherwise, the number of counters added is returned. */
+
+int AFLCoverage::instrumentEdges(Module &M, Function &F,
+                                 GlobalVariable *AFLMapPtr,
+                                 unsigned int inst_ratio) {
+
+  LLVMContext &C = M.getContext();
+  IntegerType *Int8Ty  = IntegerType::getInt8Ty(C);
+  IntegerType *Int32Ty = IntegerType::getInt32Ty(C);
+
+  DominatorTree DT(F);
+  DenseMap<BasicBlock*, unsigned int> Index;
+  std::vector<AFLEdge> Edges;
+  std::vector<unsigned int> Parent;
+  BasicBlock *Entry = &F.getEntryBlock();
+  int counters = 0;
+
+  for (auto &BB : F) {
+
+    Index[&BB] = Parent.size();
+    Parent.push_back(Parent.size());
+
+  }
+
+  /* Collect the edges. Several successors of a block that are the same block
+     can't be told apart, so they are treated as one edge. */
+
+  for (auto &BB : F) {
+
+    auto *TI = BB.getTerminator();
+    unsigned int num_succ = TI->getNumSuccessors();
+
+    for (unsigned int i = 0; i < num_succ; i++) {
+
+      BasicBlock *Succ = TI->getSuccessor(i);
+      bool duplicate = false;
+
+      for (unsigned int j = 0; j < i && !duplicate; j++)
+        duplicate = TI->getSuccessor(j) == Succ;
+
+      if (duplicate) continue;
+
+      AFLEdge E = { &BB, Succ, i, false, AFLEdge::PLACE_NONE,
+                    AFLEdge::RANK_OTHER };
+
+      if (BB.getUniqueSuccessor() == Succ)
+        E.Place = AFLEdge::PLACE_SRC_END;
+      else if (Succ->getUniquePredecessor() == &BB &&
+               Succ->getFirstInsertionPt() != Succ->end())
+        E.Place = AFLEdge::PLACE_DST_START;
+      else if ((isa<BranchInst>(TI) || isa<SwitchInst>(TI)) &&
+               !Succ->isEHPad())
+        E.Place = AFLEdge::PLACE_SPLIT;
+
+      if (E.Place == AFLEdge::PLACE_NONE) E.Rank = AFLEdge::RANK_FORCED;
+      else if (DT.dominates(Succ, &BB)) E.Rank = AFLEdge::RANK_BACK_EDGE;
+
+      Edges.push_back(E);
+
+    }
+
+    if (!num_succ) {
+
+      AFLEdge E = { &BB, Entry, 0, true, AFLEdge::PLACE_SRC_END,
+                    AFLEdge::RANK_VIRTUAL };
+
+      /* Nothing may come between a musttail call and its return. */
+
+      if (BB.getTerminatingMustTailCall()) {
+
+        E.Place = AFLEdge::PLACE_NONE;
+        E.Rank = AFLEdge::RANK_FORCED;
+
+      }
+
+      Edges.push_back(E);
+
+    }
+
+  }
+
+  std::stable_sort(Edges.begin(), Edges.end(),
+                   [](const AFLEdge &A, const AFLEdge &B) {
+                     return A.Rank < B.Rank;
+                   });
+
+  /* Build the spanning tree, keeping the edges that need a counter. */
+
+  std::vector<AFLEdge> Counted;
+
+  for (auto &E : Edges) {
+
+    unsigned int src = findRoot(Parent, Index[E.Src]);
+    unsigned int dst = findRoot(Parent, Index[E.Dst]);
+
+    if (src != dst) {
+
+      Parent[src] = dst;
+      continue;
+
+    }
+
+    if (E.Rank == AFLEdge::RANK_FORCED) return -1;
+
+    Counted.push_back(E);
+
+  }
+
+  /* Add the counters. The locations were picked before any edge was split,
+     which doesn't change whether the other edges' locations are valid. */
+
+  for (auto &E : Counted) {
+
+    Instruction *InsertBefore;
+
+    if (AFL_R(100) >= inst_ratio) continue;
+
+    if (E.Place == AFLEdge::PLACE_SRC_END) {
+
+      InsertBefore = E.Src->getTerminator();
+
+    } else if (E.Place == AFLEdge::PLACE_DST_START) {
+
+      InsertBefore = &*E.Dst->getFirstInsertionPt();
+
+    } else {
+
+      BasicBlock *Split = SplitCriticalEdge(E.Src->getTerminator(), E.SuccNum);
+
+      if (!Split) FATAL("Unable to split an edge in %s",
+                        F.getName().str().c_str());
+
+      InsertBefore = &*Split->getFirstInsertionPt();
+
+    }
+
+    IRBuilder<> IRB(InsertBefore);
+
+    /* Each counter has its own location in the bitmap */
+
+    unsigned int cur_loc = AFL_R(MAP_SIZE);
+
+    LoadInst *MapPtr = IRB.CreateLoad(AFLMapPtr);
+    MapPtr->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+    Value *MapPtrIdx =
+        IRB.CreateGEP(MapPtr, ConstantInt::get(Int32Ty, cur_loc));
+
+    LoadInst *Counter = IRB.CreateLoad(MapPtrIdx);
+    Counter->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+    Value *Incr = IRB.CreateAdd(Counter, ConstantInt::get(Int8Ty, 1));
+    IRB.CreateStore(Incr, MapPtrIdx)
+        ->setMetadata(M.getMDKindID("nosanitize"), MDNode::get(C, None));
+
+    counters++;
+
+  }
+
+  return counters;
+
+}
+
+
 bool AFLCoverage::runOnModule(Module &M) {
 
   LLVMContext &C = M.getContext();
@@ -93,6 +440,11 @@ bool AFLCoverage::runOnModule(Module &M) {
 
   }
 
+  /* Decide whether to count edges on a spanning tree's complement instead of
+     instrumenting every block */
+
+  char opt_edges = !!getenv("AFL_LLVM_OPT_EDGES");
+
   /* Get globals for the SHM region and the previous location. Note that
      __afl_prev_loc is thread-local. */
 
@@ -106,9 +458,35 @@ bool AFLCoverage::runOnModule(Module &M) {
 
   /* Instrument all the things! */
 
-  int inst_blocks = 0;
+  int inst_blocks = 0, skip_funcs = 0, edge_funcs = 0, block_funcs = 0;
+
+  for (auto &F : M) {
+
+    if (F.isDeclaration()) continue;
+
+    if (!shouldInstrument(M, F)) {
+
+      skip_funcs++;
+      continue;
+
+    }
+
+    if (opt_edges) {
+
+      int counters = instrumentEdges(M, F, AFLMapPtr, inst_ratio);
+
+      if (counters >= 0) {
+
+        inst_blocks += counters;
+        edge_funcs++;
+        continue;
+
+      }
+
+      block_funcs++;
+
+    }
 
-  for (auto &F : M)
     for (auto &BB : F) {
 
       BasicBlock::iterator IP = BB.getFirstInsertionPt();
@@ -153,6 +531,8 @@ bool AFLCoverage::runOnModule(Module &M) {
 
     }
 
+  }
+
   /* Say something nice. */
 
   if (!be_quiet) {
@@ -163,6 +543,18 @@ bool AFLCoverage::runOnModule(Module &M) {
              ((getenv("AFL_USE_ASAN") || getenv("AFL_USE_MSAN")) ?
               "ASAN/MSAN" : "non-hardened"), inst_ratio);
 
+    if (edge_funcs)
+      OKF("Counted the minimal set of edges in %u functions "
+          "(AFL_LLVM_OPT_EDGES).", edge_funcs);
+
+    if (block_funcs)
+      OKF("Instrumented %u functions per block, as their edges couldn't all "
+          "be counted (AFL_LLVM_OPT_EDGES).", block_funcs);
+
+    if (skip_funcs)
+      OKF("Skipped %u functions excluded by the allowlist/denylist.",
+          skip_funcs);
+
   }
 
   return true;
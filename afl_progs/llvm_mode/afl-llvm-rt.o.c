@@ -39,6 +39,7 @@
 
 #include <sys/mman.h>
 #include <sys/shm.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/types.h>
 
@@ -73,12 +74,28 @@ static u8 is_persistent;
 static void __afl_map_shm(void) {
 
   u8 *id_str = getenv(SHM_ENV_VAR);
+  u8 *fd_str = getenv(SHM_FD_ENV_VAR);
 
   /* If we're running under AFL, attach to the appropriate region, replacing the
      early-stage __afl_area_initial region that is needed to allow some really
      hacky .init code to work correctly in projects such as OpenSSL. */
 
-  if (id_str) {
+  if (fd_str) {
+
+    /* The fuzzer handed us a memfd; its size may have been rounded up to the
+       huge page size, so map all of it. */
+
+    struct stat st;
+    int shm_fd = atoi(fd_str);
+
+    if (fstat(shm_fd, &st) || st.st_size < MAP_SIZE) _exit(1);
+
+    __afl_area_ptr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, shm_fd, 0);
+
+    if (__afl_area_ptr == MAP_FAILED) _exit(1);
+
+  } else if (id_str) {
 
     u32 shm_id = atoi(id_str);
 
@@ -35,7 +35,9 @@
   Killerbeez fork server protocol.
  */
 
+#include <sys/mman.h>
 #include <sys/shm.h>
+#include <sys/stat.h>
 #include "../../config.h"
 #include "../../../instrumentation/forkserver_internal.h"
 
@@ -119,9 +121,11 @@ static inline TranslationBlock *tb_find(CPUState*, TranslationBlock*, int);
 static void afl_setup(void) {
 
   char *id_str = getenv(SHM_ENV_VAR),
+       *fd_str = getenv(SHM_FD_ENV_VAR),
        *inst_r = getenv("AFL_INST_RATIO");
 
-  int shm_id;
+  int shm_id, shm_fd;
+  struct stat st;
 
   if (inst_r) {
 
@@ -136,7 +140,20 @@ static void afl_setup(void) {
 
   }
 
-  if (id_str) {
+  if (fd_str) {
+
+    shm_fd = atoi(fd_str);
+
+    if (fstat(shm_fd, &st) || st.st_size < MAP_SIZE) exit(1);
+
+    afl_area_ptr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        shm_fd, 0);
+
+    if (afl_area_ptr == MAP_FAILED) exit(1);
+
+    if (inst_r) afl_area_ptr[0] = 1;
+
+  } else if (id_str) {
 
     shm_id = atoi(id_str);
     afl_area_ptr = shmat(shm_id, NULL, 0);
@@ -4,6 +4,17 @@ struct driver
   int (*test_input)(void * driver_state, char * buffer, size_t length);
   int(*test_next_input)(void * driver_state);
   void *(*get_last_input)(void * driver_state, int * length);
+  int (*test_inputs_batch)(void * driver_state, char ** inputs, size_t * lengths,
+    size_t num_inputs, int * results, driver_batch_callback_t callback,
+    void * callback_arg);
   void * state;
+
+  //Optional
+  int (*is_new_state)(void * driver_state);
+  void (*set_iteration_limit)(void * driver_state, int num_iterations);
+  char * (*get_state)(void * driver_state);
+  void (*free_state)(char * state);
+  int (*set_state)(void * driver_state, char * state);
+  int (*merge_state)(void * driver_state, char * state);
 };
 typedef struct driver driver_t;
@@ -16,5 +16,9 @@ struct instrumentation
     int * is_new, char ** module_name, char ** info, int * size);
   instrumentation_edges_t * (*get_edges)(void * instrumentation_state,
     int index);
+  int(*get_path_hash)(void * instrumentation_state, uint64_t * path_hash);
+  int(*enable_inprocess)(void * instrumentation_state);
+  int(*finish_inprocess)(void * instrumentation_state, int fuzz_result);
+  int(*uses_forkserver_library)(void * instrumentation_state);
 };
 typedef struct instrumentation instrumentation_t;
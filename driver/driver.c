@@ -12,6 +12,7 @@
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <poll.h>
 #endif
 
 /**
@@ -88,6 +89,114 @@ int generic_test_next_input(void * state, mutator_t * mutator, void * mutator_st
 	return test_input_func(state, buffer, *mutate_last_size);
 }
 
+/**
+ * This function is the pipelined version of generic_test_next_input.  Rather than mutating,
+ * running the target, and then waiting for it, it starts the target on an input that was
+ * generated ahead of time, and generates the following input into the other mutate buffer
+ * while the target runs.  If the mutator's iteration count has changed since the input was
+ * generated ahead of time (e.g. because the mutator's state or input was reset), that input
+ * is thrown away and a new one is generated before starting the target.  No input is generated
+ * ahead of the last one allowed by the pipeline's iterations_left, so the mutator's state
+ * matches the inputs that were actually tested when the fuzzer saves it.
+ * @param state - a driver specific structure previously created by the driver's create function
+ * @param mutator - the mutator to call to obtain a mutated input buffer
+ * @param mutator_state - the state of the mutator given in the mutator parameter
+ * @param pipeline - the double buffered mutate buffers, previously set up with setup_mutate_pipeline
+ * @param start_input_func - a function which starts the target on the given input, without waiting for it
+ * @param finish_input_func - a function which waits for the target to finish, and returns the FUZZ_ result
+ * @return - FUZZ_CRASH, FUZZ_HANG, or FUZZ_NONE on success, FUZZ_ERROR on error, -2 if the mutator has finished generating inputs
+ */
+int generic_test_next_input_pipelined(void * state, mutator_t * mutator, void * mutator_state, mutate_pipeline_t * pipeline,
+	int(*start_input_func)(void * driver_state, char * buffer, size_t length), int(*finish_input_func)(void * driver_state))
+{
+	int next = !pipeline->current;
+	int size;
+
+	if (!mutator) {
+		ERROR_MSG("Mutator module missing!");
+		return -1;
+	}
+
+	if (pipeline->iterations_left > 0)
+		pipeline->iterations_left--;
+
+	if (pipeline->next_ready && mutator->get_current_iteration(mutator_state) != pipeline->next_iteration)
+	{
+		DEBUG_MSG("The mutator changed state, discarding the pre-generated input");
+		pipeline->next_ready = 0;
+	}
+	if (!pipeline->next_ready)
+	{
+		DEBUG_MSG("Mutating input...");
+		pipeline->sizes[next] = mutator->mutate(mutator_state, pipeline->buffers[next], pipeline->buffer_length);
+		if (pipeline->sizes[next] < 0)
+			return -1;
+		else if (pipeline->sizes[next] == 0)
+			return -2;
+	}
+
+	pipeline->current = next;
+	pipeline->next_ready = 0;
+	if (start_input_func(state, pipeline->buffers[pipeline->current], pipeline->sizes[pipeline->current]))
+		return FUZZ_ERROR;
+
+	//Generate the next input while the target works on this one, unless this is the last input
+	//that will be tested.  If the mutator fails or runs out of inputs, we'll find out again on the
+	//next call.
+	if (pipeline->iterations_left != 0)
+	{
+		next = !pipeline->current;
+		size = mutator->mutate(mutator_state, pipeline->buffers[next], pipeline->buffer_length);
+		if (size > 0)
+		{
+			pipeline->sizes[next] = size;
+			pipeline->next_iteration = mutator->get_current_iteration(mutator_state);
+			pipeline->next_ready = 1;
+		}
+	}
+
+	return finish_input_func(state);
+}
+
+/**
+ * This function tests each of the given inputs in turn with the given test_input function,
+ * without tearing anything down between them.  The instrumentation (and any fork server it
+ * holds) stays warm for the whole batch, so the only per-input cost is the target run itself.
+ * @param state - a driver specific structure previously created by the driver's create function
+ * @param inputs - an array of the inputs to test
+ * @param lengths - an array of lengths for the buffers in the inputs parameter
+ * @param num_inputs - the number of buffers in the inputs parameter
+ * @param results - an array of num_inputs integers used to return the FUZZ_ result of each input.
+ * Entries for inputs that weren't tested are set to FUZZ_ERROR.
+ * @param callback - optionally, a function to call after each input is tested, before the next one
+ * is started.  This is the place to collect per input instrumentation results (e.g. is_new_path).
+ * If the callback returns non-zero, the rest of the batch is skipped.
+ * @param callback_arg - an argument to pass to the callback
+ * @param test_input_func - the test_input function to call for each input
+ * @return - the number of inputs that were tested, or -1 on error
+ */
+int generic_test_inputs_batch(void * state, char ** inputs, size_t * lengths, size_t num_inputs, int * results,
+	driver_batch_callback_t callback, void * callback_arg, int(*test_input_func)(void * driver_state, char * buffer, size_t length))
+{
+	size_t i;
+
+	if (!inputs || !lengths || !results)
+		return -1;
+
+	for (i = 0; i < num_inputs; i++)
+		results[i] = FUZZ_ERROR;
+
+	for (i = 0; i < num_inputs; i++)
+	{
+		results[i] = test_input_func(state, inputs[i], lengths[i]);
+		if (results[i] == FUZZ_ERROR)
+			return -1;
+		if (callback && callback(callback_arg, i, results[i]))
+			return (int)(i + 1);
+	}
+	return (int)num_inputs;
+}
+
 /**
  * This function allocates a buffer to be used for holding the mutated input that a driver will
  * to the target program.
@@ -115,6 +224,39 @@ int setup_mutate_buffer(double ratio, size_t input_length, char ** buffer, size_
 	return 0;
 }
 
+/**
+ * This function allocates the two mutate buffers used by generic_test_next_input_pipelined.
+ * @param ratio - The desired ratio of mutate buffer size to input size.
+ * @param input_length - The size of the input buffer
+ * @param pipeline - a pointer to a zeroed mutate_pipeline_t to set up
+ * @return - zero on success, non-zero on failure
+ */
+int setup_mutate_pipeline(double ratio, size_t input_length, mutate_pipeline_t * pipeline)
+{
+	if (setup_mutate_buffer(ratio, input_length, &pipeline->buffers[0], &pipeline->buffer_length)
+		|| setup_mutate_buffer(ratio, input_length, &pipeline->buffers[1], &pipeline->buffer_length))
+	{
+		cleanup_mutate_pipeline(pipeline);
+		return 1;
+	}
+	pipeline->sizes[0] = pipeline->sizes[1] = -1;
+	pipeline->current = 1; //So the first input is generated into buffers[0]
+	pipeline->next_ready = 0;
+	pipeline->iterations_left = -1;
+	return 0;
+}
+
+/**
+ * This function frees the mutate buffers allocated by setup_mutate_pipeline.
+ * @param pipeline - the mutate_pipeline_t to clean up
+ */
+void cleanup_mutate_pipeline(mutate_pipeline_t * pipeline)
+{
+	free(pipeline->buffers[0]);
+	free(pipeline->buffers[1]);
+	pipeline->buffers[0] = pipeline->buffers[1] = NULL;
+}
+
 /**
 * This function sends the provided buffer on the already connected TCP socket
 * @param sock - a pointer to a connected TCP SOCKET to send the buffer on
@@ -171,3 +313,39 @@ int send_tcp_input(int * sock, char * buffer, size_t length)
 	return total_read != length; 
 }
 
+/**
+ * This function waits for a socket to become readable.
+ * @param sock - the socket to wait on
+ * @param timeout_ms - the maximum number of milliseconds to wait
+ * @return - 1 if the socket is readable, 0 if the timeout expired, or -1 on error
+ */
+#ifdef _WIN32
+int wait_socket_readable(SOCKET sock, int timeout_ms)
+#else
+int wait_socket_readable(int sock, int timeout_ms)
+#endif
+{
+	int ret;
+#ifdef _WIN32
+	fd_set read_fds;
+	struct timeval timeout;
+
+	FD_ZERO(&read_fds);
+	FD_SET(sock, &read_fds);
+	timeout.tv_sec = timeout_ms / 1000;
+	timeout.tv_usec = (timeout_ms % 1000) * 1000;
+	ret = select(0, &read_fds, NULL, NULL, &timeout);
+	if (ret == SOCKET_ERROR)
+		return -1;
+#else
+	struct pollfd pfd;
+
+	pfd.fd = sock;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	ret = poll(&pfd, 1, timeout_ms);
+	if (ret < 0)
+		return errno == EINTR ? 0 : -1;
+#endif
+	return ret > 0;
+}
@@ -23,16 +23,45 @@
 #define FUNC_PREFIX
 #endif
 
+/**
+ * Called by test_inputs_batch after each input in the batch has been tested, while the
+ * instrumentation still holds the results for that input.  A non-zero return stops the batch.
+ */
+typedef int (*driver_batch_callback_t)(void * callback_arg, size_t index, int result);
+
 struct driver
 {
 	void (*cleanup)(void * driver_state);
 	int (*test_input)(void * driver_state, char * buffer, size_t length);
 	int (*test_next_input)(void * driver_state);
 	char *(*get_last_input)(void * driver_state, int * length);
+	int (*test_inputs_batch)(void * driver_state, char ** inputs, size_t * lengths, size_t num_inputs,
+		int * results, driver_batch_callback_t callback, void * callback_arg);
+	//Optional, NULL if the driver doesn't track any state of its own
+	int (*is_new_state)(void * driver_state);
+	//Optional, NULL if the driver doesn't generate inputs ahead of time
+	void (*set_iteration_limit)(void * driver_state, int num_iterations);
+	//Optional, NULL if the driver doesn't have any state worth saving between fuzzing sessions
+	char * (*get_state)(void * driver_state);
+	void (*free_state)(char * state);
+	int (*set_state)(void * driver_state, char * state);
+	int (*merge_state)(void * driver_state, char * state);
 	void * state;
 };
 typedef struct driver driver_t;
 
+struct mutate_pipeline
+{
+	char * buffers[2];    //The two mutate buffers, one being tested and one being filled
+	size_t buffer_length; //The length of each of the mutate buffers
+	int sizes[2];         //The size of the mutated input in each of the buffers
+	int current;          //The index of the buffer holding the input that was last tested
+	int next_ready;       //Whether the other buffer holds an input that was generated ahead of time
+	int next_iteration;   //The mutator's iteration count right after the pre-generated input was made
+	int iterations_left;  //The number of inputs that will still be tested, or -1 if there's no limit
+};
+typedef struct mutate_pipeline mutate_pipeline_t;
+
 #ifdef _WIN32
 FUNC_PREFIX int generic_wait_for_process_completion(HANDLE process, int timeout, instrumentation_t * instrumentation, void * instrumentation_state);
 #else
@@ -40,9 +69,17 @@ FUNC_PREFIX int generic_wait_for_process_completion(pid_t process, int timeout,
 #endif
 FUNC_PREFIX int generic_test_next_input(void * state, mutator_t * mutator, void * mutator_state, char * buffer, size_t buffer_length,
 	int(*test_input_func)(void * driver_state, char * buffer, size_t length), int * mutate_last_size);
+FUNC_PREFIX int generic_test_next_input_pipelined(void * state, mutator_t * mutator, void * mutator_state, mutate_pipeline_t * pipeline,
+	int(*start_input_func)(void * driver_state, char * buffer, size_t length), int(*finish_input_func)(void * driver_state));
+FUNC_PREFIX int generic_test_inputs_batch(void * state, char ** inputs, size_t * lengths, size_t num_inputs, int * results,
+	driver_batch_callback_t callback, void * callback_arg, int(*test_input_func)(void * driver_state, char * buffer, size_t length));
 FUNC_PREFIX int setup_mutate_buffer(double ratio, size_t input_length, char ** buffer, size_t * length);
+FUNC_PREFIX int setup_mutate_pipeline(double ratio, size_t input_length, mutate_pipeline_t * pipeline);
+FUNC_PREFIX void cleanup_mutate_pipeline(mutate_pipeline_t * pipeline);
 #ifdef _WIN32
 FUNC_PREFIX int send_tcp_input(SOCKET * sock, char * buffer, size_t length);
+FUNC_PREFIX int wait_socket_readable(SOCKET sock, int timeout_ms);
 #else
 FUNC_PREFIX int send_tcp_input(int * sock, char * buffer, size_t length);
+FUNC_PREFIX int wait_socket_readable(int sock, int timeout_ms);
 #endif
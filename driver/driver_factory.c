@@ -6,6 +6,8 @@
 #include "network_client_driver.h"
 #ifdef _WIN32
 #include "wmp_driver.h"
+#else
+#include "inprocess_driver.h"
 #endif
 
 #include <instrumentation.h>
@@ -72,6 +74,7 @@ DRIVER_API driver_t * driver_all_factory(char * driver_type, char * options, ins
 	mutator_t * mutator, void * mutator_state)
 {
 	driver_t * ret = (driver_t *)malloc(sizeof(driver_t));
+	memset(ret, 0, sizeof(driver_t));
 	if (!strcmp(driver_type, "file"))
 	{
 		ret->state = file_create(options, instrumentation, instrumentation_state, mutator, mutator_state);
@@ -81,6 +84,8 @@ DRIVER_API driver_t * driver_all_factory(char * driver_type, char * options, ins
 		ret->test_input = file_test_input;
 		ret->test_next_input = file_test_next_input;
 		ret->get_last_input = file_get_last_input;
+		ret->test_inputs_batch = file_test_inputs_batch;
+		ret->set_iteration_limit = file_set_iteration_limit;
 	}
 	else if (!strcmp(driver_type, "stdin"))
 	{
@@ -91,6 +96,8 @@ DRIVER_API driver_t * driver_all_factory(char * driver_type, char * options, ins
 		ret->test_input = stdin_test_input;
 		ret->test_next_input = stdin_test_next_input;
 		ret->get_last_input = stdin_get_last_input;
+		ret->test_inputs_batch = stdin_test_inputs_batch;
+		ret->set_iteration_limit = stdin_set_iteration_limit;
 	}
 	else if (!strcmp(driver_type, "network_server"))
 	{
@@ -101,6 +108,12 @@ DRIVER_API driver_t * driver_all_factory(char * driver_type, char * options, ins
 		ret->test_input = network_server_test_input;
 		ret->test_next_input = network_server_test_next_input;
 		ret->get_last_input = network_server_get_last_input;
+		ret->test_inputs_batch = network_server_test_inputs_batch;
+		ret->is_new_state = network_server_is_new_state;
+		ret->get_state = network_server_get_state;
+		ret->free_state = network_server_free_state;
+		ret->set_state = network_server_set_state;
+		ret->merge_state = network_server_merge_state;
 	}
 	else if (!strcmp(driver_type, "network_client"))
 	{
@@ -113,6 +126,7 @@ DRIVER_API driver_t * driver_all_factory(char * driver_type, char * options, ins
 		ret->test_input = network_client_test_input;
 		ret->test_next_input = network_client_test_next_input;
 		ret->get_last_input = network_client_get_last_input;
+		ret->test_inputs_batch = network_client_test_inputs_batch;
 	}
 	#ifdef _WIN32
 	else if (!strcmp(driver_type, "wmp"))
@@ -124,6 +138,19 @@ DRIVER_API driver_t * driver_all_factory(char * driver_type, char * options, ins
 		ret->test_input = wmp_test_input;
 		ret->test_next_input = wmp_test_next_input;
 		ret->get_last_input = wmp_get_last_input;
+		ret->test_inputs_batch = wmp_test_inputs_batch;
+	}
+	#else
+	else if (!strcmp(driver_type, "inprocess"))
+	{
+		ret->state = inprocess_create(options, instrumentation, instrumentation_state, mutator, mutator_state);
+		if (!ret->state)
+			FACTORY_ERROR();
+		ret->cleanup = inprocess_cleanup;
+		ret->test_input = inprocess_test_input;
+		ret->test_next_input = inprocess_test_next_input;
+		ret->get_last_input = inprocess_get_last_input;
+		ret->test_inputs_batch = inprocess_test_inputs_batch;
 	}
 	#endif
 	else
@@ -153,6 +180,8 @@ DRIVER_API char * driver_help(void)
 	APPEND_HELP(text, new_text, network_client_help);
 	#ifdef _WIN32
 	APPEND_HELP(text, new_text, wmp_help);
+	#else
+	APPEND_HELP(text, new_text, inprocess_help);
 	#endif
 	return text;
 }
@@ -14,11 +14,87 @@
 #include <Shlwapi.h>
 #include <process.h>
 #else
+#include <fcntl.h> // open
 #include <string.h> // memset
 #include <sys/types.h> // kill()
 #include <signal.h>
-#include <unistd.h> // unlink
+#include <unistd.h> // unlink, pwrite, ftruncate
+#ifdef __linux__
+#include <sys/syscall.h> // SYS_memfd_create
 #endif
+#endif
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+/**
+ * This function opens the file that the test inputs will be written to when the in_memory
+ * option is set.  If the user didn't specify a filename, the test file is created as a memfd,
+ * and the target is given the path to it in our /proc/<pid>/fd/ directory.
+ * @param state - the file_state_t object to open the test file for
+ * @return - 0 on success, non-zero on failure
+ */
+static int open_test_file(file_state_t * state)
+{
+#ifdef _WIN32
+	ERROR_MSG("The in_memory option is not supported on Windows");
+	return 1;
+#else
+	char memfd_path[64];
+
+	if (state->test_filename)
+	{
+		state->test_fd = open(state->test_filename, O_RDWR | O_CREAT | O_TRUNC, 0600);
+		if (state->test_fd < 0)
+		{
+			ERROR_MSG("Failed to open the test file %s", state->test_filename);
+			return 1;
+		}
+		return 0;
+	}
+
+#ifdef __linux__
+	state->test_fd = syscall(SYS_memfd_create, "killerbeez_input", MFD_CLOEXEC);
+	if (state->test_fd < 0)
+	{
+		ERROR_MSG("memfd_create() failed, use the filename option to specify a file on a tmpfs instead");
+		return 1;
+	}
+	state->test_fd_is_memfd = 1;
+	snprintf(memfd_path, sizeof(memfd_path), "/proc/%d/fd/%d", getpid(), state->test_fd);
+	state->test_filename = strdup(memfd_path);
+	return state->test_filename == NULL;
+#else
+	ERROR_MSG("Memory backed test files are only supported on Linux, use the filename option to specify a file on a tmpfs");
+	return 1;
+#endif
+#endif
+}
+
+/**
+ * This function writes a test input to the test file.  When the in_memory option is set, the
+ * already open test file is overwritten in place, and only truncated if the new input is shorter.
+ * @param state - the file_state_t object to write the input for
+ * @param input - the input that should be written
+ * @param length - the length of the input parameter
+ * @return - 0 on success, non-zero on failure
+ */
+static int write_test_file(file_state_t * state, char * input, size_t length)
+{
+#ifndef _WIN32
+	if (state->in_memory)
+	{
+		if (pwrite(state->test_fd, input, length, 0) != (ssize_t)length)
+			return 1;
+		if (length < state->test_file_length && ftruncate(state->test_fd, length))
+			return 1;
+		state->test_file_length = length;
+		return 0;
+	}
+#endif
+	return write_buffer_to_file(state->test_filename, input, length) != 0;
+}
 
 /**
  * This function creates a file_state_t object based on the given options.
@@ -40,6 +116,9 @@ static file_state_t * setup_options(char * options)
 	state->timeout = 2;
 	state->extension = strdup(".dat");
 	state->input_ratio = 2.0;
+#ifndef _WIN32
+	state->test_fd = -1;
+#endif
 
 	//Parse the options
 	PARSE_OPTION_STRING(state, options, path, "path", file_cleanup);
@@ -48,6 +127,8 @@ static file_state_t * setup_options(char * options)
 	PARSE_OPTION_STRING(state, options, extension, "extension", file_cleanup);
 	PARSE_OPTION_INT(state, options, timeout, "timeout", file_cleanup);
 	PARSE_OPTION_DOUBLE(state, options, input_ratio, "ratio", file_cleanup);
+	PARSE_OPTION_INT(state, options, in_memory, "in_memory", file_cleanup);
+	PARSE_OPTION_INT(state, options, pipeline, "pipeline", file_cleanup);
 
 	if (!state->path || !file_exists(state->path) || state->input_ratio <= 0)
 	{
@@ -64,7 +145,14 @@ static file_state_t * setup_options(char * options)
 			file_cleanup(state);
 			return NULL;
 		}
-		state->test_filename = get_temp_filename(state->extension);
+		if(!state->in_memory)
+			state->test_filename = get_temp_filename(state->extension);
+	}
+
+	if (state->in_memory && open_test_file(state))
+	{
+		file_cleanup(state);
+		return NULL;
 	}
 
 	if (state->arguments)
@@ -136,7 +224,8 @@ void * file_create(char * options, instrumentation_t * instrumentation, void * i
 	{
 		mutator->get_input_info(mutator_state, &num_inputs, &input_sizes);
 		if (num_inputs != 1
-			|| setup_mutate_buffer(state->input_ratio, input_sizes[0], &state->mutate_buffer, &state->mutate_buffer_length))
+			|| (!state->pipeline && setup_mutate_buffer(state->input_ratio, input_sizes[0], &state->mutate_buffer, &state->mutate_buffer_length))
+			|| (state->pipeline && setup_mutate_pipeline(state->input_ratio, input_sizes[0], &state->mutate_pipeline)))
 		{
 			free(input_sizes);
 			file_cleanup(state);
@@ -163,11 +252,21 @@ void file_cleanup(void * driver_state)
 	file_state_t * state = (file_state_t *)driver_state;
 
 	free(state->mutate_buffer);
+	cleanup_mutate_pipeline(&state->mutate_pipeline);
 
 	free(state->path);
 	free(state->extension);
 	free(state->arguments);
 	free(state->cmd_line);
+#ifndef _WIN32
+	if (state->test_fd >= 0)
+		close(state->test_fd);
+	if (state->test_fd_is_memfd) //there's nothing to unlink for a memfd
+	{
+		free(state->test_filename);
+		state->test_filename = NULL;
+	}
+#endif
 	if (state->test_filename)
 	{
 		unlink(state->test_filename);
@@ -177,31 +276,59 @@ void file_cleanup(void * driver_state)
 }
 
 /**
- * This function will run the fuzzed program and test it with the given input. This function
- * blocks until the program has finished processing the input.
+ * This function writes the given input to the test file and starts the fuzzed program on it,
+ * without waiting for the program to finish.
  * @param driver_state - a driver specific structure previously created by the file_create function
  * @param input - the input that should be tested
  * @param length - the length of the input parameter
- * @return - FUZZ_ result on success or FUZZ_ERROR on failure
+ * @return - 0 on success or non-zero on failure
  */
-int file_test_input(void * driver_state, char * input, size_t length)
+static int file_start_input(void * driver_state, char * input, size_t length)
 {
 	file_state_t * state = (file_state_t *)driver_state;
 
-	//Write the input to disk
-	DEBUG_MSG("Writing input to disk...");
-	write_buffer_to_file(state->test_filename, input, length);
+	//Write the input to the test file
+	DEBUG_MSG("Writing input to the test file...");
+	if (write_test_file(state, input, length))
+	{
+		ERROR_MSG("Failed to write the input to the test file %s", state->test_filename);
+		return 1;
+	}
 
 	//Start the process and give it our input
 	DEBUG_MSG("Enabling instrumentation module...");
-	if(state->instrumentation->enable(state->instrumentation_state, &state->process, state->cmd_line, NULL, 0))
-		return FUZZ_ERROR;
+	return state->instrumentation->enable(state->instrumentation_state, &state->process, state->cmd_line, NULL, 0);
+}
+
+/**
+ * This function waits for the fuzzed program started by file_start_input to finish processing its input.
+ * @param driver_state - a driver specific structure previously created by the file_create function
+ * @return - FUZZ_ result on success or FUZZ_ERROR on failure
+ */
+static int file_finish_input(void * driver_state)
+{
+	file_state_t * state = (file_state_t *)driver_state;
 
 	//Wait for it to be done, return the termination termination status
 	return generic_wait_for_process_completion(state->process, state->timeout,
 		state->instrumentation, state->instrumentation_state);
 }
 
+/**
+ * This function will run the fuzzed program and test it with the given input. This function
+ * blocks until the program has finished processing the input.
+ * @param driver_state - a driver specific structure previously created by the file_create function
+ * @param input - the input that should be tested
+ * @param length - the length of the input parameter
+ * @return - FUZZ_ result on success or FUZZ_ERROR on failure
+ */
+int file_test_input(void * driver_state, char * input, size_t length)
+{
+	if (file_start_input(driver_state, input, length))
+		return FUZZ_ERROR;
+	return file_finish_input(driver_state);
+}
+
 /**
  * This function will run the fuzzed program with the output of the mutator given during driver
  * creation.  This function blocks until the program has finished processing the input.
@@ -211,10 +338,51 @@ int file_test_input(void * driver_state, char * input, size_t length)
 int file_test_next_input(void * driver_state)
 {
 	file_state_t * state = (file_state_t *)driver_state;
+	if (state->pipeline)
+		return generic_test_next_input_pipelined(state, state->mutator, state->mutator_state, &state->mutate_pipeline,
+			file_start_input, file_finish_input);
 	return generic_test_next_input(state, state->mutator, state->mutator_state, state->mutate_buffer,
 		state->mutate_buffer_length, file_test_input, &state->mutate_last_size);
 }
 
+/**
+ * This function tests each of the given inputs in turn, and returns the FUZZ_ result of each one.
+ * Unless the in_memory option is already set, the test file is opened once for the whole batch and
+ * rewritten in place for each input, rather than being recreated for every input.
+ * @param driver_state - a driver specific structure previously created by the file_create function
+ * @param inputs - an array of the inputs to test
+ * @param lengths - an array of lengths for the buffers in the inputs parameter
+ * @param num_inputs - the number of buffers in the inputs parameter
+ * @param results - an array of num_inputs integers used to return the FUZZ_ result of each input
+ * @param callback - optionally, a function to call after each input is tested
+ * @param callback_arg - an argument to pass to the callback
+ * @return - the number of inputs that were tested, or -1 on error
+ */
+int file_test_inputs_batch(void * driver_state, char ** inputs, size_t * lengths, size_t num_inputs,
+	int * results, driver_batch_callback_t callback, void * callback_arg)
+{
+	file_state_t * state = (file_state_t *)driver_state;
+	int ret;
+
+#ifndef _WIN32
+	if (!state->in_memory && num_inputs > 1)
+	{
+		if (open_test_file(state))
+			return -1;
+		state->in_memory = 1;
+		state->test_file_length = 0;
+		ret = generic_test_inputs_batch(state, inputs, lengths, num_inputs, results,
+			callback, callback_arg, file_test_input);
+		state->in_memory = 0;
+		close(state->test_fd);
+		state->test_fd = -1;
+		return ret;
+	}
+#endif
+	return generic_test_inputs_batch(state, inputs, lengths, num_inputs, results,
+		callback, callback_arg, file_test_input);
+}
+
 /**
  * When this driver is using a mutator given to it during driver creation, this function retrieves
  * the last input that was tested with the file_test_next_input function.
@@ -227,12 +395,33 @@ int file_test_next_input(void * driver_state)
 char * file_get_last_input(void * driver_state, int * length)
 {
 	file_state_t * state = (file_state_t *)driver_state;
+	mutate_pipeline_t * pipeline = &state->mutate_pipeline;
+
+	if (state->mutator && state->pipeline)
+	{
+		if (pipeline->sizes[pipeline->current] <= 0)
+			return NULL;
+		*length = pipeline->sizes[pipeline->current];
+		return memdup(pipeline->buffers[pipeline->current], pipeline->sizes[pipeline->current]);
+	}
 	if (!state->mutator || state->mutate_last_size <= 0)
 		return NULL;
 	*length = state->mutate_last_size;
 	return memdup(state->mutate_buffer, state->mutate_last_size);
 }
 
+/**
+ * This function tells the driver how many more inputs will be tested with file_test_next_input, so it
+ * doesn't generate an input ahead of time that will never be tested.
+ * @param driver_state - a driver specific structure previously created by the file_create function
+ * @param num_iterations - the number of times file_test_next_input will still be called
+ */
+void file_set_iteration_limit(void * driver_state, int num_iterations)
+{
+	file_state_t * state = (file_state_t *)driver_state;
+	state->mutate_pipeline.iterations_left = num_iterations;
+}
+
 /**
  * This function returns help text for this driver.  This help text will describe the driver and any options
  * that can be passed to file_create.
@@ -250,6 +439,14 @@ int file_help(char ** help_str)
 "                          target filename specified as @@\n"
 "  extension             The file extension to give the test file\n"
 "  filename              The filename to give the test file\n"
+"  in_memory             Whether to keep the test file open and rewrite it in\n"
+"                          place, rather than recreating it for each input.  If\n"
+"                          no filename is given, the test file is kept in memory\n"
+"                          and passed to the target as /proc/<pid>/fd/<fd>\n"
+"                          (Linux only); 1=yes, 0=no (default=0)\n"
+"  pipeline              Whether to generate the next mutated input while the\n"
+"                          target is processing the current one; 1=yes, 0=no\n"
+"                          (default=0)\n"
 "  ratio                 The ratio of mutation buffer size to input size when\n"
 "                          given a mutator\n"
 "  timeout               The maximum number of seconds to wait for the target\n"
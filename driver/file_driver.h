@@ -8,6 +8,9 @@ void file_cleanup(void * driver_state);
 int file_test_input(void * driver_state, char * buffer, size_t length);
 int file_test_next_input(void * driver_state);
 char * file_get_last_input(void * driver_state, int * length);
+void file_set_iteration_limit(void * driver_state, int num_iterations);
+int file_test_inputs_batch(void * driver_state, char ** inputs, size_t * lengths, size_t num_inputs,
+	int * results, driver_batch_callback_t callback, void * callback_arg);
 int file_help(char ** help_str);
 
 struct file_state
@@ -19,6 +22,14 @@ struct file_state
 	int timeout;          //Maximum number of seconds to allow the executable to run
 	char * test_filename; //The filename that we're going to write our test input to
 	double input_ratio;   //the ratio of the maximum input size
+	int in_memory;        //Whether to keep the test file open and rewrite it in place
+	int pipeline;         //Whether to generate the next input while the target is running
+
+#ifndef _WIN32
+	int test_fd;             //The open test file, when in_memory is set
+	int test_fd_is_memfd;    //Whether test_fd is a memfd rather than a file at test_filename
+	size_t test_file_length; //The current size of the test file
+#endif
 
 	//The handle to the fuzzed process instance
 	#ifdef _WIN32
@@ -41,5 +52,6 @@ struct file_state
 	char * mutate_buffer;
 	size_t mutate_buffer_length;
 	int mutate_last_size;
+	mutate_pipeline_t mutate_pipeline; //Used instead of mutate_buffer when the pipeline option is set
 };
 typedef struct file_state file_state_t;
@@ -0,0 +1,552 @@
+#include "inprocess_driver.h"
+
+#include <utils.h>
+#include <jansson_helper.h>
+#include <instrumentation.h>
+#include "driver.h"
+
+//c headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <dlfcn.h>      // dlopen, dlsym, dlclose
+#include <errno.h>      // errno, EINTR
+#include <poll.h>       // poll
+#include <signal.h>     // kill
+#include <sys/socket.h> // socketpair, send, recv
+#include <sys/types.h>  // pid_t
+#include <sys/wait.h>   // waitpid
+#include <unistd.h>     // fork, close, usleep
+
+#include <forkserver_internal.h> // FUZZER_TO_FORKSRV, FORKSRV_TO_FUZZER
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/**
+ * This function sends a buffer over the worker socket, retrying until all of it has been sent.
+ * @param fd - the socket to send the buffer over
+ * @param buffer - the buffer to send
+ * @param length - the length of the buffer parameter
+ * @return - 0 on success, non-zero if the other end of the socket is gone
+ */
+static int send_all(int fd, const void * buffer, size_t length)
+{
+	const char * pos = (const char *)buffer;
+	ssize_t sent;
+
+	while (length)
+	{
+		sent = send(fd, pos, length, MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent <= 0)
+			return 1;
+		pos += sent;
+		length -= sent;
+	}
+	return 0;
+}
+
+/**
+ * This function receives a buffer from the worker socket, retrying until all of it has been received.
+ * @param fd - the socket to receive the buffer from
+ * @param buffer - the buffer to receive into
+ * @param length - the number of bytes to receive
+ * @return - 0 on success, non-zero if the other end of the socket is gone
+ */
+static int recv_all(int fd, void * buffer, size_t length)
+{
+	char * pos = (char *)buffer;
+	ssize_t received;
+
+	while (length)
+	{
+		received = recv(fd, pos, length, 0);
+		if (received < 0 && errno == EINTR)
+			continue;
+		if (received <= 0)
+			return 1;
+		pos += received;
+		length -= received;
+	}
+	return 0;
+}
+
+/**
+ * This function unloads the target library.
+ * @param state - the inprocess_state_t object to unload the target library for
+ */
+static void unload_library(inprocess_state_t * state)
+{
+	if (state->library)
+		dlclose(state->library);
+	state->library = NULL;
+	state->harness = NULL;
+	state->prev_loc = NULL;
+}
+
+/**
+ * This function loads the target library, finds the harness function in it, and calls the
+ * library's LLVMFuzzerInitialize function if it has one.
+ * @param state - the inprocess_state_t object to load the target library for
+ * @return - 0 on success, non-zero on failure
+ */
+static int load_library(inprocess_state_t * state)
+{
+	int(*initialize)(int * argc, char *** argv);
+	char * init_argv[] = { state->path, NULL };
+	char ** init_argv_ptr = init_argv;
+	int init_argc = 1;
+
+	state->library = dlopen(state->path, RTLD_NOW | RTLD_LOCAL);
+	if (!state->library)
+	{
+		ERROR_MSG("Failed to load the target library %s: %s", state->path, dlerror());
+		return 1;
+	}
+
+	state->harness = (harness_function_t)dlsym(state->library, state->function);
+	if (!state->harness)
+	{
+		ERROR_MSG("Failed to find the function %s in the target library %s", state->function, state->path);
+		unload_library(state);
+		return 1;
+	}
+
+	if (!dlsym(state->library, "__afl_area_ptr"))
+		WARNING_MSG("The target library %s was not built with afl-clang-fast, there will not be any coverage feedback", state->path);
+	state->prev_loc = (uint32_t *)dlsym(state->library, "__afl_prev_loc");
+
+	initialize = (int(*)(int *, char ***))dlsym(state->library, "LLVMFuzzerInitialize");
+	if (initialize)
+		initialize(&init_argc, &init_argv_ptr);
+	return 0;
+}
+
+/**
+ * This function calls the harness function on the given input in a forked child of the worker
+ * process, for targets that can't be trusted to run more than one input in the same process.
+ * @param state - the inprocess_state_t object for the target library
+ * @param input - the input that should be tested
+ * @param length - the length of the input parameter
+ * @return - FUZZ_NONE, FUZZ_HANG, FUZZ_CRASH, or FUZZ_ERROR on failure
+ */
+static int run_harness_forked(inprocess_state_t * state, char * input, size_t length)
+{
+	time_t start_time;
+	useconds_t delay = 10;
+	pid_t child, rc;
+	int status;
+
+	child = fork();
+	if (child < 0)
+	{
+		ERROR_MSG("fork() failed");
+		return FUZZ_ERROR;
+	}
+	if (child == 0)
+	{
+		state->harness((const uint8_t *)input, length);
+		_exit(0);
+	}
+
+	//Poll quickly at first, since most inputs finish quickly, and then back off
+	start_time = time(NULL);
+	while ((rc = waitpid(child, &status, WNOHANG)) == 0)
+	{
+		if (time(NULL) - start_time > state->timeout)
+		{
+			kill(child, SIGKILL);
+			waitpid(child, &status, 0);
+			return FUZZ_HANG;
+		}
+		usleep(delay);
+		if (delay < 1000)
+			delay *= 2;
+	}
+	if (rc != child)
+		return FUZZ_ERROR;
+	if (WIFSIGNALED(status))
+		return FUZZ_CRASH;
+	return FUZZ_NONE;
+}
+
+/**
+ * This function is the main loop of the worker process.  It loads the target library, and then
+ * reads inputs from the driver, calls the harness function on them, and sends back the result,
+ * until the driver closes the socket.  A crash or hang in the harness function takes the whole
+ * worker down with it, and the driver starts a new one.  This function never returns.
+ * @param state - the inprocess_state_t object for the target library
+ * @param fd - the worker's end of the socket to the driver
+ */
+static void run_worker(inprocess_state_t * state, int fd)
+{
+	char * input;
+	size_t length;
+	int result = FUZZ_NONE;
+
+	//The instrumentation runtime's constructor starts a fork server if it can talk to a fuzzer on
+	//the fork server file descriptors, which would hang the worker
+	close(FUZZER_TO_FORKSRV);
+	close(FORKSRV_TO_FUZZER);
+
+	//Let the driver know whether the library loaded
+	if (load_library(state) || send_all(fd, &result, sizeof(result)))
+		_exit(1);
+
+	while (!recv_all(fd, &length, sizeof(length)))
+	{
+		//Give the harness a buffer of exactly the input's size, so reads past the end of the input
+		//can be caught by ASAN
+		input = (char *)malloc(length ? length : 1);
+		if (!input || recv_all(fd, input, length))
+			_exit(1);
+
+		if (state->prev_loc)
+			*state->prev_loc = 0;
+		if (state->fork)
+			result = run_harness_forked(state, input, length);
+		else
+		{
+			state->harness((const uint8_t *)input, length);
+			result = FUZZ_NONE;
+		}
+		free(input);
+
+		if (send_all(fd, &result, sizeof(result)))
+			_exit(1);
+	}
+	_exit(0);
+}
+
+/**
+ * This function stops the worker process, if it's running.
+ * @param state - the inprocess_state_t object to stop the worker process for
+ * @param kill_worker - whether the worker should be killed, rather than waited for
+ * @return - the worker's exit status, as returned by waitpid
+ */
+static int stop_worker(inprocess_state_t * state, int kill_worker)
+{
+	int status = 0;
+
+	if (state->worker_fd >= 0)
+		close(state->worker_fd);
+	state->worker_fd = -1;
+
+	if (state->worker_pid > 0)
+	{
+		if (kill_worker)
+			kill(state->worker_pid, SIGKILL);
+		waitpid(state->worker_pid, &status, 0);
+	}
+	state->worker_pid = 0;
+	return status;
+}
+
+/**
+ * This function forks a new worker process and waits for it to load the target library.
+ * @param state - the inprocess_state_t object to start the worker process for
+ * @return - 0 on success, non-zero on failure
+ */
+static int start_worker(inprocess_state_t * state)
+{
+	int fds[2];
+	int ready;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+	{
+		ERROR_MSG("Failed to create the socket to the inprocess worker process");
+		return 1;
+	}
+
+	state->worker_pid = fork();
+	if (state->worker_pid < 0)
+	{
+		ERROR_MSG("fork() failed");
+		state->worker_pid = 0;
+		close(fds[0]);
+		close(fds[1]);
+		return 1;
+	}
+	if (state->worker_pid == 0)
+	{
+		close(fds[0]);
+		run_worker(state, fds[1]);
+	}
+
+	close(fds[1]);
+	state->worker_fd = fds[0];
+	if (recv_all(state->worker_fd, &ready, sizeof(ready)))
+	{
+		ERROR_MSG("The inprocess worker process failed to load the target library %s", state->path);
+		stop_worker(state, 0);
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * This function sends an input to the worker process and waits for the harness function to finish
+ * processing it.  If the worker crashes or takes too long, it's stopped, and a new worker will be
+ * started for the next input.
+ * @param state - the inprocess_state_t object for the target library
+ * @param input - the input that should be tested
+ * @param length - the length of the input parameter
+ * @return - FUZZ_NONE, FUZZ_HANG, FUZZ_CRASH, or FUZZ_ERROR on failure
+ */
+static int run_in_worker(inprocess_state_t * state, char * input, size_t length)
+{
+	struct pollfd pfd;
+	int result, status, timeout_ms, rc;
+
+	if (!state->worker_pid && start_worker(state))
+		return FUZZ_ERROR;
+
+	//In fork mode, the worker times out its own child, so give it a chance to report the hang
+	timeout_ms = state->timeout * 1000;
+	if (state->fork)
+		timeout_ms += 1000;
+
+	if (!send_all(state->worker_fd, &length, sizeof(length)) && !send_all(state->worker_fd, input, length))
+	{
+		pfd.fd = state->worker_fd;
+		pfd.events = POLLIN;
+		while ((rc = poll(&pfd, 1, timeout_ms)) < 0 && errno == EINTR)
+			;
+		if (rc == 0)
+		{
+			stop_worker(state, 1);
+			return FUZZ_HANG;
+		}
+		if (rc > 0 && !recv_all(state->worker_fd, &result, sizeof(result)))
+			return result;
+	}
+
+	//The worker went away without answering, so the harness either crashed or exited
+	status = stop_worker(state, 0);
+	if (WIFSIGNALED(status))
+		return FUZZ_CRASH;
+	return FUZZ_NONE;
+}
+
+/**
+ * This function creates a inprocess_state_t object based on the given options.
+ * @param options - A JSON string of the options to set in the new inprocess_state_t. See the
+ * help function for more information on the specific options available.
+ * @return - the inprocess_state_t generated from the options in the JSON options string, or NULL on failure
+ */
+static inprocess_state_t * setup_options(char * options)
+{
+	inprocess_state_t * state;
+
+	state = (inprocess_state_t *)malloc(sizeof(inprocess_state_t));
+	if (!state)
+		return NULL;
+	memset(state, 0, sizeof(inprocess_state_t));
+	state->worker_fd = -1;
+
+	//Setup defaults
+	state->timeout = 2;
+	state->input_ratio = 2.0;
+	state->function = strdup("LLVMFuzzerTestOneInput");
+
+	//Parse the options
+	PARSE_OPTION_STRING(state, options, path, "path", inprocess_cleanup);
+	PARSE_OPTION_STRING(state, options, function, "function", inprocess_cleanup);
+	PARSE_OPTION_INT(state, options, timeout, "timeout", inprocess_cleanup);
+	PARSE_OPTION_INT(state, options, fork, "fork", inprocess_cleanup);
+	PARSE_OPTION_DOUBLE(state, options, input_ratio, "ratio", inprocess_cleanup);
+
+	//Validate the options
+	if (!state->path || !state->function || !file_exists(state->path) || state->input_ratio <= 0 || state->timeout <= 0)
+	{
+		inprocess_cleanup(state);
+		return NULL;
+	}
+
+	return state;
+}
+
+/**
+ * This function allocates and initializes a new driver specific state object based on the given options.
+ * @param options - a JSON string that contains the driver specific string of options
+ * @param instrumentation - a pointer to an instrumentation instance that the driver will use
+ * to instrument the requested program.  This instrumentation instance should already be initialized.
+ * @param instrumentation_state - a pointer to the instrumentation state for the passed in instrumentation
+ * @return - a driver specific state object on success or NULL on failure
+ */
+void * inprocess_create(char * options, instrumentation_t * instrumentation, void * instrumentation_state,
+	mutator_t * mutator, void * mutator_state)
+{
+	inprocess_state_t * state;
+	int num_inputs;
+	size_t *input_sizes;
+
+	//This driver requires at least the path to the library. Make sure we either have both a mutator and state
+	if (!options || !strlen(options) || (mutator && !mutator_state) || (!mutator && mutator_state)) //or neither
+		return NULL;
+
+	if (!instrumentation || !instrumentation->enable_inprocess || !instrumentation->finish_inprocess)
+	{
+		ERROR_MSG("The inprocess driver requires an instrumentation that supports in-process targets, such as afl");
+		return NULL;
+	}
+
+	state = setup_options(options);
+	if (!state)
+		return NULL;
+
+	state->instrumentation = instrumentation;
+	state->instrumentation_state = instrumentation_state;
+
+	//The coverage map has to be set up before the worker process loads the library, so that the
+	//instrumentation runtime in the library can find it when its constructor runs
+	if (instrumentation->enable_inprocess(instrumentation_state) || start_worker(state))
+	{
+		inprocess_cleanup(state);
+		return NULL;
+	}
+
+	if (mutator)
+	{
+		mutator->get_input_info(mutator_state, &num_inputs, &input_sizes);
+		if (num_inputs != 1
+			|| setup_mutate_buffer(state->input_ratio, input_sizes[0], &state->mutate_buffer, &state->mutate_buffer_length))
+		{
+			free(input_sizes);
+			inprocess_cleanup(state);
+			return NULL;
+		}
+		free(input_sizes);
+	}
+
+	state->mutator = mutator;
+	state->mutator_state = mutator_state;
+	state->mutate_last_size = -1;
+	return state;
+}
+
+/**
+ * This function cleans up all resources with the passed in driver state.
+ * @param driver_state - a driver specific state object previously created by the inprocess_create function
+ * This state object should not be referenced after this function returns.
+ */
+void inprocess_cleanup(void * driver_state)
+{
+	inprocess_state_t * state = (inprocess_state_t *)driver_state;
+
+	stop_worker(state, 1);
+
+	free(state->mutate_buffer);
+	free(state->path);
+	free(state->function);
+	free(state);
+}
+
+/**
+ * This function will call the harness function in the target library with the given input.
+ * This function blocks until the harness function has finished processing the input.
+ * @param driver_state - a driver specific structure previously created by the inprocess_create function
+ * @param input - the input that should be tested
+ * @param length - the length of the input parameter
+ * @return - FUZZ_ result on success or FUZZ_ERROR on failure
+ */
+int inprocess_test_input(void * driver_state, char * input, size_t length)
+{
+	inprocess_state_t * state = (inprocess_state_t *)driver_state;
+	int result;
+
+	if (state->instrumentation->enable_inprocess(state->instrumentation_state))
+		return FUZZ_ERROR;
+
+	result = run_in_worker(state, input, length);
+	if (result == FUZZ_ERROR)
+		return FUZZ_ERROR;
+	return state->instrumentation->finish_inprocess(state->instrumentation_state, result);
+}
+
+/**
+ * This function will run the harness function with the output of the mutator given during driver
+ * creation.  This function blocks until the harness function has finished processing the input.
+ * @param driver_state - a driver specific structure previously created by the inprocess_create function
+ * @return - FUZZ_ result on success, FUZZ_ERROR on error, -2 if the mutator has finished generating inputs
+ */
+int inprocess_test_next_input(void * driver_state)
+{
+	inprocess_state_t * state = (inprocess_state_t *)driver_state;
+	return generic_test_next_input(state, state->mutator, state->mutator_state, state->mutate_buffer,
+		state->mutate_buffer_length, inprocess_test_input, &state->mutate_last_size);
+}
+
+/**
+ * This function tests each of the given inputs in turn, and returns the FUZZ_ result of each one.
+ * @param driver_state - a driver specific structure previously created by the inprocess_create function
+ * @param inputs - an array of the inputs to test
+ * @param lengths - an array of lengths for the buffers in the inputs parameter
+ * @param num_inputs - the number of buffers in the inputs parameter
+ * @param results - an array of num_inputs integers used to return the FUZZ_ result of each input
+ * @param callback - optionally, a function to call after each input is tested
+ * @param callback_arg - an argument to pass to the callback
+ * @return - the number of inputs that were tested, or -1 on error
+ */
+int inprocess_test_inputs_batch(void * driver_state, char ** inputs, size_t * lengths, size_t num_inputs,
+	int * results, driver_batch_callback_t callback, void * callback_arg)
+{
+	return generic_test_inputs_batch(driver_state, inputs, lengths, num_inputs, results,
+		callback, callback_arg, inprocess_test_input);
+}
+
+/**
+ * When this driver is using a mutator given to it during driver creation, this function retrieves
+ * the last input that was tested with the inprocess_test_next_input function.
+ * @param driver_state - a driver specific structure previously created by the inprocess_create function
+ * @param length - a pointer to an integer used to return the length of the input that was last tested.
+ * @return - NULL on error or if the driver doesn't have a mutator, or a buffer containing the last input
+ * that was tested by the driver with the inprocess_test_next_input function.  This buffer should be freed
+ * by the caller.
+ */
+char * inprocess_get_last_input(void * driver_state, int * length)
+{
+	inprocess_state_t * state = (inprocess_state_t *)driver_state;
+	if (!state->mutator || state->mutate_last_size <= 0)
+		return NULL;
+	*length = state->mutate_last_size;
+	return memdup(state->mutate_buffer, state->mutate_last_size);
+}
+
+/**
+ * This function returns help text for this driver.  This help text will describe the driver and any options
+ * that can be passed to inprocess_create.
+ * @param help_str - A pointer that will be updated to point to the new help string.
+ * @return 0 on success and -1 on failure
+ */
+int inprocess_help(char ** help_str)
+{
+	*help_str = strdup(
+"inprocess - Loads a shared library and calls a LLVMFuzzerTestOneInput style\n"
+"  function in it with the mutated input, without starting a new process for\n"
+"  each input\n"
+"Required Options:\n"
+"  path                  The path to the target library\n"
+"Optional Options:\n"
+"  fork                  Whether to call the function in a forked child process\n"
+"                          for each input, rather than in one worker process\n"
+"                          that is only restarted after a crash or hang;\n"
+"                          1=yes, 0=no (default=0)\n"
+"  function              The name of the function to call, which must have the\n"
+"                          signature int fn(const uint8_t *, size_t)\n"
+"                          (default=LLVMFuzzerTestOneInput)\n"
+"  ratio                 The ratio of mutation buffer size to input size when\n"
+"                          given a mutator\n"
+"  timeout               The maximum number of seconds to wait for the function\n"
+"                          to return\n"
+"\n"
+	);
+	if (*help_str == NULL)
+		return -1;
+	return 0;
+}
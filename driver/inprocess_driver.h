@@ -0,0 +1,50 @@
+#pragma once
+#include "driver.h"
+#include <instrumentation.h>
+
+#include <stdint.h>
+#include <sys/types.h>
+
+void * inprocess_create(char * options, instrumentation_t * instrumentation, void * instrumentation_state,
+	mutator_t * mutator, void * mutator_state);
+void inprocess_cleanup(void * driver_state);
+int inprocess_test_input(void * driver_state, char * buffer, size_t length);
+int inprocess_test_next_input(void * driver_state);
+char * inprocess_get_last_input(void * driver_state, int * length);
+int inprocess_test_inputs_batch(void * driver_state, char ** inputs, size_t * lengths, size_t num_inputs,
+	int * results, driver_batch_callback_t callback, void * callback_arg);
+int inprocess_help(char ** help_str);
+
+//The LLVMFuzzerTestOneInput compatible function that the target library exports
+typedef int (*harness_function_t)(const uint8_t * data, size_t size);
+
+struct inprocess_state
+{
+	//Options
+	char * path;          //The path to the target library
+	char * function;      //The name of the harness function in the target library
+	int timeout;          //Maximum number of seconds to allow the harness function to run
+	int fork;             //Whether to run each input in a forked child process
+	double input_ratio;   //the ratio of the maximum input size
+
+	pid_t worker_pid;            //The worker process that the target library is loaded in, or 0 if it isn't running
+	int worker_fd;               //The socket used to send inputs to and get results from the worker process
+
+	//These are only set in the worker process
+	void * library;              //The handle to the loaded target library
+	harness_function_t harness;  //The harness function in the target library
+	uint32_t * prev_loc;         //The target library's __afl_prev_loc, if it was built with afl-clang-fast
+
+	//The instrumentation module
+	instrumentation_t * instrumentation;
+
+	//The instrumentation's state
+	void * instrumentation_state;
+
+	mutator_t * mutator;
+	void * mutator_state;
+	char * mutate_buffer;
+	size_t mutate_buffer_length;
+	int mutate_last_size;
+};
+typedef struct inprocess_state inprocess_state_t;
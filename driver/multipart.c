@@ -0,0 +1,227 @@
+#include "multipart.h"
+
+#include <utils.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * This function reads a 32-bit little endian integer.
+ * @param buffer - the buffer to read the integer from
+ * @return - the integer
+ */
+static uint32_t read_u32(const char * buffer)
+{
+	const uint8_t * bytes = (const uint8_t *)buffer;
+	return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+/**
+ * This function writes a 32-bit little endian integer.
+ * @param buffer - the buffer to write the integer to
+ * @param value - the integer to write
+ */
+static void write_u32(char * buffer, uint32_t value)
+{
+	uint8_t * bytes = (uint8_t *)buffer;
+	bytes[0] = value & 0xff;
+	bytes[1] = (value >> 8) & 0xff;
+	bytes[2] = (value >> 16) & 0xff;
+	bytes[3] = (value >> 24) & 0xff;
+}
+
+/**
+ * This function determines whether a buffer is in the binary multipart format.
+ * @param buffer - the buffer to check
+ * @param length - the length of the buffer parameter
+ * @return - 1 if the buffer starts with the multipart header, 0 otherwise
+ */
+int is_multipart(const char * buffer, size_t length)
+{
+	return length >= MULTIPART_HEADER_SIZE && !memcmp(buffer, MULTIPART_MAGIC, MULTIPART_MAGIC_LENGTH);
+}
+
+/**
+ * This function sets up a view to iterate over the packets in a binary multipart buffer, without copying them.
+ * The whole buffer is validated up front, so multipart_next never reads past the end of the buffer.
+ * @param view - the multipart_view_t to initialize
+ * @param buffer - the multipart buffer.  It must stay valid as long as the view or its packets are used.
+ * @param length - the length of the buffer parameter
+ * @return - 0 on success, non-zero if the buffer is not a valid multipart buffer
+ */
+int multipart_view_init(multipart_view_t * view, const char * buffer, size_t length)
+{
+	size_t offset = MULTIPART_HEADER_SIZE, packet_length;
+	uint32_t i;
+
+	if (!is_multipart(buffer, length))
+		return 1;
+
+	view->buffer = buffer;
+	view->length = length;
+	view->count = read_u32(buffer + MULTIPART_MAGIC_LENGTH);
+	view->index = 0;
+	view->offset = MULTIPART_HEADER_SIZE;
+
+	for (i = 0; i < view->count; i++)
+	{
+		if (length - offset < sizeof(uint32_t))
+			return 1;
+		packet_length = read_u32(buffer + offset);
+		offset += sizeof(uint32_t);
+		if (length - offset < packet_length)
+			return 1;
+		offset += packet_length;
+	}
+	return 0;
+}
+
+/**
+ * This function gets the next packet from a multipart view.
+ * @param view - a multipart_view_t previously set up with multipart_view_init
+ * @param packet - a pointer used to return a pointer to the packet, inside the view's buffer
+ * @param packet_length - a pointer used to return the length of the packet
+ * @return - 1 if a packet was returned, 0 if there are no more packets
+ */
+int multipart_next(multipart_view_t * view, const char ** packet, size_t * packet_length)
+{
+	if (view->index >= view->count)
+		return 0;
+
+	*packet_length = read_u32(view->buffer + view->offset);
+	*packet = view->buffer + view->offset + sizeof(uint32_t);
+	view->offset += sizeof(uint32_t) + *packet_length;
+	view->index++;
+	return 1;
+}
+
+/**
+ * This function fills in arrays of pointers to, and lengths of, each packet in a binary multipart buffer.
+ * The arrays are reused between calls and only grown when a buffer has more packets than they can hold, so
+ * a driver can call this on every input without allocating.
+ * @param buffer - the multipart buffer.  The returned packets point into this buffer.
+ * @param length - the length of the buffer parameter
+ * @param packets - a pointer to the array of packet pointers, which may be updated if it needs to grow
+ * @param packet_lengths - a pointer to the array of packet lengths, which may be updated if it needs to grow
+ * @param capacity - a pointer to the number of entries in the packets and packet_lengths arrays
+ * @param count - a pointer used to return the number of packets in the buffer
+ * @return - 0 on success, non-zero on failure
+ */
+int multipart_get_packets(const char * buffer, size_t length, char *** packets, size_t ** packet_lengths,
+	size_t * capacity, size_t * count)
+{
+	multipart_view_t view;
+	const char * packet;
+	char ** new_packets;
+	size_t * new_lengths;
+
+	if (multipart_view_init(&view, buffer, length))
+		return 1;
+
+	if (view.count > *capacity)
+	{
+		new_packets = (char **)realloc(*packets, sizeof(char *) * view.count);
+		if (!new_packets)
+			return 1;
+		*packets = new_packets;
+		new_lengths = (size_t *)realloc(*packet_lengths, sizeof(size_t) * view.count);
+		if (!new_lengths)
+			return 1;
+		*packet_lengths = new_lengths;
+		*capacity = view.count;
+	}
+
+	*count = 0;
+	while (multipart_next(&view, &packet, &(*packet_lengths)[*count]))
+		(*packets)[(*count)++] = (char *)packet;
+	return 0;
+}
+
+/**
+ * This function encodes packets into the binary multipart format.
+ * @param packets - an array of the packets to encode
+ * @param packet_lengths - an array of the lengths of the buffers in the packets parameter
+ * @param count - the number of buffers in the packets parameter
+ * @param length - a pointer used to return the length of the encoded buffer
+ * @return - the encoded buffer on success, which should be freed by the caller, or NULL on failure
+ */
+char * encode_multipart(char ** packets, size_t * packet_lengths, size_t count, int * length)
+{
+	size_t i, total = MULTIPART_HEADER_SIZE, offset;
+	char * buffer;
+
+	for (i = 0; i < count; i++)
+	{
+		if (packet_lengths[i] > UINT32_MAX)
+			return NULL;
+		total += sizeof(uint32_t) + packet_lengths[i];
+	}
+	if (count > UINT32_MAX || total > INT32_MAX)
+		return NULL;
+
+	buffer = (char *)malloc(total);
+	if (!buffer)
+		return NULL;
+
+	memcpy(buffer, MULTIPART_MAGIC, MULTIPART_MAGIC_LENGTH);
+	write_u32(buffer + MULTIPART_MAGIC_LENGTH, (uint32_t)count);
+	offset = MULTIPART_HEADER_SIZE;
+	for (i = 0; i < count; i++)
+	{
+		write_u32(buffer + offset, (uint32_t)packet_lengths[i]);
+		offset += sizeof(uint32_t);
+		memcpy(buffer + offset, packets[i], packet_lengths[i]);
+		offset += packet_lengths[i];
+	}
+
+	*length = (int)total;
+	return buffer;
+}
+
+/**
+ * This function converts a binary multipart buffer to the mem array format, e.g. to use it as a seed for
+ * a mutator that expects mem arrays.
+ * @param buffer - the multipart buffer to convert
+ * @param length - the length of the buffer parameter
+ * @param out_length - a pointer used to return the length of the mem array
+ * @return - the mem array on success, which should be freed by the caller, or NULL on failure
+ */
+char * multipart_to_mem_array(const char * buffer, size_t length, int * out_length)
+{
+	char ** packets = NULL;
+	size_t * packet_lengths = NULL;
+	size_t capacity = 0, count;
+	char * ret = NULL;
+
+	if (!multipart_get_packets(buffer, length, &packets, &packet_lengths, &capacity, &count))
+		ret = encode_mem_array(packets, packet_lengths, count, out_length);
+
+	free(packets);
+	free(packet_lengths);
+	return ret;
+}
+
+/**
+ * This function converts a mem array to the binary multipart format.
+ * @param mem_array - the mem array to convert
+ * @param out_length - a pointer used to return the length of the multipart buffer
+ * @return - the multipart buffer on success, which should be freed by the caller, or NULL on failure
+ */
+char * mem_array_to_multipart(char * mem_array, int * out_length)
+{
+	char ** packets;
+	size_t * packet_lengths;
+	size_t i, count;
+	char * ret;
+
+	if (decode_mem_array(mem_array, &packets, &packet_lengths, &count))
+		return NULL;
+
+	ret = encode_multipart(packets, packet_lengths, count, out_length);
+
+	for (i = 0; i < count; i++)
+		free(packets[i]);
+	free(packets);
+	free(packet_lengths);
+	return ret;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "driver.h"
+
+//The binary multipart format stores several packets in one buffer.  It starts with the magic
+//value and the number of packets, followed by each packet's length and contents.  All of the
+//integers are 32-bit little endian:
+//  "KBMP" | count | length 0 | packet 0 | length 1 | packet 1 | ...
+//Unlike the mem array format (a JSON array of hex strings), packets can be read in place, without
+//decoding or copying them.
+
+#define MULTIPART_MAGIC        "KBMP"
+#define MULTIPART_MAGIC_LENGTH 4
+#define MULTIPART_HEADER_SIZE  (MULTIPART_MAGIC_LENGTH + sizeof(uint32_t))
+
+struct multipart_view
+{
+	const char * buffer; //The encoded multipart buffer
+	size_t length;       //The length of the buffer
+	uint32_t count;      //The number of packets in the buffer
+	uint32_t index;      //The index of the next packet
+	size_t offset;       //The offset of the next packet's length in the buffer
+};
+typedef struct multipart_view multipart_view_t;
+
+FUNC_PREFIX int is_multipart(const char * buffer, size_t length);
+FUNC_PREFIX int multipart_view_init(multipart_view_t * view, const char * buffer, size_t length);
+FUNC_PREFIX int multipart_next(multipart_view_t * view, const char ** packet, size_t * packet_length);
+FUNC_PREFIX int multipart_get_packets(const char * buffer, size_t length, char *** packets, size_t ** packet_lengths,
+	size_t * capacity, size_t * count);
+FUNC_PREFIX char * encode_multipart(char ** packets, size_t * packet_lengths, size_t count, int * length);
+FUNC_PREFIX char * multipart_to_mem_array(const char * buffer, size_t length, int * out_length);
+FUNC_PREFIX char * mem_array_to_multipart(char * mem_array, int * out_length);
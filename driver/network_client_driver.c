@@ -4,6 +4,7 @@
 #include <jansson_helper.h>
 #include <instrumentation.h>
 #include "driver.h"
+#include "multipart.h"
 
 //c headers
 #include <stdio.h>
@@ -21,7 +22,11 @@
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <unistd.h>
+#ifndef __APPLE__
+#include <sys/epoll.h>
+#endif
 
 #include <errno.h>
 #include <string.h>
@@ -31,6 +36,14 @@
 #define SOCKET_ERROR -1
 #endif
 
+//How many milliseconds to wait for the listening socket at a time, before checking on the target process
+#define ACCEPT_POLL_MS 50
+
+//The number of bytes to read at a time when discarding data the target sent
+#define DRAIN_BUFFER_SIZE 4096
+
+static int start_listener(network_client_state_t * state);
+
 /**
  * This function creates a network_client_state_t object based on the given options.
  * @param options - A JSON string of the options to set in the new network_client_state_t. See the
@@ -52,6 +65,10 @@ static network_client_state_t * setup_options(char * options)
 	state->input_ratio = 2.0;
 	state->lport = 9999;
 	state->target_ip = strdup("127.0.0.1");
+	state->listen_sock = INVALID_SOCKET;
+#if !defined(_WIN32) && !defined(__APPLE__)
+	state->epoll_fd = -1;
+#endif
 
 	//Parse the options
 	PARSE_OPTION_STRING(state, options, path, "path", network_client_cleanup);
@@ -61,6 +78,8 @@ static network_client_state_t * setup_options(char * options)
 	PARSE_OPTION_STRING(state, options, target_ip, "ip", network_client_cleanup);
 	PARSE_OPTION_DOUBLE(state, options, input_ratio, "ratio", network_client_cleanup);
 	PARSE_OPTION_INT_ARRAY(state, options, sleeps, sleeps_count, "sleeps", network_client_cleanup);
+	PARSE_OPTION_INT(state, options, response_timeout, "response_timeout", network_client_cleanup);
+	PARSE_OPTION_INT(state, options, binary_multipart, "binary_multipart", network_client_cleanup);
 	
 	cmd_length = (state->path ? strlen(state->path) : 0) + (state->arguments ? strlen(state->arguments) : 0) + 4;
 	state->cmd_line = (char *)malloc(cmd_length);
@@ -160,6 +179,13 @@ void * network_client_create(char * options, instrumentation_t * instrumentation
 
 	state->instrumentation = instrumentation;
 	state->instrumentation_state = instrumentation_state;
+
+	//Start the server socket once, and reuse it for every run
+	if (start_listener(state))
+	{
+		network_client_cleanup(state);
+		return NULL;
+	}
 	return state;
 }
 
@@ -173,12 +199,25 @@ void network_client_cleanup(void * driver_state)
 	network_client_state_t * state = (network_client_state_t *)driver_state;
 	int i;
 
+	if (state->listen_sock != INVALID_SOCKET)
+#ifdef _WIN32
+		closesocket(state->listen_sock);
+#else
+		close(state->listen_sock);
+#endif
+#if !defined(_WIN32) && !defined(__APPLE__)
+	if (state->epoll_fd >= 0)
+		close(state->epoll_fd);
+#endif
+
 	//Cleanup mutator stuff
 	for (i = 0; state->mutate_buffers && i < state->num_inputs; i++)
 		free(state->mutate_buffers[i]);
 	free(state->mutate_buffers);
 	free(state->mutate_buffer_lengths);
 	free(state->mutate_last_sizes);
+	free(state->packets);
+	free(state->packet_lengths);
 
 	//Clean up driver specific options
 	free(state->path);
@@ -192,21 +231,41 @@ void network_client_cleanup(void * driver_state)
 }
 
 /**
- * This function creates a socket and waits for a client to connect.
- * @param state - the network_client_state_t object that represents the current state of the driver
- * @param sock - a pointer to a SOCKET used to return the created socket
- * @return - FUZZ_ERROR error, zero on success
+ * This function changes whether a socket is in nonblocking mode.
+ * @param sock - the socket to change
+ * @param nonblocking - 1 to make the socket nonblocking, 0 to make it blocking
+ * @return - non-zero on error, zero on success
  */
 #ifdef _WIN32
-static int start_listener(network_client_state_t * state, SOCKET * sock)
+static int set_nonblocking(SOCKET sock, int nonblocking)
 #else
-static int start_listener(network_client_state_t * state, int * sock)
+static int set_nonblocking(int sock, int nonblocking)
 #endif
+{
+#ifdef _WIN32
+	u_long mode = nonblocking;
+	return ioctlsocket(sock, FIONBIO, &mode) == SOCKET_ERROR;
+#else
+	int flags = fcntl(sock, F_GETFL);
+	if (flags < 0)
+		return 1;
+	return fcntl(sock, F_SETFL, nonblocking ? flags | O_NONBLOCK : flags & ~O_NONBLOCK) < 0;
+#endif
+}
+
+/**
+ * This function creates the nonblocking listening socket that the fuzzed program connects to.  The socket
+ * is created once, when the driver is created, and kept open across runs, so that each run doesn't create
+ * a new socket and leave the old one behind in TIME_WAIT.
+ * @param state - the network_client_state_t object that represents the current state of the driver
+ * @return - FUZZ_ERROR on error, zero on success
+ */
+static int start_listener(network_client_state_t * state)
 {
 	struct sockaddr_in addr;
 	int iResult = 0;
-	*sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-	if (*sock == INVALID_SOCKET)
+	state->listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (state->listen_sock == INVALID_SOCKET)
 	{
 #ifdef _WIN32
 		ERROR_MSG("socket function failed with error: %ld", WSAGetLastError());
@@ -220,7 +279,9 @@ static int start_listener(network_client_state_t * state, int * sock)
 	// Set SO_REUSEADDR so you reuse the address instead of waiting for a minute.
 	// https://stackoverflow.com/a/24194999
 	int enable = 1;
-	if (setsockopt(*sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) < 0)
+	//The listener outlives each run, so don't let the target processes inherit it
+	fcntl(state->listen_sock, F_SETFD, FD_CLOEXEC);
+	if (setsockopt(state->listen_sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) < 0)
 		FATAL_MSG("setsockopt failed.\n");
 #endif
 
@@ -230,39 +291,181 @@ static int start_listener(network_client_state_t * state, int * sock)
 	addr.sin_port = htons(state->lport);
 
 	//Now bind to the socket
-	iResult = bind(*sock, (const struct sockaddr *)& addr, sizeof(addr));
+	iResult = bind(state->listen_sock, (const struct sockaddr *)& addr, sizeof(addr));
 
 	if (iResult == SOCKET_ERROR)
 	{
 #ifdef _WIN32
 		ERROR_MSG("Socket failed to bind to port. Error code: %d", WSAGetLastError());
-		iResult = closesocket(*sock);
-		if (iResult == SOCKET_ERROR)
-			ERROR_MSG("closesocket function failed with error %d", WSAGetLastError());
 #else
 		ERROR_MSG("Socket failed to bind to port. Error code: %d", errno);
-		iResult = close(*sock);
-		if (iResult == SOCKET_ERROR)
-			ERROR_MSG("closesocket function failed with error %d", errno);
 #endif
 		return FUZZ_ERROR;
 	}
 
 	//Now put the socket into LISTEN state
-	if (listen(*sock, SOMAXCONN) == SOCKET_ERROR)
+	if (listen(state->listen_sock, SOMAXCONN) == SOCKET_ERROR)
 	{
 #ifdef _WIN32
 		ERROR_MSG("listen function failed with error: %d", WSAGetLastError());
-		return FUZZ_ERROR;
 #else
 		ERROR_MSG("listen function failed with error: %d", errno);
-		return FUZZ_ERROR;
 #endif
+		return FUZZ_ERROR;
+	}
+
+	//accept is only called once the socket is readable, or to clear out stale connections,
+	//so it should never block
+	if (set_nonblocking(state->listen_sock, 1))
+	{
+		ERROR_MSG("Failed to make the listening socket nonblocking");
+		return FUZZ_ERROR;
 	}
 
+#if !defined(_WIN32) && !defined(__APPLE__)
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	state->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (state->epoll_fd < 0 || epoll_ctl(state->epoll_fd, EPOLL_CTL_ADD, state->listen_sock, &event))
+	{
+		ERROR_MSG("Failed to setup epoll for the listening socket, error: %d", errno);
+		return FUZZ_ERROR;
+	}
+#endif
+
 	return FUZZ_NONE;
 }
 
+/**
+ * This function waits for the listening socket to have a connection ready to accept.
+ * @param state - the network_client_state_t object that represents the current state of the driver
+ * @param timeout_ms - the maximum number of milliseconds to wait
+ * @return - 1 if a connection is ready, 0 if the timeout expired, or -1 on error
+ */
+static int wait_for_listener(network_client_state_t * state, int timeout_ms)
+{
+#if !defined(_WIN32) && !defined(__APPLE__)
+	struct epoll_event event;
+	int ret = epoll_wait(state->epoll_fd, &event, 1, timeout_ms);
+	if (ret < 0)
+		return errno == EINTR ? 0 : -1;
+	return ret > 0;
+#else
+	return wait_socket_readable(state->listen_sock, timeout_ms);
+#endif
+}
+
+/**
+ * This function closes any connections left in the listening socket's backlog, e.g. from a previous run's
+ * target process that connected after the driver had given up on it.
+ * @param state - the network_client_state_t object that represents the current state of the driver
+ */
+static void drain_stale_connections(network_client_state_t * state)
+{
+#ifdef _WIN32
+	SOCKET sock;
+	while ((sock = accept(state->listen_sock, NULL, NULL)) != INVALID_SOCKET)
+		closesocket(sock);
+#else
+	int sock;
+	while ((sock = accept(state->listen_sock, NULL, NULL)) != INVALID_SOCKET)
+		close(sock);
+#endif
+}
+
+/**
+ * This function waits for the fuzzed program to connect, giving up if the program exits or doesn't
+ * connect within the timeout.
+ * @param state - the network_client_state_t object that represents the current state of the driver
+ * @param sock - a pointer to a SOCKET used to return the connected socket
+ * @param result - a pointer used to return FUZZ_ERROR on error, or the FUZZ_ result of the fuzzed
+ * program if it exited or hung before it connected
+ * @return - 1 once the program has connected, or 0 if it never connected
+ */
+#ifdef _WIN32
+static int accept_client(network_client_state_t * state, SOCKET * sock, int * result)
+#else
+static int accept_client(network_client_state_t * state, int * sock, int * result)
+#endif
+{
+	time_t start_time = time(NULL);
+	int ready, process_done;
+
+	while (1)
+	{
+		ready = wait_for_listener(state, ACCEPT_POLL_MS);
+		if (ready < 0)
+		{
+			ERROR_MSG("Failed to wait for the target to connect");
+			*result = FUZZ_ERROR;
+			return 0;
+		}
+		if (ready)
+		{
+			*sock = accept(state->listen_sock, NULL, NULL);
+			if (*sock != INVALID_SOCKET)
+			{
+				//Windows sockets inherit nonblocking mode from the listening socket
+				set_nonblocking(*sock, 0);
+				return 1;
+			}
+		}
+
+		process_done = state->instrumentation->is_process_done(state->instrumentation_state);
+		if (process_done == 1) //The program died before it connected
+		{
+			*result = state->instrumentation->get_fuzz_result(state->instrumentation_state);
+			return 0;
+		}
+		if (process_done < 0 || time(NULL) - start_time > state->timeout)
+		{
+			*result = process_done < 0 ? FUZZ_ERROR : FUZZ_HANG;
+			return 0;
+		}
+	}
+}
+
+/**
+ * This function waits for the fuzzed program to send something before the next input is sent, and
+ * discards whatever it sent.  This lets the driver send each input as soon as the program is ready
+ * for it, rather than sleeping for a fixed amount of time.
+ * @param state - the network_client_state_t object that represents the current state of the driver
+ * @param sock - the connected socket
+ * @return - 0 if the next input should be sent, or -2 if the program closed the connection
+ */
+#ifdef _WIN32
+static int wait_for_client_data(network_client_state_t * state, SOCKET sock)
+#else
+static int wait_for_client_data(network_client_state_t * state, int sock)
+#endif
+{
+	char buffer[DRAIN_BUFFER_SIZE];
+	int ret;
+
+	if (wait_socket_readable(sock, state->response_timeout) <= 0)
+		return 0; //The program didn't send anything, send the next input anyway
+
+	//Read everything that's available, without blocking
+	do
+	{
+#ifdef _WIN32
+		u_long available = 0;
+		if (ioctlsocket(sock, FIONREAD, &available) == SOCKET_ERROR)
+			return 0;
+		if (!available) //readable with nothing to read means the connection was closed
+			ret = recv(sock, buffer, sizeof(buffer), 0);
+		else
+			ret = recv(sock, buffer, available < sizeof(buffer) ? available : sizeof(buffer), 0);
+#else
+		ret = recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT);
+#endif
+		if (ret == 0)
+			return -2;
+	} while (ret == sizeof(buffer));
+	return 0;
+}
+
 /**
  * This function will run the fuzzed program and test it with the given inputs. This function
  * blocks until the program has finished processing the input.
@@ -275,52 +478,41 @@ static int start_listener(network_client_state_t * state, int * sock)
 static int network_client_run(network_client_state_t * state, char ** inputs, size_t * lengths, size_t inputs_count)
 {
 #ifdef _WIN32
-	SOCKET serverSock;
 	SOCKET clientSock;
 #else
-	int serverSock;
 	int clientSock;
 #endif
 	size_t i;
-	int sock_ret;
+	int sock_ret, result;
 
-	//Start the server socket so the client can connect below:
-	if (start_listener(state, &serverSock))
-	{
-		return FUZZ_ERROR;
-	}
+	//Make sure the connection we accept is from this run's process
+	drain_stale_connections(state);
 
 	//Have the instrumentation start the new process, since it needs to do so in a custom environment
-	state->instrumentation->enable(state->instrumentation_state, &state->process, state->cmd_line, NULL, 0);
-
-	//Now accept the client connection
-	clientSock = accept(serverSock, NULL, NULL);
-
-	if (clientSock == INVALID_SOCKET)
-	{
-#ifdef _WIN32
-		FATAL_MSG("accept() failed with error: %d\n", WSAGetLastError());
-#else
-		FATAL_MSG("accept() failed with error: %d\n", errno);
-#endif
+	if (state->instrumentation->enable(state->instrumentation_state, &state->process, state->cmd_line, NULL, 0))
 		return FUZZ_ERROR;
-	}
 
-#ifdef _WIN32
-	closesocket(serverSock);
-#else
-	close(serverSock);
-#endif
+	//Now accept the client connection
+	if (!accept_client(state, &clientSock, &result))
+		return result;
 
 	for (i = 0; i < inputs_count; i++)
 	{
-		if (state->sleeps && state->sleeps[i] != 0)
+		sock_ret = 0;
+		if (state->sleeps)
+		{
+			if (state->sleeps[i] != 0)
 #ifdef _WIN32
-			Sleep(state->sleeps[i]);
+				Sleep(state->sleeps[i]);
 #else
-			usleep(1000*state->sleeps[i]);
+				usleep(1000*state->sleeps[i]);
 #endif
-		sock_ret = send_tcp_input(&clientSock, inputs[i], lengths[i]);
+		}
+		else if (state->response_timeout > 0)
+			sock_ret = wait_for_client_data(state, clientSock);
+
+		if (!sock_ret)
+			sock_ret = send_tcp_input(&clientSock, inputs[i], lengths[i]);
 		if (sock_ret)
 		{
 			if (sock_ret == -2)
@@ -329,6 +521,11 @@ static int network_client_run(network_client_state_t * state, char ** inputs, si
 					"were sent, %d of %d packets sent", i, inputs_count);
 				break;
 			}
+#ifdef _WIN32
+			closesocket(clientSock);
+#else
+			close(clientSock);
+#endif
 			return FUZZ_ERROR;
 		}
 	}
@@ -359,6 +556,15 @@ int network_client_test_input(void * driver_state, char * input, size_t length)
 	size_t i, inputs_count;
 	int ret = FUZZ_ERROR;
 
+	//Binary multipart inputs are sent straight from the input buffer
+	if (is_multipart(input, length))
+	{
+		if (multipart_get_packets(input, length, &state->packets, &state->packet_lengths,
+				&state->packets_capacity, &inputs_count) == 0 && inputs_count)
+			ret = network_client_run(state, state->packets, state->packet_lengths, inputs_count);
+		return ret;
+	}
+
 	if (decode_mem_array(input, &inputs, &input_lengths, &inputs_count) == 0)
 	{
 		if (inputs_count)
@@ -403,6 +609,24 @@ int network_client_test_next_input(void * driver_state)
 	return network_client_run(state, state->mutate_buffers, state->mutate_last_sizes, state->num_inputs);
 }
 
+/**
+ * This function tests each of the given inputs in turn, and returns the FUZZ_ result of each one.
+ * @param driver_state - a driver specific structure previously created by the network_client_create function
+ * @param inputs - an array of the inputs to test
+ * @param lengths - an array of lengths for the buffers in the inputs parameter
+ * @param num_inputs - the number of buffers in the inputs parameter
+ * @param results - an array of num_inputs integers used to return the FUZZ_ result of each input
+ * @param callback - optionally, a function to call after each input is tested
+ * @param callback_arg - an argument to pass to the callback
+ * @return - the number of inputs that were tested, or -1 on error
+ */
+int network_client_test_inputs_batch(void * driver_state, char ** inputs, size_t * lengths, size_t num_inputs,
+	int * results, driver_batch_callback_t callback, void * callback_arg)
+{
+	return generic_test_inputs_batch(driver_state, inputs, lengths, num_inputs, results,
+		callback, callback_arg, network_client_test_input);
+}
+
 /**
  * When this driver is using a mutator given to it during driver creation, this function retrieves
  * the last input that was tested with the network_client_test_next_input function.
@@ -430,6 +654,9 @@ char * network_client_get_last_input(void * driver_state, int * length)
 		if (state->mutate_last_sizes[i] == 0)
 			return NULL;
 	}
+	if (state->binary_multipart)
+		return encode_multipart(state->mutate_buffers,
+			state->mutate_last_sizes, state->num_inputs, length);
 	return encode_mem_array(state->mutate_buffers, 
 		state->mutate_last_sizes, state->num_inputs, length);
 }
@@ -447,6 +674,10 @@ int network_client_help(char ** help_str)
 "  path                  The path to the exe\n"
 "  arguments             Arguments to pass to the target process\n"
 "Optional Options:\n"
+"  binary_multipart      Whether to save inputs in the binary multipart\n"
+"                          format, which is smaller than the default mem\n"
+"                          array format.  Inputs in either format can be\n"
+"                          tested\n"
 "  timeout               The maximum number of seconds to wait\n"
 "                          for the target process to finish\n"
 "  ratio                 The ratio of mutation buffer size to\n"
@@ -457,6 +688,10 @@ int network_client_help(char ** help_str)
 "                          size when given a mutator\n"
 "  sleeps                An array of milliseconds to wait between each\n"
 "                          input being sent to the target program\n"
+"  response_timeout      When sleeps isn't given, the maximum number of\n"
+"                          milliseconds to wait for the target program to\n"
+"                          send something before each input (default 0,\n"
+"                          which sends every input immediately)\n"
 "\n"
 	);
 
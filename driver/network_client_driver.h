@@ -13,6 +13,8 @@ void network_client_cleanup(void * driver_state);
 int network_client_test_input(void * driver_state, char * buffer, size_t length);
 int network_client_test_next_input(void * driver_state);
 char * network_client_get_last_input(void * driver_state, int * length);
+int network_client_test_inputs_batch(void * driver_state, char ** inputs, size_t * lengths, size_t num_inputs,
+	int * results, driver_batch_callback_t callback, void * callback_arg);
 int network_client_help(char ** help_str);
 
 struct network_client_state
@@ -26,6 +28,19 @@ struct network_client_state
 	double input_ratio;     //the ratio of the maximum input size
 	int * sleeps;           //How many milliseconds to sleep between inputs
 	int sleeps_count;       //The number of items in the sleeps array
+	int response_timeout;   //When sleeps isn't set, how many milliseconds to wait for the target to send
+	                        //something before each input
+	int binary_multipart;   //Whether to return the last input in the binary multipart format, rather than a mem array
+
+	//The listening socket, which is kept open across runs
+	#ifdef _WIN32
+	SOCKET listen_sock;
+	#else
+	int listen_sock;
+	#endif
+#if !defined(_WIN32) && !defined(__APPLE__)
+	int epoll_fd;           //An epoll instance watching listen_sock, or -1
+#endif
 
 	//The handle to the fuzzed process instance
 	#ifdef _WIN32
@@ -52,5 +67,10 @@ struct network_client_state
 	char ** mutate_buffers;
 	size_t * mutate_buffer_lengths;
 	size_t * mutate_last_sizes;
+
+	//Reused by test_input to point at each packet of a binary multipart input
+	char ** packets;
+	size_t * packet_lengths;
+	size_t packets_capacity;
 };
 typedef struct network_client_state network_client_state_t;
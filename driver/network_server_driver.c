@@ -1,9 +1,13 @@
+#if !defined(_WIN32) && !defined(__APPLE__)
+#define _GNU_SOURCE // sendmmsg
+#endif
 #include "network_server_driver.h"
 
 #include <utils.h>
 #include <jansson_helper.h>
 #include <instrumentation.h>
 #include "driver.h"
+#include "multipart.h"
 
 //c headers
 #include <stdio.h>
@@ -25,11 +29,31 @@
 #include <netinet/tcp_var.h>
 #include <netinet/tcp_fsm.h>
 #else
+#include <errno.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <netinet/ip.h>
+#include <netinet/tcp.h>   // TCP_LISTEN, TCP_CLOSE
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h> // struct rtattr
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
 #endif // __APPLE__
 #endif
 
+//The longest we'll sleep between checks for the target port to be listening
+#define MAX_LISTEN_POLL_US 5000
+
+//The number of entries in the protocol state map, must be a power of 2
+#define STATE_MAP_SIZE 65536
+//The largest part of each response that's used to find its response code
+#define RESPONSE_BUFFER_SIZE 4096
+//The response codes used when the target doesn't respond in time, or closes the connection
+#define NO_RESPONSE_CODE 0xffffffff
+#define CLOSED_CODE      0xfffffffe
+
 /**
  * This function creates a network_server_state_t object based on the given options.
  * @param options - A JSON string of the options to set in the new network_server_state_t. See the
@@ -49,6 +73,12 @@ static network_server_state_t * setup_options(char * options)
 	//Setup defaults
 	state->timeout = 2;
 	state->input_ratio = 2.0;
+	state->response_timeout = 100;
+	state->response_length = 3;
+#if !defined(_WIN32) && !defined(__APPLE__)
+	state->diag_sock = -1;
+	state->desock_fd = -1;
+#endif
 
 	//Parse the options
 	PARSE_OPTION_STRING(state, options, path, "path", network_server_cleanup);
@@ -60,11 +90,20 @@ static network_server_state_t * setup_options(char * options)
 	PARSE_OPTION_INT(state, options, skip_network_check, "skip_network_check", network_server_cleanup);
 	PARSE_OPTION_DOUBLE(state, options, input_ratio, "ratio", network_server_cleanup);
 	PARSE_OPTION_INT_ARRAY(state, options, sleeps, sleeps_count, "sleeps", network_server_cleanup);
+	PARSE_OPTION_INT(state, options, desock, "desock", network_server_cleanup);
+	PARSE_OPTION_INT(state, options, responses, "responses", network_server_cleanup);
+	PARSE_OPTION_INT(state, options, response_timeout, "response_timeout", network_server_cleanup);
+	PARSE_OPTION_STRING(state, options, response_regex, "response_regex", network_server_cleanup);
+	PARSE_OPTION_INT(state, options, response_offset, "response_offset", network_server_cleanup);
+	PARSE_OPTION_INT(state, options, response_length, "response_length", network_server_cleanup);
+	PARSE_OPTION_INT(state, options, binary_multipart, "binary_multipart", network_server_cleanup);
+	PARSE_OPTION_INT(state, options, udp_batch, "udp_batch", network_server_cleanup);
 
 	cmd_length = (state->path ? strlen(state->path) : 0) + (state->arguments ? strlen(state->arguments) : 0) + 2;
 	state->cmd_line = (char *)malloc(cmd_length);
 
-	if (!state->path || !state->cmd_line || !file_exists(state->path) || !state->target_ip || !state->target_port || state->input_ratio <= 0)
+	if (!state->path || !state->cmd_line || !file_exists(state->path) || (!state->target_ip && !state->desock) || !state->target_port || state->input_ratio <= 0
+		|| state->response_timeout < 0 || state->response_offset < 0 || state->response_length < 0)
 	{
 		network_server_cleanup(state);
 		return NULL;
@@ -72,6 +111,23 @@ static network_server_state_t * setup_options(char * options)
 
 	snprintf(state->cmd_line, cmd_length, "%s %s", state->path, state->arguments ? state->arguments : "");
 
+	if (state->response_regex)
+	{
+#ifdef _WIN32
+		ERROR_MSG("The response_regex option is not supported on Windows, use response_offset and response_length");
+		network_server_cleanup(state);
+		return NULL;
+#else
+		if (regcomp(&state->response_pattern, state->response_regex, REG_EXTENDED | REG_NEWLINE))
+		{
+			ERROR_MSG("Failed to compile the response_regex %s", state->response_regex);
+			network_server_cleanup(state);
+			return NULL;
+		}
+		state->response_pattern_compiled = 1;
+#endif
+	}
+
 	return state;
 }
 
@@ -85,12 +141,34 @@ void network_server_cleanup(void * driver_state)
 	network_server_state_t * state = (network_server_state_t *)driver_state;
 	int i;
 
+	if (state->listen_wait_count)
+		INFO_MSG("Waited for the target port to be listening %llu times, %llu us on average, %llu us at most",
+			(unsigned long long)state->listen_wait_count,
+			(unsigned long long)(state->listen_wait_total_us / state->listen_wait_count),
+			(unsigned long long)state->listen_wait_max_us);
+#if !defined(_WIN32) && !defined(__APPLE__)
+	if (state->diag_sock >= 0)
+		close(state->diag_sock);
+	if (state->desock_shm)
+		munmap(state->desock_shm, sizeof(desock_shm_t));
+	if (state->desock_fd >= 0)
+	{
+		close(state->desock_fd);
+		unsetenv(DESOCK_FD_VAR);
+		unsetenv(DESOCK_PORT_VAR);
+	}
+	free(state->udp_msgs);
+	free(state->udp_iovecs);
+#endif
+
 	//Cleanup mutator stuff
 	for(i = 0; state->mutate_buffers && i < state->num_inputs; i++)
 		free(state->mutate_buffers[i]);
 	free(state->mutate_buffers);
 	free(state->mutate_buffer_lengths);
 	free(state->mutate_last_sizes);
+	free(state->packets);
+	free(state->packet_lengths);
 	
 	//Clean up driver specific options
 	free(state->path);
@@ -98,11 +176,58 @@ void network_server_cleanup(void * driver_state)
 	free(state->cmd_line);
 	free(state->target_ip);
 	free(state->sleeps);
+	free(state->response_regex);
+#ifndef _WIN32
+	if (state->response_pattern_compiled)
+		regfree(&state->response_pattern);
+#endif
+	free(state->response_buffer);
+	free(state->state_map);
 
 	//Clean up the struct holding it all
 	free(state);
 }
 
+#if !defined(_WIN32) && !defined(__APPLE__)
+/**
+ * This function creates the shared memory used to give input to the target when the desock option is
+ * set, and tells the fork server library where to find it.  The memfd is inherited by the target process,
+ * and the library replaces the socket the target binds to the target port with the input in the shared memory.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @return - zero on success, non-zero on failure
+ */
+static int setup_desock(network_server_state_t * state)
+{
+	char buffer[16];
+
+	state->desock_fd = syscall(SYS_memfd_create, "killerbeez_desock", 0);
+	if (state->desock_fd < 0)
+	{
+		ERROR_MSG("memfd_create() failed for the desock shared memory");
+		return 1;
+	}
+	if (ftruncate(state->desock_fd, sizeof(desock_shm_t)))
+	{
+		ERROR_MSG("ftruncate() failed on the desock shared memory");
+		return 1;
+	}
+	state->desock_shm = (desock_shm_t *)mmap(NULL, sizeof(desock_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED,
+		state->desock_fd, 0);
+	if (state->desock_shm == MAP_FAILED)
+	{
+		state->desock_shm = NULL;
+		ERROR_MSG("mmap() failed on the desock shared memory");
+		return 1;
+	}
+
+	snprintf(buffer, sizeof(buffer), "%d", state->desock_fd);
+	setenv(DESOCK_FD_VAR, buffer, 1);
+	snprintf(buffer, sizeof(buffer), "%d", state->target_port);
+	setenv(DESOCK_PORT_VAR, buffer, 1);
+	return 0;
+}
+#endif
+
 /**
  * This function allocates and initializes a new driver specific state object based on the given options.
  * @param options - a JSON string that contains the driver specific string of options
@@ -171,6 +296,44 @@ void * network_server_create(char * options, instrumentation_t * instrumentation
 
 	state->instrumentation = instrumentation;
 	state->instrumentation_state = instrumentation_state;
+
+	if (state->responses)
+	{
+		state->response_buffer = (char *)malloc(RESPONSE_BUFFER_SIZE + 1);
+		state->state_map = (uint8_t *)calloc(STATE_MAP_SIZE, 1);
+		if (!state->response_buffer || !state->state_map)
+		{
+			network_server_cleanup(state);
+			return NULL;
+		}
+	}
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+	//The desocketing is done by the fork server library's socket hooks, so the target has to be run with it
+	if (state->desock && (!instrumentation->uses_forkserver_library
+		|| !instrumentation->uses_forkserver_library(instrumentation_state)))
+	{
+		ERROR_MSG("The desock option requires an instrumentation that preloads the fork server library, such as ipt or return_code");
+		network_server_cleanup(state);
+		return NULL;
+	}
+	if (state->desock && setup_desock(state))
+	{
+		network_server_cleanup(state);
+		return NULL;
+	}
+
+	//If sock_diag isn't available, is_port_listening will fall back to reading /proc/net
+	if (!state->skip_network_check && !state->desock)
+		state->diag_sock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+#else
+	if (state->desock)
+	{
+		ERROR_MSG("The desock option is only supported on Linux");
+		network_server_cleanup(state);
+		return NULL;
+	}
+#endif
 	return state;
 }
 
@@ -245,14 +408,201 @@ static int send_udp_input(network_server_state_t * state, int * sock, char * buf
 	return 0;
 }
 
+#if !defined(_WIN32) && !defined(__APPLE__)
+/**
+ * This function sends several UDP packets to the target with as few sendmmsg calls as possible.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @param sock - a UDP socket, created by connect_to_target
+ * @param inputs - an array of the packets to send
+ * @param lengths - an array of the lengths of the buffers in the inputs parameter
+ * @param count - the number of buffers in the inputs parameter
+ * @param base - the index of the first packet in the whole input, used in error messages
+ * @return - 0 on success, non-zero on failure
+ */
+static int send_udp_batch(network_server_state_t * state, int sock, char ** inputs, size_t * lengths,
+	size_t count, size_t base)
+{
+	struct sockaddr_in addr;
+	struct mmsghdr * msgs;
+	struct iovec * iovecs;
+	size_t i, sent = 0;
+	int ret;
+
+	if (count > state->udp_msgs_capacity)
+	{
+		msgs = (struct mmsghdr *)realloc(state->udp_msgs, sizeof(struct mmsghdr) * count);
+		if (!msgs)
+			return 1;
+		state->udp_msgs = msgs;
+		iovecs = (struct iovec *)realloc(state->udp_iovecs, sizeof(struct iovec) * count);
+		if (!iovecs)
+			return 1;
+		state->udp_iovecs = iovecs;
+		state->udp_msgs_capacity = count;
+	}
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr(state->target_ip);
+	addr.sin_port = htons(state->target_port);
+
+	memset(state->udp_msgs, 0, sizeof(struct mmsghdr) * count);
+	for (i = 0; i < count; i++)
+	{
+		state->udp_iovecs[i].iov_base = inputs[i];
+		state->udp_iovecs[i].iov_len = lengths[i];
+		state->udp_msgs[i].msg_hdr.msg_name = &addr;
+		state->udp_msgs[i].msg_hdr.msg_namelen = sizeof(addr);
+		state->udp_msgs[i].msg_hdr.msg_iov = &state->udp_iovecs[i];
+		state->udp_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	//sendmmsg stops at the first packet that fails, or after UIO_MAXIOV packets, so keep going
+	//from wherever it stopped
+	while (sent < count)
+	{
+		ret = sendmmsg(sock, state->udp_msgs + sent, count - sent, 0);
+		if (ret < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			ERROR_MSG("Failed to send UDP packet %lu to the target: %s", (unsigned long)(base + sent), strerror(errno));
+			return 1;
+		}
+		sent += ret;
+	}
+	return 0;
+}
+
 /**
- * This function determines if there is a program listening on the specified port on the local computer
+ * This function sends every UDP packet in an input to the target, batching the packets between each
+ * of the sleeps option's non-zero sleeps into one send.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @param sock - a UDP socket, created by connect_to_target
+ * @param inputs - an array of the packets to send
+ * @param lengths - an array of the lengths of the buffers in the inputs parameter
+ * @param inputs_count - the number of buffers in the inputs parameter
+ * @return - 0 on success, non-zero on failure
+ */
+static int send_udp_batches(network_server_state_t * state, int sock, char ** inputs, size_t * lengths, size_t inputs_count)
+{
+	size_t start, end;
+
+	for (start = 0; start < inputs_count; start = end)
+	{
+		if (state->sleeps && state->sleeps[start] != 0)
+			usleep(1000*state->sleeps[start]);
+		for (end = start + 1; end < inputs_count && !(state->sleeps && state->sleeps[end] != 0); end++)
+			;
+		if (send_udp_batch(state, sock, inputs + start, lengths + start, end - start, start))
+			return 1;
+	}
+	return 0;
+}
+#endif
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+/**
+ * This function asks the kernel, through sock_diag, whether there is a socket bound to the specified
+ * port.  The kernel only dumps sockets in the listening state (for TCP) or the unconnected state (for UDP)
+ * which match the port, so this is cheap no matter how many other sockets the host has open.
+ * @param diag_sock - a NETLINK_SOCK_DIAG socket
+ * @param family - the address family to check, AF_INET or AF_INET6
  * @param port - the port number to check
  * @param udp - whether the specified port is udp (1) or tcp (0)
  * @return - 1 if the port is listening, 0 if the port is not listening, or -1 on error
  */
-static int is_port_listening(int port, int udp)
+static int sock_diag_port_listening(int diag_sock, int family, int port, int udp)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct inet_diag_req_v2 req;
+		struct rtattr bytecode;
+		struct inet_diag_bc_op ops[4];
+	} request;
+	char buffer[8192];
+	struct nlmsghdr * nlh;
+	struct inet_diag_msg * msg;
+	int length, found = 0;
+
+	memset(&request, 0, sizeof(request));
+	request.nlh.nlmsg_len = sizeof(request);
+	request.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+	request.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	request.req.sdiag_family = family;
+	request.req.sdiag_protocol = udp ? IPPROTO_UDP : IPPROTO_TCP;
+	request.req.idiag_states = udp ? (1 << TCP_CLOSE) : (1 << TCP_LISTEN);
+
+	//Filter program for sport >= port && sport <= port.  A jump to the end of the
+	//program accepts the socket, and a jump past the end rejects it.
+	request.bytecode.rta_type = INET_DIAG_REQ_BYTECODE;
+	request.bytecode.rta_len = RTA_LENGTH(sizeof(request.ops));
+	request.ops[0].code = INET_DIAG_BC_S_GE;
+	request.ops[0].yes = 2 * sizeof(struct inet_diag_bc_op);
+	request.ops[0].no = sizeof(request.ops) + 4;
+	request.ops[1].no = port;
+	request.ops[2].code = INET_DIAG_BC_S_LE;
+	request.ops[2].yes = 2 * sizeof(struct inet_diag_bc_op);
+	request.ops[2].no = 2 * sizeof(struct inet_diag_bc_op) + 4;
+	request.ops[3].no = port;
+
+	if (send(diag_sock, &request, sizeof(request), 0) != sizeof(request))
+		return -1;
+
+	while ((length = recv(diag_sock, buffer, sizeof(buffer), 0)) > 0)
+	{
+		for (nlh = (struct nlmsghdr *)buffer; NLMSG_OK(nlh, length); nlh = NLMSG_NEXT(nlh, length))
+		{
+			if (nlh->nlmsg_type == NLMSG_DONE)
+				return found;
+			if (nlh->nlmsg_type == NLMSG_ERROR)
+				return -1;
+			msg = (struct inet_diag_msg *)NLMSG_DATA(nlh);
+			if (ntohs(msg->id.idiag_sport) == port)
+				found = 1;
+		}
+	}
+	return -1;
+}
+
+/**
+ * This function checks one of the /proc/net socket tables for a socket bound to the specified port.
+ * This is the fallback for when sock_diag isn't available.
+ * @param filename - the socket table to check, e.g. /proc/net/tcp
+ * @param port - the port number to check
+ * @param state - the socket state to look for, 0x0A (listening) for TCP or 0x07 (unconnected) for UDP
+ * @return - 1 if the port is listening, 0 if the port is not listening, or -1 if the table couldn't be read
+ */
+static int proc_net_port_listening(const char * filename, int port, int state)
 {
+	char line[250];
+	FILE * socket_table = fopen(filename, "r");
+	int num, port_from_proc, state_from_proc, found = 0;
+
+	if (socket_table == NULL)
+		return -1;
+
+	while (!found && fgets(line, sizeof(line), socket_table))
+	{
+		// read in: #: (ip in hex):(port) (remote ip in hex):(remote port) (state), ignore the rest.
+		// The header line won't match.
+		if (sscanf(line, "%d: %*[A-Fa-f0-9]:%X %*[A-Fa-f0-9]:%*X %X", &num, &port_from_proc, &state_from_proc) == 3
+			&& port == port_from_proc && state == state_from_proc)
+			found = 1;
+	}
+
+	fclose(socket_table);
+	return found;
+}
+#endif
+
+/**
+ * This function determines if there is a program listening on the target port on the local computer
+ * @param state - the network_server_state_t object with the port number and protocol to check
+ * @return - 1 if the port is listening, 0 if the port is not listening, or -1 on error
+ */
+static int is_port_listening(network_server_state_t * state)
+{
+	int port = state->target_port, udp = state->target_udp;
 #ifdef _WIN32
 	MIB_TCPTABLE * tcp_table;
 	MIB_UDPTABLE * udp_table;
@@ -344,34 +694,318 @@ static int is_port_listening(int port, int udp)
 #undef ENTRY_LEN
 
 #else // Linux
-	char line[250];
-	FILE * tcp_info = fopen("/proc/net/tcp","r");
-	int num, port_from_proc;
+	int ret = -1;
+
+	if (state->diag_sock >= 0)
+	{
+		ret = sock_diag_port_listening(state->diag_sock, AF_INET, port, udp);
+		if (ret == 0)
+			ret = sock_diag_port_listening(state->diag_sock, AF_INET6, port, udp);
+		if (ret >= 0)
+			return ret;
+
+		//e.g. the udp_diag module isn't loaded, so stop trying sock_diag
+		WARNING_MSG("sock_diag query failed, falling back to /proc/net to check the target port");
+		close(state->diag_sock);
+		state->diag_sock = -1;
+	}
+
+	ret = proc_net_port_listening(udp ? "/proc/net/udp" : "/proc/net/tcp", port, udp ? 0x07 : 0x0A);
+	if (ret == 0) // IPv6 may be disabled, in which case there's no table to check
+		ret = proc_net_port_listening(udp ? "/proc/net/udp6" : "/proc/net/tcp6", port, udp ? 0x07 : 0x0A) == 1;
+	if (ret < 0)
+		ERROR_MSG("Failed to open %s", udp ? "/proc/net/udp" : "/proc/net/tcp");
+	return ret;
+#endif
+	return 0;
+}
+
+/**
+ * This function returns a monotonic timestamp in microseconds, used to time how long the target takes to listen.
+ * @return - the current time in microseconds
+ */
+static uint64_t get_time_us(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER counter, frequency;
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+	return (uint64_t)(counter.QuadPart * 1000000 / frequency.QuadPart);
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#endif
+}
 
-	if (tcp_info == NULL)
-		FATAL_MSG("Failed to open /proc/net/tcp");
+/**
+ * This function waits for the fuzzed program to start listening on the target port.  The port is
+ * checked quickly at first, and then less often the longer the program takes to start up.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @param result - a pointer used to return FUZZ_ERROR on error, or the FUZZ_ result of the fuzzed
+ * program if it exited or hung before it started listening
+ * @return - 1 once the port is listening, or 0 if it never started listening
+ */
+static int wait_for_port(network_server_state_t * state, int * result)
+{
+	uint64_t start_time, waited;
+	unsigned int delay = 10;
+	int listening, process_done;
 
-	// Would it be faster to directly fscanf here, instead of reading output
-	// into a buffer and then scanf'ing that?
-	while(fgets(line, 250, tcp_info))
+	start_time = get_time_us();
+	while ((listening = is_port_listening(state)) == 0)
 	{
-		// skip header line
-        if(!strncmp(line, "  sl", 4) != 0)
-            continue;
+		process_done = state->instrumentation->is_process_done(state->instrumentation_state);
+		if (process_done == 1) //The program died before it started listening
+		{
+			*result = state->instrumentation->get_fuzz_result(state->instrumentation_state);
+			return 0;
+		}
+		if (process_done < 0 || get_time_us() - start_time > (uint64_t)state->timeout * 1000000)
+		{
+			*result = process_done < 0 ? FUZZ_ERROR : FUZZ_HANG;
+			return 0;
+		}
 
-		// read in: #: (ip in hex):(port), ignore the rest
-		// throw away the (ip in hex) since we don't need it
-		sscanf(line, "%d: %*[A-Fa-f0-9]:%X", &num, &port_from_proc);
+#ifdef _WIN32
+		Sleep(delay / 1000);
+#else
+		usleep(delay);
+#endif
+		if (delay < MAX_LISTEN_POLL_US)
+			delay *= 2;
+	}
+	if (listening < 0)
+	{
+		*result = FUZZ_ERROR;
+		return 0;
+	}
+
+	waited = get_time_us() - start_time;
+	state->listen_wait_count++;
+	state->listen_wait_total_us += waited;
+	if (waited > state->listen_wait_max_us)
+		state->listen_wait_max_us = waited;
+	return 1;
+}
 
-		if (port == port_from_proc)
-			return 1;	
+/**
+ * This function hashes a response code.
+ * @param code - the response code
+ * @param length - the length of the code parameter
+ * @return - the hash of the response code
+ */
+static uint32_t hash_response_code(const char * code, size_t length)
+{
+	uint32_t hash = 2166136261u; //FNV-1a
+	size_t i;
+
+	for (i = 0; i < length; i++)
+		hash = (hash ^ (uint8_t)code[i]) * 16777619u;
+	return hash;
+}
+
+/**
+ * This function records the transition from the previous response code to the given one in the protocol
+ * state map.  Like AFL's edge coverage, the previous code is shifted so that A->B and B->A are different.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @param code_hash - the hash of the response code
+ */
+static void record_response_code(network_server_state_t * state, uint32_t code_hash)
+{
+	uint32_t index;
+
+	//Whether a response arrives before the timeout depends on timing as much as on the input, so a
+	//missing response isn't a protocol state.  The next response is treated as following the last one.
+	if (code_hash == NO_RESPONSE_CODE)
+		return;
+
+	index = (state->last_response_code ^ code_hash) & (STATE_MAP_SIZE - 1);
+	if (!state->state_map[index])
+	{
+		state->state_map[index] = 1;
+		state->new_state = 1;
 	}
+	state->last_response_code = code_hash >> 1;
+}
 
-	fclose(tcp_info);
+/**
+ * This function finds the response code in a response, using either the response_regex option or the
+ * response_offset and response_length options.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @param response - the response, which must have room for a NULL terminator after it
+ * @param length - the length of the response parameter.  Where regexec supports REG_STARTEND, the
+ * response may contain NULL bytes, otherwise the regex only sees the response up to the first one.
+ * @param flags - regexec flags, i.e. REG_NOTBOL when searching the middle of a response
+ * @param code_end - optionally, a pointer used to return the offset just past the response code, or
+ * 0 if the response_regex didn't match
+ * @return - the hash of the response code
+ */
+static uint32_t find_response_code(network_server_state_t * state, char * response, size_t length, int flags,
+	size_t * code_end)
+{
+	size_t offset = 0, code_length = 0;
+#ifndef _WIN32
+	regmatch_t matches[2];
+	int group;
+
+	if (state->response_pattern_compiled)
+	{
+		//Use the first capture group if the regex has one, otherwise the whole match
+		response[length] = 0;
+#ifdef REG_STARTEND
+		matches[0].rm_so = 0;
+		matches[0].rm_eo = length;
+		flags |= REG_STARTEND;
 #endif
-	return 0;
+		if (!regexec(&state->response_pattern, response, 2, matches, flags))
+		{
+			group = matches[1].rm_so >= 0 ? 1 : 0;
+			offset = matches[group].rm_so;
+			code_length = matches[group].rm_eo - matches[group].rm_so;
+			if (code_end)
+				*code_end = matches[0].rm_eo > matches[0].rm_so ? matches[0].rm_eo : matches[0].rm_so + 1;
+		}
+		else if (code_end)
+			*code_end = 0;
+	}
+	else
+#endif
+	if (length > (size_t)state->response_offset)
+	{
+		offset = state->response_offset;
+		code_length = length - offset < (size_t)state->response_length ? length - offset : state->response_length;
+	}
+	return hash_response_code(response + offset, code_length);
 }
 
+/**
+ * This function waits for the target to respond, and records the response code of its response.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @param sock - the socket to read the response from
+ * @param timeout_ms - the maximum number of milliseconds to wait for the response.  If zero, the
+ * response is only read if it has already arrived, and no response isn't recorded.
+ * @return - 1 if a response was read, 0 if not, or -2 if the target closed the connection
+ */
+#ifdef _WIN32
+static int read_response(network_server_state_t * state, SOCKET sock, int timeout_ms)
+#else
+static int read_response(network_server_state_t * state, int sock, int timeout_ms)
+#endif
+{
+	char discard[RESPONSE_BUFFER_SIZE];
+	int length, ret;
+
+	if (wait_socket_readable(sock, timeout_ms) <= 0)
+	{
+		if (timeout_ms > 0)
+			record_response_code(state, NO_RESPONSE_CODE);
+		return 0;
+	}
+
+	length = recv(sock, state->response_buffer, RESPONSE_BUFFER_SIZE, 0);
+	if (length <= 0)
+	{
+		record_response_code(state, CLOSED_CODE);
+		return -2;
+	}
+	record_response_code(state, find_response_code(state, state->response_buffer, length, 0, NULL));
+
+	//Throw away the rest of this response, so it isn't mistaken for the next one
+	do
+		ret = wait_socket_readable(sock, 0) > 0 ? recv(sock, discard, sizeof(discard), 0) : 0;
+	while (ret > 0);
+	return 1;
+}
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+/**
+ * This function records the response codes in everything the target sent while being fuzzed with the
+ * desock option.  With response_regex, each match is a response code, otherwise there's a single response
+ * code at response_offset.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ */
+static void read_desock_responses(network_server_state_t * state)
+{
+	desock_shm_t * shm = state->desock_shm;
+	size_t length, position = 0, code_end;
+	char * output;
+
+	length = shm->output_length < DESOCK_OUTPUT_SIZE ? shm->output_length : DESOCK_OUTPUT_SIZE;
+	if (!length)
+	{
+		record_response_code(state, NO_RESPONSE_CODE);
+		return;
+	}
+
+	output = (char *)malloc(length + 1);
+	if (!output)
+		return;
+	memcpy(output, shm->output, length);
+
+	if (!state->response_pattern_compiled)
+		record_response_code(state, find_response_code(state, output, length, 0, NULL));
+	while (state->response_pattern_compiled && position < length)
+	{
+		uint32_t code = find_response_code(state, output + position, length - position,
+			position ? REG_NOTBOL : 0, &code_end);
+		if (!code_end)
+			break;
+		record_response_code(state, code);
+		position += code_end;
+	}
+	free(output);
+}
+#endif
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+/**
+ * This function will run the fuzzed program and give it the given inputs through the desock shared
+ * memory, rather than the network.  This function blocks until the program has finished processing the input.
+ * @param state - the network_server_state_t object that represents the current state of the driver
+ * @param inputs - an array of inputs to give to the program, each of which is read as a separate packet
+ * @param lengths - an array of lengths for the buffers in the inputs parameter
+ * @param inputs_count - the number of buffers in the inputs parameter
+ * @return - FUZZ_ result on success or FUZZ_ERROR on failure
+ */
+static int network_server_run_desock(network_server_state_t * state, char ** inputs, size_t * lengths, size_t inputs_count)
+{
+	desock_shm_t * shm = state->desock_shm;
+	size_t i, offset = 0;
+	int result;
+
+	if (inputs_count > DESOCK_MAX_PACKETS)
+	{
+		ERROR_MSG("The desock option supports at most %d packets, but the input has %lu",
+			DESOCK_MAX_PACKETS, (unsigned long)inputs_count);
+		return FUZZ_ERROR;
+	}
+	for (i = 0; i < inputs_count; i++)
+	{
+		if (lengths[i] > DESOCK_INPUT_SIZE - offset)
+		{
+			ERROR_MSG("The input is too large for the desock shared memory (%d bytes)", DESOCK_INPUT_SIZE);
+			return FUZZ_ERROR;
+		}
+		memcpy(shm->input + offset, inputs[i], lengths[i]);
+		shm->packet_lengths[i] = (uint32_t)lengths[i];
+		offset += lengths[i];
+	}
+	shm->num_packets = (uint32_t)inputs_count;
+	shm->output_length = 0;
+
+	if (state->instrumentation->enable(state->instrumentation_state, &state->process, state->cmd_line, NULL, 0))
+		return FUZZ_ERROR;
+
+	result = generic_wait_for_process_completion(state->process, state->timeout,
+		state->instrumentation, state->instrumentation_state);
+	DEBUG_MSG("The target sent %u bytes in response", shm->output_length);
+	if (state->responses)
+		read_desock_responses(state);
+	return result;
+}
+#endif
+
 /**
  * This function will run the fuzzed program and test it with the given inputs. This function
  * blocks until the program has finished processing the input.
@@ -390,30 +1024,48 @@ static int network_server_run(network_server_state_t * state, char ** inputs, si
 	int sock;
 #endif
 	size_t i;
-	int listening = 0;
+	int result, timeout_ms;
+
+	state->new_state = 0;
+	state->last_response_code = 0;
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+	if (state->desock)
+		return network_server_run_desock(state, inputs, lengths, inputs_count);
+#endif
 
 	//Start the process and give it our input
 	if(state->instrumentation->enable(state->instrumentation_state, &state->process, state->cmd_line, NULL, 0))
 		return FUZZ_ERROR;
 
 	//Wait for the port to be listening
-	while (!state->skip_network_check && listening == 0) {
-		listening = is_port_listening(state->target_port, state->target_udp);
-		if(listening == 0)
-#ifdef _WIN32
-			Sleep(5);
-#else
-			usleep(5*1000);
-#endif
-	}
-	if(listening < 0)
-		return FUZZ_ERROR;
+	if (!state->skip_network_check && !wait_for_port(state, &result))
+		return result;
 
 	if (connect_to_target(state, &sock)) // opens socket
 		return FUZZ_ERROR;
+#if !defined(_WIN32) && !defined(__APPLE__)
+	if (state->target_udp && state->udp_batch && !state->responses)
+	{
+		result = send_udp_batches(state, sock, inputs, lengths, inputs_count);
+		close(sock);
+		if (result)
+			return FUZZ_ERROR;
+		return generic_wait_for_process_completion(state->process, state->timeout,
+			state->instrumentation, state->instrumentation_state);
+	}
+#endif
 	for (i = 0; i < inputs_count; i++)
 	{
-		if (state->sleeps && state->sleeps[i] != 0)
+		if (state->responses)
+		{
+			//Wait for the response to the previous packet, rather than sleeping.  Before the first
+			//packet, only pick up a banner if the server has already sent one.
+			timeout_ms = state->sleeps ? state->sleeps[i] : (i ? state->response_timeout : 0);
+			if (read_response(state, sock, timeout_ms) == -2)
+				break; //The target closed the connection, there's no point in sending more
+		}
+		else if (state->sleeps && state->sleeps[i] != 0)
 #ifdef _WIN32
 			Sleep(state->sleeps[i]);
 #else
@@ -430,6 +1082,8 @@ static int network_server_run(network_server_state_t * state, char ** inputs, si
 			return FUZZ_ERROR;
 		}
 	}
+	if (state->responses && i == inputs_count)
+		read_response(state, sock, state->response_timeout);
 #ifdef _WIN32
 	closesocket(sock);
 #else
@@ -465,6 +1119,17 @@ int network_server_test_input(void * driver_state, char * input, size_t length)
 	size_t inputs_count;
 	int network_server_run_result = FUZZ_ERROR;
 
+	//Binary multipart inputs are sent straight from the input buffer
+	if (is_multipart(input, length))
+	{
+		if (multipart_get_packets(input, length, &state->packets, &state->packet_lengths,
+				&state->packets_capacity, &inputs_count))
+			return FUZZ_ERROR;
+		if (!inputs_count)
+			return FUZZ_ERROR;
+		return network_server_run(state, state->packets, state->packet_lengths, inputs_count);
+	}
+
 	if (decode_mem_array(input, &inputs, &input_lengths, &inputs_count))
 		return FUZZ_ERROR;
 	if (inputs_count)
@@ -514,6 +1179,122 @@ int network_server_test_next_input(void * driver_state)
 	return network_server_run_result;
 }
 
+/**
+ * This function tests each of the given inputs in turn, and returns the FUZZ_ result of each one.
+ * @param driver_state - a driver specific structure previously created by the network_server_create function
+ * @param inputs - an array of the inputs to test
+ * @param lengths - an array of lengths for the buffers in the inputs parameter
+ * @param num_inputs - the number of buffers in the inputs parameter
+ * @param results - an array of num_inputs integers used to return the FUZZ_ result of each input
+ * @param callback - optionally, a function to call after each input is tested
+ * @param callback_arg - an argument to pass to the callback
+ * @return - the number of inputs that were tested, or -1 on error
+ */
+int network_server_test_inputs_batch(void * driver_state, char ** inputs, size_t * lengths, size_t num_inputs,
+	int * results, driver_batch_callback_t callback, void * callback_arg)
+{
+	return generic_test_inputs_batch(driver_state, inputs, lengths, num_inputs, results,
+		callback, callback_arg, network_server_test_input);
+}
+
+/**
+ * This function determines whether the last input reached a new protocol state, i.e. the target's responses
+ * had a transition between response codes that hasn't been seen before.
+ * @param driver_state - a driver specific structure previously created by the network_server_create function
+ * @return - 1 if the last input reached a new protocol state, 0 if it didn't or the responses option isn't set
+ */
+int network_server_is_new_state(void * driver_state)
+{
+	network_server_state_t * state = (network_server_state_t *)driver_state;
+	return state->responses && state->new_state;
+}
+
+/**
+ * This function returns the protocol state transitions that have been seen so far, so they can be loaded
+ * again with network_server_set_state when fuzzing is resumed.
+ * @param driver_state - a driver specific structure previously created by the network_server_create function
+ * @return - a JSON string holding the driver state, or NULL on failure or if the responses option isn't set.
+ * It should be freed with network_server_free_state.
+ */
+char * network_server_get_state(void * driver_state)
+{
+	network_server_state_t * state = (network_server_state_t *)driver_state;
+	json_t *state_obj, *temp;
+	char * ret;
+
+	if (!state->state_map)
+		return NULL;
+
+	state_obj = json_object();
+	if (!state_obj)
+		return NULL;
+	ADD_MEM(temp, (const char *)state->state_map, STATE_MAP_SIZE, state_obj, "state_map");
+	ret = json_dumps(state_obj, 0);
+	json_decref(state_obj);
+	return ret;
+}
+
+/**
+ * This function frees a driver state previously obtained via network_server_get_state.
+ * @param state - the driver state to free
+ */
+void network_server_free_state(char * state)
+{
+	free(state);
+}
+
+/**
+ * This function loads the protocol state map from a state previously returned by network_server_get_state.
+ * @param state - the network_server_state_t object to load the state map into
+ * @param saved_state - the driver state to load
+ * @param merge - whether to add the saved transitions to the ones already seen, rather than replace them
+ * @return - 0 on success, non-zero on failure
+ */
+static int load_state_map(network_server_state_t * state, char * saved_state, int merge)
+{
+	char * saved_map;
+	size_t i;
+	int result;
+
+	if (!state->state_map || !saved_state)
+		return 1;
+
+	GET_MEM(saved_map, saved_state, saved_map, "state_map", result);
+	if (merge)
+	{
+		for (i = 0; i < STATE_MAP_SIZE; i++)
+			state->state_map[i] |= saved_map[i];
+	}
+	else
+		memcpy(state->state_map, saved_map, STATE_MAP_SIZE);
+	free(saved_map);
+	return 0;
+}
+
+/**
+ * This function replaces the protocol state transitions that have been seen with a state previously returned
+ * by network_server_get_state.
+ * @param driver_state - a driver specific structure previously created by the network_server_create function
+ * @param state - the driver state to load
+ * @return - 0 on success, non-zero on failure
+ */
+int network_server_set_state(void * driver_state, char * state)
+{
+	return load_state_map((network_server_state_t *)driver_state, state, 0);
+}
+
+/**
+ * This function adds the protocol state transitions in a state previously returned by network_server_get_state,
+ * e.g. by another fuzzer, to the ones that have been seen.
+ * @param driver_state - a driver specific structure previously created by the network_server_create function
+ * @param state - the driver state to merge
+ * @return - 0 on success, non-zero on failure
+ */
+int network_server_merge_state(void * driver_state, char * state)
+{
+	return load_state_map((network_server_state_t *)driver_state, state, 1);
+}
+
 /**
  * When this driver is using a mutator given to it during driver creation, this function retrieves
  * the last input that was tested with the network_server_test_next_input function.
@@ -541,6 +1322,8 @@ char * network_server_get_last_input(void * driver_state, int * length)
 		if (state->mutate_last_sizes[i] == 0)
 			return NULL;
 	}
+	if (state->binary_multipart)
+		return encode_multipart(state->mutate_buffers, state->mutate_last_sizes, state->num_inputs, length);
 	return encode_mem_array(state->mutate_buffers, state->mutate_last_sizes, state->num_inputs, length);
 }
 
@@ -555,15 +1338,36 @@ int network_server_help(char ** help_str)
 	*help_str = strdup(
 "network_server - Fuzzes server-like applications by sending input over the network\n"
 "Required Options:\n"
-"  ip                    The target IP to connect to\n"
+"  ip                    The target IP to connect to (not needed with desock)\n"
 "  path                  The path to the target process\n"
 "  port                  The target port to connect to\n"
 "Optional Options:\n"
 "  arguments             Arguments to pass to the target process\n"
+"  binary_multipart      Whether to save inputs in the binary multipart format,\n"
+"                          which is smaller than the default mem array format.\n"
+"                          Inputs in either format can be tested\n"
+"  desock                Whether to give the input to the target through the fork\n"
+"                          server library's socket hooks instead of the network.\n"
+"                          Requires an instrumentation that uses the fork server\n"
+"                          library, such as return_code or ipt (Linux only)\n"
 "  timeout               The maximum number of seconds to wait for the target\n"
 "                          process to finish\n"
 "  ratio                 The ratio of mutation buffer size to input size when\n"
 "                          given a mutator\n"
+"  responses             Whether to read the target's response to each input\n"
+"                          and report inputs whose response codes reach new\n"
+"                          protocol states as new paths\n"
+"  response_timeout      The maximum number of milliseconds to wait for each\n"
+"                          response (default 100).  If sleeps is set, it is\n"
+"                          used instead, but the wait ends when a reply arrives\n"
+"  response_regex        A POSIX extended regex that finds the response code\n"
+"                          in each response, the first capture group is used if\n"
+"                          there is one, and ^ and $ match at line boundaries\n"
+"                          (not supported on Windows)\n"
+"  response_offset       The offset of the response code in each response, if\n"
+"                          response_regex isn't set (default 0)\n"
+"  response_length       The length of the response code in each response, if\n"
+"                          response_regex isn't set (default 3)\n"
 "  skip_network_check    Whether or not to wait for the specified port to be\n"
 "                          listening on the localhost prior to connecting to\n"
 "                          the target program\n"
@@ -571,6 +1375,10 @@ int network_server_help(char ** help_str)
 "                          being sent to the target program\n"
 "  udp                   Whether the fuzzed input should be sent to the target\n"
 "                          program on UDP (1) or TCP (0)\n"
+"  udp_batch             Whether to send each run of UDP packets between\n"
+"                          non-zero sleeps with a single system call, rather\n"
+"                          than one per packet.  Ignored with responses\n"
+"                          (Linux only)\n"
 "\n"
 	);
 	if (*help_str == NULL)
@@ -3,8 +3,14 @@
 #include <instrumentation.h>
 #include <global_types.h>
 
+#include <stdint.h>
+
 #ifndef _WIN32 // Linux
 #include <sys/types.h> // pid_t
+#include <regex.h>
+#endif
+#if !defined(_WIN32) && !defined(__APPLE__)
+#include <forkserver_desock.h>
 #endif
 
 void * network_server_create(char * options, instrumentation_t * instrumentation, void * instrumentation_state,
@@ -13,6 +19,13 @@ void network_server_cleanup(void * driver_state);
 int network_server_test_input(void * driver_state, char * buffer, size_t length);
 int network_server_test_next_input(void * driver_state);
 char * network_server_get_last_input(void * driver_state, int * length);
+int network_server_test_inputs_batch(void * driver_state, char ** inputs, size_t * lengths, size_t num_inputs,
+	int * results, driver_batch_callback_t callback, void * callback_arg);
+int network_server_is_new_state(void * driver_state);
+char * network_server_get_state(void * driver_state);
+void network_server_free_state(char * state);
+int network_server_set_state(void * driver_state, char * state);
+int network_server_merge_state(void * driver_state, char * state);
 int network_server_help(char ** help_str);
 
 struct network_server_state
@@ -28,6 +41,15 @@ struct network_server_state
 	double input_ratio;     //the ratio of the maximum input size
 	int * sleeps;           //How many milliseconds to sleep between inputs
 	int sleeps_count;       //The number of items in the sleeps array
+	int desock;             //Whether to give the input to the target through the fork server library's
+	                        //socket hooks, rather than over the network
+	int responses;          //Whether to read the target's responses and track the protocol states they reach
+	int response_timeout;   //How many milliseconds to wait for each response
+	char * response_regex;  //A regex that extracts the response code from each response
+	int response_offset;    //The offset of the response code in each response, if response_regex isn't set
+	int response_length;    //The length of the response code in each response, if response_regex isn't set
+	int binary_multipart;   //Whether to return the last input in the binary multipart format, rather than a mem array
+	int udp_batch;          //Whether to send the UDP packets between each sleep with a single sendmmsg call
 
 	//The handle to the fuzzed process instance
 	#ifdef _WIN32
@@ -39,6 +61,30 @@ struct network_server_state
 	//command line of the fuzzed process
 	char * cmd_line;
 
+#if !defined(_WIN32) && !defined(__APPLE__)
+	int diag_sock;          //A NETLINK_SOCK_DIAG socket used to check for the target port, or -1
+	int desock_fd;          //The memfd holding the desock shared memory, or -1
+	desock_shm_t * desock_shm; //The desock shared memory, which holds the input packets and the target's output
+	struct mmsghdr * udp_msgs; //The messages passed to sendmmsg by the udp_batch option, reused across runs
+	struct iovec * udp_iovecs; //The buffers for each message in udp_msgs
+	size_t udp_msgs_capacity;  //The number of entries in udp_msgs and udp_iovecs
+#endif
+
+	//Protocol state feedback, used when the responses option is set
+#ifndef _WIN32
+	regex_t response_pattern;      //The compiled response_regex
+#endif
+	int response_pattern_compiled; //Whether response_pattern needs to be freed
+	char * response_buffer;        //A buffer used to read each response
+	uint8_t * state_map;           //The transitions between response codes that have been seen so far
+	uint32_t last_response_code;   //The hash of the previous response code in the current run
+	int new_state;                 //Whether the last input reached a new transition
+
+	//Statistics on how long the target takes to start listening
+	uint64_t listen_wait_count;    //The number of runs that waited for the target port
+	uint64_t listen_wait_total_us; //The total number of microseconds spent waiting
+	uint64_t listen_wait_max_us;   //The longest wait, in microseconds
+
 	//The instrumentation module
 	instrumentation_t * instrumentation;
 
@@ -55,5 +101,10 @@ struct network_server_state
 	char ** mutate_buffers;
 	size_t * mutate_buffer_lengths;
 	size_t * mutate_last_sizes;
+
+	//Reused by test_input to point at each packet of a binary multipart input
+	char ** packets;
+	size_t * packet_lengths;
+	size_t packets_capacity;
 };
 typedef struct network_server_state network_server_state_t;
@@ -45,6 +45,7 @@ static stdin_state_t * setup_options(char * options)
 	PARSE_OPTION_STRING(state, options, arguments, "arguments", stdin_cleanup);
 	PARSE_OPTION_INT(state, options, timeout, "timeout", stdin_cleanup);
 	PARSE_OPTION_DOUBLE(state, options, input_ratio, "ratio", stdin_cleanup);
+	PARSE_OPTION_INT(state, options, pipeline, "pipeline", stdin_cleanup);
 
 	cmd_length = (state->path ? strlen(state->path) : 0) + (state->arguments ? strlen(state->arguments) : 0) + 2;
 	state->cmd_line = (char *)malloc(cmd_length);
@@ -88,7 +89,8 @@ void * stdin_create(char * options, instrumentation_t * instrumentation, void *
 	{
 		mutator->get_input_info(mutator_state, &num_inputs, &input_sizes);
 		if (num_inputs != 1
-			|| setup_mutate_buffer(state->input_ratio, input_sizes[0], &state->mutate_buffer, &state->mutate_buffer_length))
+			|| (!state->pipeline && setup_mutate_buffer(state->input_ratio, input_sizes[0], &state->mutate_buffer, &state->mutate_buffer_length))
+			|| (state->pipeline && setup_mutate_pipeline(state->input_ratio, input_sizes[0], &state->mutate_pipeline)))
 		{
 			free(input_sizes);
 			stdin_cleanup(state);
@@ -115,6 +117,7 @@ void stdin_cleanup(void * driver_state)
 	stdin_state_t * state = (stdin_state_t *)driver_state;
 
 	free(state->mutate_buffer);
+	cleanup_mutate_pipeline(&state->mutate_pipeline);
 	free(state->path);
 	free(state->arguments);
 	free(state->cmd_line);
@@ -122,26 +125,50 @@ void stdin_cleanup(void * driver_state)
 }
 
 /**
- * This function will run the fuzzed program and test it with the given input. This function
- * blocks until the program has finished processing the input.
+ * This function starts the fuzzed program with the given input on its stdin, without waiting
+ * for the program to finish.
  * @param driver_state - a driver specific structure previously created by the stdin_create function
  * @param input - the input that should be tested
  * @param length - the length of the input parameter
- * @return - FUZZ_ on success or FUZZ_ERROR on failure
+ * @return - 0 on success or non-zero on failure
  */
-int stdin_test_input(void * driver_state, char * input, size_t length)
+static int stdin_start_input(void * driver_state, char * input, size_t length)
 {
 	stdin_state_t * state = (stdin_state_t *)driver_state;
 
 	//Start the process and give it our input
-	if(state->instrumentation->enable(state->instrumentation_state, &state->process, state->cmd_line, input, length))
-		return FUZZ_ERROR;
+	return state->instrumentation->enable(state->instrumentation_state, &state->process, state->cmd_line, input, length);
+}
+
+/**
+ * This function waits for the fuzzed program started by stdin_start_input to finish processing its input.
+ * @param driver_state - a driver specific structure previously created by the stdin_create function
+ * @return - FUZZ_ result on success or FUZZ_ERROR on failure
+ */
+static int stdin_finish_input(void * driver_state)
+{
+	stdin_state_t * state = (stdin_state_t *)driver_state;
 
 	//Wait for it to be done
 	return generic_wait_for_process_completion(state->process, state->timeout,
 		state->instrumentation, state->instrumentation_state);
 }
 
+/**
+ * This function will run the fuzzed program and test it with the given input. This function
+ * blocks until the program has finished processing the input.
+ * @param driver_state - a driver specific structure previously created by the stdin_create function
+ * @param input - the input that should be tested
+ * @param length - the length of the input parameter
+ * @return - FUZZ_ on success or FUZZ_ERROR on failure
+ */
+int stdin_test_input(void * driver_state, char * input, size_t length)
+{
+	if (stdin_start_input(driver_state, input, length))
+		return FUZZ_ERROR;
+	return stdin_finish_input(driver_state);
+}
+
 /**
  * This function will run the fuzzed program with the output of the mutator given during driver
  * creation.  This function blocks until the program has finished processing the input.
@@ -151,10 +178,31 @@ int stdin_test_input(void * driver_state, char * input, size_t length)
 int stdin_test_next_input(void * driver_state)
 {
 	stdin_state_t * state = (stdin_state_t *)driver_state;
+	if (state->pipeline)
+		return generic_test_next_input_pipelined(state, state->mutator, state->mutator_state, &state->mutate_pipeline,
+			stdin_start_input, stdin_finish_input);
 	return generic_test_next_input(state, state->mutator, state->mutator_state, state->mutate_buffer,
 		state->mutate_buffer_length, stdin_test_input, &state->mutate_last_size);
 }
 
+/**
+ * This function tests each of the given inputs in turn, and returns the FUZZ_ result of each one.
+ * @param driver_state - a driver specific structure previously created by the stdin_create function
+ * @param inputs - an array of the inputs to test
+ * @param lengths - an array of lengths for the buffers in the inputs parameter
+ * @param num_inputs - the number of buffers in the inputs parameter
+ * @param results - an array of num_inputs integers used to return the FUZZ_ result of each input
+ * @param callback - optionally, a function to call after each input is tested
+ * @param callback_arg - an argument to pass to the callback
+ * @return - the number of inputs that were tested, or -1 on error
+ */
+int stdin_test_inputs_batch(void * driver_state, char ** inputs, size_t * lengths, size_t num_inputs,
+	int * results, driver_batch_callback_t callback, void * callback_arg)
+{
+	return generic_test_inputs_batch(driver_state, inputs, lengths, num_inputs, results,
+		callback, callback_arg, stdin_test_input);
+}
+
 /**
  * When this driver is using a mutator given to it during driver creation, this function retrieves
  * the last input that was tested with the stdin_test_next_input function.
@@ -167,12 +215,33 @@ int stdin_test_next_input(void * driver_state)
 char * stdin_get_last_input(void * driver_state, int * length)
 {
 	stdin_state_t * state = (stdin_state_t *)driver_state;
+	mutate_pipeline_t * pipeline = &state->mutate_pipeline;
+
+	if (state->mutator && state->pipeline)
+	{
+		if (pipeline->sizes[pipeline->current] <= 0)
+			return NULL;
+		*length = pipeline->sizes[pipeline->current];
+		return memdup(pipeline->buffers[pipeline->current], pipeline->sizes[pipeline->current]);
+	}
 	if (!state->mutator || state->mutate_last_size <= 0)
 		return NULL;
 	*length = state->mutate_last_size;
 	return memdup(state->mutate_buffer, state->mutate_last_size);
 }
 
+/**
+ * This function tells the driver how many more inputs will be tested with stdin_test_next_input, so it
+ * doesn't generate an input ahead of time that will never be tested.
+ * @param driver_state - a driver specific structure previously created by the stdin_create function
+ * @param num_iterations - the number of times stdin_test_next_input will still be called
+ */
+void stdin_set_iteration_limit(void * driver_state, int num_iterations)
+{
+	stdin_state_t * state = (stdin_state_t *)driver_state;
+	state->mutate_pipeline.iterations_left = num_iterations;
+}
+
 /**
  * This function returns help text for this driver.  This help text will describe the driver and any options
  * that can be passed to stdin_create.
@@ -187,6 +256,9 @@ int stdin_help(char ** help_str)
 "  path                  The path to the target process\n"
 "Optional Options:\n"
 "  arguments             Arguments to pass to the target process\n"
+"  pipeline              Whether to generate the next mutated input while the\n"
+"                          target is processing the current one; 1=yes, 0=no\n"
+"                          (default=0)\n"
 "  ratio                 The ratio of mutation buffer size to input size when\n""                          given a mutator\n"
 "  timeout               The maximum number of seconds to wait for the target\n"
 "                          process to finish\n"
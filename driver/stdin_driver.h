@@ -9,6 +9,9 @@ void stdin_cleanup(void * driver_state);
 int stdin_test_input(void * driver_state, char * buffer, size_t length);
 int stdin_test_next_input(void * driver_state);
 char * stdin_get_last_input(void * driver_state, int * length);
+void stdin_set_iteration_limit(void * driver_state, int num_iterations);
+int stdin_test_inputs_batch(void * driver_state, char ** inputs, size_t * lengths, size_t num_inputs,
+	int * results, driver_batch_callback_t callback, void * callback_arg);
 int stdin_help(char ** help_str);
 
 struct stdin_state
@@ -18,6 +21,7 @@ struct stdin_state
 	char * arguments;    //Arguments to give the binary
 	int timeout;         //Maximum number of seconds to allow the executable to run
 	double input_ratio;  //the ratio of the maximum input size
+	int pipeline;        //Whether to generate the next input while the target is running
 
 	//The handle to the fuzzed process instance
 	#ifdef _WIN32
@@ -40,5 +44,6 @@ struct stdin_state
 	char * mutate_buffer;
 	size_t mutate_buffer_length;
 	int mutate_last_size;
+	mutate_pipeline_t mutate_pipeline; //Used instead of mutate_buffer when the pipeline option is set
 };
 typedef struct stdin_state stdin_state_t;
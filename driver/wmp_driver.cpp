@@ -199,6 +199,24 @@ int wmp_test_next_input(void * driver_state)
 		state->mutate_buffer_length, wmp_test_input, &state->mutate_last_size);
 }
 
+/**
+ * This function tests each of the given inputs in turn, and returns the FUZZ_ result of each one.
+ * @param driver_state - a driver specific structure previously created by the wmp_create function
+ * @param inputs - an array of the inputs to test
+ * @param lengths - an array of lengths for the buffers in the inputs parameter
+ * @param num_inputs - the number of buffers in the inputs parameter
+ * @param results - an array of num_inputs integers used to return the FUZZ_ result of each input
+ * @param callback - optionally, a function to call after each input is tested
+ * @param callback_arg - an argument to pass to the callback
+ * @return - the number of inputs that were tested, or -1 on error
+ */
+int wmp_test_inputs_batch(void * driver_state, char ** inputs, size_t * lengths, size_t num_inputs,
+	int * results, driver_batch_callback_t callback, void * callback_arg)
+{
+	return generic_test_inputs_batch(driver_state, inputs, lengths, num_inputs, results,
+		callback, callback_arg, wmp_test_input);
+}
+
 /**
  * When this driver is using a mutator given to it during driver creation, this function retrieves
  * the last input that was tested with the wmp_test_next_input function.
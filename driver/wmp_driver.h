@@ -15,6 +15,8 @@ FUNC_PREFIX void wmp_cleanup(void * driver_state);
 FUNC_PREFIX int wmp_test_input(void * driver_state, char * buffer, size_t length);
 FUNC_PREFIX int wmp_test_next_input(void * driver_state);
 FUNC_PREFIX char * wmp_get_last_input(void * driver_state, int * length);
+FUNC_PREFIX int wmp_test_inputs_batch(void * driver_state, char ** inputs, size_t * lengths, size_t num_inputs,
+	int * results, driver_batch_callback_t callback, void * callback_arg);
 FUNC_PREFIX int wmp_help(char ** help_str);
 
 struct wmp_state
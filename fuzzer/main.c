@@ -1,9 +1,11 @@
 #include <global_types.h>
 #include <driver.h>
 #include <driver_factory.h>
+#include <multipart.h>
 #include <mutator_factory.h>
 #include <instrumentation.h>
 #include <instrumentation_factory.h>
+#include <binary_state.h>
 #include <utils.h>
 
 
@@ -40,11 +42,22 @@ void usage(char * program_name, char * mutator_directory)
 "\n"
 "Options:\n"
 "  -d driver_options                 Set the options for the driver\n"
+"  -dsd driver_state_file            Set the file that the driver state, such\n"
+"                                      as the protocol states seen by\n"
+"                                      network_server, should dump to\n"
+"  -dsf driver_state_file            Set the file that the driver state should\n"
+"                                      load from.  May be given more than once\n"
+"                                      to merge several driver states\n"
 "  -i instrumentation_options        Set the options for the instrumentation\n"
+"  -isb                              Dump the instrumentation state in the\n"
+"                                      compact binary format, rather than JSON\n"
 "  -isd instrumentation_state_file   Set the file containing that the\n"
 "                                      instrumentation state should dump to\n"
+"  -isdelta                          Dump only the coverage found since the\n"
+"                                      -isf state, as a binary delta state\n"
 "  -isf instrumentation_state_file   Set the file containing that the\n"
 "                                      instrumentation state should load from\n"
+"                                      (JSON, the binary format, or a delta)\n"
 "  -l logging_options                Set the options for logging\n"
 "  -n num_iterations                 Limit the number of iterations to run\n"
 "                                      (optional, infinite by default)\n"
@@ -103,11 +116,17 @@ int main(int argc, char ** argv)
 		*mutator_name, *mutator_options = NULL, *mutator_saved_state = NULL, *mutation_state_dump_file = NULL, *mutation_state_load_file = NULL,
 		*mutate_buffer = NULL, *mutator_directory = NULL, *mutator_directory_cli = NULL,
 		*logging_options = NULL,
-		*seed_file = NULL, *seed_buffer = NULL,
+		*seed_file = NULL, *seed_buffer = NULL, *converted_seed = NULL,
 		*instrumentation_name = NULL, *instrumentation_options = NULL, 
 		*instrumentation_state_string = NULL, *instrumentation_state_load_file = NULL,
-		*instrumentation_state_dump_file = NULL;
+		*instrumentation_state_dump_file = NULL,
+		*driver_state_string = NULL, *driver_state_dump_file = NULL;
+	char ** driver_state_load_files;
+	int num_driver_state_load_files = 0;
 	int seed_length = 0, mutate_length = 0, instrumentation_length = 0, mutator_state_length;
+	size_t instrumentation_state_length;
+	uint64_t baseline_digest = 0;
+	void * baseline_state = NULL;
 	time_t fuzz_begin_time;
 	int iteration = 0, fuzz_result = FUZZ_NONE, new_path = 0;
 	char filename[MAX_PATH];
@@ -116,6 +135,8 @@ int main(int argc, char ** argv)
 
 	//Default options
 	int num_iterations = NUM_ITERATIONS_INFINITE; //default to infinite
+	int binary_instrumentation_state = 0;
+	int delta_instrumentation_state = 0;
 	char * output_directory = "output";
 
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -201,12 +222,21 @@ int main(int argc, char ** argv)
 	instrumentation_name = argv[2];
 	mutator_name = argv[3];
 
+	driver_state_load_files = (char **)malloc(sizeof(char *) * argc);
+	if (!driver_state_load_files)
+		FATAL_MSG("malloc() failed");
+
 	//Now parse the rest of the args now that we have a valid mutator dir setup
 	for (int i = 4; i < argc; i++)
 	{
 		IF_ARG_OPTION("-d", driver_options)
+		ELSE_IF_ARG_OPTION("-dsd", driver_state_dump_file)
+		else if (!strcmp(argv[i], "-dsf") && i + 1 < argc)
+			driver_state_load_files[num_driver_state_load_files++] = argv[++i];
 		ELSE_IF_ARG_OPTION("-i", instrumentation_options)
+		ELSE_IF_ARG_SET_TRUE("-isb", binary_instrumentation_state)
 		ELSE_IF_ARG_OPTION("-isd", instrumentation_state_dump_file)
+		ELSE_IF_ARG_SET_TRUE("-isdelta", delta_instrumentation_state)
 		ELSE_IF_ARG_OPTION("-isf", instrumentation_state_load_file)
 		ELSE_IF_ARGINT_OPTION("-n", num_iterations)
 		ELSE_IF_ARG_OPTION("-m", mutator_options)
@@ -237,6 +267,9 @@ int main(int argc, char ** argv)
 	if (num_iterations != NUM_ITERATIONS_INFINITE && num_iterations <= 0)
 		FATAL_MSG("Invalid number of iterations %d", num_iterations);
 
+	if (delta_instrumentation_state && (!instrumentation_state_load_file || !instrumentation_state_dump_file))
+		FATAL_MSG("The -isdelta option requires both the -isf and -isd options");
+
 	if (mutator_directory_cli) 
 	{ 
 		free(mutator_directory);
@@ -258,6 +291,18 @@ int main(int argc, char ** argv)
 		if (access(filename, W_OK))
 			FATAL_MSG("The provided instrumentation_state_dump_file filename (%s) is not writeable", instrumentation_state_dump_file);
 	}
+	if (driver_state_dump_file) {
+		strncpy(filename, driver_state_dump_file, sizeof(filename));
+
+		#ifdef _WIN32
+		PathRemoveFileSpec(filename);
+		#else
+		dirname(filename);
+		#endif
+
+		if (access(filename, W_OK))
+			FATAL_MSG("The provided driver_state_dump_file filename (%s) is not writeable", driver_state_dump_file);
+	}
 	if (mutation_state_dump_file) {
 		strncpy(filename, mutation_state_dump_file, sizeof(filename));
 
@@ -312,13 +357,27 @@ int main(int argc, char ** argv)
 		FATAL_MSG("Unknown instrumentation '%s'", instrumentation_name);
 	}
 
-	instrumentation_state = instrumentation->create(instrumentation_options, instrumentation_state_string);
+	instrumentation_state = load_any_state(instrumentation, instrumentation->create, instrumentation_options,
+		instrumentation_state_string, instrumentation_length);
 	if (!instrumentation_state)
 	{
 		free(instrumentation_state_string);
 		FATAL_MSG("Bad options/state for instrumentation %s", instrumentation_name);
 	}
 
+	//Keep a copy of the loaded coverage, so the delta can be found when the state is dumped
+	if (delta_instrumentation_state && instrumentation_state_dump_file && instrumentation->get_state_delta)
+	{
+		baseline_state = load_any_state(instrumentation, instrumentation->load_state ? instrumentation->load_state : instrumentation->create,
+			instrumentation_options, instrumentation_state_string, instrumentation_length);
+		if (!baseline_state)
+		{
+			free(instrumentation_state_string);
+			FATAL_MSG("Bad options/state for instrumentation %s", instrumentation_name);
+		}
+		baseline_digest = binary_state_digest(instrumentation_state_string, instrumentation_length);
+	}
+
 	free(instrumentation_state_string);
 
 	//Load the seed buffer from a file
@@ -332,6 +391,19 @@ int main(int argc, char ** argv)
 	if (!seed_buffer)
 		FATAL_MSG("No seed file or seed id specified.");
 
+	//The mutators expect multipart seeds as mem arrays, so convert binary multipart seeds (such as
+	//inputs saved by a network driver with the binary_multipart option).  Only the network drivers
+	//take multipart inputs; for any other driver, a seed that starts with the magic is just data.
+	if ((!strcmp(driver_name, "network_server") || !strcmp(driver_name, "network_client"))
+		&& is_multipart(seed_buffer, seed_length))
+	{
+		converted_seed = multipart_to_mem_array(seed_buffer, seed_length, &seed_length);
+		if (!converted_seed)
+			FATAL_MSG("Invalid binary multipart seed%s%s", seed_file ? " file: " : "", seed_file ? seed_file : "");
+		free(seed_buffer);
+		seed_buffer = converted_seed;
+	}
+
 	if (mutation_state_load_file)
 	{
 		free(mutator_saved_state);
@@ -360,10 +432,27 @@ int main(int argc, char ** argv)
 			driver_options, mutator_options, argv[0]);
 	}
 
+	//Load the driver state, merging in any further driver states after the first one
+	if (num_driver_state_load_files && !driver->set_state)
+		FATAL_MSG("The %s driver does not support saved driver states", driver_name);
+	for (int i = 0; i < num_driver_state_load_files; i++)
+	{
+		if (read_file(driver_state_load_files[i], &driver_state_string) <= 0)
+			FATAL_MSG("Could not read driver saved state from file: %s", driver_state_load_files[i]);
+		if (i == 0 ? driver->set_state(driver->state, driver_state_string) : driver->merge_state(driver->state, driver_state_string))
+			FATAL_MSG("Could not load driver saved state from file: %s", driver_state_load_files[i]);
+		free(driver_state_string);
+	}
+	free(driver_state_load_files);
+
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 	// Main Fuzz Loop ////////////////////////////////////////////////////////////////////////////////////
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 
+	//Drivers that mutate inputs ahead of time need to know when to stop, or the saved mutator state would skip an input
+	if (num_iterations != NUM_ITERATIONS_INFINITE && driver->set_iteration_limit)
+		driver->set_iteration_limit(driver->state, num_iterations);
+
 	fuzz_begin_time = time(NULL);
 
 	//Copy the input, mutate it, and run the fuzzed program
@@ -388,6 +477,9 @@ int main(int argc, char ** argv)
 			ERROR_MSG("The instrumentation failed to determine the fuzzed process's fuzz_result");
 			break;
 		}
+		//An input that reaches a new state in the target, e.g. a new protocol state, is as interesting as a new path
+		if (!new_path && driver->is_new_state && driver->is_new_state(driver->state) > 0)
+			new_path = 1;
 
 		directory = NULL;
 		if (fuzz_result == FUZZ_CRASH) {
@@ -425,15 +517,43 @@ int main(int argc, char ** argv)
 
 	if (instrumentation_state_dump_file)
 	{
-		instrumentation_state_string = instrumentation->get_state(instrumentation_state);
+		if (delta_instrumentation_state && !instrumentation->get_state_delta)
+			WARNING_MSG("The %s instrumentation does not support delta instrumentation states, dumping the whole state", instrumentation_name);
+		else if (binary_instrumentation_state && !instrumentation->get_state_binary)
+			WARNING_MSG("The %s instrumentation does not support binary instrumentation states, dumping it as JSON", instrumentation_name);
+		if (baseline_state)
+		{
+			instrumentation_state_string = instrumentation->get_state_delta(instrumentation_state, baseline_state, baseline_digest,
+				&instrumentation_state_length);
+			instrumentation->cleanup(baseline_state);
+		}
+		else if (binary_instrumentation_state && instrumentation->get_state_binary)
+			instrumentation_state_string = instrumentation->get_state_binary(instrumentation_state, &instrumentation_state_length);
+		else
+		{
+			instrumentation_state_string = instrumentation->get_state(instrumentation_state);
+			if (instrumentation_state_string)
+				instrumentation_state_length = strlen(instrumentation_state_string);
+		}
 		if (instrumentation_state_string)
 		{
-			write_buffer_to_file(instrumentation_state_dump_file, instrumentation_state_string, strlen(instrumentation_state_string));
+			write_buffer_to_file(instrumentation_state_dump_file, instrumentation_state_string, instrumentation_state_length);
 			instrumentation->free_state(instrumentation_state_string);
 		}
 		else
 			WARNING_MSG("Couldn't dump instrumentation state to file %s", instrumentation_state_dump_file);
 	}
+	if (driver_state_dump_file)
+	{
+		driver_state_string = driver->get_state ? driver->get_state(driver->state) : NULL;
+		if (driver_state_string)
+		{
+			write_buffer_to_file(driver_state_dump_file, driver_state_string, strlen(driver_state_string));
+			driver->free_state(driver_state_string);
+		}
+		else
+			WARNING_MSG("Couldn't dump driver state to file %s", driver_state_dump_file);
+	}
 	if (mutation_state_dump_file)
 	{
 		mutator_saved_state = mutator->get_state(mutator_state);
@@ -1,15 +1,35 @@
 #include <fcntl.h>
 #include <stddef.h>  // for NULL
+#include <sys/mman.h> // for mmap, madvise
 #include <sys/shm.h> // for shm functions
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>  // for lseek, write, ftruncate
+#ifdef __linux__
+#include <sys/syscall.h> // for SYS_memfd_create
+#endif
+
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB 0x0004U
+#endif
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+
+//Huge page size assumed when backing the map with hugetlbfs pages
+#define AFL_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+//Default number of recently seen crash and hang trace hashes to remember
+#define AFL_PATH_CACHE_SIZE 65536
+//Number of slots to probe in the path cache before evicting an entry
+#define AFL_PATH_CACHE_PROBES 8
 
 #include <utils.h>   // for FUZZ_* return values
 
 #include <jansson_helper.h>  // for PARSE_OPTION_*
 
 #include "afl_instrumentation.h"
+#include "binary_state.h"
 
 /**
  * This function allocates and initializes a new instrumentation specific state
@@ -33,6 +53,40 @@ void * afl_create(char *options, char *state) {
 	return afl_state;
 }
 
+/**
+ * This function allocates an instrumentation specific state object that only
+ * holds coverage information, for tools that merge or inspect states without
+ * running a target.  No options are parsed and nothing is set up to run a
+ * target, so the returned state can't be passed to afl_enable.
+ * @param options - ignored, the coverage information doesn't depend on the
+ *                  instrumentation's options
+ * @param state - an instrumentation specific JSON string previously returned
+ *                from afl_get_state that should be loaded, or NULL
+ * @return - An instrumentation specific state object on success or NULL on
+ *           failure
+ */
+void * afl_load_state(char *options, char *state) {
+	afl_state_t * afl_state;
+
+	afl_state = (afl_state_t *)calloc(1, sizeof(afl_state_t));
+	if(!afl_state)
+		return NULL;
+
+	//Start with nothing covered, so merging into this state doesn't lose any coverage
+	memset(afl_state->virgin_bits, 255, MAP_SIZE);
+	memset(afl_state->virgin_tmout, 255, MAP_SIZE);
+	memset(afl_state->virgin_crash, 255, MAP_SIZE);
+	afl_state->loaded_state = 1;
+
+	if(state && afl_set_state(afl_state, state)) {
+		DEBUG_MSG("Unable to set state for afl instrumentation");
+		afl_cleanup(afl_state);
+		return NULL;
+	}
+
+	return afl_state;
+}
+
 /**
  * This function cleans up all resources with the passed in instrumentation state.
  * @param instrumentation_state - an instrumentation specific state object
@@ -44,7 +98,7 @@ void afl_cleanup(void *instrumentation_state) {
 	afl_state_t * state = (afl_state_t *)instrumentation_state;
 
 	//Cleanup the SHM region
-	shmctl(state->shm_id, IPC_RMID, NULL);
+	remove_shm(state);
 
 	//Kill any remaining target processes
 	destroy_target_process(state, 1);
@@ -57,6 +111,8 @@ void afl_cleanup(void *instrumentation_state) {
 
 	free(state->target_path);
 	free(state->qemu_path);
+	free(state->path_cache);
+	free(state);
 }
 
 char * afl_get_state(void *instrumentation_state) {
@@ -105,9 +161,142 @@ int afl_set_state(void *instrumentation_state, char *state) {
 	get_bits("virgin_tmout", afl_state->virgin_tmout);
 	get_bits("virgin_crash", afl_state->virgin_crash);
 
+	//Traces we've seen may be new again against the loaded bitmaps
+	if(afl_state->path_cache)
+		memset(afl_state->path_cache, 0, afl_state->path_cache_size * sizeof(uint64_t));
+
+	return 0;
+}
+
+/**
+ * This function returns the state information holding the previous execution
+ * path info in the binary state format.  The virgin maps are sparse encoded,
+ * so the state is much smaller than the JSON one from afl_get_state.
+ * @param instrumentation_state - an instrumentation specific state object
+ *                                previously created by the afl_create function
+ * @param length - a pointer used to return the length of the binary state
+ * @return - the binary state on success or NULL on failure.  It should be
+ *           freed with afl_free_state.
+ */
+char * afl_get_state_binary(void *instrumentation_state, size_t *length) {
+	afl_state_t * state = (afl_state_t *)instrumentation_state;
+	binary_state_writer_t writer;
+
+	binary_state_writer_init(&writer, "afl");
+	binary_state_write_sparse_map(&writer, state->virgin_bits, MAP_SIZE, 0xff);
+	binary_state_write_sparse_map(&writer, state->virgin_tmout, MAP_SIZE, 0xff);
+	binary_state_write_sparse_map(&writer, state->virgin_crash, MAP_SIZE, 0xff);
+	return binary_state_writer_finish(&writer, length);
+}
+
+/**
+ * This function sets the instrumentation state to the passed in binary state
+ * previously obtained from afl_get_state_binary.
+ * @param instrumentation_state - an instrumentation specific state object
+ *                                previously created by the afl_create function
+ * @param state - the binary state to load
+ * @param length - the length of the state parameter
+ * @return - 0 on success, non-zero on failure
+ */
+int afl_set_state_binary(void *instrumentation_state, char *state, size_t length) {
+	afl_state_t * afl_state = (afl_state_t *)instrumentation_state;
+	binary_state_reader_t reader;
+
+	if(!state || !instrumentation_state || binary_state_reader_init(&reader, state, length, "afl"))
+		return 1;
+
+	binary_state_read_sparse_map(&reader, afl_state->virgin_bits, MAP_SIZE, 0xff);
+	binary_state_read_sparse_map(&reader, afl_state->virgin_tmout, MAP_SIZE, 0xff);
+	binary_state_read_sparse_map(&reader, afl_state->virgin_crash, MAP_SIZE, 0xff);
+	if(binary_state_reader_finish(&reader))
+		return 1;
+	afl_state->loaded_state = 1;
+
+	//Traces we've seen may be new again against the loaded bitmaps
+	if(afl_state->path_cache)
+		memset(afl_state->path_cache, 0, afl_state->path_cache_size * sizeof(uint64_t));
+
 	return 0;
 }
 
+/**
+ * This function returns a binary delta state, holding only the coverage that
+ * has been found since the baseline state.  Each virgin map is written as the
+ * bits that are set in the baseline and have since been cleared, which are
+ * mostly zeros and sparse encode well.
+ * @param instrumentation_state - an instrumentation specific state object
+ *                                previously created by the afl_create function
+ * @param baseline_state - an instrumentation specific state object holding
+ *                         the coverage that this state started from
+ * @param baseline_digest - the digest of the baseline state file
+ * @param length - a pointer used to return the length of the delta state
+ * @return - the delta state on success or NULL on failure.  It should be freed
+ *           with afl_free_state.
+ */
+char * afl_get_state_delta(void *instrumentation_state, void *baseline_state, uint64_t baseline_digest, size_t *length) {
+	afl_state_t * state = (afl_state_t *)instrumentation_state;
+	afl_state_t * baseline = (afl_state_t *)baseline_state;
+	u8 * current_maps[3] = { state->virgin_bits, state->virgin_tmout, state->virgin_crash };
+	u8 * baseline_maps[3] = { baseline->virgin_bits, baseline->virgin_tmout, baseline->virgin_crash };
+	binary_state_writer_t writer;
+	u8 * found;
+	size_t i, j;
+
+	found = (u8 *)malloc(MAP_SIZE);
+	if(!found)
+		return NULL;
+
+	binary_state_delta_writer_init(&writer, "afl", baseline_digest);
+	for(i = 0; i < 3; i++) {
+		for(j = 0; j < MAP_SIZE; j++)
+			found[j] = baseline_maps[i][j] & ~current_maps[i][j];
+		binary_state_write_sparse_map(&writer, found, MAP_SIZE, 0);
+	}
+	free(found);
+	return binary_state_writer_finish(&writer, length);
+}
+
+/**
+ * This function adds the coverage in a binary delta state from
+ * afl_get_state_delta to the instrumentation state.
+ * @param instrumentation_state - an instrumentation specific state object
+ *                                previously created by the afl_create function
+ * @param delta - the delta state to apply
+ * @param length - the length of the delta parameter
+ * @return - 0 on success, non-zero on failure
+ */
+int afl_apply_state_delta(void *instrumentation_state, char *delta, size_t length) {
+	afl_state_t * state = (afl_state_t *)instrumentation_state;
+	u8 * maps[3] = { state->virgin_bits, state->virgin_tmout, state->virgin_crash };
+	binary_state_reader_t reader;
+	u8 * found;
+	size_t i, j;
+
+	if(binary_state_delta_reader_init(&reader, delta, length, "afl"))
+		return 1;
+	found = (u8 *)malloc(MAP_SIZE);
+	if(!found)
+		return 1;
+
+	//A state that hasn't loaded any coverage yet still needs its virgin maps set up
+	if(!state->loaded_state) {
+		memset(state->virgin_bits, 255, MAP_SIZE);
+		memset(state->virgin_tmout, 255, MAP_SIZE);
+		memset(state->virgin_crash, 255, MAP_SIZE);
+		state->loaded_state = 1;
+	}
+
+	for(i = 0; i < 3 && !reader.error; i++) {
+		binary_state_read_sparse_map(&reader, found, MAP_SIZE, 0);
+		if(reader.error)
+			break;
+		for(j = 0; j < MAP_SIZE; j++)
+			maps[i][j] &= ~found[j];
+	}
+	free(found);
+	return binary_state_reader_finish(&reader);
+}
+
 /**
  * This function merges the bitmap in src into the bitmap in dest
  * @param dest - the bitmap that will be combined with the src bitmap.
@@ -139,6 +328,32 @@ void * afl_merge(void *instrumentation_state, void *other_instrumentation_state)
 	return ret;
 }
 
+/**
+ * This function merges the coverage information from several instrumentation
+ * states into the first one, without allocating a new state for each merge.
+ * @param instrumentation_state - an instrumentation specific state object
+ *                                previously created by the afl_create function.
+ *                                The other states are merged into this one.
+ * @param other_instrumentation_states - an array of instrumentation specific
+ *                                       state objects to merge in.  They are
+ *                                       not modified.
+ * @param num_states - the number of states in other_instrumentation_states
+ * @return - 0 on success, non-zero on failure
+ */
+int afl_merge_many(void *instrumentation_state, void **other_instrumentation_states, int num_states) {
+	afl_state_t * state = (afl_state_t *)instrumentation_state;
+	afl_state_t * other;
+	int i;
+
+	for(i = 0; i < num_states; i++) {
+		other = (afl_state_t *)other_instrumentation_states[i];
+		merge_bitmaps(state->virgin_bits, other->virgin_bits);
+		merge_bitmaps(state->virgin_tmout, other->virgin_tmout);
+		merge_bitmaps(state->virgin_crash, other->virgin_crash);
+	}
+	return 0;
+}
+
 /**
  * This function enables the instrumentation and runs the fuzzed process.
  * @param instrumentation_state - an instrumentation specific state object
@@ -174,6 +389,7 @@ int afl_enable(void *instrumentation_state, pid_t *process, char *cmd_line,
 		return -1;
 	state->process_finished = 0;
 	state->fuzz_results_set = 0;
+	state->path_hash_set = 0;
 
 	*process = state->child_pid;
 	return 0;
@@ -229,47 +445,70 @@ int afl_get_fuzz_result(void *instrumentation_state) {
  * @return - either FUZZ_NONE, FUZZ_HANG, FUZZ_CRASH, or -1 on error.
  */
 static int finish_fuzz_round(afl_state_t *state) {
-	int status, rc;
-
 	// if our process is still running, then it was a hang
 	if(!afl_is_process_done(state)) {
 		destroy_target_process(state, 1);
 		state->last_fuzz_result = FUZZ_HANG;
-#ifdef __x86_64__
-		simplify_trace((uint64_t*)state->trace_bits);
-#else
-		simplify_trace((uint32_t*)state->trace_bits);
-#endif /* ^__x86_64__ */
-		state->last_is_new_path = has_new_bits(state->virgin_tmout, state->trace_bits);
-		DEBUG_MSG("Process hung, has_new_bits = %d", state->last_is_new_path);
-		state->fuzz_results_set = 1;
-
 	} else if(WIFEXITED(state->last_status)) {
-		/* Any subsequent operations on trace_bits must not be moved by the
-			 compiler below this point. Past this location, trace_bits[] behave
-			 very normally and do not have to be treated as volatile. */
-		MEM_BARRIER();
-		state->last_is_new_path = has_new_bits(state->virgin_bits, state->trace_bits);
 		state->last_fuzz_result = FUZZ_NONE;  // process exited normally
-		DEBUG_MSG("Process exited normally, has_new_bits = %d", state->last_is_new_path);
-		state->fuzz_results_set = 1;
-
 	} else if(WIFSIGNALED(state->last_status)) {
 		// process was terminated by a signal, we don't really care which one...
 		state->last_fuzz_result = FUZZ_CRASH;
-#ifdef __x86_64__
-		simplify_trace((uint64_t*)state->trace_bits);
-#else
-		simplify_trace((uint32_t*)state->trace_bits);
-#endif /* ^__x86_64__ */
-		state->last_is_new_path = has_new_bits(state->virgin_crash, state->trace_bits);
-		DEBUG_MSG("Process crashed, has_new_bits = %d", state->last_is_new_path);
-		state->fuzz_results_set = 1;
 	} else {
 		// if it didn't exit normally, nor get interrupted by a signal...
 		// I'm not sure what happened!
 		return FUZZ_ERROR;
 	}
+
+	return check_trace(state);
+}
+
+/**
+ * This function compares the trace left by the last input against the virgin
+ * map that goes with state->last_fuzz_result, and records whether it took a
+ * new path.
+ * @param state - The AFL specific state structure
+ * @return - the fuzz result in state->last_fuzz_result
+ */
+static int check_trace(afl_state_t *state) {
+	uint8_t *virgin_map;
+
+	if(state->last_fuzz_result == FUZZ_HANG)
+		virgin_map = state->virgin_tmout;
+	else if(state->last_fuzz_result == FUZZ_CRASH)
+		virgin_map = state->virgin_crash;
+	else
+		virgin_map = state->virgin_bits;
+
+	/* Any subsequent operations on trace_bits must not be moved by the
+		 compiler below this point. Past this location, trace_bits[] behave
+		 very normally and do not have to be treated as volatile. */
+	MEM_BARRIER();
+
+	// Crashes and hangs need an extra pass to simplify the trace before it's
+	// compared, so a repeated crash or hang trace is recognized by its hash
+	// instead.  Hashing a normal trace would cost as much as comparing it.
+	if(state->last_fuzz_result != FUZZ_NONE) {
+		state->last_path_hash = hash_trace(state->trace_bits);
+		state->path_hash_set = 1;
+		if(path_cache_check(state, state->last_path_hash, state->last_fuzz_result)) {
+			state->last_is_new_path = 0;
+		} else {
+#ifdef __x86_64__
+			simplify_trace((uint64_t*)state->trace_bits);
+#else
+			simplify_trace((uint32_t*)state->trace_bits);
+#endif /* ^__x86_64__ */
+			state->last_is_new_path = has_new_bits(virgin_map, state->trace_bits);
+		}
+	} else
+		state->last_is_new_path = has_new_bits(virgin_map, state->trace_bits);
+
+	DEBUG_MSG("Process %s, has_new_bits = %d",
+		state->last_fuzz_result == FUZZ_HANG ? "hung" :
+		(state->last_fuzz_result == FUZZ_CRASH ? "crashed" : "exited normally"),
+		state->last_is_new_path);
+	state->fuzz_results_set = 1;
 	return state->last_fuzz_result;
 }
 
@@ -319,6 +558,82 @@ int afl_is_process_done(void *instrumentation_state) {
 	return -1;
 }
 
+/**
+ * This function returns a hash of the coverage map recorded by the last run
+ * of the target process.  Runs with identical hashes took the same path, so
+ * this can be used to count unique paths or deduplicate inputs.
+ * @param instrumentation_state - an instrumentation specific structure
+ *                                previously created by the afl_create function
+ * @param path_hash - a pointer used to return the hash of the last run's path
+ * @return - 0 on success, non-zero on failure
+ */
+int afl_get_path_hash(void *instrumentation_state, uint64_t *path_hash) {
+	afl_state_t * state = (afl_state_t *)instrumentation_state;
+
+	if(!state->trace_bits) //nothing has been run yet
+		return 1;
+
+	// If we haven't set the fuzz results, do that first
+	if(!state->fuzz_results_set && finish_fuzz_round(state) == FUZZ_ERROR)
+		return 1;
+
+	// The hash is only calculated when it's asked for, unless the trace was
+	// hashed (before it was simplified) to check the path cache
+	if(!state->path_hash_set) {
+		state->last_path_hash = hash_trace(state->trace_bits);
+		state->path_hash_set = 1;
+	}
+	*path_hash = state->last_path_hash;
+	return 0;
+}
+
+/**
+ * This function starts a fuzz round for a target that runs inside of the
+ * fuzzer's own process, such as a library loaded by the inprocess driver.
+ * Rather than starting a target process, it just makes sure the coverage map
+ * exists (and that SHM_ENV_VAR or SHM_FD_ENV_VAR points at it, so that an
+ * instrumented library can attach to it when it's loaded) and clears it.
+ * @param instrumentation_state - an instrumentation specific structure
+ *                                previously created by the afl_create function
+ * @return - 0 on success, non-zero on failure
+ */
+int afl_enable_inprocess(void *instrumentation_state) {
+	afl_state_t * state = (afl_state_t *)instrumentation_state;
+
+	if(setup_shm(state))
+		return 1;
+
+	memset(state->trace_bits, 0, MAP_SIZE);
+	MEM_BARRIER();
+
+	state->process_finished = 0;
+	state->fuzz_results_set = 0;
+	state->path_hash_set = 0;
+	return 0;
+}
+
+/**
+ * This function ends a fuzz round started with afl_enable_inprocess.  Since
+ * there's no target process to check on, the caller gives the result of the
+ * input, and the coverage map is checked for new paths just like it is for a
+ * target process.
+ * @param instrumentation_state - an instrumentation specific structure
+ *                                previously created by the afl_create function
+ * @param fuzz_result - the result of the input, FUZZ_NONE, FUZZ_HANG, or FUZZ_CRASH
+ * @return - the fuzz_result parameter on success, or FUZZ_ERROR on failure
+ */
+int afl_finish_inprocess(void *instrumentation_state, int fuzz_result) {
+	afl_state_t * state = (afl_state_t *)instrumentation_state;
+
+	if(!state->trace_bits || (fuzz_result != FUZZ_NONE
+		&& fuzz_result != FUZZ_HANG && fuzz_result != FUZZ_CRASH))
+		return FUZZ_ERROR;
+
+	state->process_finished = 1;
+	state->last_fuzz_result = fuzz_result;
+	return check_trace(state);
+}
+
 int afl_help(char **help_str) {
 	*help_str = strdup(
 		"afl - AFL-based instrumentation\n"
@@ -329,6 +644,17 @@ int afl_help(char **help_str) {
 		"  qemu_mode            Whether to use qemu mode; 1=yes, 0=no (default=0)\n"
 		"  qemu_path            The path to afl-qemu-trace\n"
 		"  deferred_startup     Whether to use deferred startup mode; 1=yes, 0=no (default=0)\n"
+		"  use_memfd            Whether to pass the coverage map to the target as a memfd\n"
+		"                         instead of a SysV shared memory segment; requires an\n"
+		"                         LLVM, GCC plugin, or QEMU instrumented target (Linux only)\n"
+		"                         1=yes, 0=no (default=0)\n"
+		"  huge_pages           Whether to back the memfd map with huge pages; 1=yes, 0=no\n"
+		"                         (default=0)\n"
+		"  prefault_map         Whether to prefault the memfd map when mapping it; 1=yes,\n"
+		"                         0=no (default=0)\n"
+		"  path_cache_size      The number of recently seen crash and hang path hashes to\n"
+		"                         remember, so repeated crashes and hangs can skip the\n"
+		"                         bitmap comparison; 0 to disable (default=65536)\n"
 		"\n"
 	);
 	if (*help_str == NULL)
@@ -355,6 +681,7 @@ static afl_state_t * setup_options(char *options) {
 		return NULL;
 	memset(state, 0, sizeof(afl_state_t));
 	state->use_fork_server = 1;  // default to use the fork server
+	state->path_cache_size = AFL_PATH_CACHE_SIZE;
 
 	if(options) {
 		DEBUG_MSG("JSON options = %s", options);
@@ -368,6 +695,14 @@ static afl_state_t * setup_options(char *options) {
 				"qemu_mode", afl_cleanup);
 		PARSE_OPTION_STRING(state, options, qemu_path,
 				"qemu_path", afl_cleanup);
+		PARSE_OPTION_INT(state, options, use_memfd,
+				"use_memfd", afl_cleanup);
+		PARSE_OPTION_INT(state, options, huge_pages,
+				"huge_pages", afl_cleanup);
+		PARSE_OPTION_INT(state, options, prefault_map,
+				"prefault_map", afl_cleanup);
+		PARSE_OPTION_INT(state, options, path_cache_size,
+				"path_cache_size", afl_cleanup);
 	}
 
 	if(state->persistence_max_cnt && !state->use_fork_server) {
@@ -382,6 +717,26 @@ static afl_state_t * setup_options(char *options) {
 	} else if(state->qemu_mode && state->persistence_max_cnt) {
 		ERROR_MSG("Cannot use qemu mode and persistence mode (yet).");
 		error = 1;
+	} else if((state->huge_pages || state->prefault_map) && !state->use_memfd) {
+		ERROR_MSG("The huge_pages and prefault_map options require the use_memfd option");
+		error = 1;
+	}
+#ifndef __linux__
+	else if(state->use_memfd) {
+		ERROR_MSG("The use_memfd option is only supported on Linux");
+		error = 1;
+	}
+#endif
+	else if(state->path_cache_size < 0
+		|| (state->path_cache_size & (state->path_cache_size - 1))) {
+		ERROR_MSG("The path_cache_size option must be a power of two");
+		error = 1;
+	}
+
+	if(!error && state->path_cache_size) {
+		state->path_cache = calloc(state->path_cache_size, sizeof(uint64_t));
+		if(!state->path_cache)
+			error = 1;
 	}
 
 	if(error) {
@@ -457,7 +812,7 @@ static int create_target_process(afl_state_t * state, char* cmd_line,
 
 			//Start the fork server
 			fork_server_init(&state->fs, state->target_path, argv, 0,
-					state->persistence_max_cnt, input_length != 0);
+					state->persistence_max_cnt, input_length != 0, 0);
 			state->fork_server_setup = 1;
 
 			//Free the split arguments
@@ -544,7 +899,6 @@ int setup_shm(void *instrumentation_state) {
 	http://www.apache.org/licenses/LICENSE-2.0
 	*/
  
-	char* shm_str;
 	afl_state_t * state = (afl_state_t *)instrumentation_state;
 
 	if(state->trace_bits) // if trace_bits already points at the shm
@@ -558,6 +912,20 @@ int setup_shm(void *instrumentation_state) {
 		memset(state->virgin_crash, 255, MAP_SIZE);
 	}
 
+	if(state->use_memfd)
+		return setup_memfd_shm(state);
+	return setup_sysv_shm(state);
+}
+
+/**
+ * This function allocates the coverage map as a SysV shared memory segment
+ * and passes its ID to the target process via SHM_ENV_VAR.
+ * @param state - The afl_state_t object containing this instrumentation's state
+ * @returns zero on success, non-zero on error
+ */
+static int setup_sysv_shm(afl_state_t * state) {
+	char* shm_str;
+
 	// Allocate shared memory; shm_id must be module level or global so
 	// the atexit function has access to it (as we can not pass arguments
 	// to the callback function)
@@ -571,11 +939,14 @@ int setup_shm(void *instrumentation_state) {
 	// set the environment variable so the instrumented binary knows which
 	// shared memory ID to attach to when it goes to write the bitmap
 	setenv(SHM_ENV_VAR, shm_str, 1);
+	unsetenv(SHM_FD_ENV_VAR);
 	ck_free(shm_str);
 
 	// Attach to shared memory region
 	state->trace_bits = shmat(state->shm_id, NULL, 0);
-	if(!state->trace_bits) {
+	if(state->trace_bits == (void *)-1) {
+		state->trace_bits = NULL;
+		shmctl(state->shm_id, IPC_RMID, NULL);
 		ERROR_MSG("shmat() failed");
 		return 1;
 	}
@@ -583,6 +954,88 @@ int setup_shm(void *instrumentation_state) {
 	return 0;
 }
 
+/**
+ * This function allocates the coverage map as an anonymous memfd and passes
+ * its file descriptor to the target process via SHM_FD_ENV_VAR.  Unlike a SysV
+ * segment, the memfd goes away with the last process that references it, so
+ * nothing is left behind if the fuzzer dies.  The map can optionally be backed
+ * by huge pages and prefaulted.
+ * @param state - The afl_state_t object containing this instrumentation's state
+ * @returns zero on success, non-zero on error
+ */
+static int setup_memfd_shm(afl_state_t * state) {
+#ifdef __linux__
+	char fd_str[16];
+	int flags = MAP_SHARED;
+
+	state->shm_fd = -1;
+	if(state->huge_pages) {
+		//hugetlbfs files must be a multiple of the huge page size
+		state->shm_size = (MAP_SIZE + AFL_HUGE_PAGE_SIZE - 1) & ~(AFL_HUGE_PAGE_SIZE - 1);
+		state->shm_fd = syscall(SYS_memfd_create, "afl_map", MFD_HUGETLB);
+		if(state->shm_fd >= 0 && ftruncate(state->shm_fd, state->shm_size)) {
+			close(state->shm_fd);
+			state->shm_fd = -1;
+		}
+		if(state->shm_fd < 0)
+			WARNING_MSG("Unable to allocate the map with huge pages (are any reserved in "
+				"/proc/sys/vm/nr_hugepages?), falling back to regular pages");
+	}
+
+	if(state->shm_fd < 0) {
+		state->shm_size = MAP_SIZE;
+		state->shm_fd = syscall(SYS_memfd_create, "afl_map", 0);
+		if(state->shm_fd < 0) {
+			ERROR_MSG("memfd_create() failed");
+			return 1;
+		}
+		if(ftruncate(state->shm_fd, state->shm_size)) {
+			ERROR_MSG("ftruncate() failed on the coverage map memfd");
+			close(state->shm_fd);
+			return 1;
+		}
+	}
+
+	if(state->prefault_map)
+		flags |= MAP_POPULATE;
+
+	state->trace_bits = mmap(NULL, state->shm_size, PROT_READ | PROT_WRITE, flags, state->shm_fd, 0);
+	if(state->trace_bits == MAP_FAILED) {
+		state->trace_bits = NULL;
+		ERROR_MSG("mmap() failed on the coverage map memfd");
+		close(state->shm_fd);
+		return 1;
+	}
+
+	// The memfd is inherited by the target process, so it only needs the fd number
+	snprintf(fd_str, sizeof(fd_str), "%d", state->shm_fd);
+	setenv(SHM_FD_ENV_VAR, fd_str, 1);
+	unsetenv(SHM_ENV_VAR);
+	return 0;
+#else
+	ERROR_MSG("memfd based coverage maps are only supported on Linux");
+	return 1;
+#endif
+}
+
+/**
+ * This function releases the coverage map allocated by setup_shm.
+ * @param state - The afl_state_t object containing this instrumentation's state
+ */
+static void remove_shm(afl_state_t * state) {
+	if(!state->trace_bits)
+		return;
+
+	if(state->use_memfd) {
+		munmap(state->trace_bits, state->shm_size);
+		close(state->shm_fd);
+	} else {
+		shmdt(state->trace_bits);
+		shmctl(state->shm_id, IPC_RMID, NULL);
+	}
+	state->trace_bits = NULL;
+}
+
 /**
  * Check if the current execution path brings anything new to the table.
  * Update virgin bits to reflect the new paths found, so subsequent calls will
@@ -661,6 +1114,74 @@ static inline uint8_t has_new_bits(uint8_t* virgin_map, uint8_t *trace_bits) {
   return ret;
 }
 
+/**
+ * Hash the trace for a single run.  Like has_new_bits, it skips over the zero
+ * words of the (usually sparse) map and only mixes in the words that were hit,
+ * along with their position.
+ *
+ * @param trace_bits - The trace for this particular run
+ * @returns - a 64-bit hash of the trace
+ */
+static uint64_t hash_trace(uint8_t *trace_bits) {
+#ifdef __x86_64__
+	uint64_t* current = (uint64_t*)trace_bits;
+	uint32_t  count = (MAP_SIZE >> 3);
+#else
+	uint32_t* current = (uint32_t*)trace_bits;
+	uint32_t  count = (MAP_SIZE >> 2);
+#endif /* ^__x86_64__ */
+	uint64_t hash = 0xcbf29ce484222325ULL, word;
+	uint32_t i;
+
+	for(i = 0; i < count; i++) {
+		if(unlikely(current[i])) {
+			// MurmurHash3's 64-bit finalizer, chained over the non-zero words
+			word = hash ^ current[i] ^ ((uint64_t)i << 32);
+			word ^= word >> 33;
+			word *= 0xff51afd7ed558ccdULL;
+			word ^= word >> 33;
+			word *= 0xc4ceb9fe1a85ec53ULL;
+			word ^= word >> 33;
+			hash = word + i;
+		}
+	}
+	return hash;
+}
+
+/**
+ * Look up a trace hash in the cache of recently seen paths, and add it if it
+ * isn't there.  The cache is a fixed size open-addressing table; once the
+ * probe sequence for a hash is full, the first slot is evicted.  Since the
+ * virgin maps differ per result type, the result is mixed into the key.
+ *
+ * @param state - The AFL specific state structure
+ * @param path_hash - the hash of the trace, as returned by hash_trace
+ * @param fuzz_result - the FUZZ_* result of the run that produced the trace
+ * @returns - 1 if the trace was seen before, 0 otherwise
+ */
+static int path_cache_check(afl_state_t *state, uint64_t path_hash, int fuzz_result) {
+	uint64_t key = path_hash + (uint64_t)fuzz_result * 0x9e3779b97f4a7c15ULL;
+	uint32_t mask, slot, i;
+
+	if(!state->path_cache)
+		return 0;
+
+	if(!key) // zero marks an empty slot
+		key = 1;
+	mask = state->path_cache_size - 1;
+	slot = key & mask;
+	for(i = 0; i < AFL_PATH_CACHE_PROBES; i++) {
+		if(state->path_cache[(slot + i) & mask] == key)
+			return 1;
+		if(!state->path_cache[(slot + i) & mask]) {
+			state->path_cache[(slot + i) & mask] = key;
+			return 0;
+		}
+	}
+	state->path_cache[slot] = key;
+	return 0;
+}
+
 /* Destructively simplify trace by eliminating hit count information
    and replacing it with 0x80 or 0x01 depending on whether the tuple
    is hit or not. Called on every new crash or timeout, should be
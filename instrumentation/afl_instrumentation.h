@@ -11,6 +11,11 @@
 
 struct afl_state {
 	int shm_id;
+	int shm_fd;      // memfd backing trace_bits when use_memfd is set
+	size_t shm_size; // size of the memfd mapping
+	int use_memfd;
+	int huge_pages;
+	int prefault_map;
 	char *qemu_path;
 	char *target_path;
 	pid_t child_pid;
@@ -26,6 +31,10 @@ struct afl_state {
 	int qemu_mode;
 	int deferred_startup;
 	int loaded_state;
+	int path_cache_size;        // number of entries in path_cache, 0 disables it
+	uint64_t *path_cache;       // hashes of recently seen crash and hang traces
+	uint64_t last_path_hash;    // hash of the last input's trace
+	int path_hash_set;          // has last_path_hash been calculated?
 	uint8_t virgin_bits[MAP_SIZE];  // Regions yet untouched by fuzzing
 	uint8_t virgin_tmout[MAP_SIZE]; // Bits we haven't seen in tmouts
 	uint8_t virgin_crash[MAP_SIZE]; // Bits we haven't seen in crashes
@@ -34,16 +43,25 @@ struct afl_state {
 typedef struct afl_state afl_state_t;
 
 void * afl_create(char *options, char *state);
+void * afl_load_state(char *options, char *state);
 void afl_cleanup(void *instrumentation_state);
 char * afl_get_state(void *instrumentation_state);
 void afl_free_state(char *state);
 int afl_set_state(void *instrumentation_state, char *state);
+char * afl_get_state_binary(void *instrumentation_state, size_t *length);
+int afl_set_state_binary(void *instrumentation_state, char *state, size_t length);
+char * afl_get_state_delta(void *instrumentation_state, void *baseline_state, uint64_t baseline_digest, size_t *length);
+int afl_apply_state_delta(void *instrumentation_state, char *delta, size_t length);
 void * afl_merge(void *instrumentation_state, void *other_instrumentation_state);
+int afl_merge_many(void *instrumentation_state, void **other_instrumentation_states, int num_states);
 int afl_enable(void *instrumentation_state, pid_t *process, char *cmd_line,
 		char *input, size_t input_length);
 int afl_is_new_path(void *instrumentation_state);
 int afl_get_fuzz_result(void *instrumentation_state);
 int afl_is_process_done(void *instrumentation_state);
+int afl_get_path_hash(void *instrumentation_state, uint64_t *path_hash);
+int afl_enable_inprocess(void *instrumentation_state);
+int afl_finish_inprocess(void *instrumentation_state, int fuzz_result);
 int afl_help(char **help_str);
 
 static afl_state_t * setup_options(char *options);
@@ -51,11 +69,16 @@ static void destroy_target_process(afl_state_t * state, int force);
 static int create_target_process(afl_state_t * state, char* cmd_line,
 			char * input, size_t input_length);
 int setup_shm(void *instrumentation_state);
-static void remove_shm();
+static int setup_sysv_shm(afl_state_t * state);
+static int setup_memfd_shm(afl_state_t * state);
+static void remove_shm(afl_state_t * state);
 #ifdef __x86_64__
 static void simplify_trace(uint64_t* mem);
 #else
 static void simplify_trace(uint32_t* mem);
 #endif /* ^__x86_64__ */
 static inline uint8_t has_new_bits(uint8_t* virgin_map, uint8_t *trace_bits);
+static uint64_t hash_trace(uint8_t *trace_bits);
+static int path_cache_check(afl_state_t *state, uint64_t path_hash, int fuzz_result);
 static int finish_fuzz_round(afl_state_t *state);
+static int check_trace(afl_state_t *state);
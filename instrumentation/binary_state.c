@@ -0,0 +1,460 @@
+#include "binary_state.h"
+#include "xxhash.h"
+
+#include <utils.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+//The initial size of a binary_state_writer's buffer
+#define INITIAL_BUFFER_SIZE 4096
+
+//The shortest run of fill bytes that's encoded as a run, rather than as part of the surrounding literal bytes.
+//Shorter runs would take more space to encode as a run, since each run needs two varints.
+#define MIN_FILL_RUN 3
+
+/**
+ * This function writes a 32-bit little endian integer.
+ * @param buffer - the buffer to write the integer to
+ * @param value - the integer to write
+ */
+static void put_u32(uint8_t * buffer, uint32_t value)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		buffer[i] = (uint8_t)(value >> (i * 8));
+}
+
+/**
+ * This function reads a 32-bit little endian integer.
+ * @param buffer - the buffer to read the integer from
+ * @return - the integer
+ */
+static uint32_t get_u32(const uint8_t * buffer)
+{
+	return buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+}
+
+/**
+ * This function checks whether an instrumentation state is in the binary format, rather than JSON.
+ * @param state - the instrumentation state
+ * @param length - the length of the state parameter
+ * @return - 1 if the state is in the binary format, 0 otherwise
+ */
+int is_binary_state(const char * state, size_t length)
+{
+	return length >= BINARY_STATE_HEADER_SIZE && !memcmp(state, BINARY_STATE_MAGIC, BINARY_STATE_MAGIC_LENGTH);
+}
+
+/**
+ * This function checks whether an instrumentation state is a binary delta state.
+ * @param state - the instrumentation state
+ * @param length - the length of the state parameter
+ * @return - 1 if the state is a delta state, 0 otherwise
+ */
+int is_binary_state_delta(const char * state, size_t length)
+{
+	return length >= BINARY_STATE_HEADER_SIZE + sizeof(uint64_t)
+		&& !memcmp(state, BINARY_STATE_DELTA_MAGIC, BINARY_STATE_MAGIC_LENGTH);
+}
+
+/**
+ * This function calculates the digest that identifies a baseline state in the delta states made against it.
+ * @param state - the contents of the baseline state file, in any format
+ * @param length - the length of the state parameter
+ * @return - the digest of the state
+ */
+uint64_t binary_state_digest(const char * state, size_t length)
+{
+	return XXH64(state, length, 0);
+}
+
+/**
+ * This function gets the digest of the baseline state that a delta state was made against, so it can be matched
+ * with the baseline without needing the instrumentation that wrote it.
+ * @param state - the delta state
+ * @param length - the length of the state parameter
+ * @param baseline_digest - a pointer used to return the baseline's digest
+ * @return - 0 on success, or non-zero if the state isn't a delta state
+ */
+int binary_state_delta_digest(const char * state, size_t length, uint64_t * baseline_digest)
+{
+	binary_state_reader_t reader;
+
+	if (!is_binary_state_delta(state, length))
+		return 1;
+	reader.buffer = (const uint8_t *)state;
+	reader.length = length;
+	reader.offset = BINARY_STATE_HEADER_SIZE;
+	reader.error = 0;
+	*baseline_digest = binary_state_read_u64(&reader);
+	return 0;
+}
+
+/**
+ * This function creates an instrumentation state from a dumped state in any of the formats: JSON, binary, or a
+ * binary delta.  A delta is applied to a new empty state.
+ * @param instrumentation - the instrumentation to create the state with
+ * @param create - the function used to create the state, either the instrumentation's create or load_state function
+ * @param options - the options to pass to the create function
+ * @param state - the dumped state, or NULL to create a new empty state.  A JSON state must be NUL terminated.
+ * @param length - the length of the state parameter
+ * @return - the instrumentation state on success, or NULL on failure
+ */
+void * load_any_state(instrumentation_t * instrumentation, void *(*create)(char *, char *), char * options, char * state, size_t length)
+{
+	void * instrumentation_state;
+	int ret;
+
+	if (!state || (!is_binary_state(state, length) && !is_binary_state_delta(state, length)))
+		return create(options, state);
+
+	if (is_binary_state(state, length) ? !instrumentation->set_state_binary : !instrumentation->apply_state_delta)
+	{
+		ERROR_MSG("The instrumentation does not support this binary instrumentation state format");
+		return NULL;
+	}
+
+	instrumentation_state = create(options, NULL);
+	if (!instrumentation_state)
+		return NULL;
+	if (is_binary_state(state, length))
+		ret = instrumentation->set_state_binary(instrumentation_state, state, length);
+	else
+		ret = instrumentation->apply_state_delta(instrumentation_state, state, length);
+	if (ret)
+	{
+		instrumentation->cleanup(instrumentation_state);
+		return NULL;
+	}
+	return instrumentation_state;
+}
+
+/**
+ * This function makes sure a binary_state_writer_t's buffer has room for more data.
+ * @param writer - the binary_state_writer_t to grow
+ * @param length - the number of bytes that are about to be written
+ * @return - 0 on success, non-zero on failure
+ */
+static int reserve(binary_state_writer_t * writer, size_t length)
+{
+	size_t new_capacity;
+	char * new_buffer;
+
+	if (writer->error)
+		return 1;
+	if (writer->length + length <= writer->capacity)
+		return 0;
+
+	new_capacity = writer->capacity ? writer->capacity : INITIAL_BUFFER_SIZE;
+	while (new_capacity < writer->length + length)
+		new_capacity *= 2;
+	new_buffer = (char *)realloc(writer->buffer, new_capacity);
+	if (!new_buffer)
+	{
+		writer->error = 1;
+		return 1;
+	}
+	writer->buffer = new_buffer;
+	writer->capacity = new_capacity;
+	return 0;
+}
+
+/**
+ * This function starts a binary_state_writer_t by writing a header.
+ * @param writer - the binary_state_writer_t to initialize
+ * @param magic - the magic identifying the kind of state
+ * @param type - the name of the instrumentation writing the state
+ */
+static void write_header(binary_state_writer_t * writer, const char * magic, const char * type)
+{
+	uint8_t header[BINARY_STATE_HEADER_SIZE];
+
+	memset(writer, 0, sizeof(binary_state_writer_t));
+	memset(header, 0, sizeof(header));
+	memcpy(header, magic, BINARY_STATE_MAGIC_LENGTH);
+	put_u32(header + BINARY_STATE_MAGIC_LENGTH, BINARY_STATE_VERSION);
+	strncpy((char *)header + BINARY_STATE_MAGIC_LENGTH + sizeof(uint32_t), type, BINARY_STATE_TYPE_LENGTH);
+	binary_state_write_bytes(writer, header, sizeof(header));
+}
+
+/**
+ * This function starts writing a binary instrumentation state, by writing its header.
+ * @param writer - the binary_state_writer_t to initialize
+ * @param type - the name of the instrumentation writing the state, which must match the type given when it is read
+ */
+void binary_state_writer_init(binary_state_writer_t * writer, const char * type)
+{
+	write_header(writer, BINARY_STATE_MAGIC, type);
+}
+
+/**
+ * This function starts writing a binary delta state, by writing its header and the digest of its baseline.
+ * @param writer - the binary_state_writer_t to initialize
+ * @param type - the name of the instrumentation writing the state, which must match the type given when it is read
+ * @param baseline_digest - the digest of the baseline state file that the delta is against
+ */
+void binary_state_delta_writer_init(binary_state_writer_t * writer, const char * type, uint64_t baseline_digest)
+{
+	write_header(writer, BINARY_STATE_DELTA_MAGIC, type);
+	binary_state_write_u64(writer, baseline_digest);
+}
+
+/**
+ * This function writes raw bytes to a binary instrumentation state.
+ * @param writer - the binary_state_writer_t to write to
+ * @param data - the bytes to write
+ * @param length - the length of the data parameter
+ */
+void binary_state_write_bytes(binary_state_writer_t * writer, const void * data, size_t length)
+{
+	if (!length || reserve(writer, length))
+		return;
+	memcpy(writer->buffer + writer->length, data, length);
+	writer->length += length;
+}
+
+/**
+ * This function writes a fixed size 64-bit integer to a binary instrumentation state, for values such as hashes
+ * that wouldn't be any smaller as a varint.
+ * @param writer - the binary_state_writer_t to write to
+ * @param value - the value to write
+ */
+void binary_state_write_u64(binary_state_writer_t * writer, uint64_t value)
+{
+	uint8_t buffer[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		buffer[i] = (uint8_t)(value >> (i * 8));
+	binary_state_write_bytes(writer, buffer, sizeof(buffer));
+}
+
+/**
+ * This function writes an unsigned LEB128 varint to a binary instrumentation state.
+ * @param writer - the binary_state_writer_t to write to
+ * @param value - the value to write
+ */
+void binary_state_write_varint(binary_state_writer_t * writer, uint64_t value)
+{
+	uint8_t buffer[10];
+	size_t length = 0;
+
+	while (value >= 0x80)
+	{
+		buffer[length++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	buffer[length++] = (uint8_t)value;
+	binary_state_write_bytes(writer, buffer, length);
+}
+
+/**
+ * This function writes a sparse encoded coverage map to a binary instrumentation state.
+ * @param writer - the binary_state_writer_t to write to
+ * @param map - the coverage map to write
+ * @param size - the size of the coverage map
+ * @param fill - the byte value that most of the map is expected to hold, which is encoded as runs
+ */
+void binary_state_write_sparse_map(binary_state_writer_t * writer, const uint8_t * map, size_t size, uint8_t fill)
+{
+	size_t start, run, pos = 0;
+
+	while (pos < size)
+	{
+		start = pos;
+		while (pos < size && map[pos] == fill)
+			pos++;
+		binary_state_write_varint(writer, pos - start);
+
+		//The literal bytes end at the next run of fill bytes that's long enough to be worth encoding as a run, or
+		//that reaches the end of the map
+		start = pos;
+		while (pos < size)
+		{
+			if (map[pos] != fill)
+			{
+				pos++;
+				continue;
+			}
+			for (run = 1; run < MIN_FILL_RUN && pos + run < size && map[pos + run] == fill; run++);
+			if (run == MIN_FILL_RUN || pos + run == size)
+				break;
+			pos += run;
+		}
+		binary_state_write_varint(writer, pos - start);
+		binary_state_write_bytes(writer, map + start, pos - start);
+	}
+}
+
+/**
+ * This function finishes writing a binary instrumentation state.
+ * @param writer - the binary_state_writer_t to finish
+ * @param length - a pointer used to return the length of the binary state
+ * @return - the binary state on success, or NULL on failure.  It should be freed with free.
+ */
+char * binary_state_writer_finish(binary_state_writer_t * writer, size_t * length)
+{
+	if (writer->error)
+	{
+		free(writer->buffer);
+		return NULL;
+	}
+	*length = writer->length;
+	return writer->buffer;
+}
+
+/**
+ * This function starts a binary_state_reader_t by checking the version and type in a state's header.
+ * @param reader - the binary_state_reader_t to initialize
+ * @param state - the binary state, which must be at least as long as the header
+ * @param length - the length of the state parameter
+ * @param type - the name of the instrumentation reading the state
+ * @return - 0 on success, or non-zero if the state wasn't written by the given instrumentation
+ */
+static int read_header(binary_state_reader_t * reader, const char * state, size_t length, const char * type)
+{
+	binary_state_header_t header;
+
+	memset(reader, 0, sizeof(binary_state_reader_t));
+	memcpy(header.magic, state, BINARY_STATE_MAGIC_LENGTH);
+	header.version = get_u32((const uint8_t *)state + BINARY_STATE_MAGIC_LENGTH);
+	memcpy(header.type, state + BINARY_STATE_MAGIC_LENGTH + sizeof(uint32_t), BINARY_STATE_TYPE_LENGTH);
+	if (header.version != BINARY_STATE_VERSION || strncmp(header.type, type, BINARY_STATE_TYPE_LENGTH))
+		return 1;
+
+	reader->buffer = (const uint8_t *)state;
+	reader->length = length;
+	reader->offset = BINARY_STATE_HEADER_SIZE;
+	return 0;
+}
+
+/**
+ * This function starts reading a binary instrumentation state, by checking its header.
+ * @param reader - the binary_state_reader_t to initialize
+ * @param state - the binary instrumentation state
+ * @param length - the length of the state parameter
+ * @param type - the name of the instrumentation reading the state
+ * @return - 0 on success, or non-zero if the state isn't a binary state written by the given instrumentation
+ */
+int binary_state_reader_init(binary_state_reader_t * reader, const char * state, size_t length, const char * type)
+{
+	if (!is_binary_state(state, length))
+		return 1;
+	return read_header(reader, state, length, type);
+}
+
+/**
+ * This function starts reading a binary delta state, by checking its header and skipping the baseline's digest.
+ * @param reader - the binary_state_reader_t to initialize
+ * @param state - the binary delta state
+ * @param length - the length of the state parameter
+ * @param type - the name of the instrumentation reading the state
+ * @return - 0 on success, or non-zero if the state isn't a delta state written by the given instrumentation
+ */
+int binary_state_delta_reader_init(binary_state_reader_t * reader, const char * state, size_t length, const char * type)
+{
+	if (!is_binary_state_delta(state, length) || read_header(reader, state, length, type))
+		return 1;
+	binary_state_read_u64(reader);
+	return 0;
+}
+
+/**
+ * This function reads raw bytes from a binary instrumentation state.
+ * @param reader - the binary_state_reader_t to read from
+ * @param data - a buffer used to return the bytes, which is zeroed if there aren't enough bytes left
+ * @param length - the number of bytes to read
+ */
+void binary_state_read_bytes(binary_state_reader_t * reader, void * data, size_t length)
+{
+	if (reader->error || length > reader->length - reader->offset)
+	{
+		reader->error = 1;
+		memset(data, 0, length);
+		return;
+	}
+	memcpy(data, reader->buffer + reader->offset, length);
+	reader->offset += length;
+}
+
+/**
+ * This function reads a fixed size 64-bit integer from a binary instrumentation state.
+ * @param reader - the binary_state_reader_t to read from
+ * @return - the value that was read
+ */
+uint64_t binary_state_read_u64(binary_state_reader_t * reader)
+{
+	uint8_t buffer[8];
+	uint64_t value = 0;
+	int i;
+
+	binary_state_read_bytes(reader, buffer, sizeof(buffer));
+	for (i = 0; i < 8; i++)
+		value |= (uint64_t)buffer[i] << (i * 8);
+	return value;
+}
+
+/**
+ * This function reads an unsigned LEB128 varint from a binary instrumentation state.
+ * @param reader - the binary_state_reader_t to read from
+ * @return - the value that was read
+ */
+uint64_t binary_state_read_varint(binary_state_reader_t * reader)
+{
+	uint64_t value = 0;
+	uint8_t byte;
+	int shift;
+
+	for (shift = 0; shift < 64; shift += 7)
+	{
+		binary_state_read_bytes(reader, &byte, 1);
+		if (reader->error)
+			return 0;
+		value |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return value;
+	}
+	reader->error = 1;
+	return 0;
+}
+
+/**
+ * This function reads a sparse encoded coverage map from a binary instrumentation state.
+ * @param reader - the binary_state_reader_t to read from
+ * @param map - a buffer used to return the coverage map
+ * @param size - the size of the coverage map
+ * @param fill - the byte value that the map's runs hold, which must match the one it was written with
+ */
+void binary_state_read_sparse_map(binary_state_reader_t * reader, uint8_t * map, size_t size, uint8_t fill)
+{
+	uint64_t fill_length, literal_length;
+	size_t pos = 0;
+
+	memset(map, fill, size);
+	while (pos < size && !reader->error)
+	{
+		fill_length = binary_state_read_varint(reader);
+		if (fill_length > size - pos)
+			break;
+		pos += (size_t)fill_length;
+		literal_length = binary_state_read_varint(reader);
+		if (literal_length > size - pos || (!fill_length && !literal_length))
+			break;
+		binary_state_read_bytes(reader, map + pos, (size_t)literal_length);
+		pos += (size_t)literal_length;
+	}
+	if (pos != size)
+		reader->error = 1;
+}
+
+/**
+ * This function finishes reading a binary instrumentation state.
+ * @param reader - the binary_state_reader_t to finish
+ * @return - 0 if the whole state was read successfully, non-zero otherwise
+ */
+int binary_state_reader_finish(binary_state_reader_t * reader)
+{
+	return reader->error || reader->offset != reader->length;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "instrumentation.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+//Instrumentation states can be dumped in a compact binary format, rather than JSON, by instrumentations that
+//implement get_state_binary and set_state_binary.  A binary state starts with a header (BINARY_STATE_HEADER_SIZE
+//bytes: char magic[4], uint32_t version, and char type[16], the NUL padded name of the instrumentation that wrote
+//the state), followed by the instrumentation specific data.  All integers are little endian, and each header field
+//is written separately, so the layout doesn't depend on the compiler's struct padding.  Most other integers are
+//written as unsigned LEB128 varints.  Coverage maps are sparse encoded: the map is written as pairs of varints giving the length of a run of
+//an instrumentation specific fill byte (usually the value of an untouched map entry), and the length of a run of
+//literal bytes, followed by the literal bytes themselves.
+//
+//A delta state holds only the coverage that was found after starting from a baseline state.  It has the same
+//header with the BINARY_STATE_DELTA_MAGIC magic, followed by the 64-bit digest of the baseline state file it was
+//made against (from binary_state_digest) and then the instrumentation specific delta.  Applying a delta adds its
+//coverage to a state, so deltas can be applied to any state, not just their baseline.
+
+#define BINARY_STATE_MAGIC        "KBIS"
+#define BINARY_STATE_DELTA_MAGIC  "KBSD"
+#define BINARY_STATE_MAGIC_LENGTH 4
+#define BINARY_STATE_VERSION      1
+#define BINARY_STATE_TYPE_LENGTH  16
+
+//The size of the header in a binary state
+#define BINARY_STATE_HEADER_SIZE  (BINARY_STATE_MAGIC_LENGTH + sizeof(uint32_t) + BINARY_STATE_TYPE_LENGTH)
+
+//The decoded header
+struct binary_state_header
+{
+	char magic[BINARY_STATE_MAGIC_LENGTH];
+	uint32_t version;
+	char type[BINARY_STATE_TYPE_LENGTH];  //The name of the instrumentation that wrote the state, NUL padded
+};
+typedef struct binary_state_header binary_state_header_t;
+
+struct binary_state_writer
+{
+	char * buffer;
+	size_t length;
+	size_t capacity;
+	int error;       //Set if memory couldn't be allocated, in which case the writes are ignored
+};
+typedef struct binary_state_writer binary_state_writer_t;
+
+struct binary_state_reader
+{
+	const uint8_t * buffer;
+	size_t length;
+	size_t offset;
+	int error;       //Set if the state is truncated or corrupt, in which case the reads return 0
+};
+typedef struct binary_state_reader binary_state_reader_t;
+
+int is_binary_state(const char * state, size_t length);
+int is_binary_state_delta(const char * state, size_t length);
+uint64_t binary_state_digest(const char * state, size_t length);
+int binary_state_delta_digest(const char * state, size_t length, uint64_t * baseline_digest);
+void * load_any_state(instrumentation_t * instrumentation, void *(*create)(char *, char *), char * options, char * state, size_t length);
+
+void binary_state_writer_init(binary_state_writer_t * writer, const char * type);
+void binary_state_delta_writer_init(binary_state_writer_t * writer, const char * type, uint64_t baseline_digest);
+void binary_state_write_bytes(binary_state_writer_t * writer, const void * data, size_t length);
+void binary_state_write_u64(binary_state_writer_t * writer, uint64_t value);
+void binary_state_write_varint(binary_state_writer_t * writer, uint64_t value);
+void binary_state_write_sparse_map(binary_state_writer_t * writer, const uint8_t * map, size_t size, uint8_t fill);
+char * binary_state_writer_finish(binary_state_writer_t * writer, size_t * length);
+
+int binary_state_reader_init(binary_state_reader_t * reader, const char * state, size_t length, const char * type);
+int binary_state_delta_reader_init(binary_state_reader_t * reader, const char * state, size_t length, const char * type);
+void binary_state_read_bytes(binary_state_reader_t * reader, void * data, size_t length);
+uint64_t binary_state_read_u64(binary_state_reader_t * reader);
+uint64_t binary_state_read_varint(binary_state_reader_t * reader);
+void binary_state_read_sparse_map(binary_state_reader_t * reader, uint8_t * map, size_t size, uint8_t fill);
+int binary_state_reader_finish(binary_state_reader_t * reader);
@@ -1130,6 +1130,58 @@ void * dynamorio_create(char * options, char * state)
 	return dynamorio_state;
 }
 
+/**
+ * This function allocates an instrumentation specific state object that only holds coverage information, for tools that merge
+ * or inspect states without running a target.  Only the per_module_coverage and coverage_modules options are parsed, and
+ * DynamoRIO and WinAFL don't need to be installed, but the returned state can't be passed to dynamorio_enable.
+ * @param options - a JSON string that contains the instrumentation specific string of options
+ * @param state - an instrumentation specific JSON string previously returned from dynamorio_get_state that should be loaded, or NULL
+ * @return - An instrumentation specific state object on success or NULL on failure
+ */
+void * dynamorio_load_state(char * options, char * state)
+{
+	dynamorio_state_t * dynamorio_state;
+	target_module_t * target_module;
+	size_t i;
+
+	dynamorio_state = (dynamorio_state_t *)calloc(1, sizeof(dynamorio_state_t));
+	if (!dynamorio_state)
+		return NULL;
+
+	if (options)
+	{
+		PARSE_OPTION_INT(dynamorio_state, options, per_module_coverage, "per_module_coverage", dynamorio_cleanup);
+		PARSE_OPTION_ARRAY(dynamorio_state, options, module_names, num_modules, "coverage_modules", dynamorio_cleanup);
+	}
+	if (dynamorio_state->per_module_coverage && !dynamorio_state->num_modules)
+	{
+		ERROR_MSG("The coverage_modules option is required to load a per module coverage state");
+		dynamorio_cleanup(dynamorio_state);
+		return NULL;
+	}
+
+	for (i = 0; i < dynamorio_state->num_modules; i++)
+	{
+		target_module = (target_module_t *)calloc(1, sizeof(target_module_t));
+		if (!target_module)
+		{
+			dynamorio_cleanup(dynamorio_state);
+			return NULL;
+		}
+		target_module->index = i;
+		target_module->next = dynamorio_state->modules;
+		dynamorio_state->modules = target_module;
+	}
+
+	if (state && dynamorio_set_state(dynamorio_state, state))
+	{
+		dynamorio_cleanup(dynamorio_state);
+		return NULL;
+	}
+
+	return dynamorio_state;
+}
+
 /**
  * This function cleans up all resources with the passed in instrumentation state.
  * @param instrumentation_state - an instrumentation specific state object previously created by the dynamorio_create function
@@ -1171,25 +1223,19 @@ void dynamorio_cleanup(void * instrumentation_state)
 }
 
 /**
- * This function merges the coverage information from two instrumentation states.
- * @param instrumentation_state - an instrumentation specific state object previously created by the dynamorio_create function
- * @param other_instrumentation_state - an instrumentation specific state object previously created by the dynamorio_create function
- * @return - An instrumentation specific state object that contains the combination of both of the passed in instrumentation states
- * on success, or NULL on failure
+ * This function checks whether two instrumentation states track the same modules, and can be merged.
+ * @param first - an instrumentation specific state object previously created by the dynamorio_create function
+ * @param second - an instrumentation specific state object previously created by the dynamorio_create function
+ * @return - 1 if the states can be merged, 0 otherwise
  */
-void * dynamorio_merge(void * instrumentation_state, void * other_instrumentation_state)
+static int states_are_compatible(dynamorio_state_t * first, dynamorio_state_t * second)
 {
-	target_module_t * ret_module, * new_module;
 	size_t i, j;
 	int found;
-	dynamorio_state_t * ret;
-	dynamorio_state_t * first = (dynamorio_state_t *)instrumentation_state;
-	dynamorio_state_t * second = (dynamorio_state_t *)other_instrumentation_state;
 
-	//Check that the instrumenation states are similar enough
 	if (first->per_module_coverage != second->per_module_coverage
 		|| first->num_modules != second->num_modules)
-		return NULL;
+		return 0;
 
 	for (i = 0; i < first->num_modules; i++)
 	{
@@ -1200,36 +1246,93 @@ void * dynamorio_merge(void * instrumentation_state, void * other_instrumentatio
 				found = 1;
 		}
 		if (!found)
-			return NULL;
+			return 0;
 	}
+	return 1;
+}
 
-	ret = copy_state(first);
-	if (!ret)
-		return NULL;
+/**
+ * This function merges the coverage information from one instrumentation state into another.  The states must have been
+ * checked with states_are_compatible.
+ * @param dest - the instrumentation state to merge the coverage information into
+ * @param src - the instrumentation state to merge the coverage information from
+ */
+static void merge_state_into(dynamorio_state_t * dest, dynamorio_state_t * src)
+{
+	target_module_t * dest_module, * src_module;
 
-	if (ret->per_module_coverage)
+	if (dest->per_module_coverage)
 	{
-		FOREACH_MODULE(ret_module, ret)
+		FOREACH_MODULE(dest_module, dest)
 		{
-			FOREACH_MODULE(new_module, second)
+			FOREACH_MODULE(src_module, src)
 			{
-				if (!strcmp(ret->module_names[ret_module->index], second->module_names[new_module->index]))
+				if (!strcmp(dest->module_names[dest_module->index], src->module_names[src_module->index]))
 				{
-					merge_bitmaps(ret_module->virgin_bits, new_module->virgin_bits);
+					merge_bitmaps(dest_module->virgin_bits, src_module->virgin_bits);
 					//We don't really need to track these, they're not relevant for merged instrumentations
-					ret_module->last_path_was_new = ret_module->last_shm_hash = 0;
+					dest_module->last_path_was_new = dest_module->last_shm_hash = 0;
 				}
 			}
 		}
 	}
 	else
 	{
-		merge_bitmaps(ret->virgin_bits, second->virgin_bits);
-		ret->last_path_was_new = ret->last_shm_hash = 0;
+		merge_bitmaps(dest->virgin_bits, src->virgin_bits);
+		dest->last_path_was_new = dest->last_shm_hash = 0;
 	}
+}
+
+/**
+ * This function merges the coverage information from two instrumentation states.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the dynamorio_create function
+ * @param other_instrumentation_state - an instrumentation specific state object previously created by the dynamorio_create function
+ * @return - An instrumentation specific state object that contains the combination of both of the passed in instrumentation states
+ * on success, or NULL on failure
+ */
+void * dynamorio_merge(void * instrumentation_state, void * other_instrumentation_state)
+{
+	dynamorio_state_t * ret;
+	dynamorio_state_t * first = (dynamorio_state_t *)instrumentation_state;
+	dynamorio_state_t * second = (dynamorio_state_t *)other_instrumentation_state;
+
+	//Check that the instrumenation states are similar enough
+	if (!states_are_compatible(first, second))
+		return NULL;
+
+	ret = copy_state(first);
+	if (!ret)
+		return NULL;
+	merge_state_into(ret, second);
 	return ret;
 }
 
+/**
+ * This function merges the coverage information from several instrumentation states into the first one, without allocating a new
+ * state for each merge.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the dynamorio_create function.  The
+ * other states are merged into this one.
+ * @param other_instrumentation_states - an array of instrumentation specific state objects previously created by the dynamorio_create
+ * function.  They are not modified.
+ * @param num_states - the number of states in other_instrumentation_states
+ * @return - 0 on success, non-zero on failure
+ */
+int dynamorio_merge_many(void * instrumentation_state, void ** other_instrumentation_states, int num_states)
+{
+	dynamorio_state_t * state = (dynamorio_state_t *)instrumentation_state;
+	int i;
+
+	//Check all of the states first, so a failure doesn't leave this state partially merged
+	for (i = 0; i < num_states; i++)
+	{
+		if (!states_are_compatible(state, (dynamorio_state_t *)other_instrumentation_states[i]))
+			return 1;
+	}
+	for (i = 0; i < num_states; i++)
+		merge_state_into(state, (dynamorio_state_t *)other_instrumentation_states[i]);
+	return 0;
+}
+
 /**
  * This function returns the state information holding the previous execution path info.  The returned value can later be passed to
  * dynamorio_create or dynamorio_set_state to load the state.
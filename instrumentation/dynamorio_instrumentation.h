@@ -6,8 +6,10 @@
 #include "winafl_config.h"
 
 void * dynamorio_create(char * options, char * state);
+void * dynamorio_load_state(char * options, char * state);
 void dynamorio_cleanup(void * instrumentation_state);
 void * dynamorio_merge(void * instrumentation_state, void * other_instrumentation_state);
+int dynamorio_merge_many(void * instrumentation_state, void ** other_instrumentation_states, int num_states);
 char * dynamorio_get_state(void * instrumentation_state);
 void dynamorio_free_state(char * state);
 int dynamorio_set_state(void * instrumentation_state, char * state);
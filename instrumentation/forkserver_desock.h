@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+//Desocketed fuzzing lets the fork server library stand in for the network.  Instead of sending
+//input over a real connection, the driver writes the packets into a shared memory region, and
+//the fork server library's socket hooks hand them to the target as if a client had connected.
+//Anything the target sends back is written to the same region.
+
+//The environment variable used to pass the shared memory's file descriptor to the target
+#define DESOCK_FD_VAR   "KILLERBEEZ_DESOCK_FD"
+//The environment variable used to pass the port to desocket to the target.  If it is not set,
+//every socket that the target binds to an IPv4 or IPv6 address is desocketed
+#define DESOCK_PORT_VAR "KILLERBEEZ_DESOCK_PORT"
+
+#define DESOCK_MAX_PACKETS 256
+#define DESOCK_INPUT_SIZE  (1024 * 1024)
+#define DESOCK_OUTPUT_SIZE (64 * 1024)
+
+struct desock_shm {
+  uint32_t num_packets;                        //The number of packets in the input buffer
+  uint32_t packet_lengths[DESOCK_MAX_PACKETS]; //The length of each packet, stored back to back in input
+  uint32_t output_length;                      //The number of bytes the target sent, which may
+                                               //be more than fit in the output buffer
+  char input[DESOCK_INPUT_SIZE];
+  char output[DESOCK_OUTPUT_SIZE];
+};
+typedef struct desock_shm desock_shm_t;
@@ -3,6 +3,7 @@
 
 #include "forkserver.h"
 #include "forkserver_config.h"
+#include "forkserver_internal.h"
 
 #if !DISABLE_HOOKING
 
@@ -58,7 +59,10 @@ static orig_function_type orig_main = 0;
 
 void * fake_main(void * a0, void * a1, void * a2, void * a3, void * a4, void * a5, void * a6, void * a7)
 {
-  __forkserver_init();
+  if(!forkserver_use_network_startup()) {
+    __forkserver_init();
+    init_done = 1;
+  }
   return orig_main(a0, a1, a2, a3, a4, a5, a6, a7);
 }
 #endif
@@ -78,7 +82,7 @@ void * NEW_FUNCTION(void * a0, void * a1, void * a2, void * a3, void * a4, void
 #else //We're hooking a custom function
 
 #if RUN_BEFORE_CUSTOM_FUNCTION //If we want to run before the hooked function
-  if(!init_done) {
+  if(!init_done && !forkserver_use_network_startup()) {
     __forkserver_init();
     init_done = 1;
   }
@@ -87,7 +91,7 @@ void * NEW_FUNCTION(void * a0, void * a1, void * a2, void * a3, void * a4, void
   ret = orig_func(a0, a1, a2, a3, a4, a5, a6, a7);
 
 #if !RUN_BEFORE_CUSTOM_FUNCTION //If we want to run after the hooked function
-  if(!init_done) {
+  if(!init_done && !forkserver_use_network_startup()) {
     __forkserver_init();
     init_done = 1;
   }
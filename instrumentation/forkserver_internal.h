@@ -2,6 +2,7 @@
 
 #define PERSIST_MAX_VAR "PERSISTENCE_MAX_CNT"
 #define DEFER_ENV_VAR   "DEFER_ENV_VAR"
+#define NETWORK_STARTUP_VAR "KILLERBEEZ_NETWORK_STARTUP"
 
 //Designated file descriptors for read/write to the forkserver
 //and target process
@@ -34,7 +35,7 @@ typedef struct forkserver forkserver_t;
 //These functions control all interactions with the forkserver, sending the
 //commands listed above
 void fork_server_init(forkserver_t * fs, char * target_path, char ** argv, int use_forkserver_library,
-  int persistence_max_cnt, int needs_stdin_fd);
+  int persistence_max_cnt, int needs_stdin_fd, int network_startup);
 int fork_server_exit(forkserver_t * fs);
 int fork_server_fork(forkserver_t * fs);
 int fork_server_fork_run(forkserver_t * fs);
@@ -42,3 +43,7 @@ int fork_server_run(forkserver_t * fs);
 int fork_server_get_status(forkserver_t * fs, int wait);
 int fork_server_get_pending_status(forkserver_t * fs, int wait);
 
+//Used by the fork server library's function hooks to check whether the fork server should be
+//started from the network hooks (see forkserver_network.c) rather than the hooked function
+int forkserver_use_network_startup(void);
+
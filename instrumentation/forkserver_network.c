@@ -0,0 +1,687 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "forkserver.h"
+#include "forkserver_config.h"
+#include "forkserver_desock.h"
+#include "forkserver_internal.h"
+
+//////////////////////////////////////////////////////////////
+//Types, Function Prototypes, and Globals ////////////////////
+//////////////////////////////////////////////////////////////
+
+//Declares and resolves orig_<name>, a pointer to the next definition of a function we've hooked
+#define GET_ORIG(name)                                       \
+  static __typeof__(name) * orig_##name = 0;                 \
+  if(!orig_##name)                                           \
+    orig_##name = (__typeof__(name) *)dlsym(RTLD_NEXT, #name)
+
+//Whether the fork server should wait for the target's first accept()/recv, -1 if we haven't checked yet
+static int network_startup = -1;
+
+//Whether the network hooks have started the fork server
+static int network_init_done = 0;
+
+//Whether the target has a socket that can receive input, i.e. a listening stream socket or a
+//bound datagram socket.  Until it does, waiting in poll/select/epoll is for something else.
+static int network_listening = 0;
+
+//The kinds of file descriptors that are desocketed
+#define DESOCK_NONE       0
+#define DESOCK_LISTENER   1 //A bound stream socket that the target will accept a connection from
+#define DESOCK_CONNECTION 2 //The connection returned from accept()
+#define DESOCK_DATAGRAM   3 //A bound datagram socket
+
+//The highest file descriptor that can be desocketed
+#define DESOCK_MAX_FDS 1024
+
+//The port reported for the fake client
+#define DESOCK_CLIENT_PORT 40000
+
+//The shared memory holding the input and the target's output, or NULL if desocketing is disabled
+static desock_shm_t * desock_shm = NULL;
+
+//Whether we've checked the environment to see if desocketing was requested
+static int desock_checked = 0;
+
+//The port to desocket, or 0 to desocket every bound port
+static int desock_port = 0;
+
+//The kind of each desocketed file descriptor, and the other end of the socketpair that replaced it
+static char desock_kind[DESOCK_MAX_FDS];
+static int desock_peer[DESOCK_MAX_FDS];
+
+//The address the target bound its desocketed socket to
+static struct sockaddr_storage desock_address;
+static socklen_t desock_address_length = 0;
+
+//The packet the target is reading, how much of it has been read, and its offset in the input buffer
+static uint32_t desock_packet = 0;
+static uint32_t desock_packet_offset = 0;
+static uint32_t desock_input_offset = 0;
+
+//Whether the target has accepted its connection, and whether that connection is still open
+static int desock_accepted = 0;
+static volatile int desock_connection_open = 0;
+
+//A pipe whose write end is closed when the target closes its connection, so that a thread waiting
+//in accept() for the next connection can block on the read end until then
+static int desock_control[2] = { -1, -1 };
+
+//////////////////////////////////////////////////////////////
+//Network Startup ////////////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+//When network startup is requested, the fork server is started the first time the target
+//accepts a connection, waits for one of its sockets to be ready after it has started listening,
+//or receives on a datagram socket.  By then the target has already created, bound, and listened on its socket, so each
+//forked child inherits a socket that is ready to go, and the fuzzer doesn't need to wait for the
+//port to open on every run.
+
+/**
+ * This function determines whether the fuzzer asked for the fork server to be started once the target
+ * is ready to receive input from the network, rather than at the hooked function.
+ * @return - 1 if the fork server should be started from the network hooks, 0 otherwise
+ */
+int forkserver_use_network_startup(void)
+{
+  if(network_startup == -1)
+    network_startup = getenv(NETWORK_STARTUP_VAR) != NULL;
+  return network_startup;
+}
+
+/**
+ * This function determines the type of a socket.
+ * @param fd - the socket to check
+ * @return - the socket's type, i.e. SOCK_STREAM or SOCK_DGRAM, or -1 if fd isn't a socket
+ */
+static int socket_type(int fd)
+{
+  int type;
+  socklen_t length = sizeof(type);
+  GET_ORIG(getsockopt);
+
+  if(fd >= 0 && fd < DESOCK_MAX_FDS && desock_kind[fd] != DESOCK_NONE)
+    return desock_kind[fd] == DESOCK_DATAGRAM ? SOCK_DGRAM : SOCK_STREAM;
+  if(orig_getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &length))
+    return -1;
+  return type;
+}
+
+/**
+ * This function starts the fork server, if network startup was requested and it hasn't been started yet.
+ * @param datagram_fd - if not -1, only start the fork server if this fd is a datagram socket
+ */
+static void network_startup_init(int datagram_fd)
+{
+#if !DISABLE_HOOKING
+  if(network_init_done || !forkserver_use_network_startup())
+    return;
+  if(datagram_fd != -1 && socket_type(datagram_fd) != SOCK_DGRAM)
+    return;
+
+  network_init_done = 1;
+  __forkserver_init();
+#endif
+}
+
+/**
+ * This function starts the fork server from the poll/select/epoll hooks, but only once the target has
+ * a socket that input can arrive on.  Targets often wait on pipes, timers, or their own helper
+ * connections long before they set up the socket being fuzzed.
+ */
+static void network_startup_wait(void)
+{
+  if(network_listening)
+    network_startup_init(-1);
+}
+
+/**
+ * This function records a successful bind() of a datagram socket, which can receive input as soon as
+ * it's bound.
+ * @param sockfd - the socket that was bound
+ * @param ret - the return value of bind()
+ * @return - the ret parameter
+ */
+static int network_track_bind(int sockfd, int ret)
+{
+  if(!ret && socket_type(sockfd) == SOCK_DGRAM)
+    network_listening = 1;
+  return ret;
+}
+
+//////////////////////////////////////////////////////////////
+//Desocketing ////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+//When the fuzzer passes a desock shared memory region, sockets that the target binds are replaced
+//with one end of a socketpair, so the file descriptor stays valid for fcntl, poll, select, and
+//epoll.  A byte is left in the other end, so these fds always look readable.  The target's reads
+//are served from the packets in shared memory, one packet at a time, so packet boundaries are the
+//same on every run, and its writes are copied back to shared memory.  Only one connection is made
+//per input; once the target closes it and asks for another, the target process exits.
+
+/**
+ * This function maps the desock shared memory, if the fuzzer requested desocketing.
+ * @return - 1 if desocketing is enabled, 0 otherwise
+ */
+static int desock_enabled(void)
+{
+  char * value;
+  void * shm;
+  int fd;
+  GET_ORIG(close);
+
+  if(!desock_checked) {
+    desock_checked = 1;
+    value = getenv(DESOCK_FD_VAR);
+    if(value) {
+      fd = atoi(value);
+      shm = mmap(NULL, sizeof(desock_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if(shm != MAP_FAILED)
+        desock_shm = (desock_shm_t *)shm;
+      orig_close(fd);
+
+      value = getenv(DESOCK_PORT_VAR);
+      if(value)
+        desock_port = atoi(value);
+    }
+  }
+  return desock_shm != NULL;
+}
+
+/**
+ * This function determines whether a file descriptor has been desocketed.
+ * @param fd - the file descriptor to check
+ * @return - the DESOCK_ kind of the file descriptor, or DESOCK_NONE if it's not desocketed
+ */
+static inline int desock_fd_kind(int fd)
+{
+  if(fd < 0 || fd >= DESOCK_MAX_FDS)
+    return DESOCK_NONE;
+  return desock_kind[fd];
+}
+
+/**
+ * This function creates a file descriptor that stands in for a socket.
+ * @param fd - the file descriptor to replace, or -1 to allocate a new one
+ * @param kind - the DESOCK_ kind of the new file descriptor
+ * @return - the new file descriptor, or -1 on failure
+ */
+static int desock_replace(int fd, int kind)
+{
+  int pair[2], flags, fd_flags;
+  GET_ORIG(write);
+  GET_ORIG(close);
+
+  if(socketpair(AF_UNIX, SOCK_STREAM, 0, pair))
+    return -1;
+
+  if(orig_write(pair[1], "", 1) != 1 || pair[0] >= DESOCK_MAX_FDS || pair[1] >= DESOCK_MAX_FDS) {
+    orig_close(pair[0]);
+    orig_close(pair[1]);
+    errno = EMFILE;
+    return -1;
+  }
+  fcntl(pair[1], F_SETFD, FD_CLOEXEC);
+
+  if(fd >= 0) {
+    //Carry over anything the target set on the original socket, such as O_NONBLOCK
+    flags = fcntl(fd, F_GETFL);
+    fd_flags = fcntl(fd, F_GETFD);
+    if(dup2(pair[0], fd) < 0) {
+      orig_close(pair[0]);
+      orig_close(pair[1]);
+      return -1;
+    }
+    orig_close(pair[0]);
+    if(flags >= 0)
+      fcntl(fd, F_SETFL, flags);
+    if(fd_flags >= 0)
+      fcntl(fd, F_SETFD, fd_flags);
+  } else
+    fd = pair[0];
+
+  desock_kind[fd] = kind;
+  desock_peer[fd] = pair[1];
+  return fd;
+}
+
+/**
+ * This function returns the address of the fake client that sent the input.
+ * @param addr - a buffer used to return the client address
+ * @param addrlen - the length of the addr buffer, updated to the full length of the address
+ */
+static void desock_client_address(struct sockaddr * addr, socklen_t * addrlen)
+{
+  struct sockaddr_in6 client6;
+  struct sockaddr_in client4;
+  void * client;
+  socklen_t length;
+
+  if(!addr || !addrlen)
+    return;
+
+  if(desock_address.ss_family == AF_INET6) {
+    memset(&client6, 0, sizeof(client6));
+    client6.sin6_family = AF_INET6;
+    client6.sin6_addr = in6addr_loopback;
+    client6.sin6_port = htons(DESOCK_CLIENT_PORT);
+    client = &client6;
+    length = sizeof(client6);
+  } else {
+    memset(&client4, 0, sizeof(client4));
+    client4.sin_family = AF_INET;
+    client4.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    client4.sin_port = htons(DESOCK_CLIENT_PORT);
+    client = &client4;
+    length = sizeof(client4);
+  }
+
+  memcpy(addr, client, *addrlen < length ? *addrlen : length);
+  *addrlen = length;
+}
+
+/**
+ * This function hands the target a connection on a desocketed listening socket.
+ * @param sockfd - the listening socket
+ * @param addr - optionally, a buffer used to return the client address
+ * @param addrlen - the length of the addr buffer
+ * @param flags - SOCK_NONBLOCK and/or SOCK_CLOEXEC, as given to accept4
+ * @return - the file descriptor of the connection, or -1 on failure
+ */
+static int desock_accept(int sockfd, struct sockaddr * addr, socklen_t * addrlen, int flags)
+{
+  struct pollfd control;
+  int fd;
+  GET_ORIG(poll);
+  GET_ORIG(close);
+
+  if(desock_accepted) {
+    //Wait for the target to finish with the first connection.  Nonblocking servers will come
+    //back to accept() since the listening socket always looks readable, so just tell them to
+    //try again later.  Otherwise, another thread is handling the connection, so block until it
+    //closes the connection and the control pipe's write end with it.
+    while(desock_connection_open) {
+      if(fcntl(sockfd, F_GETFL) & O_NONBLOCK) {
+        errno = EAGAIN;
+        return -1;
+      }
+      control.fd = desock_control[0];
+      control.events = POLLIN;
+      if(orig_poll(&control, 1, -1) < 0 && errno != EINTR)
+        break;
+    }
+    exit(0);
+  }
+
+  if(pipe(desock_control))
+    return -1;
+  fcntl(desock_control[0], F_SETFD, FD_CLOEXEC);
+  fcntl(desock_control[1], F_SETFD, FD_CLOEXEC);
+
+  fd = desock_replace(-1, DESOCK_CONNECTION);
+  if(fd < 0) {
+    orig_close(desock_control[0]);
+    orig_close(desock_control[1]);
+    desock_control[0] = desock_control[1] = -1;
+    return -1;
+  }
+  if(flags & SOCK_NONBLOCK)
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  if(flags & SOCK_CLOEXEC)
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  desock_accepted = 1;
+  desock_connection_open = 1;
+  desock_client_address(addr, addrlen);
+  return fd;
+}
+
+/**
+ * This function reads the next part of the input for the target.  A single read never crosses a
+ * packet boundary, and a datagram socket reads one whole packet at a time.
+ * @param fd - the desocketed file descriptor being read
+ * @param iov - an array of buffers to read into
+ * @param iovcnt - the number of buffers in iov
+ * @param flags - the MSG_ flags passed to recv, only MSG_PEEK is used
+ * @param truncated - optionally, a pointer used to return whether part of a datagram was discarded
+ * @return - the number of bytes read, 0 if the input is done, or -1 on failure
+ */
+static ssize_t desock_recv(int fd, const struct iovec * iov, int iovcnt, int flags, int * truncated)
+{
+  uint32_t num_packets, remaining, copied = 0, chunk, consumed;
+  int i;
+
+  if(desock_kind[fd] == DESOCK_LISTENER) {
+    errno = ENOTCONN;
+    return -1;
+  }
+
+  //Skip over any packets the target has finished with
+  num_packets = desock_shm->num_packets < DESOCK_MAX_PACKETS ? desock_shm->num_packets : DESOCK_MAX_PACKETS;
+  while(desock_packet < num_packets && desock_packet_offset >= desock_shm->packet_lengths[desock_packet]) {
+    desock_packet++;
+    desock_packet_offset = 0;
+  }
+
+  if(desock_packet >= num_packets) {
+    //There won't be another datagram, so rather than wait forever, we're done
+    if(desock_kind[fd] == DESOCK_DATAGRAM)
+      exit(0);
+    return 0;
+  }
+
+  remaining = desock_shm->packet_lengths[desock_packet] - desock_packet_offset;
+  if(remaining > DESOCK_INPUT_SIZE - desock_input_offset)
+    remaining = DESOCK_INPUT_SIZE - desock_input_offset;
+
+  for(i = 0; i < iovcnt && copied < remaining; i++) {
+    chunk = remaining - copied < iov[i].iov_len ? remaining - copied : iov[i].iov_len;
+    memcpy(iov[i].iov_base, desock_shm->input + desock_input_offset + copied, chunk);
+    copied += chunk;
+  }
+
+  if(truncated)
+    *truncated = desock_kind[fd] == DESOCK_DATAGRAM && copied < remaining;
+
+  if(!(flags & MSG_PEEK)) {
+    //The rest of a datagram is discarded if the target's buffer is too small
+    consumed = desock_kind[fd] == DESOCK_DATAGRAM ? remaining : copied;
+    desock_input_offset += consumed;
+    desock_packet_offset += consumed;
+  }
+  return copied;
+}
+
+/**
+ * This function records data that the target sent on a desocketed file descriptor.
+ * @param fd - the desocketed file descriptor being written
+ * @param iov - an array of buffers to write
+ * @param iovcnt - the number of buffers in iov
+ * @return - the number of bytes written, or -1 on failure
+ */
+static ssize_t desock_send(int fd, const struct iovec * iov, int iovcnt)
+{
+  ssize_t total = 0;
+  uint32_t offset;
+  size_t chunk;
+  int i;
+
+  if(desock_kind[fd] == DESOCK_LISTENER) {
+    errno = ENOTCONN;
+    return -1;
+  }
+
+  for(i = 0; i < iovcnt; i++) {
+    offset = desock_shm->output_length;
+    if(offset < DESOCK_OUTPUT_SIZE) {
+      chunk = DESOCK_OUTPUT_SIZE - offset < iov[i].iov_len ? DESOCK_OUTPUT_SIZE - offset : iov[i].iov_len;
+      memcpy(desock_shm->output + offset, iov[i].iov_base, chunk);
+    }
+    desock_shm->output_length += iov[i].iov_len;
+    total += iov[i].iov_len;
+  }
+  return total;
+}
+
+//////////////////////////////////////////////////////////////
+//Function Hooking ///////////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+int bind(int sockfd, const struct sockaddr * addr, socklen_t addrlen)
+{
+  int type, port;
+  GET_ORIG(bind);
+
+  if(!desock_enabled() || sockfd < 0 || sockfd >= DESOCK_MAX_FDS || !addr || addrlen > sizeof(desock_address))
+    return network_track_bind(sockfd, orig_bind(sockfd, addr, addrlen));
+
+  if(addr->sa_family == AF_INET)
+    port = ntohs(((const struct sockaddr_in *)addr)->sin_port);
+  else if(addr->sa_family == AF_INET6)
+    port = ntohs(((const struct sockaddr_in6 *)addr)->sin6_port);
+  else
+    return network_track_bind(sockfd, orig_bind(sockfd, addr, addrlen));
+
+  type = socket_type(sockfd);
+  if((desock_port && port != desock_port) || (type != SOCK_STREAM && type != SOCK_DGRAM))
+    return network_track_bind(sockfd, orig_bind(sockfd, addr, addrlen));
+
+  if(desock_replace(sockfd, type == SOCK_DGRAM ? DESOCK_DATAGRAM : DESOCK_LISTENER) < 0)
+    return -1;
+  memcpy(&desock_address, addr, addrlen);
+  desock_address_length = addrlen;
+  return network_track_bind(sockfd, 0);
+}
+
+int listen(int sockfd, int backlog)
+{
+  int ret = 0;
+  GET_ORIG(listen);
+  if(desock_fd_kind(sockfd) == DESOCK_NONE)
+    ret = orig_listen(sockfd, backlog);
+  if(!ret)
+    network_listening = 1;
+  return ret;
+}
+
+int accept(int sockfd, struct sockaddr * addr, socklen_t * addrlen)
+{
+  GET_ORIG(accept);
+  network_startup_init(-1);
+  if(desock_fd_kind(sockfd) == DESOCK_LISTENER)
+    return desock_accept(sockfd, addr, addrlen, 0);
+  return orig_accept(sockfd, addr, addrlen);
+}
+
+int accept4(int sockfd, struct sockaddr * addr, socklen_t * addrlen, int flags)
+{
+  GET_ORIG(accept4);
+  network_startup_init(-1);
+  if(desock_fd_kind(sockfd) == DESOCK_LISTENER)
+    return desock_accept(sockfd, addr, addrlen, flags);
+  return orig_accept4(sockfd, addr, addrlen, flags);
+}
+
+int getsockname(int sockfd, struct sockaddr * addr, socklen_t * addrlen)
+{
+  GET_ORIG(getsockname);
+  if(desock_fd_kind(sockfd) == DESOCK_NONE)
+    return orig_getsockname(sockfd, addr, addrlen);
+  memcpy(addr, &desock_address, *addrlen < desock_address_length ? *addrlen : desock_address_length);
+  *addrlen = desock_address_length;
+  return 0;
+}
+
+int getpeername(int sockfd, struct sockaddr * addr, socklen_t * addrlen)
+{
+  GET_ORIG(getpeername);
+  if(desock_fd_kind(sockfd) == DESOCK_NONE)
+    return orig_getpeername(sockfd, addr, addrlen);
+  if(desock_fd_kind(sockfd) != DESOCK_CONNECTION) {
+    errno = ENOTCONN;
+    return -1;
+  }
+  desock_client_address(addr, addrlen);
+  return 0;
+}
+
+int setsockopt(int sockfd, int level, int optname, const void * optval, socklen_t optlen)
+{
+  GET_ORIG(setsockopt);
+  if(desock_fd_kind(sockfd) != DESOCK_NONE)
+    return 0;
+  return orig_setsockopt(sockfd, level, optname, optval, optlen);
+}
+
+int getsockopt(int sockfd, int level, int optname, void * optval, socklen_t * optlen)
+{
+  GET_ORIG(getsockopt);
+  if(desock_fd_kind(sockfd) == DESOCK_NONE)
+    return orig_getsockopt(sockfd, level, optname, optval, optlen);
+
+  memset(optval, 0, *optlen);
+  if(level == SOL_SOCKET && optname == SO_TYPE && *optlen >= sizeof(int))
+    *(int *)optval = socket_type(sockfd);
+  return 0;
+}
+
+int shutdown(int sockfd, int how)
+{
+  GET_ORIG(shutdown);
+  if(desock_fd_kind(sockfd) != DESOCK_NONE)
+    return 0;
+  return orig_shutdown(sockfd, how);
+}
+
+int close(int fd)
+{
+  GET_ORIG(close);
+  if(desock_fd_kind(fd) != DESOCK_NONE) {
+    if(desock_kind[fd] == DESOCK_CONNECTION) {
+      desock_connection_open = 0;
+      orig_close(desock_control[1]);
+      desock_control[1] = -1;
+    }
+    orig_close(desock_peer[fd]);
+    desock_kind[fd] = DESOCK_NONE;
+  }
+  return orig_close(fd);
+}
+
+ssize_t read(int fd, void * buf, size_t count)
+{
+  struct iovec iov = { buf, count };
+  GET_ORIG(read);
+  if(desock_fd_kind(fd) == DESOCK_NONE)
+    return orig_read(fd, buf, count);
+  return desock_recv(fd, &iov, 1, 0, NULL);
+}
+
+ssize_t readv(int fd, const struct iovec * iov, int iovcnt)
+{
+  GET_ORIG(readv);
+  if(desock_fd_kind(fd) == DESOCK_NONE)
+    return orig_readv(fd, iov, iovcnt);
+  return desock_recv(fd, iov, iovcnt, 0, NULL);
+}
+
+ssize_t recv(int sockfd, void * buf, size_t len, int flags)
+{
+  struct iovec iov = { buf, len };
+  GET_ORIG(recv);
+  network_startup_init(sockfd);
+  if(desock_fd_kind(sockfd) == DESOCK_NONE)
+    return orig_recv(sockfd, buf, len, flags);
+  return desock_recv(sockfd, &iov, 1, flags, NULL);
+}
+
+ssize_t recvfrom(int sockfd, void * buf, size_t len, int flags, struct sockaddr * src_addr, socklen_t * addrlen)
+{
+  struct iovec iov = { buf, len };
+  ssize_t ret;
+  GET_ORIG(recvfrom);
+  network_startup_init(sockfd);
+  if(desock_fd_kind(sockfd) == DESOCK_NONE)
+    return orig_recvfrom(sockfd, buf, len, flags, src_addr, addrlen);
+  ret = desock_recv(sockfd, &iov, 1, flags, NULL);
+  if(ret >= 0)
+    desock_client_address(src_addr, addrlen);
+  return ret;
+}
+
+ssize_t recvmsg(int sockfd, struct msghdr * msg, int flags)
+{
+  ssize_t ret;
+  int truncated = 0;
+  GET_ORIG(recvmsg);
+  network_startup_init(sockfd);
+  if(desock_fd_kind(sockfd) == DESOCK_NONE)
+    return orig_recvmsg(sockfd, msg, flags);
+  ret = desock_recv(sockfd, msg->msg_iov, msg->msg_iovlen, flags, &truncated);
+  if(ret >= 0) {
+    if(msg->msg_name)
+      desock_client_address((struct sockaddr *)msg->msg_name, &msg->msg_namelen);
+    msg->msg_controllen = 0;
+    msg->msg_flags = truncated ? MSG_TRUNC : 0;
+  }
+  return ret;
+}
+
+ssize_t write(int fd, const void * buf, size_t count)
+{
+  struct iovec iov = { (void *)buf, count };
+  GET_ORIG(write);
+  if(desock_fd_kind(fd) == DESOCK_NONE)
+    return orig_write(fd, buf, count);
+  return desock_send(fd, &iov, 1);
+}
+
+ssize_t writev(int fd, const struct iovec * iov, int iovcnt)
+{
+  GET_ORIG(writev);
+  if(desock_fd_kind(fd) == DESOCK_NONE)
+    return orig_writev(fd, iov, iovcnt);
+  return desock_send(fd, iov, iovcnt);
+}
+
+ssize_t send(int sockfd, const void * buf, size_t len, int flags)
+{
+  struct iovec iov = { (void *)buf, len };
+  GET_ORIG(send);
+  if(desock_fd_kind(sockfd) == DESOCK_NONE)
+    return orig_send(sockfd, buf, len, flags);
+  return desock_send(sockfd, &iov, 1);
+}
+
+ssize_t sendto(int sockfd, const void * buf, size_t len, int flags, const struct sockaddr * dest_addr,
+  socklen_t addrlen)
+{
+  struct iovec iov = { (void *)buf, len };
+  GET_ORIG(sendto);
+  if(desock_fd_kind(sockfd) == DESOCK_NONE)
+    return orig_sendto(sockfd, buf, len, flags, dest_addr, addrlen);
+  return desock_send(sockfd, &iov, 1);
+}
+
+ssize_t sendmsg(int sockfd, const struct msghdr * msg, int flags)
+{
+  GET_ORIG(sendmsg);
+  if(desock_fd_kind(sockfd) == DESOCK_NONE)
+    return orig_sendmsg(sockfd, msg, flags);
+  return desock_send(sockfd, msg->msg_iov, msg->msg_iovlen);
+}
+
+int poll(struct pollfd * fds, nfds_t nfds, int timeout)
+{
+  GET_ORIG(poll);
+  network_startup_wait();
+  return orig_poll(fds, nfds, timeout);
+}
+
+int select(int nfds, fd_set * readfds, fd_set * writefds, fd_set * exceptfds, struct timeval * timeout)
+{
+  GET_ORIG(select);
+  network_startup_wait();
+  return orig_select(nfds, readfds, writefds, exceptfds, timeout);
+}
+
+int epoll_wait(int epfd, struct epoll_event * events, int maxevents, int timeout)
+{
+  GET_ORIG(epoll_wait);
+  network_startup_wait();
+  return orig_epoll_wait(epfd, events, maxevents, timeout);
+}
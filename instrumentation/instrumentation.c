@@ -77,11 +77,14 @@ static void find_fork_server_library(char * buffer, size_t buffer_len)
  * @param persistence_max_cnt - if fork server is in use, and perssistent mode
  *                              is in use, this is the number of inputs which
  *                              will be handled by each execution of the target
+ * @param network_startup - if the fork server library is in use, whether it
+ *                          should wait for the target to accept a connection
+ *                          or receive a datagram before starting
  * @return the process ID of spawned process
  */
 static pid_t run_target(int needs_stdin_fd, char *target_path, char **argv,
                 forkserver_t * fs, int use_forkserver_library, int *st_pipe,
-                int *ctl_pipe, int persistence_max_cnt) {
+                int *ctl_pipe, int persistence_max_cnt, int network_startup) {
 /*
   This function is based on the AFL run_target function present in afl-fuzz.c,
   available at this URL:
@@ -183,10 +186,26 @@ static pid_t run_target(int needs_stdin_fd, char *target_path, char **argv,
         char fork_server_library_path[MAX_PATH];
         find_fork_server_library(fork_server_library_path, sizeof(fork_server_library_path));
   #ifdef __APPLE__
-        setenv("DYLD_INSERT_LIBRARIES", fork_server_library_path, 1);
+        char * preload_var = "DYLD_INSERT_LIBRARIES";
   #else
-        setenv("LD_PRELOAD", fork_server_library_path, 1);
+        char * preload_var = "LD_PRELOAD";
   #endif
+        char * preload = getenv(preload_var);
+        // Keep any libraries the user asked to preload, rather than replacing them
+        if(preload && *preload) {
+          size_t combined_length = strlen(fork_server_library_path) + strlen(preload) + 2;
+          char * combined = malloc(combined_length);
+          if(!combined)
+            FATAL_MSG("malloc() failed");
+          snprintf(combined, combined_length, "%s:%s", fork_server_library_path, preload);
+          setenv(preload_var, combined, 1);
+          free(combined);
+        } else
+          setenv(preload_var, fork_server_library_path, 1);
+        if(network_startup)
+          setenv(NETWORK_STARTUP_VAR, "1", 1);
+        else
+          unsetenv(NETWORK_STARTUP_VAR);
       }
 
       if(persistence_max_cnt) {
@@ -239,9 +258,11 @@ static pid_t run_target(int needs_stdin_fd, char *target_path, char **argv,
  * library or not
  * @param persistence_max_cnt - the maximum number of fuzz iterations a persistence mode process should run
  * @param needs_stdin_fd - whether we should open a library for the stdin of the newly created process
+ * @param network_startup - whether the fork server library should wait until the target accepts a connection
+ * or receives a datagram to start the fork server, rather than starting it before main
  */
 void fork_server_init(forkserver_t * fs, char * target_path, char ** argv, int use_forkserver_library,
-  int persistence_max_cnt, int needs_stdin_fd)
+  int persistence_max_cnt, int needs_stdin_fd, int network_startup)
 {
   static struct itimerval it;
   int st_pipe[2], ctl_pipe[2];
@@ -294,7 +315,7 @@ void fork_server_init(forkserver_t * fs, char * target_path, char ** argv, int u
     FATAL_MSG("pipe() failed");
 
   forksrv_pid = run_target(needs_stdin_fd, target_path, argv, fs, use_forkserver_library,
-             st_pipe, ctl_pipe, persistence_max_cnt);
+             st_pipe, ctl_pipe, persistence_max_cnt, network_startup);
 
   // Close the unneeded endpoints.
   close(ctl_pipe[0]);
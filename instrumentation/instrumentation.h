@@ -59,5 +59,15 @@ struct instrumentation
 	int (*get_module_info)(void * instrumentation_state, int index, int * is_new, char ** module_name, char ** info, int * size);
 	instrumentation_edges_t * (*get_edges)(void * instrumentation_state, int index);
 	int(*is_process_done)(void * instrumentation_state);
+	int(*get_path_hash)(void * instrumentation_state, uint64_t * path_hash);
+	int(*enable_inprocess)(void * instrumentation_state);
+	int(*finish_inprocess)(void * instrumentation_state, int fuzz_result);
+	int(*merge_many)(void * instrumentation_state, void ** other_instrumentation_states, int num_states);
+	void *(*load_state)(char * options, char * state);
+	char * (*get_state_binary)(void * instrumentation_state, size_t * length);
+	int(*set_state_binary)(void * instrumentation_state, char * state, size_t length);
+	char * (*get_state_delta)(void * instrumentation_state, void * baseline_state, uint64_t baseline_digest, size_t * length);
+	int(*apply_state_delta)(void * instrumentation_state, char * delta, size_t length);
+	int(*uses_forkserver_library)(void * instrumentation_state);
 };
 typedef struct instrumentation instrumentation_t;
@@ -45,6 +45,8 @@ instrumentation_t * instrumentation_factory(char * instrumentation_type)
 		ret->create = dynamorio_create;
 		ret->cleanup = dynamorio_cleanup;
 		ret->merge = dynamorio_merge;
+		ret->merge_many = dynamorio_merge_many;
+		ret->load_state = dynamorio_load_state;
 		ret->get_state = dynamorio_get_state;
 		ret->free_state = dynamorio_free_state;
 		ret->set_state = dynamorio_set_state;
@@ -68,12 +70,19 @@ instrumentation_t * instrumentation_factory(char * instrumentation_type)
 		ret->is_new_path = return_code_is_new_path;
 		ret->get_fuzz_result = return_code_get_fuzz_result;
 		ret->is_process_done = return_code_is_process_done;
+		ret->uses_forkserver_library = return_code_uses_forkserver_library;
 	}
 	else if (!strcmp(instrumentation_type, "afl"))
 	{
 		ret->create = afl_create;
 		ret->cleanup = afl_cleanup;
 		ret->merge = afl_merge;
+		ret->merge_many = afl_merge_many;
+		ret->load_state = afl_load_state;
+		ret->get_state_binary = afl_get_state_binary;
+		ret->set_state_binary = afl_set_state_binary;
+		ret->get_state_delta = afl_get_state_delta;
+		ret->apply_state_delta = afl_apply_state_delta;
 		ret->get_state = afl_get_state;
 		ret->free_state = afl_free_state;
 		ret->set_state = afl_set_state;
@@ -81,6 +90,9 @@ instrumentation_t * instrumentation_factory(char * instrumentation_type)
 		ret->is_new_path = afl_is_new_path;
 		ret->get_fuzz_result = afl_get_fuzz_result;
 		ret->is_process_done = afl_is_process_done;
+		ret->get_path_hash = afl_get_path_hash;
+		ret->enable_inprocess = afl_enable_inprocess;
+		ret->finish_inprocess = afl_finish_inprocess;
 	}
 	#if !__APPLE__ // Linux
 	else if (!strcmp(instrumentation_type, "ipt"))
@@ -88,6 +100,12 @@ instrumentation_t * instrumentation_factory(char * instrumentation_type)
 		ret->create = linux_ipt_create;
 		ret->cleanup = linux_ipt_cleanup;
 		ret->merge = linux_ipt_merge;
+		ret->merge_many = linux_ipt_merge_many;
+		ret->load_state = linux_ipt_load_state;
+		ret->get_state_binary = linux_ipt_get_state_binary;
+		ret->set_state_binary = linux_ipt_set_state_binary;
+		ret->get_state_delta = linux_ipt_get_state_delta;
+		ret->apply_state_delta = linux_ipt_apply_state_delta;
 		ret->get_state = linux_ipt_get_state;
 		ret->free_state = linux_ipt_free_state;
 		ret->set_state = linux_ipt_set_state;
@@ -95,6 +113,7 @@ instrumentation_t * instrumentation_factory(char * instrumentation_type)
 		ret->is_new_path = linux_ipt_is_new_path;
 		ret->get_fuzz_result = linux_ipt_get_fuzz_result;
 		ret->is_process_done = linux_ipt_is_process_done;
+		ret->uses_forkserver_library = linux_ipt_uses_forkserver_library;
 	}
 	#endif
 	#endif
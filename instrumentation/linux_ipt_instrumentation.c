@@ -15,8 +15,8 @@
 
 #include "instrumentation.h"
 #include "linux_ipt_instrumentation.h"
+#include "binary_state.h"
 #include "forkserver_internal.h"
-#include "uthash.h"
 #include "xxhash.h"
 
 #include <utils.h>
@@ -203,18 +203,199 @@ static int get_tnt_num_bits(unsigned char * packet, int max_bits)
   return num_bits;
 }
 
+//The number of slots in a hashtable when the first hash is added, must be a power of 2
+#define IPT_HASHTABLE_INITIAL_SIZE 1024
+
 /**
- * This function parses the IPT packet buffer to determine if the execution trace was new or not.  If it was, the
- * execution trace's hash is added to the hashtable to ensure we do not mark it as new again.
+ * This function picks the first slot to look for a key in an ipt_hashtable.  The keys are already xxhash digests, so
+ * they only need to be combined.
+ * @param key - the key to look for
+ * @param mask - the number of slots in the hashtable minus one
+ * @return - the index of the first slot to look in
+ */
+static size_t ipt_hashtable_slot(const struct ipt_hashtable_key * key, size_t mask)
+{
+  return (size_t)(key->tip ^ (key->tnt * 0x9E3779B97F4A7C15ULL)) & mask;
+}
+
+/**
+ * This function adds a key to an ipt_hashtable which is known to have room for it and to not already contain it.
+ * @param table - the ipt_hashtable to add the key to
+ * @param key - the key to add
+ */
+static void ipt_hashtable_insert(struct ipt_hashtable * table, const struct ipt_hashtable_key * key)
+{
+  size_t slot, mask = table->size - 1;
+
+  if(!key->tip && !key->tnt) {
+    table->has_zero_key = 1;
+    table->count++;
+    return;
+  }
+
+  slot = ipt_hashtable_slot(key, mask);
+  while(table->keys[slot].tip || table->keys[slot].tnt)
+    slot = (slot + 1) & mask;
+  table->keys[slot] = *key;
+  table->count++;
+}
+
+/**
+ * This function makes sure an ipt_hashtable has room for more keys, growing it if necessary.  The table is kept at most
+ * half full, so probe sequences stay short.
+ * @param table - the ipt_hashtable to grow
+ * @param num_keys - the number of keys that are about to be added
+ * @return - 0 on success, non-zero on failure
+ */
+static int ipt_hashtable_reserve(struct ipt_hashtable * table, size_t num_keys)
+{
+  struct ipt_hashtable old = *table;
+  size_t i, new_size;
+
+  new_size = table->size ? table->size : IPT_HASHTABLE_INITIAL_SIZE;
+  while((table->count + num_keys) * 2 > new_size)
+    new_size *= 2;
+  if(new_size == table->size)
+    return 0;
+
+  table->keys = calloc(new_size, sizeof(struct ipt_hashtable_key));
+  if(!table->keys) {
+    *table = old;
+    return 1;
+  }
+  table->size = new_size;
+  table->count = table->has_zero_key;
+  for(i = 0; i < old.size; i++) {
+    if(old.keys[i].tip || old.keys[i].tnt)
+      ipt_hashtable_insert(table, &old.keys[i]);
+  }
+  free(old.keys);
+  return 0;
+}
+
+/**
+ * This function looks for a key in an ipt_hashtable.
+ * @param table - the ipt_hashtable to look in
+ * @param key - the key to look for
+ * @return - 1 if the key is in the hashtable, 0 otherwise
+ */
+static int ipt_hashtable_contains(const struct ipt_hashtable * table, const struct ipt_hashtable_key * key)
+{
+  size_t slot, mask = table->size - 1;
+
+  if(!key->tip && !key->tnt)
+    return table->has_zero_key;
+  if(!table->size)
+    return 0;
+
+  slot = ipt_hashtable_slot(key, mask);
+  while(table->keys[slot].tip || table->keys[slot].tnt) {
+    if(table->keys[slot].tip == key->tip && table->keys[slot].tnt == key->tnt)
+      return 1;
+    slot = (slot + 1) & mask;
+  }
+  return 0;
+}
+
+/**
+ * This function adds a key to an ipt_hashtable if it isn't already in it.  Only one probe sequence is needed to both look
+ * for the key and find the slot to add it in.
+ * @param table - the ipt_hashtable to add the key to
+ * @param key - the key to add
+ * @return - 1 if the key was added, 0 if it was already in the hashtable, or -1 on failure
+ */
+static int ipt_hashtable_add(struct ipt_hashtable * table, const struct ipt_hashtable_key * key)
+{
+  size_t slot, mask;
+
+  if(!key->tip && !key->tnt) {
+    if(table->has_zero_key)
+      return 0;
+    table->has_zero_key = 1;
+    table->count++;
+    return 1;
+  }
+
+  if((table->count + 1) * 2 > table->size && ipt_hashtable_reserve(table, 1))
+    return -1;
+
+  mask = table->size - 1;
+  slot = ipt_hashtable_slot(key, mask);
+  while(table->keys[slot].tip || table->keys[slot].tnt) {
+    if(table->keys[slot].tip == key->tip && table->keys[slot].tnt == key->tnt)
+      return 0;
+    slot = (slot + 1) & mask;
+  }
+  table->keys[slot] = *key;
+  table->count++;
+  return 1;
+}
+
+/**
+ * This function iterates over the keys in an ipt_hashtable.
+ * @param table - the ipt_hashtable to iterate over
+ * @param index - the position of the iteration, which should be 0 for the first call
+ * @return - the next key in the hashtable, or NULL if there are no more
+ */
+static const struct ipt_hashtable_key * ipt_hashtable_next(const struct ipt_hashtable * table, size_t * index)
+{
+  static const struct ipt_hashtable_key zero_key = { 0, 0 };
+
+  while(*index < table->size) {
+    if(table->keys[*index].tip || table->keys[*index].tnt)
+      return &table->keys[(*index)++];
+    (*index)++;
+  }
+  if(*index == table->size) {
+    (*index)++;
+    if(table->has_zero_key)
+      return &zero_key;
+  }
+  return NULL;
+}
+
+/**
+ * This function adds all of the keys in one ipt_hashtable to another, growing the destination at most once.
+ * @param table - the ipt_hashtable to add the keys to
+ * @param other - the ipt_hashtable containing the keys to add
+ * @return - 0 on success, non-zero on failure
+ */
+static int ipt_hashtable_add_all(struct ipt_hashtable * table, const struct ipt_hashtable * other)
+{
+  const struct ipt_hashtable_key * key;
+  size_t index = 0;
+
+  if(ipt_hashtable_reserve(table, other->count))
+    return 1;
+  while((key = ipt_hashtable_next(other, &index)) != NULL) {
+    if(!ipt_hashtable_contains(table, key))
+      ipt_hashtable_insert(table, key);
+  }
+  return 0;
+}
+
+/**
+ * This function removes all of the keys from an ipt_hashtable and frees its memory.
+ * @param table - the ipt_hashtable to clear
+ */
+static void ipt_hashtable_clear(struct ipt_hashtable * table)
+{
+  free(table->keys);
+  memset(table, 0, sizeof(struct ipt_hashtable));
+}
+
+/**
+ * This function parses IPT trace data and calculates the TIP and TNT hashes of the execution trace it describes.
  * @param state - The linux_ipt_state_t object containing this instrumentation's state
- * @param return - -1 on error, 0 if the IPT packets in the IPT packet buffer don't describe a unique run, or 1 if they do
+ * @param start - the start of the IPT trace data
+ * @param end - the end of the IPT trace data
+ * @param key - a pointer to a ipt_hashtable_key that will be filled in with the trace's hashes
+ * @param return - 0 on success, or -1 on error
  */
-static int analyze_ipt(linux_ipt_state_t * state)
+static int decode_ipt(linux_ipt_state_t * state, unsigned char * start, unsigned char * end, struct ipt_hashtable_key * key)
 {
-  unsigned char * p, * start, * end, * psb_pos;
-  struct ipt_hashtable_entry * hashes, * match = NULL;
+  unsigned char * p, * psb_pos;
   uint64_t ip_address;
-  size_t num_bytes_at_end;
   int unknown_packet_hit = 0;
 
   const unsigned char psb[0x10] = {
@@ -222,18 +403,6 @@ static int analyze_ipt(linux_ipt_state_t * state)
     0x02, 0x82, 0x02, 0x82, 0x02, 0x82, 0x02, 0x82
   };
 
-  //Disable IPT while we're analyzing it
-  ioctl(state->perf_fd, PERF_EVENT_IOC_DISABLE, 0);
-
-  //Perform a quick sanity check to ensure the IPT trace data is sane
-  if (state->pem->aux_head == state->pem->aux_tail) {
-    WARNING_MSG("No IPT trace data was recorded, something is likely wrong.");
-    return -1;
-  } else if (state->persistence_max_cnt == 0 && state->pem->aux_head < state->pem->aux_tail) {
-    WARNING_MSG("The IPT trace data has overflown. Use the ipt_mmap_size option to increase the size.");
-    return -1;
-  }
-
   //Reset the IPT hashes struct
   state->ipt_hashes.tnt_bits = 0;
   state->ipt_hashes.num_bits = 0;
@@ -242,23 +411,6 @@ static int analyze_ipt(linux_ipt_state_t * state)
       XXH64_reset(state->ipt_hashes.tip, 0) == XXH_ERROR)
     return -1;
 
-  hashes = malloc(sizeof(struct ipt_hashtable_entry));
-  if(!hashes)
-    return -1;
-
-  //Reorder the buffer if it wrapped around to make parsing easier
-  if(state->pem->aux_head < state->pem->aux_tail) {
-    state->reorder_buffer = malloc(state->ipt_mmap_size);
-    num_bytes_at_end = state->pem->aux_size - state->pem->aux_tail;
-    memcpy(state->reorder_buffer, state->perf_aux_buf + state->pem->aux_tail, num_bytes_at_end);
-    memcpy(state->reorder_buffer + num_bytes_at_end, state->perf_aux_buf, state->pem->aux_head);
-
-    start = state->reorder_buffer;
-    end = state->reorder_buffer + num_bytes_at_end + state->pem->aux_head;
-  } else {
-    start = (char *)state->perf_aux_buf + state->pem->aux_tail;
-    end = (char *)state->perf_aux_buf + state->pem->aux_head;
-  }
   p = start;
 
 #ifdef IPT_DEBUG
@@ -409,20 +561,111 @@ static int analyze_ipt(linux_ipt_state_t * state)
     }
   }
 
-  //Create a hashtable entry to lookup/add
+  //Create a hashtable key to lookup/add
   finish_tnt_hash(&state->ipt_hashes);
-  memset(hashes, 0, sizeof(struct ipt_hashtable_entry));
-  hashes->id.tip = XXH64_digest(state->ipt_hashes.tip);
-  hashes->id.tnt = XXH64_digest(state->ipt_hashes.tnt);
-  DEBUG_MSG("Got TIP hash 0x%llx and TNT hash 0x%llx", hashes->id.tip, hashes->id.tnt);
+  key->tip = XXH64_digest(state->ipt_hashes.tip);
+  key->tnt = XXH64_digest(state->ipt_hashes.tnt);
+  DEBUG_MSG("Got TIP hash 0x%llx and TNT hash 0x%llx", key->tip, key->tnt);
+  return 0;
+}
+
+/**
+ * This function saves IPT trace data, along with the address ranges used to normalize its TIP addresses, to a new file in
+ * the ipt_capture_dir directory.  The file can be decoded again later with linux_ipt_replay_trace.
+ * @param state - The linux_ipt_state_t object containing this instrumentation's state
+ * @param start - the start of the IPT trace data
+ * @param end - the end of the IPT trace data
+ */
+static void capture_ipt(linux_ipt_state_t * state, unsigned char * start, unsigned char * end)
+{
+  struct ipt_capture_header header;
+  struct ipt_capture_library library;
+  char filename[MAX_PATH];
+  FILE * fp;
+  size_t i;
+  int failed;
+
+  snprintf(filename, sizeof(filename), "%s/ipt_trace_%d_%llu", state->capture_dir, getpid(),
+    (unsigned long long)state->num_captures++);
+  fp = fopen(filename, "wb");
+  if(!fp) {
+    WARNING_MSG("Couldn't open the IPT capture file %s", filename);
+    return;
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, IPT_CAPTURE_MAGIC, IPT_CAPTURE_MAGIC_LENGTH);
+  header.version = IPT_CAPTURE_VERSION;
+  header.target_start = state->target_start;
+  header.target_end = state->target_end;
+  header.last_ip = state->last_ip;
+  header.num_libraries = state->num_coverage_libraries;
+  failed = fwrite(&header, sizeof(header), 1, fp) != 1;
+
+  for(i = 0; i < state->num_coverage_libraries && !failed; i++) {
+    memset(&library, 0, sizeof(library));
+    library.start = state->library_starts[i];
+    library.end = state->library_ends[i];
+    library.hash = state->library_hashes[i];
+    failed = fwrite(&library, sizeof(library), 1, fp) != 1;
+  }
+
+  if(!failed && end > start)
+    failed = fwrite(start, end - start, 1, fp) != 1;
+  if(fclose(fp) || failed)
+    WARNING_MSG("Failed writing the IPT capture file %s", filename);
+}
+
+/**
+ * This function parses the IPT packet buffer to determine if the execution trace was new or not.  If it was, the
+ * execution trace's hash is added to the hashtable to ensure we do not mark it as new again.
+ * @param state - The linux_ipt_state_t object containing this instrumentation's state
+ * @param return - -1 on error, 0 if the IPT packets in the IPT packet buffer don't describe a unique run, or 1 if they do
+ */
+static int analyze_ipt(linux_ipt_state_t * state)
+{
+  unsigned char * start, * end;
+  struct ipt_hashtable_key key;
+  size_t num_bytes_at_end;
+  int added;
+
+  //Disable IPT while we're analyzing it
+  ioctl(state->perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+
+  //Perform a quick sanity check to ensure the IPT trace data is sane
+  if (state->pem->aux_head == state->pem->aux_tail) {
+    WARNING_MSG("No IPT trace data was recorded, something is likely wrong.");
+    return -1;
+  } else if (state->persistence_max_cnt == 0 && state->pem->aux_head < state->pem->aux_tail) {
+    WARNING_MSG("The IPT trace data has overflown. Use the ipt_mmap_size option to increase the size.");
+    return -1;
+  }
+
+  //Reorder the buffer if it wrapped around to make parsing easier
+  if(state->pem->aux_head < state->pem->aux_tail) {
+    state->reorder_buffer = malloc(state->ipt_mmap_size);
+    num_bytes_at_end = state->pem->aux_size - state->pem->aux_tail;
+    memcpy(state->reorder_buffer, state->perf_aux_buf + state->pem->aux_tail, num_bytes_at_end);
+    memcpy(state->reorder_buffer + num_bytes_at_end, state->perf_aux_buf, state->pem->aux_head);
+
+    start = state->reorder_buffer;
+    end = state->reorder_buffer + num_bytes_at_end + state->pem->aux_head;
+  } else {
+    start = (char *)state->perf_aux_buf + state->pem->aux_tail;
+    end = (char *)state->perf_aux_buf + state->pem->aux_head;
+  }
+
+  if(state->capture_dir)
+    capture_ipt(state, start, end);
+
+  if(decode_ipt(state, start, end, &key))
+    return -1;
 
   //Look for our hashes in the hashtable, and add them if they're not already in it
-  HASH_FIND(hh, state->head, &hashes->id, sizeof(struct ipt_hashtable_key), match);
-  if(!match)
-    HASH_ADD(hh, state->head, id, sizeof(struct ipt_hashtable_key), hashes);
-  else
-    free(hashes);
-  return match == NULL;
+  added = ipt_hashtable_add(&state->hashes, &key);
+  if(added < 0)
+    return -1;
+  return added;
 }
 
 ////////////////////////////////////////////////////////////////
@@ -675,7 +918,8 @@ static int create_target_process(linux_ipt_state_t * state, char* cmd_line, char
     //Get the absolute path for the target
     state->target_path = realpath(temp_path, NULL);
     if(state->target_path) {
-      fork_server_init(&state->fs, state->target_path, argv, 1, state->persistence_max_cnt, stdin_length != 0);
+      fork_server_init(&state->fs, state->target_path, argv, 1, state->persistence_max_cnt, stdin_length != 0,
+        state->network_startup);
       record_fork_server_address_info(state);
       state->fork_server_setup = 1;
     }
@@ -817,8 +1061,10 @@ static linux_ipt_state_t * setup_options(char * options)
   //Parse the options
   if(options) {
     PARSE_OPTION_INT(state, options, persistence_max_cnt, "persistence_max_cnt", linux_ipt_cleanup);
+    PARSE_OPTION_INT(state, options, network_startup, "network_startup", linux_ipt_cleanup);
     PARSE_OPTION_INT(state, options, ipt_mmap_size, "ipt_mmap_size", linux_ipt_cleanup);
     PARSE_OPTION_ARRAY(state, options, coverage_libraries, num_coverage_libraries, "coverage_libraries", linux_ipt_cleanup);
+    PARSE_OPTION_STRING(state, options, capture_dir, "ipt_capture_dir", linux_ipt_cleanup);
   }
 
   for(i = 0; i < state->num_coverage_libraries; i++) {
@@ -887,6 +1133,31 @@ void * linux_ipt_create(char * options, char * state)
   return linux_ipt_state;
 }
 
+/**
+ * This function allocates an instrumentation specific state object that only holds coverage information, for tools that merge
+ * or inspect states without running a target.  Unlike linux_ipt_create, it doesn't check for Intel PT support, so it can be used
+ * on any machine, but the returned state can't be passed to linux_ipt_enable.
+ * @param options - ignored, the coverage information doesn't depend on the instrumentation's options
+ * @param state - an instrumentation specific JSON string previously returned from linux_ipt_get_state that should be loaded, or NULL
+ * @return - An instrumentation specific state object on success or NULL on failure
+ */
+void * linux_ipt_load_state(char * options, char * state)
+{
+  linux_ipt_state_t * linux_ipt_state;
+
+  linux_ipt_state = calloc(1, sizeof(linux_ipt_state_t));
+  if(!linux_ipt_state)
+    return NULL;
+  linux_ipt_state->perf_fd = -1;
+
+  if(state && linux_ipt_set_state(linux_ipt_state, state)) {
+    linux_ipt_cleanup(linux_ipt_state);
+    return NULL;
+  }
+
+  return linux_ipt_state;
+}
+
 /**
  * This function cleans up all resources with the passed in instrumentation state.
  * @param instrumentation_state - an instrumentation specific state object previously created by the linux_ipt_create function
@@ -894,7 +1165,6 @@ void * linux_ipt_create(char * options, char * state)
  */
 void linux_ipt_cleanup(void * instrumentation_state)
 {
-  struct ipt_hashtable_entry * hash, * tmp;
   size_t i;
   linux_ipt_state_t * state = (linux_ipt_state_t *)instrumentation_state;
 
@@ -916,11 +1186,8 @@ void linux_ipt_cleanup(void * instrumentation_state)
   //Cleanup the perf IPT fd and mmaps
   cleanup_ipt(state);
 
-  //Cleanup the hashtable entries
-  HASH_ITER(hh, state->head, hash, tmp) {
-    HASH_DEL(state->head, hash);
-    free(hash);
-  }
+  //Cleanup the hashtable
+  ipt_hashtable_clear(&state->hashes);
 
   for(i = 0; i < state->num_coverage_libraries; i++)
     free(state->coverage_libraries[i]);
@@ -931,6 +1198,7 @@ void linux_ipt_cleanup(void * instrumentation_state)
   free(state->reorder_buffer);
   free(state->filter);
   free(state->target_path);
+  free(state->capture_dir);
   free(state);
 }
 
@@ -944,37 +1212,47 @@ void linux_ipt_cleanup(void * instrumentation_state)
 void * linux_ipt_merge(void * instrumentation_state, void * other_instrumentation_state)
 {
   linux_ipt_state_t * merged;
-  struct ipt_hashtable_entry * entry = NULL, * hash = NULL, * tmp = NULL, * match = NULL;
   linux_ipt_state_t * first = (linux_ipt_state_t *)instrumentation_state;
   linux_ipt_state_t * second = (linux_ipt_state_t *)other_instrumentation_state;
 
-  merged = linux_ipt_create(NULL, NULL);
+  merged = linux_ipt_load_state(NULL, NULL);
   if (!merged)
     return NULL;
 
-  //Add the first state's entries
-  HASH_ITER(hh, first->head, hash, tmp)
-  {
-    entry = malloc(sizeof(struct ipt_hashtable_entry));
-    memset(entry, 0, sizeof(entry));
-    entry->id.tip = hash->id.tip;
-    entry->id.tnt = hash->id.tnt;
-    HASH_ADD(hh, merged->head, id, sizeof(struct ipt_hashtable_key), entry);
+  //Add both states' hashes
+  if(ipt_hashtable_reserve(&merged->hashes, first->hashes.count + second->hashes.count)
+    || ipt_hashtable_add_all(&merged->hashes, &first->hashes)
+    || ipt_hashtable_add_all(&merged->hashes, &second->hashes)) {
+    linux_ipt_cleanup(merged);
+    return NULL;
   }
 
-  //Add the second state's entries
-  HASH_ITER(hh, second->head, hash, tmp)
+  return merged;
+}
+
+/**
+ * This function merges the coverage information from several instrumentation states into the first one, without allocating a new
+ * state for each merge.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the linux_ipt_create function.  The
+ * other states are merged into this one.
+ * @param other_instrumentation_states - an array of instrumentation specific state objects previously created by the linux_ipt_create
+ * function.  They are not modified.
+ * @param num_states - the number of states in other_instrumentation_states
+ * @return - 0 on success, non-zero on failure
+ */
+int linux_ipt_merge_many(void * instrumentation_state, void ** other_instrumentation_states, int num_states)
+{
+  linux_ipt_state_t * state = (linux_ipt_state_t *)instrumentation_state;
+  linux_ipt_state_t * other;
+  int i;
+
+  for (i = 0; i < num_states; i++)
   {
-    entry = malloc(sizeof(struct ipt_hashtable_entry));
-    memset(entry, 0, sizeof(entry));
-    entry->id.tip = hash->id.tip;
-    entry->id.tnt = hash->id.tnt;
-    HASH_FIND(hh, merged->head, &entry->id, sizeof(struct ipt_hashtable_key), match);
-    if(!match)
-      HASH_ADD(hh, merged->head, id, sizeof(struct ipt_hashtable_key), entry);
+    other = (linux_ipt_state_t *)other_instrumentation_states[i];
+    if (ipt_hashtable_add_all(&state->hashes, &other->hashes))
+      return 1;
   }
-
-  return merged;
+  return 0;
 }
 
 /**
@@ -987,7 +1265,8 @@ char * linux_ipt_get_state(void * instrumentation_state)
 {
   linux_ipt_state_t * state = (linux_ipt_state_t *)instrumentation_state;
   json_t *state_obj, *hash_obj, *hash_list, *temp;
-  struct ipt_hashtable_entry * hash = NULL, * tmp = NULL;
+  const struct ipt_hashtable_key * key;
+  size_t index = 0;
   char * ret;
 
   state_obj = json_object();
@@ -1003,9 +1282,9 @@ char * linux_ipt_get_state(void * instrumentation_state)
   hash_list = json_array();
   if (!hash_list)
     return NULL;
-  HASH_ITER(hh, state->head, hash, tmp)
+  while((key = ipt_hashtable_next(&state->hashes, &index)) != NULL)
   {
-    hash_obj = json_mem((const char *)&hash->id, sizeof(struct ipt_hashtable_key));
+    hash_obj = json_mem((const char *)key, sizeof(struct ipt_hashtable_key));
     if (!hash_obj)
       return NULL;
     json_array_append_new(hash_list, hash_obj);
@@ -1017,6 +1296,36 @@ char * linux_ipt_get_state(void * instrumentation_state)
   return ret;
 }
 
+/**
+ * This function returns the state information holding the previous execution path info in the binary state format, which avoids
+ * encoding each hash as a JSON string.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the linux_ipt_create function
+ * @param length - a pointer used to return the length of the binary state
+ * @return - the binary state on success or NULL on failure.  It should be freed with linux_ipt_free_state.
+ */
+char * linux_ipt_get_state_binary(void * instrumentation_state, size_t * length)
+{
+  linux_ipt_state_t * state = (linux_ipt_state_t *)instrumentation_state;
+  const struct ipt_hashtable_key * key;
+  binary_state_writer_t writer;
+  size_t index = 0;
+
+  binary_state_writer_init(&writer, "ipt");
+  binary_state_write_varint(&writer, (uint32_t)state->last_status);
+  binary_state_write_varint(&writer, (uint32_t)state->process_finished);
+  binary_state_write_varint(&writer, (uint32_t)state->last_fuzz_result);
+  binary_state_write_varint(&writer, (uint32_t)state->fuzz_results_set);
+  binary_state_write_varint(&writer, (uint32_t)state->last_is_new_path);
+
+  binary_state_write_varint(&writer, state->hashes.count);
+  while((key = ipt_hashtable_next(&state->hashes, &index)) != NULL)
+  {
+    binary_state_write_u64(&writer, key->tip);
+    binary_state_write_u64(&writer, key->tnt);
+  }
+  return binary_state_writer_finish(&writer, length);
+}
+
 /**
  * This function frees an instrumentation state previously obtained via linux_ipt_get_state.
  * @param state - the instrumentation state to free
@@ -1035,7 +1344,7 @@ void linux_ipt_free_state(char * state)
 int linux_ipt_set_state(void * instrumentation_state, char * state)
 {
   linux_ipt_state_t * current_state = (linux_ipt_state_t *)instrumentation_state;
-  struct ipt_hashtable_entry * entry = NULL, * hash = NULL, * tmp = NULL, * match = NULL;
+  struct ipt_hashtable_key key;
   json_t * hash_obj;
   int result, temp_int;
   size_t length;
@@ -1047,10 +1356,7 @@ int linux_ipt_set_state(void * instrumentation_state, char * state)
   destroy_target_process(current_state, 0); //kill it so we don't orphan it
 
   //Free any existing hashes already in the hashtable
-  HASH_ITER(hh, current_state->head, hash, tmp) {
-    HASH_DEL(current_state->head, hash);
-    free(hash);
-  }
+  ipt_hashtable_clear(&current_state->hashes);
 
   GET_INT(temp_int, state, current_state->last_status, "last_status", result);
   GET_INT(temp_int, state, current_state->process_finished, "process_finished", result);
@@ -1064,21 +1370,130 @@ int linux_ipt_set_state(void * instrumentation_state, char * state)
     if(length != sizeof(struct ipt_hashtable_key))
       return 1;
 
-    entry = malloc(sizeof(struct ipt_hashtable_entry));
-    if(!entry)
+    memcpy(&key, json_mem_value(hash_obj), sizeof(struct ipt_hashtable_key));
+    if(ipt_hashtable_add(&current_state->hashes, &key) < 0)
       return 1;
 
-    memset(entry, 0, sizeof(entry));
-    memcpy(&entry->id, json_mem_value(hash_obj), sizeof(struct ipt_hashtable_key));
-    HASH_FIND(hh, current_state->head, &entry->id, sizeof(struct ipt_hashtable_key), match);
-    if(!match)
-      HASH_ADD(hh, current_state->head, id, sizeof(struct ipt_hashtable_key), entry);
-
   FOREACH_OBJECT_JSON_ARRAY_ITEM_END(hash_list)
 
   return 0; //No state to set, so just return success
 }
 
+/**
+ * This function reads a count and then that many hashes from a binary state, and adds them to a hashtable.  The hashtable is grown
+ * once for all of the hashes.
+ * @param reader - the binary_state_reader_t to read the hashes from
+ * @param table - the ipt_hashtable to add the hashes to
+ * @return - 0 on success, non-zero on failure
+ */
+static int read_hashes(binary_state_reader_t * reader, struct ipt_hashtable * table)
+{
+  struct ipt_hashtable_key key;
+  uint64_t i, num_hashes;
+
+  num_hashes = binary_state_read_varint(reader);
+  //Each hash takes 16 bytes, so don't trust a count that's larger than the rest of the state
+  if(num_hashes > (reader->length - reader->offset) / sizeof(struct ipt_hashtable_key))
+    return 1;
+  if(ipt_hashtable_reserve(table, (size_t)num_hashes))
+    return 1;
+
+  for(i = 0; i < num_hashes && !reader->error; i++) {
+    key.tip = binary_state_read_u64(reader);
+    key.tnt = binary_state_read_u64(reader);
+    if(!reader->error && ipt_hashtable_add(table, &key) < 0)
+      return 1;
+  }
+  return reader->error;
+}
+
+/**
+ * This function sets the instrumentation state to the passed in binary state previously obtained from linux_ipt_get_state_binary.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the linux_ipt_create function
+ * @param state - the binary state to load
+ * @param length - the length of the state parameter
+ * @return - 0 on success, non-zero on failure
+ */
+int linux_ipt_set_state_binary(void * instrumentation_state, char * state, size_t length)
+{
+  linux_ipt_state_t * current_state = (linux_ipt_state_t *)instrumentation_state;
+  binary_state_reader_t reader;
+
+  if(!state || binary_state_reader_init(&reader, state, length, "ipt"))
+    return 1;
+
+  //If a child process is running when the state is being set
+  destroy_target_process(current_state, 0); //kill it so we don't orphan it
+
+  //Free any existing hashes already in the hashtable
+  ipt_hashtable_clear(&current_state->hashes);
+
+  current_state->last_status = (int)binary_state_read_varint(&reader);
+  current_state->process_finished = (int)binary_state_read_varint(&reader);
+  current_state->last_fuzz_result = (int)binary_state_read_varint(&reader);
+  current_state->fuzz_results_set = (int)binary_state_read_varint(&reader);
+  current_state->last_is_new_path = (int)binary_state_read_varint(&reader);
+
+  if(read_hashes(&reader, &current_state->hashes))
+    return 1;
+  return binary_state_reader_finish(&reader);
+}
+
+/**
+ * This function returns a binary delta state, holding only the hashes that have been found since the baseline state.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the linux_ipt_create function
+ * @param baseline_state - an instrumentation specific state object holding the coverage that this state started from
+ * @param baseline_digest - the digest of the baseline state file
+ * @param length - a pointer used to return the length of the delta state
+ * @return - the delta state on success or NULL on failure.  It should be freed with linux_ipt_free_state.
+ */
+char * linux_ipt_get_state_delta(void * instrumentation_state, void * baseline_state, uint64_t baseline_digest, size_t * length)
+{
+  linux_ipt_state_t * state = (linux_ipt_state_t *)instrumentation_state;
+  linux_ipt_state_t * baseline = (linux_ipt_state_t *)baseline_state;
+  const struct ipt_hashtable_key * key;
+  binary_state_writer_t writer;
+  uint64_t num_new = 0;
+  size_t index = 0;
+
+  while((key = ipt_hashtable_next(&state->hashes, &index)) != NULL)
+  {
+    if(!ipt_hashtable_contains(&baseline->hashes, key))
+      num_new++;
+  }
+
+  binary_state_delta_writer_init(&writer, "ipt", baseline_digest);
+  binary_state_write_varint(&writer, num_new);
+  index = 0;
+  while((key = ipt_hashtable_next(&state->hashes, &index)) != NULL)
+  {
+    if(!ipt_hashtable_contains(&baseline->hashes, key)) {
+      binary_state_write_u64(&writer, key->tip);
+      binary_state_write_u64(&writer, key->tnt);
+    }
+  }
+  return binary_state_writer_finish(&writer, length);
+}
+
+/**
+ * This function adds the hashes in a binary delta state from linux_ipt_get_state_delta to the instrumentation state.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the linux_ipt_create function
+ * @param delta - the delta state to apply
+ * @param length - the length of the delta parameter
+ * @return - 0 on success, non-zero on failure
+ */
+int linux_ipt_apply_state_delta(void * instrumentation_state, char * delta, size_t length)
+{
+  linux_ipt_state_t * current_state = (linux_ipt_state_t *)instrumentation_state;
+  binary_state_reader_t reader;
+
+  if(binary_state_delta_reader_init(&reader, delta, length, "ipt"))
+    return 1;
+  if(read_hashes(&reader, &current_state->hashes))
+    return 1;
+  return binary_state_reader_finish(&reader);
+}
+
 /**
  * This function enables the instrumentation and runs the fuzzed process.
  * @param instrumentation_state - an instrumentation specific state object previously created by the linux_ipt_create function
@@ -1146,6 +1561,120 @@ int linux_ipt_is_new_path(void * instrumentation_state)
   return state->last_is_new_path;
 }
 
+/**
+ * This function grows the library arrays used by linux_ipt_replay_trace.  The replayed libraries don't have names,
+ * so the new entries in the coverage_libraries array are set to NULL.
+ * @param state - the linux_ipt_state_t object containing this instrumentation's state
+ * @param count - the number of libraries the arrays need to hold
+ * @return - 0 on success, non-zero on failure
+ */
+static int grow_replay_libraries(linux_ipt_state_t * state, size_t count)
+{
+  char ** new_libraries;
+  uint64_t * new_starts, * new_ends;
+  uint32_t * new_hashes;
+
+  new_libraries = realloc(state->coverage_libraries, count * sizeof(char *));
+  if(!new_libraries)
+    return 1;
+  memset(new_libraries + state->replay_library_capacity, 0, (count - state->replay_library_capacity) * sizeof(char *));
+  state->coverage_libraries = new_libraries;
+
+  new_starts = realloc(state->library_starts, count * sizeof(uint64_t));
+  if(!new_starts)
+    return 1;
+  state->library_starts = new_starts;
+  new_ends = realloc(state->library_ends, count * sizeof(uint64_t));
+  if(!new_ends)
+    return 1;
+  state->library_ends = new_ends;
+  new_hashes = realloc(state->library_hashes, count * sizeof(uint32_t));
+  if(!new_hashes)
+    return 1;
+  state->library_hashes = new_hashes;
+
+  state->replay_library_capacity = count;
+  return 0;
+}
+
+/**
+ * This function decodes IPT trace data previously saved with the ipt_capture_dir option, using the same packet parser as
+ * fuzzing, and checks whether the execution trace it describes is new.  This allows the parser to be tested and benchmarked
+ * on machines without Intel PT support.
+ * @param instrumentation_state - an instrumentation specific state object previously created by the linux_ipt_create or
+ * linux_ipt_load_state function.  The address ranges recorded in the capture file replace the state's address ranges.
+ * @param trace - the contents of a capture file
+ * @param length - the length of the trace buffer
+ * @param key - optionally, a pointer to a ipt_hashtable_key that will be filled in with the trace's hashes
+ * @return - 1 if the captured execution trace was new, 0 if it was not, or -1 on failure.
+ */
+int linux_ipt_replay_trace(void * instrumentation_state, char * trace, size_t length, struct ipt_hashtable_key * key)
+{
+  linux_ipt_state_t * state = (linux_ipt_state_t *)instrumentation_state;
+  struct ipt_capture_header header;
+  struct ipt_capture_library library;
+  struct ipt_hashtable_key trace_key;
+  size_t i, offset;
+  int added;
+
+  if(length < sizeof(header))
+    return -1;
+  memcpy(&header, trace, sizeof(header));
+  if(memcmp(header.magic, IPT_CAPTURE_MAGIC, IPT_CAPTURE_MAGIC_LENGTH) || header.version != IPT_CAPTURE_VERSION
+      || header.num_libraries > (length - sizeof(header)) / sizeof(library)) {
+    ERROR_MSG("Bad IPT capture file");
+    return -1;
+  }
+  offset = sizeof(header);
+
+  //The hash states aren't allocated in states from linux_ipt_load_state
+  if(!state->ipt_hashes.tip)
+    state->ipt_hashes.tip = XXH64_createState();
+  if(!state->ipt_hashes.tnt)
+    state->ipt_hashes.tnt = XXH64_createState();
+  if(!state->ipt_hashes.tip || !state->ipt_hashes.tnt)
+    return -1;
+
+  //Use the address ranges that were in use when the trace was recorded.  The first replay drops the state's own
+  //libraries, after which the arrays are only grown, so replaying many traces doesn't allocate on every call.
+  if(!state->replay_library_capacity) {
+    for(i = 0; i < state->num_coverage_libraries; i++)
+      free(state->coverage_libraries[i]);
+    free(state->coverage_libraries);
+    free(state->library_starts);
+    free(state->library_ends);
+    free(state->library_hashes);
+    state->coverage_libraries = NULL;
+    state->library_starts = state->library_ends = NULL;
+    state->library_hashes = NULL;
+  }
+  state->num_coverage_libraries = 0;
+  if(header.num_libraries > state->replay_library_capacity && grow_replay_libraries(state, header.num_libraries))
+    return -1;
+
+  for(i = 0; i < header.num_libraries; i++) {
+    memcpy(&library, trace + offset, sizeof(library));
+    offset += sizeof(library);
+    state->library_starts[i] = library.start;
+    state->library_ends[i] = library.end;
+    state->library_hashes[i] = library.hash;
+  }
+  state->num_coverage_libraries = header.num_libraries;
+  state->target_start = header.target_start;
+  state->target_end = header.target_end;
+  state->last_ip = header.last_ip;
+
+  if(decode_ipt(state, (unsigned char *)trace + offset, (unsigned char *)trace + length, &trace_key))
+    return -1;
+  if(key)
+    *key = trace_key;
+
+  added = ipt_hashtable_add(&state->hashes, &trace_key);
+  if(added < 0)
+    return -1;
+  return added;
+}
+
 /**
  * This function will return the result of the fuzz job. It should be called
  * after the process has finished processing the tested input.
@@ -1179,6 +1708,17 @@ int linux_ipt_is_process_done(void * instrumentation_state)
   return 1;
 }
 
+/**
+ * Checks whether the target is run with the fork server library preloaded, and thus whether the library's
+ * socket hooks (e.g. for desocketing) are available in the target.
+ * @param state - The linux_ipt_state_t object containing this instrumentation's state
+ * @return - 1, the fork server library is always used
+ */
+int linux_ipt_uses_forkserver_library(void * instrumentation_state)
+{
+  return 1;
+}
+
 /**
  * This function returns help text for the Linux IPT instrumentation.
  * @param help_str - A pointer that will be updated to point to the new help string.
@@ -1191,11 +1731,16 @@ int linux_ipt_help(char ** help_str)
 "Options:\n"
 "  persistence_max_cnt  The number of executions to run in one process while\n"
 "                         fuzzing in persistence mode\n"
+"  network_startup      Whether to start the fork server when the target first\n"
+"                         accepts a connection or receives a datagram, rather\n"
+"                         than before main; 1=yes, 0=no (default=0)\n"
 "  ipt_mmap_size        The amount of memory to use for the IPT trace data\n"
 "                         buffer\n"
 "  coverage_libraries   An array of library or executable filenames that IPT\n"
 "                         should record trace information.  By default, only\n"
 "                         the executable is traced.\n"
+"  ipt_capture_dir      A directory to save the raw IPT trace data from each\n"
+"                         execution to, for replaying with the ipt_replay tool\n"
 "\n"
   );
   if (*help_str == NULL)
@@ -1,29 +1,70 @@
 #pragma once
 
 #include "forkserver_internal.h"
-#include "uthash.h"
 #include "xxhash.h"
 
+struct ipt_hashtable_key;
+
 void * linux_ipt_create(char * options, char * state);
+void * linux_ipt_load_state(char * options, char * state);
 void linux_ipt_cleanup(void * instrumentation_state);
 void * linux_ipt_merge(void * instrumentation_state, void * other_instrumentation_state);
+int linux_ipt_merge_many(void * instrumentation_state, void ** other_instrumentation_states, int num_states);
 char * linux_ipt_get_state(void * instrumentation_state);
 void linux_ipt_free_state(char * state);
 int linux_ipt_set_state(void * instrumentation_state, char * state);
+char * linux_ipt_get_state_binary(void * instrumentation_state, size_t * length);
+int linux_ipt_set_state_binary(void * instrumentation_state, char * state, size_t length);
+char * linux_ipt_get_state_delta(void * instrumentation_state, void * baseline_state, uint64_t baseline_digest, size_t * length);
+int linux_ipt_apply_state_delta(void * instrumentation_state, char * delta, size_t length);
 int linux_ipt_enable(void * instrumentation_state, pid_t * process, char * cmd_line, char * input, size_t input_length);
 int linux_ipt_is_new_path(void * instrumentation_state);
 int linux_ipt_is_process_done(void * instrumentation_state);
 int linux_ipt_get_fuzz_result(void * instrumentation_state);
+int linux_ipt_uses_forkserver_library(void * instrumentation_state);
 int linux_ipt_help(char ** help_str);
+int linux_ipt_replay_trace(void * instrumentation_state, char * trace, size_t length, struct ipt_hashtable_key * key);
 
 struct ipt_hashtable_key {
   uint64_t tip;
   uint64_t tnt;
 };
 
-struct ipt_hashtable_entry {
-    struct ipt_hashtable_key id;
-    UT_hash_handle hh;
+//An open addressing hashtable of the trace hashes that have been seen.  Empty slots hold a key of all zeros, so a
+//real key of all zeros is tracked separately.
+struct ipt_hashtable {
+  struct ipt_hashtable_key * keys;  //The slots, of which there are size, a power of 2
+  size_t size;
+  size_t count;                     //The number of keys in the hashtable
+  int has_zero_key;                 //Whether the key of all zeros is in the hashtable
+};
+
+//When the ipt_capture_dir option is set, the raw IPT trace data from each execution is saved to a file so it can be
+//decoded again later with linux_ipt_replay_trace, without Intel PT hardware.  A capture file holds an
+//ipt_capture_header, then num_libraries ipt_capture_library entries with the address ranges that were used to
+//normalize TIP addresses, and then the trace data until the end of the file.  The integers are in the native
+//byte order, as Intel PT is only available on x86.
+#define IPT_CAPTURE_MAGIC        "KBIT"
+#define IPT_CAPTURE_MAGIC_LENGTH 4
+#define IPT_CAPTURE_VERSION      1
+
+struct ipt_capture_header
+{
+  char magic[IPT_CAPTURE_MAGIC_LENGTH];
+  uint32_t version;
+  uint64_t target_start;
+  uint64_t target_end;
+  uint64_t last_ip;         //The last IP before the trace data, in case it doesn't start with a PSB packet
+  uint32_t num_libraries;
+  uint32_t reserved;
+};
+
+struct ipt_capture_library
+{
+  uint64_t start;
+  uint64_t end;
+  uint32_t hash;
+  uint32_t reserved;
 };
 
 struct ipt_hash_state
@@ -38,6 +79,7 @@ struct ipt_hash_state
 struct linux_ipt_state
 {
   int persistence_max_cnt;
+  int network_startup;
   int ipt_mmap_size;
 
   char ** coverage_libraries;
@@ -45,6 +87,7 @@ struct linux_ipt_state
   uint64_t * library_ends;
   uint32_t * library_hashes;
   size_t num_coverage_libraries;
+  size_t replay_library_capacity; //The number of entries in the library arrays allocated by linux_ipt_replay_trace
 
   char * target_path;
   uint64_t target_start;
@@ -60,9 +103,11 @@ struct linux_ipt_state
   char * reorder_buffer;
   uint64_t last_ip;
   char * filter;
+  char * capture_dir;
+  uint64_t num_captures;
 
   struct ipt_hash_state ipt_hashes;
-  struct ipt_hashtable_entry * head;
+  struct ipt_hashtable hashes;
 
   pid_t child_pid;
   forkserver_t fs;
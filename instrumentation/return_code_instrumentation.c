@@ -60,7 +60,7 @@ static int create_target_process(return_code_state_t * state, char* cmd_line, ch
 				return -1;
 
 			//Start the fork server
-			fork_server_init(&state->fs, target_path, argv, 1, 0, stdin_length != 0);
+			fork_server_init(&state->fs, target_path, argv, 1, 0, stdin_length != 0, state->network_startup);
 			state->fork_server_setup = 1;
 
 			//Free the split up command line
@@ -119,6 +119,7 @@ static return_code_state_t * setup_options(char *options) {
 
 	if(options) {
 		PARSE_OPTION_INT(state, options, use_fork_server, "use_fork_server", return_code_cleanup);
+		PARSE_OPTION_INT(state, options, network_startup, "network_startup", return_code_cleanup);
 	}
 	return state;
 }
@@ -326,6 +327,19 @@ int return_code_is_process_done(void * instrumentation_state)
 	}
 }
 
+/**
+ * Checks whether the target is run with the fork server library preloaded, and thus whether the library's
+ * socket hooks (e.g. for desocketing) are available in the target.
+ *
+ * @param state - The return_code_state_t object containing this instrumentation's state
+ * @return - 1 if the fork server library is used, 0 otherwise
+ */
+int return_code_uses_forkserver_library(void * instrumentation_state)
+{
+	return_code_state_t * state = (return_code_state_t *)instrumentation_state;
+	return state->use_fork_server;
+}
+
 /**
  * This function returns help text for this instrumentation.  This help text will describe the instrumentation and any options
  * that can be passed to return_code_create.
@@ -338,6 +352,10 @@ int return_code_help(char ** help_str)
 		"return_code - Linux/Mac return_code \"instrumentation\"\n"
 		"Options:\n"
 		"  use_fork_server      Whether to inject the fork server library; 1=yes, 0=no (default=1)\n"
+		"  network_startup      Whether to start the fork server when the target first\n"
+		"                         accepts a connection or receives a datagram, rather\n"
+		"                         than before main, so the listening socket is only set\n"
+		"                         up once; 1=yes, 0=no (default=0)\n"
 		"\n"
 	);
 	if (*help_str == NULL)
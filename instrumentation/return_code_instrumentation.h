@@ -11,12 +11,14 @@ int return_code_enable(void * instrumentation_state, pid_t * process, char * cmd
 int return_code_is_new_path(void * instrumentation_state);
 int return_code_get_fuzz_result(void * instrumentation_state);
 int return_code_is_process_done(void * instrumentation_state);
+int return_code_uses_forkserver_library(void * instrumentation_state);
 int return_code_help(char ** help_str);
 
 struct return_code_state
 {
 	int fork_server_setup;
 	int use_fork_server;
+	int network_startup; // start the fork server at the first accept()/recv, rather than before main
 	forkserver_t fs;
 
 	pid_t child_pid;
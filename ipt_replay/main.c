@@ -0,0 +1,131 @@
+//This program replays IPT trace data previously saved by the IPT instrumentation's
+//ipt_capture_dir option through the IPT instrumentation's packet parser.  It
+//prints the TIP and TNT hashes of each execution trace and how quickly the trace
+//data was decoded, so the parser can be tested and benchmarked on machines
+//without Intel PT support.
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <linux_ipt_instrumentation.h>
+#include <utils.h>
+
+/**
+* This function prints out the usage information for the IPT replay tool.
+* @param program_name - the name of the program currently being run (for use in the outputted message)
+*/
+void usage(char * program_name)
+{
+	printf(
+		"Usage: %s [-l logging_options] [-n iterations] capture_file [capture_file ...]\n"
+		"\n"
+		"Options:\n"
+		"\t -l logging_options           Set the options for logging\n"
+		"\t -n iterations                Decode the capture files this many times when measuring the decoding speed\n"
+		"\t                              (default 1)\n"
+		"\t capture_file                 A file of IPT trace data saved by the IPT instrumentation's ipt_capture_dir option\n"
+		"\n",
+		program_name
+	);
+	exit(1);
+}
+
+/**
+* This function returns the current time in seconds, from a clock that is not affected by changes to the system time.
+* @return - the current time in seconds
+*/
+static double get_time(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1000000000.0;
+}
+
+int main(int argc, char ** argv)
+{
+	void * instrumentation_state;
+	struct ipt_hashtable_key key;
+	char *logging_options = NULL;
+	char ** traces;
+	int * lengths;
+	int i, j, iteration, num_traces, num_new = 0, num_iterations = 1, ret;
+	uint64_t total_bytes = 0;
+	double start, elapsed;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++)
+	{
+		IF_ARG_OPTION("-l", logging_options)
+		ELSE_IF_ARGINT_OPTION("-n", num_iterations)
+		else
+		{
+			if (strcmp("-h", argv[i]))
+				printf("Unknown argument: %s\n", argv[i]);
+			usage(argv[0]);
+		}
+	}
+	if (i >= argc)
+		usage(argv[0]);
+	if (num_iterations < 1)
+		FATAL_MSG("Bad iteration count (%d).  Must have an iteration count 1 or greater.", num_iterations);
+
+	if (setup_logging(logging_options))
+	{
+		printf("Failed setting up logging, exitting\n");
+		return 1;
+	}
+
+	//Load all of the capture files up front, so only the decoding is timed
+	num_traces = argc - i;
+	traces = calloc(num_traces, sizeof(char *));
+	lengths = calloc(num_traces, sizeof(int));
+	if (!traces || !lengths)
+		FATAL_MSG("Failed allocating memory for the capture files");
+	for (j = 0; j < num_traces; j++)
+	{
+		lengths[j] = read_file(argv[i + j], &traces[j]);
+		if (lengths[j] < 0)
+			FATAL_MSG("Couldn't read the capture file %s", argv[i + j]);
+	}
+
+	//Decode each capture once to report its hashes
+	instrumentation_state = linux_ipt_load_state(NULL, NULL);
+	if (!instrumentation_state)
+		FATAL_MSG("Failed to create the IPT instrumentation state");
+	for (j = 0; j < num_traces; j++)
+	{
+		ret = linux_ipt_replay_trace(instrumentation_state, traces[j], lengths[j], &key);
+		if (ret < 0)
+			FATAL_MSG("Failed to decode the capture file %s", argv[i + j]);
+		num_new += ret;
+		printf("%s: TIP hash 0x%016llx TNT hash 0x%016llx%s\n", argv[i + j], (unsigned long long)key.tip,
+			(unsigned long long)key.tnt, ret ? "" : " (duplicate)");
+	}
+	printf("%d of %d execution traces were unique\n", num_new, num_traces);
+
+	//Then decode them again to measure the decoding speed
+	start = get_time();
+	for (iteration = 0; iteration < num_iterations; iteration++)
+	{
+		for (j = 0; j < num_traces; j++)
+		{
+			if (linux_ipt_replay_trace(instrumentation_state, traces[j], lengths[j], NULL) < 0)
+				FATAL_MSG("Failed to decode the capture file %s", argv[i + j]);
+			total_bytes += lengths[j];
+		}
+	}
+	elapsed = get_time() - start;
+	printf("Decoded %llu bytes in %.3f seconds (%.2f MB/s)\n", (unsigned long long)total_bytes, elapsed,
+		elapsed > 0 ? total_bytes / elapsed / (1024 * 1024) : 0);
+
+	//Cleanup the objects and exit
+	linux_ipt_cleanup(instrumentation_state);
+	for (j = 0; j < num_traces; j++)
+		free(traces[j]);
+	free(traces);
+	free(lengths);
+	return 0;
+}
@@ -6,12 +6,23 @@
 
 #include <instrumentation.h>
 #include <instrumentation_factory.h>
+#include <binary_state.h>
 #include <utils.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
+
+//The number of instrumentation states to load before merging them into the combined state
+#define MERGE_BATCH_SIZE 16
 
 /**
 * This function prints out the usage information for the merger and the available instrumentations.
@@ -21,12 +32,16 @@ void usage(char * program_name)
 {
 	char * help_text;
 	printf(
-		"Usage: %s instrumentation_name [-i instrumentation_options] output_file input_file [input_file ...]\n"
+		"Usage: %s instrumentation_name [-b] [-i instrumentation_options] [-j num_workers] output_file input_file [input_file ...]\n"
 		"\n"
 		"Options:\n"
+		"\t -b                           Write the combined instrumentation state in the compact binary format\n"
 		"\t -i instrumentation_options   Set the options for the instrumentation\n"
+		"\t -j num_workers               Split the input files between this many worker processes, and then merge\n"
+		"\t                              their results (not supported on Windows, default 1)\n"
 		"\t output_file                  Set the file containing that the combined instrumentation state should dump to\n"
 		"\t input_file                   Set the file containing that the instrumentation state should load from\n"
+		"\t                              (JSON, the binary format, or a binary delta from the fuzzer's -isdelta option)\n"
 		"\n",
 		program_name
 	);
@@ -42,13 +57,284 @@ void usage(char * program_name)
 	exit(1);
 }
 
+/**
+* This function loads an instrumentation state file into memory.  The returned buffer is always NUL terminated, so it can
+* be passed directly to the instrumentation's create function.
+* @param filename - the file to load
+* @param length - a pointer used to return the length of the file
+* @param mapped_length - a pointer used to return the length of the returned buffer, which should be passed to unmap_state_file
+* @return - the contents of the file, or NULL on failure or if the file is empty.  It should be freed with unmap_state_file.
+*/
+static char * map_state_file(char * filename, size_t * length, size_t * mapped_length)
+{
+#ifdef _WIN32
+	char * buffer;
+	int file_length;
+
+	file_length = read_file(filename, &buffer);
+	if (file_length <= 0)
+		return NULL;
+	*length = *mapped_length = file_length;
+	return buffer;
+#else
+	struct stat st;
+	char * buffer;
+	size_t page_size;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) || st.st_size <= 0)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	//Reserve at least one page more than the file needs, so there's always a zeroed byte after the file's
+	//contents to terminate it, and then map the file over the start of the reservation
+	page_size = (size_t)sysconf(_SC_PAGESIZE);
+	*mapped_length = ((size_t)st.st_size / page_size + 1) * page_size;
+	buffer = (char *)mmap(NULL, *mapped_length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buffer != MAP_FAILED && mmap(buffer, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+	{
+		munmap(buffer, *mapped_length);
+		buffer = (char *)MAP_FAILED;
+	}
+	close(fd);
+	*length = (size_t)st.st_size;
+	return buffer == MAP_FAILED ? NULL : buffer;
+#endif
+}
+
+/**
+* This function frees a buffer returned by map_state_file.
+* @param buffer - the buffer to free
+* @param mapped_length - the length returned by map_state_file
+*/
+static void unmap_state_file(char * buffer, size_t mapped_length)
+{
+#ifdef _WIN32
+	free(buffer);
+#else
+	munmap(buffer, mapped_length);
+#endif
+}
+
+/**
+* This function loads an instrumentation state from a file, exiting on failure.  If the instrumentation has a load_state
+* function, it is used rather than create, so nothing is set up to run a target.  The file may hold a JSON, binary, or
+* binary delta instrumentation state.  A delta is applied directly to the combined state, when there is one, since that
+* only costs as much as the new coverage in the delta.
+* @param instrumentation - the instrumentation to create the state with
+* @param instrumentation_options - the options to pass to the instrumentation's create function
+* @param filename - the file containing the instrumentation state
+* @param combined_state - the combined instrumentation state that deltas should be applied to, or NULL
+* @return - the instrumentation state, or NULL if the file held a delta that was applied to combined_state
+*/
+static void * load_state_file(instrumentation_t * instrumentation, char * instrumentation_options, char * filename, void * combined_state)
+{
+	char * instrumentation_state_string;
+	size_t length, mapped_length;
+	void * instrumentation_state = NULL;
+	int failed = 0;
+
+	instrumentation_state_string = map_state_file(filename, &length, &mapped_length);
+	if (!instrumentation_state_string)
+		FATAL_MSG("Could not read instrumentation file or empty instrumentation file: %s", filename);
+
+	if (combined_state && is_binary_state_delta(instrumentation_state_string, length) && instrumentation->apply_state_delta)
+		failed = instrumentation->apply_state_delta(combined_state, instrumentation_state_string, length);
+	else
+	{
+		instrumentation_state = load_any_state(instrumentation,
+			instrumentation->load_state ? instrumentation->load_state : instrumentation->create,
+			instrumentation_options, instrumentation_state_string, length);
+		failed = !instrumentation_state;
+	}
+	unmap_state_file(instrumentation_state_string, mapped_length);
+	if (failed)
+		FATAL_MSG("Bad options/state for instrumentation file %s", filename);
+	return instrumentation_state;
+}
+
+/**
+* This function merges instrumentation states into a combined state, and then frees them.  If the instrumentation has a
+* merge_many function, the states are merged into the combined state in place, otherwise they're merged one at a time.
+* @param instrumentation - the instrumentation that created the states
+* @param instrumentation_state - the combined instrumentation state
+* @param states - the instrumentation states to merge into the combined state
+* @param num_states - the number of states in the states array
+* @return - the combined instrumentation state, which may not be the one that was passed in
+*/
+static void * fold_states(instrumentation_t * instrumentation, void * instrumentation_state, void ** states, int num_states)
+{
+	void * merged_instrumentation_state;
+	int i;
+
+	if (instrumentation->merge_many)
+	{
+		if (instrumentation->merge_many(instrumentation_state, states, num_states))
+			FATAL_MSG("Failed to merge the instrumentation states");
+	}
+	else
+	{
+		for (i = 0; i < num_states; i++)
+		{
+			merged_instrumentation_state = instrumentation->merge(instrumentation_state, states[i]);
+			if (!merged_instrumentation_state)
+				FATAL_MSG("Failed to merge the instrumentation states");
+			instrumentation->cleanup(instrumentation_state);
+			instrumentation_state = merged_instrumentation_state;
+		}
+	}
+
+	for (i = 0; i < num_states; i++)
+		instrumentation->cleanup(states[i]);
+	return instrumentation_state;
+}
+
+/**
+* This function loads and merges a list of instrumentation state files.
+* @param instrumentation - the instrumentation to create the states with
+* @param instrumentation_options - the options to pass to the instrumentation's create function
+* @param filenames - the files containing the instrumentation states
+* @param num_files - the number of files in the filenames array
+* @return - the combined instrumentation state
+*/
+static void * merge_files(instrumentation_t * instrumentation, char * instrumentation_options, char ** filenames, int num_files)
+{
+	void * states[MERGE_BATCH_SIZE];
+	void * instrumentation_state;
+	int i, num_states = 0;
+
+	instrumentation_state = load_state_file(instrumentation, instrumentation_options, filenames[0], NULL);
+	for (i = 1; i < num_files; i++)
+	{
+		states[num_states] = load_state_file(instrumentation, instrumentation_options, filenames[i], instrumentation_state);
+		if (states[num_states])
+			num_states++;
+		if (num_states == MERGE_BATCH_SIZE || (num_states && i == num_files - 1))
+		{
+			instrumentation_state = fold_states(instrumentation, instrumentation_state, states, num_states);
+			num_states = 0;
+		}
+	}
+	return instrumentation_state;
+}
+
+/**
+* This function writes an instrumentation state to a file.
+* @param instrumentation - the instrumentation that created the state
+* @param instrumentation_state - the instrumentation state to write
+* @param filename - the file to write the state to
+* @param binary - whether to write the state in the binary format, rather than JSON.  The instrumentation must support it.
+* @return - 0 on success, non-zero on failure
+*/
+static int write_state(instrumentation_t * instrumentation, void * instrumentation_state, char * filename, int binary)
+{
+	char * instrumentation_state_string;
+	size_t length;
+	int ret;
+
+	if (binary)
+		instrumentation_state_string = instrumentation->get_state_binary(instrumentation_state, &length);
+	else
+	{
+		instrumentation_state_string = instrumentation->get_state(instrumentation_state);
+		if (instrumentation_state_string)
+			length = strlen(instrumentation_state_string);
+	}
+	if (!instrumentation_state_string)
+		return 1;
+	ret = write_buffer_to_file(filename, instrumentation_state_string, length);
+	instrumentation->free_state(instrumentation_state_string);
+	return ret;
+}
+
+#ifndef _WIN32
+/**
+* This function merges a list of instrumentation state files with several worker processes.  The files are split into a
+* contiguous range for each worker, each worker merges its range and writes the result to a temporary file, and then the
+* workers' results are merged.  The temporary files use the binary format when the instrumentation supports it, since it's
+* quicker to write and load.
+* @param instrumentation - the instrumentation to create the states with
+* @param instrumentation_options - the options to pass to the instrumentation's create function
+* @param filenames - the files containing the instrumentation states
+* @param num_files - the number of files in the filenames array
+* @param output_file - the file the combined state will be written to, used to name the temporary files
+* @param num_workers - the number of worker processes to use
+* @return - the combined instrumentation state
+*/
+static void * merge_files_parallel(instrumentation_t * instrumentation, char * instrumentation_options, char ** filenames, int num_files,
+	char * output_file, int num_workers)
+{
+	void * instrumentation_state;
+	char ** worker_filenames;
+	pid_t * pids;
+	int i, start, end, status, failed = 0;
+
+	pids = (pid_t *)malloc(num_workers * sizeof(pid_t));
+	worker_filenames = (char **)malloc(num_workers * sizeof(char *));
+	if (!pids || !worker_filenames)
+		FATAL_MSG("Failed to allocate memory for %d workers", num_workers);
+	for (i = 0; i < num_workers; i++)
+	{
+		worker_filenames[i] = (char *)malloc(MAX_PATH);
+		if (!worker_filenames[i])
+			FATAL_MSG("Failed to allocate memory for %d workers", num_workers);
+		snprintf(worker_filenames[i], MAX_PATH - 1, "%s.worker%d.tmp", output_file, i);
+		worker_filenames[i][MAX_PATH - 1] = 0;
+	}
+
+	//Otherwise anything still buffered would be written again by each worker when it exits
+	fflush(NULL);
+
+	for (i = 0; i < num_workers; i++)
+	{
+		pids[i] = fork();
+		if (pids[i] < 0)
+			FATAL_MSG("Failed to start merger worker %d", i);
+		if (pids[i] == 0)
+		{
+			start = (int)((long long)num_files * i / num_workers);
+			end = (int)((long long)num_files * (i + 1) / num_workers);
+			instrumentation_state = merge_files(instrumentation, instrumentation_options, filenames + start, end - start);
+			if (write_state(instrumentation, instrumentation_state, worker_filenames[i], instrumentation->get_state_binary != NULL))
+				FATAL_MSG("Couldn't dump instrumentation state to file %s", worker_filenames[i]);
+			exit(0);
+		}
+	}
+
+	for (i = 0; i < num_workers; i++)
+	{
+		if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+		{
+			ERROR_MSG("Merger worker %d failed", i);
+			failed = 1;
+		}
+	}
+	if (failed)
+		FATAL_MSG("Failed to merge the instrumentation states");
+
+	instrumentation_state = merge_files(instrumentation, instrumentation_options, worker_filenames, num_workers);
+	for (i = 0; i < num_workers; i++)
+	{
+		unlink(worker_filenames[i]);
+		free(worker_filenames[i]);
+	}
+	free(worker_filenames);
+	free(pids);
+	return instrumentation_state;
+}
+#endif
 
 int main(int argc, char ** argv)
 {
 	instrumentation_t * instrumentation;
-	int instrumentation_length, argv_index;
-	char *instrumentation_options = NULL, *instrumentation_state_string = NULL, *instrumentation_state_dump_file = NULL;
-	void * instrumentation_state = NULL, *new_instrumentation_state = NULL, *merged_instrumentation_state = NULL;
+	int i, num_workers = 1, binary = 0;
+	char *instrumentation_options = NULL, *instrumentation_state_dump_file = NULL;
+	void * instrumentation_state = NULL;
 
 	if (argc < 3)
 		usage(argv[0]);
@@ -63,48 +349,42 @@ int main(int argc, char ** argv)
 	if (!instrumentation)
 		FATAL_MSG("Unknown instrumentation (%s)", argv[1]);
 
-	if (strcmp("-i", argv[2]))
-	{
-		argv_index = 3;
-		instrumentation_state_dump_file = argv[2];
-	}
-	else
-	{
-		instrumentation_options = argv[3];
-		argv_index = 5;
-		instrumentation_state_dump_file = argv[4];
-	}
-
-
-	for (; argv_index < argc; argv_index++)
+	for (i = 2; i < argc && argv[i][0] == '-'; i++)
 	{
-		//Load the instrumentation state from disk
-		instrumentation_length = read_file(argv[argv_index], &instrumentation_state_string);
-		if (instrumentation_length <= 0)
-			FATAL_MSG("Could not read instrumentation file or empty instrumentation file: %s", argv[argv_index]);
-		new_instrumentation_state = instrumentation->create(instrumentation_options, instrumentation_state_string);
-		if (!instrumentation)
-			FATAL_MSG("Bad options/state for instrumentation file %s", argv[argv_index]);
-		free(instrumentation_state_string);
-
-		if (!instrumentation_state)
-			instrumentation_state = new_instrumentation_state;
+		IF_ARG_SET_TRUE("-b", binary)
+		ELSE_IF_ARG_OPTION("-i", instrumentation_options)
+		ELSE_IF_ARGINT_OPTION("-j", num_workers)
 		else
 		{
-			merged_instrumentation_state = instrumentation->merge(instrumentation_state, new_instrumentation_state);
-			instrumentation->cleanup(instrumentation_state);
-			instrumentation->cleanup(new_instrumentation_state);
-			instrumentation_state = merged_instrumentation_state;
+			if (strcmp("-h", argv[i]))
+				printf("Unknown argument: %s\n", argv[i]);
+			usage(argv[0]);
 		}
 	}
+	if (argc - i < 2)
+		usage(argv[0]);
+	instrumentation_state_dump_file = argv[i++];
 
-	instrumentation_state_string = instrumentation->get_state(instrumentation_state);
-	if (instrumentation_state_string)
-	{
-		write_buffer_to_file(instrumentation_state_dump_file, instrumentation_state_string, strlen(instrumentation_state_string));
-		instrumentation->free_state(instrumentation_state_string);
-	}
+	if (binary && !instrumentation->get_state_binary)
+		FATAL_MSG("The %s instrumentation does not support binary instrumentation states", argv[1]);
+	if (num_workers < 1)
+		FATAL_MSG("Bad worker count (%d).  Must have a worker count 1 or greater.", num_workers);
+	//Each worker needs at least two files for it to save any work
+	if (num_workers > (argc - i) / 2)
+		num_workers = (argc - i) / 2;
+
+#ifndef _WIN32
+	if (num_workers > 1)
+		instrumentation_state = merge_files_parallel(instrumentation, instrumentation_options, argv + i, argc - i,
+			instrumentation_state_dump_file, num_workers);
 	else
+#else
+	if (num_workers > 1)
+		FATAL_MSG("Merging with multiple workers is not supported on Windows");
+#endif
+		instrumentation_state = merge_files(instrumentation, instrumentation_options, argv + i, argc - i);
+
+	if (write_state(instrumentation, instrumentation_state, instrumentation_state_dump_file, binary))
 		WARNING_MSG("Couldn't dump instrumentation state to file %s", instrumentation_state_dump_file);
 
 	//Cleanup the objects and exit
@@ -0,0 +1,651 @@
+//Round trip and corruption tests for the binary formats: binary instrumentation states, binary multipart
+//inputs, edge databases, and the tracer's edge sets.  Returns non-zero if any test fails.
+
+#include <binary_state.h>
+#include <multipart.h>
+#include <edge_db.h>
+#include <edge_set.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_STATE_TYPE "format_tests"
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+		if (!(condition)) \
+		{ \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			failures++; \
+		} \
+	} while (0)
+
+/**
+ * This function fills a buffer with pseudo-random bytes, so the tests are repeatable.
+ * @param buffer - the buffer to fill
+ * @param length - the length of the buffer parameter
+ * @param seed - a pointer to the generator's state
+ */
+static void fill_random(uint8_t * buffer, size_t length, uint32_t * seed)
+{
+	size_t i;
+
+	for (i = 0; i < length; i++)
+	{
+		*seed = *seed * 1103515245 + 12345;
+		buffer[i] = (uint8_t)(*seed >> 16);
+	}
+}
+
+/**
+ * This function writes a file.
+ * @param filename - the file to write
+ * @param buffer - the contents of the file
+ * @param length - the length of the buffer parameter
+ * @return - 0 on success, non-zero on failure
+ */
+static int write_test_file(const char * filename, const char * buffer, size_t length)
+{
+	FILE * fp;
+	int ret;
+
+	fp = fopen(filename, "wb");
+	if (!fp)
+		return 1;
+	ret = fwrite(buffer, 1, length, fp) != length;
+	fclose(fp);
+	return ret;
+}
+
+/**
+ * This function reads a file.
+ * @param filename - the file to read
+ * @param length - a pointer used to return the length of the file
+ * @return - the contents of the file, which should be freed by the caller, or NULL on failure
+ */
+static char * read_test_file(const char * filename, size_t * length)
+{
+	FILE * fp;
+	char * buffer;
+	long size;
+
+	fp = fopen(filename, "rb");
+	if (!fp)
+		return NULL;
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	buffer = (char *)malloc(size > 0 ? size : 1);
+	if (buffer && fread(buffer, 1, size, fp) != (size_t)size)
+	{
+		free(buffer);
+		buffer = NULL;
+	}
+	fclose(fp);
+	*length = (size_t)size;
+	return buffer;
+}
+
+//////////////////////////////////////////////////////////////
+// Binary instrumentation states /////////////////////////////
+//////////////////////////////////////////////////////////////
+
+static void test_binary_state_varints(void)
+{
+	uint64_t values[] = { 0, 1, 127, 128, 300, 16383, 16384, 0xffffffffULL, 0x123456789abcdefULL, UINT64_MAX };
+	size_t encoded_lengths[] = { 1, 1, 1, 2, 2, 2, 3, 5, 9, 10 };
+	size_t num_values = sizeof(values) / sizeof(values[0]);
+	binary_state_writer_t writer;
+	binary_state_reader_t reader;
+	char * state, overlong[BINARY_STATE_HEADER_SIZE + 11];
+	size_t i, length, offset;
+
+	binary_state_writer_init(&writer, TEST_STATE_TYPE);
+	for (i = 0; i < num_values; i++)
+	{
+		offset = writer.length;
+		binary_state_write_varint(&writer, values[i]);
+		CHECK(writer.length - offset == encoded_lengths[i]);
+	}
+	binary_state_write_u64(&writer, 0x0102030405060708ULL);
+	state = binary_state_writer_finish(&writer, &length);
+	CHECK(state != NULL);
+	if (!state)
+		return;
+
+	CHECK(is_binary_state(state, length));
+	CHECK(!is_binary_state_delta(state, length));
+	CHECK(!memcmp(state, BINARY_STATE_MAGIC "\x01\0\0\0" TEST_STATE_TYPE "\0\0\0\0", BINARY_STATE_HEADER_SIZE));
+	CHECK(binary_state_reader_init(&reader, state, length, "other_type"));
+	CHECK(!binary_state_reader_init(&reader, state, length, TEST_STATE_TYPE));
+	for (i = 0; i < num_values; i++)
+		CHECK(binary_state_read_varint(&reader) == values[i]);
+	CHECK(binary_state_read_u64(&reader) == 0x0102030405060708ULL);
+	CHECK(!binary_state_reader_finish(&reader));
+
+	//Reading past the end of the state is an error, as are trailing bytes that weren't read
+	CHECK(binary_state_read_varint(&reader) == 0);
+	CHECK(binary_state_reader_finish(&reader));
+	CHECK(!binary_state_reader_init(&reader, state, length, TEST_STATE_TYPE));
+	binary_state_read_varint(&reader);
+	CHECK(binary_state_reader_finish(&reader));
+
+	//Every truncation either has no header or runs out of data part way through a value
+	for (length--; length >= BINARY_STATE_HEADER_SIZE; length--)
+	{
+		CHECK(!binary_state_reader_init(&reader, state, length, TEST_STATE_TYPE));
+		for (i = 0; i < num_values; i++)
+			binary_state_read_varint(&reader);
+		binary_state_read_u64(&reader);
+		CHECK(binary_state_reader_finish(&reader));
+	}
+	for (; length > 0; length--)
+		CHECK(!is_binary_state(state, length));
+
+	//A varint can't have more than 64 bits worth of continuation bytes
+	memcpy(overlong, state, BINARY_STATE_HEADER_SIZE);
+	memset(overlong + BINARY_STATE_HEADER_SIZE, 0x80, 10);
+	overlong[sizeof(overlong) - 1] = 0;
+	CHECK(!binary_state_reader_init(&reader, overlong, sizeof(overlong), TEST_STATE_TYPE));
+	binary_state_read_varint(&reader);
+	CHECK(reader.error);
+	free(state);
+}
+
+/**
+ * This function writes a coverage map as a sparse map and checks that it reads back the same.
+ * @param map - the coverage map to test
+ * @param size - the size of the coverage map
+ * @param fill - the fill byte to encode the map with
+ * @param encoded_length - a pointer used to return the length of the encoded map, or NULL
+ */
+static void check_sparse_map_round_trip(const uint8_t * map, size_t size, uint8_t fill, size_t * encoded_length)
+{
+	binary_state_writer_t writer;
+	binary_state_reader_t reader;
+	uint8_t * read_map;
+	char * state;
+	size_t length;
+
+	binary_state_writer_init(&writer, TEST_STATE_TYPE);
+	binary_state_write_sparse_map(&writer, map, size, fill);
+	state = binary_state_writer_finish(&writer, &length);
+	read_map = (uint8_t *)malloc(size ? size : 1);
+	CHECK(state != NULL && read_map != NULL);
+	if (state && read_map)
+	{
+		CHECK(!binary_state_reader_init(&reader, state, length, TEST_STATE_TYPE));
+		binary_state_read_sparse_map(&reader, read_map, size, fill);
+		CHECK(!binary_state_reader_finish(&reader));
+		CHECK(!memcmp(map, read_map, size));
+		if (encoded_length)
+			*encoded_length = length - BINARY_STATE_HEADER_SIZE;
+	}
+	free(state);
+	free(read_map);
+}
+
+static void test_binary_state_sparse_maps(void)
+{
+	uint8_t map[65536], read_map[65536], small_map[10], gaps[] = { 1, 0, 0, 2, 0, 0, 0, 3, 0, 4 };
+	binary_state_writer_t writer;
+	binary_state_reader_t reader;
+	uint32_t seed = 1;
+	size_t i, length, encoded_length, sizes[] = { 0, 1, 2, 3, 4, 7, 64, 1000 };
+	char * state;
+
+	//Maps that are all fill bytes, all literal bytes, or mixed, including fill runs too short to encode as runs
+	memset(map, 0, sizeof(map));
+	check_sparse_map_round_trip(map, sizeof(map), 0, &encoded_length);
+	CHECK(encoded_length <= 4);
+	check_sparse_map_round_trip(map, sizeof(map), 0xff, &encoded_length);
+	CHECK(encoded_length <= sizeof(map) + 8);
+	fill_random(map, sizeof(map), &seed);
+	check_sparse_map_round_trip(map, sizeof(map), 0, NULL);
+	check_sparse_map_round_trip(gaps, sizeof(gaps), 0, NULL);
+	check_sparse_map_round_trip(gaps, sizeof(gaps), 1, NULL);
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+	{
+		memset(map, 0, sizes[i]);
+		check_sparse_map_round_trip(map, sizes[i], 0, NULL);
+		if (sizes[i])
+			map[sizes[i] - 1] = 1;
+		check_sparse_map_round_trip(map, sizes[i], 0, NULL);
+		map[0] = 2;
+		check_sparse_map_round_trip(map, sizes[i], 0, NULL);
+	}
+
+	//A sparse map like real coverage, which should encode much smaller than the map
+	memset(map, 0, sizeof(map));
+	for (i = 0; i < 200; i++)
+	{
+		fill_random(read_map, 3, &seed);
+		map[(read_map[0] | (read_map[1] << 8)) % sizeof(map)] = read_map[2] | 1;
+	}
+	check_sparse_map_round_trip(map, sizeof(map), 0, &encoded_length);
+	CHECK(encoded_length < 200 * 4);
+
+	//Every truncation of the encoded map must be detected
+	binary_state_writer_init(&writer, TEST_STATE_TYPE);
+	binary_state_write_sparse_map(&writer, map, sizeof(map), 0);
+	state = binary_state_writer_finish(&writer, &length);
+	CHECK(state != NULL);
+	if (!state)
+		return;
+	for (length--; length >= BINARY_STATE_HEADER_SIZE; length--)
+	{
+		CHECK(!binary_state_reader_init(&reader, state, length, TEST_STATE_TYPE));
+		binary_state_read_sparse_map(&reader, read_map, sizeof(read_map), 0);
+		CHECK(binary_state_reader_finish(&reader));
+	}
+	free(state);
+
+	//Runs that go past the end of the map, and empty runs that would never finish the map, are errors
+	binary_state_writer_init(&writer, TEST_STATE_TYPE);
+	binary_state_write_varint(&writer, 11);
+	binary_state_write_varint(&writer, 0);
+	state = binary_state_writer_finish(&writer, &length);
+	CHECK(state != NULL);
+	if (state)
+	{
+		CHECK(!binary_state_reader_init(&reader, state, length, TEST_STATE_TYPE));
+		binary_state_read_sparse_map(&reader, small_map, sizeof(small_map), 0);
+		CHECK(binary_state_reader_finish(&reader));
+		free(state);
+	}
+
+	binary_state_writer_init(&writer, TEST_STATE_TYPE);
+	binary_state_write_varint(&writer, 5);
+	binary_state_write_varint(&writer, 6);
+	binary_state_write_bytes(&writer, gaps, 6);
+	state = binary_state_writer_finish(&writer, &length);
+	CHECK(state != NULL);
+	if (state)
+	{
+		CHECK(!binary_state_reader_init(&reader, state, length, TEST_STATE_TYPE));
+		binary_state_read_sparse_map(&reader, small_map, sizeof(small_map), 0);
+		CHECK(binary_state_reader_finish(&reader));
+		free(state);
+	}
+
+	binary_state_writer_init(&writer, TEST_STATE_TYPE);
+	for (i = 0; i < 4; i++)
+		binary_state_write_varint(&writer, 0);
+	state = binary_state_writer_finish(&writer, &length);
+	CHECK(state != NULL);
+	if (state)
+	{
+		CHECK(!binary_state_reader_init(&reader, state, length, TEST_STATE_TYPE));
+		binary_state_read_sparse_map(&reader, small_map, sizeof(small_map), 0);
+		CHECK(binary_state_reader_finish(&reader));
+		free(state);
+	}
+}
+
+static void test_binary_state_deltas(void)
+{
+	binary_state_writer_t writer;
+	binary_state_reader_t reader;
+	uint64_t digest;
+	char * state;
+	size_t length;
+
+	binary_state_delta_writer_init(&writer, TEST_STATE_TYPE, 0xdeadbeefcafef00dULL);
+	binary_state_write_varint(&writer, 42);
+	state = binary_state_writer_finish(&writer, &length);
+	CHECK(state != NULL);
+	if (!state)
+		return;
+
+	CHECK(is_binary_state_delta(state, length));
+	CHECK(!is_binary_state(state, length));
+	CHECK(binary_state_reader_init(&reader, state, length, TEST_STATE_TYPE));
+	CHECK(!binary_state_delta_digest(state, length, &digest));
+	CHECK(digest == 0xdeadbeefcafef00dULL);
+	CHECK(!binary_state_delta_reader_init(&reader, state, length, TEST_STATE_TYPE));
+	CHECK(binary_state_read_varint(&reader) == 42);
+	CHECK(!binary_state_reader_finish(&reader));
+	CHECK(binary_state_delta_digest(state, BINARY_STATE_HEADER_SIZE + 7, &digest));
+	CHECK(binary_state_digest(state, length) == binary_state_digest(state, length));
+	CHECK(binary_state_digest(state, length) != binary_state_digest(state, length - 1));
+	free(state);
+}
+
+//////////////////////////////////////////////////////////////
+// Binary multipart inputs ///////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+static void test_multipart(void)
+{
+	char binary[1000], * packets[3] = { "abc", "", binary }, * buffer, * mem_array, * converted;
+	size_t packet_lengths[3] = { 3, 0, sizeof(binary) };
+	char ** got_packets = NULL;
+	size_t * got_lengths = NULL, capacity = 0, count, i, packet_length;
+	multipart_view_t view;
+	const char * packet;
+	uint32_t seed = 2;
+	int length, converted_length, mem_array_length;
+
+	fill_random((uint8_t *)binary, sizeof(binary), &seed);
+	binary[0] = 0;
+	buffer = encode_multipart(packets, packet_lengths, 3, &length);
+	CHECK(buffer != NULL);
+	if (!buffer)
+		return;
+	CHECK(length == MULTIPART_HEADER_SIZE + 3 * sizeof(uint32_t) + 3 + 0 + sizeof(binary));
+	CHECK(is_multipart(buffer, length));
+
+	//Iterate over the packets in place
+	CHECK(!multipart_view_init(&view, buffer, length));
+	CHECK(view.count == 3);
+	for (i = 0; multipart_next(&view, &packet, &packet_length); i++)
+	{
+		CHECK(i < 3);
+		if (i >= 3)
+			break;
+		CHECK(packet_length == packet_lengths[i]);
+		CHECK(!memcmp(packet, packets[i], packet_length));
+		CHECK(packet >= buffer && packet + packet_length <= buffer + length);
+	}
+	CHECK(i == 3);
+
+	//The packet arrays grow as needed, and are reused for inputs with fewer packets
+	CHECK(!multipart_get_packets(buffer, length, &got_packets, &got_lengths, &capacity, &count));
+	CHECK(count == 3 && capacity == 3);
+	for (i = 0; i < count && i < 3; i++)
+		CHECK(got_lengths[i] == packet_lengths[i] && !memcmp(got_packets[i], packets[i], got_lengths[i]));
+	free(buffer);
+	buffer = encode_multipart(packets, packet_lengths, 1, &length);
+	CHECK(buffer != NULL);
+	if (!buffer)
+		return;
+	CHECK(!multipart_get_packets(buffer, length, &got_packets, &got_lengths, &capacity, &count));
+	CHECK(count == 1 && capacity == 3);
+	free(buffer);
+	buffer = encode_multipart(NULL, NULL, 0, &length);
+	CHECK(buffer != NULL && length == MULTIPART_HEADER_SIZE);
+	if (!buffer)
+		return;
+	CHECK(!multipart_get_packets(buffer, length, &got_packets, &got_lengths, &capacity, &count));
+	CHECK(count == 0);
+	free(buffer);
+
+	//Converting to a mem array and back gives the same buffer
+	buffer = encode_multipart(packets, packet_lengths, 3, &length);
+	CHECK(buffer != NULL);
+	if (!buffer)
+		return;
+	mem_array = multipart_to_mem_array(buffer, length, &mem_array_length);
+	CHECK(mem_array != NULL);
+	if (mem_array)
+	{
+		CHECK(!is_multipart(mem_array, mem_array_length));
+		converted = mem_array_to_multipart(mem_array, &converted_length);
+		CHECK(converted != NULL && converted_length == length && !memcmp(converted, buffer, length));
+		free(converted);
+		free(mem_array);
+	}
+
+	//Every truncation, and packet counts or lengths that run past the end of the buffer, must be rejected
+	for (i = 0; i < (size_t)length; i++)
+	{
+		CHECK(multipart_view_init(&view, buffer, i));
+		CHECK(multipart_get_packets(buffer, i, &got_packets, &got_lengths, &capacity, &count));
+	}
+	CHECK(capacity == 3);
+	buffer[MULTIPART_MAGIC_LENGTH] = 4;
+	CHECK(multipart_view_init(&view, buffer, length));
+	buffer[MULTIPART_MAGIC_LENGTH] = 3;
+	buffer[MULTIPART_HEADER_SIZE + 3] = (char)0xff;
+	CHECK(multipart_view_init(&view, buffer, length));
+	buffer[MULTIPART_HEADER_SIZE + 3] = 0;
+	buffer[MULTIPART_HEADER_SIZE] = 4;
+	CHECK(multipart_view_init(&view, buffer, length));
+	buffer[MULTIPART_HEADER_SIZE] = 3;
+	CHECK(!multipart_view_init(&view, buffer, length));
+	buffer[0] = 'X';
+	CHECK(!is_multipart(buffer, length));
+	CHECK(multipart_view_init(&view, buffer, length));
+
+	free(buffer);
+	free(got_packets);
+	free(got_lengths);
+}
+
+//////////////////////////////////////////////////////////////
+// Edge databases ////////////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+static void test_edge_db(const char * filename)
+{
+	char * module_names[] = { "target", "libtest.so" };
+	instrumentation_edge_t first[] = { { 0x401000, 0x401020 }, { 0x400000, 0x400010 }, { 0x401000, 0x400100 },
+		{ 0xffffffff, 0 }, { 0, 0 } };
+	instrumentation_edge_t second[] = { { 0x7f001000, 0x10 } };
+	instrumentation_edge_t expected[] = { { 0, 0 }, { 0x400000, 0x400010 }, { 0x401000, 0x400100 },
+		{ 0x401000, 0x401020 }, { 0xffffffff, 0 } };
+	instrumentation_edge_t decoded[5];
+	edge_db_writer_t * writer;
+	edge_db_reader_t * reader;
+	edge_db_index_t entry;
+	const uint8_t * data;
+	char * contents, * corrupt;
+	size_t length, data_length, i, j, opened = 0;
+	volatile uint8_t sum = 0;
+	uint32_t input, module;
+	int variant;
+
+	writer = edge_db_create(filename, 2, module_names);
+	CHECK(writer != NULL);
+	if (!writer)
+		return;
+	CHECK(!edge_db_add_input(writer, "corpus/dir/input1"));
+	CHECK(!edge_db_add_edges(writer, first, 5, 0));
+	CHECK(!edge_db_add_edges(writer, NULL, 0, EDGE_DB_FLAG_FAILED));
+	CHECK(!edge_db_add_input(writer, "input2"));
+	CHECK(!edge_db_add_edges(writer, NULL, 0, 0));
+	CHECK(!edge_db_add_edges(writer, second, 1, 0));
+	CHECK(!edge_db_close(writer));
+
+	//The edges read back sorted, with the flags they were written with
+	reader = edge_db_open(filename);
+	CHECK(reader != NULL);
+	if (!reader)
+		return;
+	CHECK(reader->header.num_inputs == 2 && reader->header.num_modules == 2);
+	CHECK(!edge_db_get_block(reader, 0, 0, &data, &data_length, &entry));
+	CHECK(entry.num_edges == 5 && entry.flags == 0);
+	CHECK(!edge_db_decode_block(reader, 0, 0, decoded, 5));
+	CHECK(!memcmp(decoded, expected, sizeof(expected)));
+	CHECK(edge_db_decode_block(reader, 0, 0, decoded, 4));
+	CHECK(!edge_db_get_block(reader, 0, 1, &data, &data_length, &entry));
+	CHECK(entry.num_edges == 0 && entry.flags == EDGE_DB_FLAG_FAILED && data_length == 0);
+	CHECK(!edge_db_get_block(reader, 1, 0, &data, &data_length, &entry));
+	CHECK(entry.num_edges == 0 && data_length == 0);
+	CHECK(!edge_db_get_block(reader, 1, 1, &data, &data_length, &entry));
+	CHECK(entry.num_edges == 1 && !edge_db_decode_block(reader, 1, 1, decoded, 1));
+	CHECK(decoded[0].from == second[0].from && decoded[0].to == second[0].to);
+	CHECK(edge_db_get_block(reader, 2, 0, &data, &data_length, &entry));
+	CHECK(edge_db_get_block(reader, 0, 2, &data, &data_length, &entry));
+	CHECK(edge_db_decode_block(reader, 2, 0, decoded, 5));
+	CHECK(!edge_db_decode_block(reader, 0, 1, NULL, 0));
+
+	//Only the file names of the inputs are stored
+	CHECK(!strcmp(edge_db_get_input_name(reader, 0), "input1"));
+	CHECK(!strcmp(edge_db_get_input_name(reader, 1), "input2"));
+	CHECK(!strcmp(edge_db_get_module_name(reader, 0), "target"));
+	CHECK(!strcmp(edge_db_get_module_name(reader, 1), "libtest.so"));
+	CHECK(edge_db_get_input_name(reader, 2) == NULL);
+	CHECK(edge_db_get_module_name(reader, 2) == NULL);
+	edge_db_reader_cleanup(reader);
+
+	contents = read_test_file(filename, &length);
+	CHECK(contents != NULL);
+	if (!contents)
+		return;
+	corrupt = (char *)malloc(length);
+	CHECK(corrupt != NULL);
+	if (!corrupt)
+	{
+		free(contents);
+		return;
+	}
+
+	//Every truncation of the file must be rejected
+	for (i = 0; i < length; i++)
+	{
+		CHECK(!write_test_file(filename, contents, i));
+		reader = edge_db_open(filename);
+		CHECK(reader == NULL);
+		edge_db_reader_cleanup(reader);
+	}
+
+	//Corrupting any byte must either be rejected, or still give blocks and names inside the file
+	for (i = 0; i < length; i++)
+	{
+		for (variant = 0; variant < 3; variant++)
+		{
+			memcpy(corrupt, contents, length);
+			corrupt[i] = variant == 0 ? (char)0xff : (variant == 1 ? 0 : corrupt[i] ^ 0x80);
+			CHECK(!write_test_file(filename, corrupt, length));
+			reader = edge_db_open(filename);
+			if (!reader)
+				continue;
+			opened++;
+			for (input = 0; input < reader->header.num_inputs; input++)
+				sum += strlen(edge_db_get_input_name(reader, input));
+			for (module = 0; module < reader->header.num_modules; module++)
+				sum += strlen(edge_db_get_module_name(reader, module));
+			for (input = 0; input < reader->header.num_inputs; input++)
+			{
+				for (module = 0; module < reader->header.num_modules; module++)
+				{
+					CHECK(!edge_db_get_block(reader, input, module, &data, &data_length, &entry));
+					CHECK(data >= (const uint8_t *)reader->buffer
+						&& data + data_length <= (const uint8_t *)reader->buffer + reader->length);
+					for (j = 0; j < data_length; j++)
+						sum += data[j];
+					edge_db_decode_block(reader, input, module, decoded, 5);
+				}
+			}
+			edge_db_reader_cleanup(reader);
+		}
+	}
+	CHECK(opened < length * 3);
+
+	free(corrupt);
+	free(contents);
+	remove(filename);
+}
+
+//////////////////////////////////////////////////////////////
+// Edge sets /////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////
+
+/**
+ * This function allocates an instrumentation_edges_t, like an instrumentation's get_edges function.
+ * @param num_edges - the number of edges to allocate room for
+ * @return - the instrumentation_edges_t, which should be freed by the caller
+ */
+static instrumentation_edges_t * alloc_edges(size_t num_edges)
+{
+	instrumentation_edges_t * edges;
+
+	edges = (instrumentation_edges_t *)malloc(sizeof(instrumentation_edges_t)
+		+ (num_edges ? num_edges - 1 : 0) * sizeof(instrumentation_edge_t));
+	if (edges)
+		edges->num_edges = num_edges;
+	return edges;
+}
+
+static void test_edge_set(void)
+{
+	instrumentation_edge_t * got, edge;
+	instrumentation_edges_t * run;
+	edge_set_t * set;
+	size_t i, num_edges, num_runs = 3, many = 5000;
+
+	set = edge_set_create();
+	run = alloc_edges(many + 2);
+	CHECK(set != NULL && run != NULL);
+	if (!set || !run)
+	{
+		edge_set_cleanup(set);
+		free(run);
+		return;
+	}
+
+	//Some edges show up in every run, and an extra edge in only the first run.  Edges repeated within a run
+	//are only counted once.
+	for (i = 0; i < many; i++)
+	{
+		run->edges[i].from = (uint32_t)(i * 16);
+		run->edges[i].to = (uint32_t)(i % 7);
+	}
+	run->edges[many] = run->edges[0];
+	run->edges[many + 1].from = 0xabcdef;
+	run->edges[many + 1].to = 1;
+	for (i = 0; i < num_runs; i++)
+	{
+		run->num_edges = i ? many : many + 2;
+		CHECK(!edge_set_record_run(set, run));
+	}
+	CHECK(set->num_edges == many + 1);
+
+	got = edge_set_get_edges(set, (int)num_runs, &num_edges);
+	CHECK(got != NULL && num_edges == many);
+	for (i = 0; got && i < num_edges && i < many; i++)
+		CHECK(got[i].from == i * 16 && got[i].to == i % 7);
+	free(got);
+	got = edge_set_get_edges(set, 1, &num_edges);
+	CHECK(got != NULL && num_edges == many + 1);
+	free(got);
+
+	//Merging counts, including for edges that aren't in the set yet
+	edge.from = 0xabcdef;
+	edge.to = 1;
+	CHECK(!edge_set_add_count(set, &edge, 2));
+	edge.from = 0x123456;
+	CHECK(!edge_set_add_count(set, &edge, 3));
+	got = edge_set_get_edges(set, (int)num_runs, &num_edges);
+	CHECK(got != NULL && num_edges == many + 2);
+	CHECK(got && got[num_edges - 1].from == 0x123456 && got[num_edges - 1].to == 1);
+	free(got);
+
+	//A reset set keeps its memory but forgets every edge
+	edge_set_reset(set);
+	got = edge_set_get_edges(set, 0, &num_edges);
+	CHECK(got == NULL && num_edges == 0);
+	run->num_edges = 1;
+	run->edges[0].from = 1;
+	run->edges[0].to = 2;
+	CHECK(!edge_set_record_run(set, run));
+	got = edge_set_get_edges(set, 1, &num_edges);
+	CHECK(got != NULL && num_edges == 1 && got[0].from == 1 && got[0].to == 2);
+	free(got);
+
+	free(run);
+	edge_set_cleanup(set);
+}
+
+int main(int argc, char ** argv)
+{
+	const char * edge_db_filename = argc > 1 ? argv[1] : "format_tests.kbed";
+
+	test_binary_state_varints();
+	test_binary_state_sparse_maps();
+	test_binary_state_deltas();
+	test_multipart();
+	test_edge_db(edge_db_filename);
+	test_edge_set();
+
+	if (failures)
+	{
+		printf("%d format test checks failed\n", failures);
+		return 1;
+	}
+	printf("All format tests passed\n");
+	return 0;
+}
@@ -40,6 +40,11 @@ mkdir -p build; cd build; cmake ../killerbeez; make
 # Try running the fuzzer and make sure we have some basic functionality
 cd killerbeez
 
+# Check the binary file formats round trip and reject corrupt files
+echo "Running tests - file formats"
+output=`./format_tests format_tests.kbed`
+generic_error $? "$output" "File format tests failed"
+
 # Run the test-linux program with input which should not cause a crash
 echo "AAAA" > test0
 echo "Running expected non-crashing test"
@@ -0,0 +1,608 @@
+#include "edge_db.h"
+
+#include <utils.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//The most bytes an edge can take to encode, two 64-bit LEB128 varints
+#define MAX_ENCODED_EDGE_SIZE 20
+
+/**
+ * These functions store and load little endian integers, regardless of the host's byte order.
+ */
+static void put_u32(uint8_t * buffer, uint32_t value)
+{
+	int i;
+	for (i = 0; i < 4; i++)
+		buffer[i] = (uint8_t)(value >> (i * 8));
+}
+
+static void put_u64(uint8_t * buffer, uint64_t value)
+{
+	int i;
+	for (i = 0; i < 8; i++)
+		buffer[i] = (uint8_t)(value >> (i * 8));
+}
+
+static uint32_t get_u32(const uint8_t * buffer)
+{
+	uint32_t value = 0;
+	int i;
+	for (i = 0; i < 4; i++)
+		value |= (uint32_t)buffer[i] << (i * 8);
+	return value;
+}
+
+static uint64_t get_u64(const uint8_t * buffer)
+{
+	uint64_t value = 0;
+	int i;
+	for (i = 0; i < 8; i++)
+		value |= (uint64_t)buffer[i] << (i * 8);
+	return value;
+}
+
+/**
+ * This function writes to an edge database's file and tracks the current offset.
+ * @param db - the edge_db_writer_t to write to
+ * @param buffer - the data to write
+ * @param length - the length of the buffer parameter
+ * @return - 0 on success, non-zero on failure
+ */
+static int write_data(edge_db_writer_t * db, const void * buffer, size_t length)
+{
+	if (length && fwrite(buffer, 1, length, db->fp) != length)
+		return 1;
+	db->offset += length;
+	return 0;
+}
+
+/**
+ * This function encodes an unsigned LEB128 varint.
+ * @param buffer - the buffer to write the varint to, which must have at least 10 bytes free
+ * @param value - the value to encode
+ * @return - the number of bytes written
+ */
+static size_t write_varint(uint8_t * buffer, uint64_t value)
+{
+	size_t length = 0;
+
+	while (value >= 0x80)
+	{
+		buffer[length++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	buffer[length++] = (uint8_t)value;
+	return length;
+}
+
+static int compare_edges(const void * a, const void * b)
+{
+	const instrumentation_edge_t * edge_a = (const instrumentation_edge_t *)a;
+	const instrumentation_edge_t * edge_b = (const instrumentation_edge_t *)b;
+
+	if (edge_a->from != edge_b->from)
+		return edge_a->from < edge_b->from ? -1 : 1;
+	if (edge_a->to != edge_b->to)
+		return edge_a->to < edge_b->to ? -1 : 1;
+	return 0;
+}
+
+/**
+ * This function frees an edge_db_writer_t and closes its file.
+ * @param db - the edge_db_writer_t to free
+ */
+static void edge_db_free(edge_db_writer_t * db)
+{
+	uint32_t i;
+
+	if (db->fp)
+		fclose(db->fp);
+	for (i = 0; i < db->num_inputs; i++)
+		free(db->input_names[i]);
+	free(db->input_names);
+	free(db->index);
+	free(db->buffer);
+	free(db);
+}
+
+/**
+ * This function creates a new edge database file.  Inputs should be added with edge_db_add_input, each followed
+ * by one call to edge_db_add_edges per module, and then the database should be finished with edge_db_close.
+ * @param filename - the file to write the edge database to
+ * @param num_modules - the number of modules recorded for each input
+ * @param module_names - an array of num_modules module names, or NULL if the edges aren't recorded per module.
+ * The names must stay valid until edge_db_close is called.
+ * @return - the new edge_db_writer_t, or NULL on failure
+ */
+edge_db_writer_t * edge_db_create(const char * filename, int num_modules, char ** module_names)
+{
+	edge_db_writer_t * db;
+	uint8_t header[EDGE_DB_HEADER_SIZE];
+
+	db = (edge_db_writer_t *)calloc(1, sizeof(edge_db_writer_t));
+	if (!db)
+		return NULL;
+	db->num_modules = num_modules;
+	db->module_names = module_names;
+
+	db->fp = fopen(filename, "wb+");
+	if (!db->fp)
+	{
+		edge_db_free(db);
+		return NULL;
+	}
+
+	//Reserve room for the header, it's filled in once the rest of the file has been written
+	memset(header, 0, sizeof(header));
+	if (write_data(db, header, sizeof(header)))
+	{
+		edge_db_free(db);
+		return NULL;
+	}
+	return db;
+}
+
+/**
+ * This function starts a new input in an edge database.
+ * @param db - the edge_db_writer_t to add the input to
+ * @param name - the path of the input.  Only the file name is stored in the database.
+ * @return - 0 on success, non-zero on failure
+ */
+int edge_db_add_input(edge_db_writer_t * db, const char * name)
+{
+	const char * base;
+	char ** new_names;
+
+	//Only store the file name, regardless of the path separator used
+	for (base = name; *name; name++)
+	{
+		if (*name == '/' || *name == '\\')
+			base = name + 1;
+	}
+
+	new_names = (char **)realloc(db->input_names, (db->num_inputs + 1) * sizeof(char *));
+	if (!new_names)
+		return 1;
+	db->input_names = new_names;
+	db->input_names[db->num_inputs] = strdup(base);
+	if (!db->input_names[db->num_inputs])
+		return 1;
+	db->num_inputs++;
+	return 0;
+}
+
+/**
+ * This function writes an already encoded block of edge data for the next module of the current input to an
+ * edge database, e.g. one copied from another edge database with edge_db_get_block.
+ * @param db - the edge_db_writer_t to add the edges to
+ * @param data - the encoded edge data
+ * @param length - the length of the data parameter
+ * @param num_edges - the number of edges encoded in the data parameter
+ * @param flags - EDGE_DB_FLAG_ values to store with the edges
+ * @return - 0 on success, non-zero on failure
+ */
+int edge_db_add_block(edge_db_writer_t * db, const uint8_t * data, size_t length, uint32_t num_edges, uint32_t flags)
+{
+	edge_db_index_t * entry;
+	size_t new_capacity;
+
+	if (db->num_entries == db->index_capacity)
+	{
+		new_capacity = db->index_capacity ? db->index_capacity * 2 : 64;
+		entry = (edge_db_index_t *)realloc(db->index, new_capacity * sizeof(edge_db_index_t));
+		if (!entry)
+			return 1;
+		db->index = entry;
+		db->index_capacity = new_capacity;
+	}
+
+	entry = &db->index[db->num_entries++];
+	entry->offset = db->offset;
+	entry->num_edges = num_edges;
+	entry->flags = flags;
+	return write_data(db, data, length);
+}
+
+/**
+ * This function writes the edges for the next module of the current input to an edge database.
+ * @param db - the edge_db_writer_t to add the edges to
+ * @param edges - the edges to write.  This array is sorted in place.
+ * @param num_edges - the number of edges in the edges parameter
+ * @param flags - EDGE_DB_FLAG_ values to store with the edges
+ * @return - 0 on success, non-zero on failure
+ */
+int edge_db_add_edges(edge_db_writer_t * db, instrumentation_edge_t * edges, size_t num_edges, uint32_t flags)
+{
+	uint64_t from, to, previous_from = 0, previous_to = 0;
+	size_t i, length = 0;
+	uint8_t * new_buffer;
+
+	if (num_edges > UINT32_MAX)
+		return 1;
+
+	if (num_edges * MAX_ENCODED_EDGE_SIZE > db->buffer_capacity)
+	{
+		new_buffer = (uint8_t *)realloc(db->buffer, num_edges * MAX_ENCODED_EDGE_SIZE);
+		if (!new_buffer)
+			return 1;
+		db->buffer = new_buffer;
+		db->buffer_capacity = num_edges * MAX_ENCODED_EDGE_SIZE;
+	}
+
+	if (num_edges)
+		qsort(edges, num_edges, sizeof(instrumentation_edge_t), compare_edges);
+	for (i = 0; i < num_edges; i++)
+	{
+		from = edges[i].from;
+		to = edges[i].to;
+		length += write_varint(db->buffer + length, from - previous_from);
+		length += write_varint(db->buffer + length, from == previous_from ? to - previous_to : to);
+		previous_from = from;
+		previous_to = to;
+	}
+
+	return edge_db_add_block(db, db->buffer, length, (uint32_t)num_edges, flags);
+}
+
+/**
+ * This function gets the name of an input or module in an edge database.
+ * @param db - the edge_db_writer_t to get the name from
+ * @param i - the index of the name, where the module names follow the input names
+ * @return - the name
+ */
+static const char * get_name(edge_db_writer_t * db, uint32_t i)
+{
+	if (i < db->num_inputs)
+		return db->input_names[i];
+	return db->module_names ? db->module_names[i - db->num_inputs] : "";
+}
+
+/**
+ * This function writes the index, names and header that follow an edge database's edge data.
+ * @param db - the edge_db_writer_t to write to
+ * @return - 0 on success, non-zero on failure
+ */
+static int write_index_and_names(edge_db_writer_t * db)
+{
+	uint8_t header[EDGE_DB_HEADER_SIZE], entry[EDGE_DB_INDEX_ENTRY_SIZE], encoded_offset[8];
+	uint64_t name_offset = 0, index_offset, names_offset;
+	size_t j;
+	uint32_t i;
+
+	if (db->num_entries != (size_t)db->num_inputs * db->num_modules)
+		return 1;
+
+	index_offset = db->offset;
+	for (j = 0; j < db->num_entries; j++)
+	{
+		put_u64(entry, db->index[j].offset);
+		put_u32(entry + 8, db->index[j].num_edges);
+		put_u32(entry + 12, db->index[j].flags);
+		if (write_data(db, entry, sizeof(entry)))
+			return 1;
+	}
+
+	names_offset = db->offset;
+	for (i = 0; i < db->num_inputs + db->num_modules; i++)
+	{
+		put_u64(encoded_offset, name_offset);
+		if (write_data(db, encoded_offset, sizeof(encoded_offset)))
+			return 1;
+		name_offset += strlen(get_name(db, i)) + 1;
+	}
+	for (i = 0; i < db->num_inputs + db->num_modules; i++)
+	{
+		if (write_data(db, get_name(db, i), strlen(get_name(db, i)) + 1))
+			return 1;
+	}
+
+	memcpy(header, EDGE_DB_MAGIC, EDGE_DB_MAGIC_LENGTH);
+	put_u32(header + 4, EDGE_DB_VERSION);
+	put_u32(header + 8, db->num_inputs);
+	put_u32(header + 12, db->num_modules);
+	put_u64(header + 16, index_offset);
+	put_u64(header + 24, names_offset);
+	if (fseek(db->fp, 0, SEEK_SET) || fwrite(header, sizeof(header), 1, db->fp) != 1)
+		return 1;
+	return 0;
+}
+
+/**
+ * This function finishes writing an edge database, and then frees the edge_db_writer_t.
+ * @param db - the edge_db_writer_t to finish
+ * @return - 0 on success, non-zero on failure.  The edge_db_writer_t is freed either way.
+ */
+int edge_db_close(edge_db_writer_t * db)
+{
+	int ret;
+
+	ret = write_index_and_names(db);
+	if (fclose(db->fp))
+		ret = 1;
+	db->fp = NULL;
+	edge_db_free(db);
+	return ret;
+}
+
+/**
+ * This function decodes one of an edge database's index entries.
+ * @param db - the edge_db_reader_t to read the index entry from
+ * @param index - the index of the entry, which must be less than num_inputs * num_modules
+ * @param entry - a pointer used to return the decoded index entry
+ */
+static void read_index_entry(edge_db_reader_t * db, size_t index, edge_db_index_t * entry)
+{
+	const uint8_t * encoded = (const uint8_t *)db->buffer + db->header.index_offset + index * EDGE_DB_INDEX_ENTRY_SIZE;
+
+	entry->offset = get_u64(encoded);
+	entry->num_edges = get_u32(encoded + 8);
+	entry->flags = get_u32(encoded + 12);
+}
+
+/**
+ * This function checks that every section of an edge database lies within the file: the blocks must be in order
+ * between the header and the index, the index must fit before the names, and every name must be NUL terminated
+ * within the file.
+ * @param db - the edge_db_reader_t to check
+ * @return - 0 if the edge database is valid, non-zero otherwise
+ */
+static int validate_edge_db(edge_db_reader_t * db)
+{
+	edge_db_header_t * header = &db->header;
+	const uint8_t * names_table;
+	edge_db_index_t entry;
+	uint64_t num_entries, num_names, names_start, previous_offset = EDGE_DB_HEADER_SIZE, name_offset;
+	uint64_t i;
+
+	num_entries = (uint64_t)header->num_inputs * header->num_modules;
+	num_names = (uint64_t)header->num_inputs + header->num_modules;
+	if (header->index_offset < EDGE_DB_HEADER_SIZE || header->index_offset > header->names_offset
+		|| header->names_offset > db->length
+		|| (header->names_offset - header->index_offset) / EDGE_DB_INDEX_ENTRY_SIZE < num_entries
+		|| (db->length - header->names_offset) / sizeof(uint64_t) < num_names)
+		return 1;
+
+	for (i = 0; i < num_entries; i++)
+	{
+		read_index_entry(db, (size_t)i, &entry);
+		if (entry.offset < previous_offset || entry.offset > header->index_offset)
+			return 1;
+		previous_offset = entry.offset;
+	}
+
+	names_table = (const uint8_t *)db->buffer + header->names_offset;
+	names_start = header->names_offset + num_names * sizeof(uint64_t);
+	for (i = 0; i < num_names; i++)
+	{
+		name_offset = get_u64(names_table + i * sizeof(uint64_t));
+		if (name_offset >= db->length - names_start
+			|| !memchr(db->buffer + names_start + name_offset, 0, (size_t)(db->length - names_start - name_offset)))
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * This function maps an edge database into memory.
+ * @param filename - the file holding the edge database
+ * @return - an edge_db_reader_t for the database, or NULL if the file couldn't be read or isn't a valid edge
+ * database.  It should be freed with edge_db_reader_cleanup.
+ */
+edge_db_reader_t * edge_db_open(const char * filename)
+{
+	edge_db_reader_t * db;
+	const uint8_t * header;
+#ifdef _WIN32
+	int length;
+#else
+	struct stat st;
+	void * mapping;
+	int fd;
+#endif
+
+	db = (edge_db_reader_t *)calloc(1, sizeof(edge_db_reader_t));
+	if (!db)
+		return NULL;
+
+#ifdef _WIN32
+	length = read_file((char *)filename, &db->buffer);
+	db->length = length > 0 ? (size_t)length : 0;
+#else
+	fd = open(filename, O_RDONLY);
+	if (fd >= 0)
+	{
+		if (!fstat(fd, &st) && st.st_size >= EDGE_DB_HEADER_SIZE)
+		{
+			mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapping != MAP_FAILED)
+			{
+				db->buffer = (char *)mapping;
+				db->length = (size_t)st.st_size;
+			}
+		}
+		close(fd);
+	}
+#endif
+	if (db->length < EDGE_DB_HEADER_SIZE)
+	{
+		edge_db_reader_cleanup(db);
+		return NULL;
+	}
+
+	header = (const uint8_t *)db->buffer;
+	memcpy(db->header.magic, header, EDGE_DB_MAGIC_LENGTH);
+	db->header.version = get_u32(header + 4);
+	db->header.num_inputs = get_u32(header + 8);
+	db->header.num_modules = get_u32(header + 12);
+	db->header.index_offset = get_u64(header + 16);
+	db->header.names_offset = get_u64(header + 24);
+	if (memcmp(db->header.magic, EDGE_DB_MAGIC, EDGE_DB_MAGIC_LENGTH) || db->header.version != EDGE_DB_VERSION
+		|| validate_edge_db(db))
+	{
+		edge_db_reader_cleanup(db);
+		return NULL;
+	}
+	return db;
+}
+
+/**
+ * This function frees an edge_db_reader_t.
+ * @param db - the edge_db_reader_t to free
+ */
+void edge_db_reader_cleanup(edge_db_reader_t * db)
+{
+	if (!db)
+		return;
+#ifdef _WIN32
+	free(db->buffer);
+#else
+	if (db->buffer)
+		munmap(db->buffer, db->length);
+#endif
+	free(db);
+}
+
+/**
+ * This function gets the encoded edge data for one input and module in an edge database.
+ * @param db - the edge_db_reader_t to get the edge data from
+ * @param input - the index of the input
+ * @param module - the index of the module
+ * @param data - a pointer used to return a pointer to the encoded edge data, inside the reader's buffer
+ * @param length - a pointer used to return the length of the encoded edge data
+ * @param entry - a pointer used to return the block's index entry
+ * @return - 0 on success, non-zero if the input or module is out of range
+ */
+int edge_db_get_block(edge_db_reader_t * db, uint32_t input, uint32_t module, const uint8_t ** data, size_t * length,
+	edge_db_index_t * entry)
+{
+	edge_db_index_t next;
+	size_t index = (size_t)input * db->header.num_modules + module;
+	uint64_t end = db->header.index_offset;
+
+	if (input >= db->header.num_inputs || module >= db->header.num_modules)
+		return 1;
+
+	//Blocks are written back to back, so each one ends where the next one starts.  edge_db_open already checked
+	//that the blocks are in order and within the file.
+	read_index_entry(db, index, entry);
+	if (index + 1 < (size_t)db->header.num_inputs * db->header.num_modules)
+	{
+		read_index_entry(db, index + 1, &next);
+		end = next.offset;
+	}
+
+	*data = (const uint8_t *)db->buffer + entry->offset;
+	*length = (size_t)(end - entry->offset);
+	return 0;
+}
+
+/**
+ * This function decodes an unsigned LEB128 varint from a block of edge data, without reading past its end.
+ * @param data - the encoded edge data
+ * @param length - the length of the data parameter
+ * @param offset - a pointer to the offset of the varint in the data, which is moved past it
+ * @param value - a pointer used to return the decoded value
+ * @return - 0 on success, non-zero if the varint is truncated or too long
+ */
+static int read_varint(const uint8_t * data, size_t length, size_t * offset, uint64_t * value)
+{
+	int shift;
+
+	*value = 0;
+	for (shift = 0; shift < 64 && *offset < length; shift += 7)
+	{
+		*value |= (uint64_t)(data[*offset] & 0x7f) << shift;
+		if (!(data[(*offset)++] & 0x80))
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * This function decodes the edges for one input and module in an edge database.
+ * @param db - the edge_db_reader_t to get the edges from
+ * @param input - the index of the input
+ * @param module - the index of the module
+ * @param edges - an array used to return the edges, sorted by from and then to
+ * @param num_edges - the number of edges the edges array can hold, which must be at least the block's num_edges
+ * (as returned in the index entry from edge_db_get_block)
+ * @return - 0 on success, non-zero if the input or module is out of range, the edges array is too small, or the
+ * edge data is corrupt
+ */
+int edge_db_decode_block(edge_db_reader_t * db, uint32_t input, uint32_t module, instrumentation_edge_t * edges,
+	size_t num_edges)
+{
+	uint64_t from = 0, to = 0, from_delta, to_value;
+	edge_db_index_t entry;
+	const uint8_t * data;
+	size_t length, offset = 0;
+	uint32_t i;
+
+	if (edge_db_get_block(db, input, module, &data, &length, &entry) || entry.num_edges > num_edges)
+		return 1;
+
+	for (i = 0; i < entry.num_edges; i++)
+	{
+		if (read_varint(data, length, &offset, &from_delta) || read_varint(data, length, &offset, &to_value))
+			return 1;
+		from += from_delta;
+		to = from_delta ? to_value : to + to_value;
+		edges[i].from = from;
+		edges[i].to = to;
+		if (edges[i].from != from || edges[i].to != to) //The addresses don't fit in an instrumentation_edge_t
+			return 1;
+	}
+	return offset != length;
+}
+
+/**
+ * This function gets one of the names in an edge database.  edge_db_open already checked that every name is NUL
+ * terminated within the file.
+ * @param db - the edge_db_reader_t to get the name from
+ * @param i - the index of the name, where the module names follow the input names
+ * @return - the name
+ */
+static const char * get_reader_name(edge_db_reader_t * db, uint64_t i)
+{
+	const uint8_t * names_table = (const uint8_t *)db->buffer + db->header.names_offset;
+	uint64_t num_names = (uint64_t)db->header.num_inputs + db->header.num_modules;
+
+	return (const char *)names_table + num_names * sizeof(uint64_t) + get_u64(names_table + i * sizeof(uint64_t));
+}
+
+/**
+ * This function gets the name of an input in an edge database.
+ * @param db - the edge_db_reader_t to get the name from
+ * @param input - the index of the input
+ * @return - the input's file name, without its directory, inside the reader's buffer, or NULL if the input is out
+ * of range
+ */
+const char * edge_db_get_input_name(edge_db_reader_t * db, uint32_t input)
+{
+	if (input >= db->header.num_inputs)
+		return NULL;
+	return get_reader_name(db, input);
+}
+
+/**
+ * This function gets the name of a module in an edge database.
+ * @param db - the edge_db_reader_t to get the name from
+ * @param module - the index of the module
+ * @return - the module's name, inside the reader's buffer, which is empty if the edges weren't recorded per module,
+ * or NULL if the module is out of range
+ */
+const char * edge_db_get_module_name(edge_db_reader_t * db, uint32_t module)
+{
+	if (module >= db->header.num_modules)
+		return NULL;
+	return get_reader_name(db, (uint64_t)db->header.num_inputs + module);
+}
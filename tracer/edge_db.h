@@ -0,0 +1,93 @@
+#pragma once
+#include <instrumentation.h>
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//An edge database holds the edges of every input in a corpus, for every module, in one file that can be
+//memory mapped.  All integers are little endian, and each field is written separately, so the layout doesn't
+//depend on the compiler's struct padding.  The file is laid out as:
+//  The header (EDGE_DB_HEADER_SIZE bytes): char magic[4], uint32_t version, uint32_t num_inputs,
+//    uint32_t num_modules, uint64_t index_offset, uint64_t names_offset
+//  The edge data, one block per input and module
+//  num_inputs * num_modules index entries (EDGE_DB_INDEX_ENTRY_SIZE bytes each), ordered by input and then by
+//    module: uint64_t offset, uint32_t num_edges, uint32_t flags
+//  uint64_t name_offsets[num_inputs + num_modules], the offset of each name from the end of this array
+//  The input names (without their directories), then the module names, each NUL terminated
+//
+//Each block of edge data holds that input and module's edges sorted by from and then to.  Each edge is
+//written as two unsigned LEB128 varints: the difference between its from and the previous edge's from,
+//and then, if that difference was zero, the difference between its to and the previous edge's to, or
+//otherwise its to.  The first edge is compared against an edge of 0 -> 0.
+
+#define EDGE_DB_MAGIC        "KBED"
+#define EDGE_DB_MAGIC_LENGTH 4
+#define EDGE_DB_VERSION      1
+
+//The size of the header and of each index entry in the file
+#define EDGE_DB_HEADER_SIZE      32
+#define EDGE_DB_INDEX_ENTRY_SIZE 16
+
+//Set in an edge_db_index_t's flags if the input couldn't be traced
+#define EDGE_DB_FLAG_FAILED 1
+
+//The decoded header
+struct edge_db_header
+{
+	char magic[EDGE_DB_MAGIC_LENGTH];
+	uint32_t version;
+	uint32_t num_inputs;
+	uint32_t num_modules;   //1 when the edges weren't recorded per module, in which case the module name is empty
+	uint64_t index_offset;
+	uint64_t names_offset;
+};
+typedef struct edge_db_header edge_db_header_t;
+
+//A decoded index entry
+struct edge_db_index
+{
+	uint64_t offset;    //The offset of this input and module's edge data in the file
+	uint32_t num_edges; //The number of edges in the edge data
+	uint32_t flags;     //EDGE_DB_FLAG_ values
+};
+typedef struct edge_db_index edge_db_index_t;
+
+struct edge_db_writer
+{
+	FILE * fp;
+	uint64_t offset;             //The current offset in the file
+	uint32_t num_modules;
+	char ** module_names;
+	edge_db_index_t * index;     //The index entries written so far
+	size_t index_capacity;       //The number of entries allocated in the index array
+	size_t num_entries;          //The number of entries in the index array
+	char ** input_names;         //The name of each input added so far
+	uint32_t num_inputs;
+	uint8_t * buffer;            //A buffer used to encode each block of edge data
+	size_t buffer_capacity;
+};
+typedef struct edge_db_writer edge_db_writer_t;
+
+struct edge_db_reader
+{
+	char * buffer;           //The whole edge database, memory mapped where possible
+	size_t length;           //The length of the buffer
+	edge_db_header_t header;
+};
+typedef struct edge_db_reader edge_db_reader_t;
+
+edge_db_writer_t * edge_db_create(const char * filename, int num_modules, char ** module_names);
+int edge_db_add_input(edge_db_writer_t * db, const char * name);
+int edge_db_add_edges(edge_db_writer_t * db, instrumentation_edge_t * edges, size_t num_edges, uint32_t flags);
+int edge_db_add_block(edge_db_writer_t * db, const uint8_t * data, size_t length, uint32_t num_edges, uint32_t flags);
+int edge_db_close(edge_db_writer_t * db);
+
+edge_db_reader_t * edge_db_open(const char * filename);
+void edge_db_reader_cleanup(edge_db_reader_t * db);
+int edge_db_get_block(edge_db_reader_t * db, uint32_t input, uint32_t module, const uint8_t ** data, size_t * length,
+	edge_db_index_t * entry);
+int edge_db_decode_block(edge_db_reader_t * db, uint32_t input, uint32_t module, instrumentation_edge_t * edges,
+	size_t num_edges);
+const char * edge_db_get_input_name(edge_db_reader_t * db, uint32_t input);
+const char * edge_db_get_module_name(edge_db_reader_t * db, uint32_t module);
@@ -0,0 +1,220 @@
+#include "edge_set.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+//The number of slots in a new edge_set's hash table, must be a power of 2
+#define INITIAL_TABLE_SIZE 1024
+
+/**
+ * This function hashes an edge into an index in an edge_set's hash table.
+ * @param edge - the edge to hash
+ * @param mask - the size of the hash table minus one
+ * @return - the first slot to look for the edge in
+ */
+static size_t hash_edge(const instrumentation_edge_t * edge, size_t mask)
+{
+	uint64_t hash = ((uint64_t)edge->from * 0x9E3779B97F4A7C15ULL) ^ (uint64_t)edge->to;
+	hash ^= hash >> 31;
+	hash *= 0xBF58476D1CE4E5B9ULL;
+	hash ^= hash >> 29;
+	return (size_t)hash & mask;
+}
+
+/**
+ * This function doubles the size of an edge_set's hash table and reinserts each edge.
+ * @param set - the edge_set_t to grow
+ * @return - 0 on success, non-zero on failure
+ */
+static int grow_table(edge_set_t * set)
+{
+	size_t i, slot, new_size = set->table_size * 2;
+	uint32_t * new_table;
+
+	new_table = (uint32_t *)calloc(new_size, sizeof(uint32_t));
+	if (!new_table)
+		return 1;
+
+	for (i = 0; i < set->num_edges; i++)
+	{
+		slot = hash_edge(&set->edges[i].edge, new_size - 1);
+		while (new_table[slot])
+			slot = (slot + 1) & (new_size - 1);
+		new_table[slot] = (uint32_t)(i + 1);
+	}
+
+	free(set->table);
+	set->table = new_table;
+	set->table_size = new_size;
+	return 0;
+}
+
+/**
+ * This function creates an empty edge_set_t.
+ * @return - the new edge_set_t, or NULL on failure.  It should be freed with edge_set_cleanup.
+ */
+edge_set_t * edge_set_create(void)
+{
+	edge_set_t * set;
+
+	set = (edge_set_t *)calloc(1, sizeof(edge_set_t));
+	if (!set)
+		return NULL;
+	set->table_size = INITIAL_TABLE_SIZE;
+	set->table = (uint32_t *)calloc(set->table_size, sizeof(uint32_t));
+	if (!set->table)
+	{
+		free(set);
+		return NULL;
+	}
+	return set;
+}
+
+/**
+ * This function frees an edge_set_t.
+ * @param set - the edge_set_t to free
+ */
+void edge_set_cleanup(edge_set_t * set)
+{
+	if (!set)
+		return;
+	free(set->edges);
+	free(set->table);
+	free(set);
+}
+
+/**
+ * This function removes every edge from an edge_set_t, keeping its memory so it can be reused for another input.
+ * @param set - the edge_set_t to reset
+ */
+void edge_set_reset(edge_set_t * set)
+{
+	memset(set->table, 0, set->table_size * sizeof(uint32_t));
+	set->num_edges = 0;
+	set->generation = 0;
+}
+
+/**
+ * This function finds an edge in an edge_set_t, adding it with a count of 0 if it isn't there yet.
+ * @param set - the edge_set_t to look for the edge in
+ * @param edge - the edge to look for
+ * @return - the edge's entry, or NULL on failure
+ */
+static struct edge_counts * find_or_add_edge(edge_set_t * set, const instrumentation_edge_t * edge)
+{
+	struct edge_counts * entry, * new_edges;
+	size_t slot, new_capacity;
+
+	slot = hash_edge(edge, set->table_size - 1);
+	while (set->table[slot])
+	{
+		entry = &set->edges[set->table[slot] - 1];
+		if (entry->edge.from == edge->from && entry->edge.to == edge->to)
+			return entry;
+		slot = (slot + 1) & (set->table_size - 1);
+	}
+
+	if (set->num_edges == set->edges_capacity)
+	{
+		new_capacity = set->edges_capacity ? set->edges_capacity * 2 : INITIAL_TABLE_SIZE / 2;
+		new_edges = (struct edge_counts *)realloc(set->edges, new_capacity * sizeof(struct edge_counts));
+		if (!new_edges)
+			return NULL;
+		set->edges = new_edges;
+		set->edges_capacity = new_capacity;
+	}
+
+	//Keep the table at most half full, so probe sequences stay short
+	if ((set->num_edges + 1) * 2 > set->table_size)
+	{
+		if (grow_table(set))
+			return NULL;
+		slot = hash_edge(edge, set->table_size - 1);
+		while (set->table[slot])
+			slot = (slot + 1) & (set->table_size - 1);
+	}
+
+	entry = &set->edges[set->num_edges];
+	entry->edge.from = edge->from;
+	entry->edge.to = edge->to;
+	entry->count = 0;
+	entry->generation = 0;
+	set->table[slot] = (uint32_t)(++set->num_edges);
+	return entry;
+}
+
+/**
+ * This function records the edges from one run.  Each distinct edge's count is incremented once, no matter
+ * how many times it appears in the run.
+ * @param set - the edge_set_t to record the edges in
+ * @param edges - the edges from the run, as returned by the instrumentation's get_edges function
+ * @return - 0 on success, non-zero on failure
+ */
+int edge_set_record_run(edge_set_t * set, instrumentation_edges_t * edges)
+{
+	struct edge_counts * entry;
+	size_t i;
+
+	set->generation++;
+	for (i = 0; i < edges->num_edges; i++)
+	{
+		entry = find_or_add_edge(set, &edges->edges[i]);
+		if (!entry)
+			return 1;
+
+		//Only count the edge once per run
+		if (entry->generation != set->generation)
+		{
+			entry->generation = set->generation;
+			entry->count++;
+		}
+	}
+	return 0;
+}
+
+/**
+ * This function adds to the number of runs an edge was seen in, e.g. to combine the edges recorded by another
+ * edge_set_t.  Edges that aren't in the set yet are added after the existing edges.
+ * @param set - the edge_set_t to add the edge to
+ * @param edge - the edge to add
+ * @param count - the number of runs to add to the edge's count
+ * @return - 0 on success, non-zero on failure
+ */
+int edge_set_add_count(edge_set_t * set, const instrumentation_edge_t * edge, int count)
+{
+	struct edge_counts * entry;
+
+	entry = find_or_add_edge(set, edge);
+	if (!entry)
+		return 1;
+	entry->count += count;
+	return 0;
+}
+
+/**
+ * This function gets the edges that were seen in at least the given number of runs.
+ * @param set - the edge_set_t to get the edges from
+ * @param min_count - the minimum number of runs an edge must have been seen in
+ * @param num_edges - a pointer used to return the number of edges in the returned array
+ * @return - an array of the edges, in the order they were first seen, or NULL on failure or if there are
+ * no edges.  It should be freed by the caller.
+ */
+instrumentation_edge_t * edge_set_get_edges(edge_set_t * set, int min_count, size_t * num_edges)
+{
+	instrumentation_edge_t * ret;
+	size_t i;
+
+	*num_edges = 0;
+	if (!set->num_edges)
+		return NULL;
+	ret = (instrumentation_edge_t *)malloc(set->num_edges * sizeof(instrumentation_edge_t));
+	if (!ret)
+		return NULL;
+
+	for (i = 0; i < set->num_edges; i++)
+	{
+		if (set->edges[i].count >= min_count)
+			ret[(*num_edges)++] = set->edges[i].edge;
+	}
+	return ret;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <instrumentation.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct edge_counts
+{
+	instrumentation_edge_t edge;
+	int count;      //The number of runs the edge was seen in
+	int generation; //The last run the edge was seen in
+};
+
+//Accumulates the edges from several runs of the same input, counting how many runs each edge was seen in
+struct edge_set
+{
+	struct edge_counts * edges; //Every edge seen so far, in the order they were first seen
+	size_t num_edges;           //The number of edges in the edges array
+	size_t edges_capacity;      //The number of entries allocated in the edges array
+	uint32_t * table;           //An open addressing hash table of indices into edges, plus one (0 is an empty slot)
+	size_t table_size;          //The number of slots in table, always a power of 2
+	int generation;             //The number of runs recorded so far
+};
+typedef struct edge_set edge_set_t;
+
+edge_set_t * edge_set_create(void);
+void edge_set_cleanup(edge_set_t * set);
+void edge_set_reset(edge_set_t * set);
+int edge_set_record_run(edge_set_t * set, instrumentation_edges_t * edges);
+int edge_set_add_count(edge_set_t * set, const instrumentation_edge_t * edge, int count);
+instrumentation_edge_t * edge_set_get_edges(edge_set_t * set, int min_count, size_t * num_edges);
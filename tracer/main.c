@@ -4,16 +4,29 @@
 #include <instrumentation_factory.h>
 #include <jansson_helper.h>
 #include <utils.h>
+#include "edge_db.h"
+#include "edge_set.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
+
 void usage(char * program_name)
 {
 	char * help_text;
 	printf(
 		"Usage: %s driver_name instrumentation_name input_file output_file [options]\n"
+		"       %s driver_name instrumentation_name -c input_directory output_file [options]\n"
 		"\n"
 		"Required:\n"
 		"\t driver_name                   The driver framework used to run the target program\n"
@@ -22,13 +35,19 @@ void usage(char * program_name)
 		"\t output_file                   Write the edges to the given file.  The given path will be used as a prefix when recording multiple modules\n"
 		"Options:\n"
 		"\t -b                            When writing the edges to a file, write them in binary (rather than human readable text)\n"
+		"\t -c                            Trace every file in input_file, which is a directory, and write all of their edges to a\n"
+		"\t                               single edge database in output_file\n"
 		"\t -d driver_options             Set the options for the driver\n"
 		"\t -i instrumentation_options    Set the options for the instrumentation\n"
+		"\t -j num_workers                The number of processes to trace with [1].  With -c, the inputs are split between\n"
+		"\t                               the processes, otherwise the iterations are.  The output is the same either way\n"
+		"\t                               (not supported on Windows, or with the network drivers, since every\n"
+		"\t                               worker's target would use the same port)\n"
 		"\t -l logging_options            Set the options for logging\n"
 		"\t -n num_iterations             The number of iterations to run [5 per file].  Edges which are only in one run will be excluded\n"
 		"\t -p                            Record the edges for each module independently\n"
 		"\n",
-		program_name
+		program_name, program_name
 	);
 
 #define PRINT_HELP(x, y) \
@@ -44,87 +63,687 @@ void usage(char * program_name)
 	exit(1);
 }
 
-struct edge_counts
+#define MAX_MODULES 512
+
+struct trace_context
+{
+	instrumentation_t * instrumentation;
+	void * instrumentation_state;
+	int num_modules;
+	edge_set_t ** all_runs;
+};
+
+//The options needed to set up tracing, which each worker process uses to create its own driver and instrumentation
+struct trace_options
 {
-	instrumentation_edge_t edge;
-	int count;
+	char * driver_name;
+	char * driver_options;
+	char * instrumentation_name;
+	char * instrumentation_options;
+	char * output_file;
+	int num_iterations;
+	int num_workers;
+	int num_modules;
+	char ** module_names;
 };
 
-void record_edges(instrumentation_edges_t * edges, struct edge_counts ** all_runs, int * all_runs_num_edges)
+/**
+ * Called by the driver after each run of the seed file, while the instrumentation
+ * still holds that run's edges.
+ */
+static int record_run_edges(void * callback_arg, size_t index, int result)
 {
-	int this_run_num_edges;
-	instrumentation_edge_t *this_run;
-	int i, j, found;
+	struct trace_context * context = (struct trace_context *)callback_arg;
+	instrumentation_edges_t * edges;
+	int i;
 
-	this_run = NULL;
-	this_run_num_edges = 0;
+	for (i = 0; i < context->num_modules; i++)
+	{
+		edges = context->instrumentation->get_edges(context->instrumentation_state, i);
+		if (!edges)
+			FATAL_MSG("Instrumentation failed to get the program edges from the tested process.");
+		if (edge_set_record_run(context->all_runs[i], edges))
+			FATAL_MSG("Failed to allocate memory for the program edges");
+	}
+	return 0;
+}
 
-	for (i = 0; i < edges->num_edges; i++)
+/**
+ * This function sets up a trace_context, with an empty edge set for each module.
+ * @param context - the trace_context to set up
+ * @param instrumentation - the instrumentation to get the edges from, or NULL if the context is only used to
+ * combine edges recorded elsewhere
+ * @param instrumentation_state - the instrumentation's state
+ * @param num_modules - the number of modules to record edges for
+ */
+static void setup_trace_context(struct trace_context * context, instrumentation_t * instrumentation,
+	void * instrumentation_state, int num_modules)
+{
+	int i;
+
+	context->instrumentation = instrumentation;
+	context->instrumentation_state = instrumentation_state;
+	context->num_modules = num_modules;
+	context->all_runs = (edge_set_t **)calloc(num_modules, sizeof(edge_set_t *));
+	if (!context->all_runs)
+		FATAL_MSG("Failed to allocate memory for the program edges");
+	for (i = 0; i < num_modules; i++)
 	{
-		//First check for the edge in this run
-		found = 0;
-		for (j = 0; j < this_run_num_edges; j++)
+		context->all_runs[i] = edge_set_create();
+		if (!context->all_runs[i])
+			FATAL_MSG("Failed to allocate memory for the program edges");
+	}
+}
+
+/**
+ * This function frees the edge sets in a trace_context.
+ * @param context - the trace_context to clean up
+ */
+static void cleanup_trace_context(struct trace_context * context)
+{
+	int i;
+
+	for (i = 0; i < context->num_modules; i++)
+		edge_set_cleanup(context->all_runs[i]);
+	free(context->all_runs);
+}
+
+/**
+ * This function creates the instrumentation used to record the edges.
+ * @param options - the trace_options holding the instrumentation name and options
+ * @param instrumentation_state - a pointer used to return the instrumentation's state
+ * @return - the instrumentation.  If it can't be created, this function exits the program.
+ */
+static instrumentation_t * create_instrumentation(struct trace_options * options, void ** instrumentation_state)
+{
+	instrumentation_t * instrumentation;
+
+	instrumentation = instrumentation_factory(options->instrumentation_name);
+	if (!instrumentation)
+		FATAL_MSG("Unknown instrumentation '%s'", options->instrumentation_name);
+	if (!instrumentation->get_edges)
+		FATAL_MSG("Instrumentation '%s' does not support the ability to get a list of edges", options->instrumentation_name);
+
+	*instrumentation_state = instrumentation->create(options->instrumentation_options, NULL);
+	if (!*instrumentation_state)
+		FATAL_MSG("Bad options/state for instrumentation %s", options->instrumentation_name);
+	return instrumentation;
+}
+
+/**
+ * This function creates the driver used to run the inputs.
+ * @param options - the trace_options holding the driver name and options
+ * @param instrumentation - the instrumentation for the driver to use
+ * @param instrumentation_state - the instrumentation's state
+ * @return - the driver.  If it can't be created, this function exits the program.
+ */
+static driver_t * create_driver(struct trace_options * options, instrumentation_t * instrumentation, void * instrumentation_state)
+{
+	driver_t * driver;
+
+	driver = driver_instrumentation_factory(options->driver_name, options->driver_options, instrumentation, instrumentation_state);
+	if (!driver)
+		FATAL_MSG("Unknown driver '%s' or bad options: %s", options->driver_name,
+			options->driver_options ? options->driver_options : "none");
+	return driver;
+}
+
+/**
+ * This function runs an input num_iterations times, recording the edges from each run in the context's edge sets.
+ * @param driver - the driver to run the input with
+ * @param context - the trace_context holding the edge sets to record the edges in.  The edge sets are reset first.
+ * @param buffer - the input to run
+ * @param length - the length of the buffer parameter
+ * @param num_iterations - the number of times to run the input
+ * @return - 0 on success, non-zero if the input couldn't be tested
+ */
+static int trace_input(driver_t * driver, struct trace_context * context, char * buffer, int length, int num_iterations)
+{
+	char ** run_inputs;
+	size_t * run_lengths;
+	int * run_results;
+	int i, ret;
+
+	for (i = 0; i < context->num_modules; i++)
+		edge_set_reset(context->all_runs[i]);
+
+	//Run the input num_iterations times in one batch, recording the edges after each run
+	run_inputs = (char **)malloc(num_iterations * sizeof(char *));
+	run_lengths = (size_t *)malloc(num_iterations * sizeof(size_t));
+	run_results = (int *)malloc(num_iterations * sizeof(int));
+	if (!run_inputs || !run_lengths || !run_results)
+		FATAL_MSG("Failed to allocate memory for %d iterations", num_iterations);
+	for (i = 0; i < num_iterations; i++)
+	{
+		run_inputs[i] = buffer;
+		run_lengths[i] = length;
+	}
+
+	ret = driver->test_inputs_batch(driver->state, run_inputs, run_lengths, num_iterations,
+		run_results, record_run_edges, context) != num_iterations;
+
+	free(run_inputs);
+	free(run_lengths);
+	free(run_results);
+	return ret;
+}
+
+static int compare_filenames(const void * a, const void * b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/**
+ * This function lists the files in a directory, sorted by name.  Subdirectories are skipped.
+ * @param directory - the directory to list
+ * @param num_files - a pointer used to return the number of files found
+ * @return - an array of the paths of the files in the directory, or NULL on failure.  The array and each
+ * path in it should be freed by the caller.
+ */
+static char ** list_directory(const char * directory, int * num_files)
+{
+	char ** filenames = NULL;
+	char filename[MAX_PATH];
+#ifdef _WIN32
+	WIN32_FIND_DATA fdFile;
+	HANDLE file_handle;
+	int success = 1;
+#else
+	struct dirent * entry;
+	struct stat info;
+	DIR * dir;
+#endif
+
+	*num_files = 0;
+#ifdef _WIN32
+	snprintf(filename, sizeof(filename) - 1, "%s\\*", directory);
+	file_handle = FindFirstFile(filename, &fdFile);
+	if (file_handle == INVALID_HANDLE_VALUE)
+		return NULL;
+	for (; success; success = FindNextFile(file_handle, &fdFile))
+	{
+		if (fdFile.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+		snprintf(filename, sizeof(filename) - 1, "%s\\%s", directory, fdFile.cFileName);
+#else
+	dir = opendir(directory);
+	if (!dir)
+		return NULL;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		snprintf(filename, sizeof(filename) - 1, "%s/%s", directory, entry->d_name);
+		if (stat(filename, &info) || !S_ISREG(info.st_mode))
+			continue;
+#endif
+		filenames = (char **)realloc(filenames, (*num_files + 1) * sizeof(char *));
+		if (!filenames)
+			FATAL_MSG("Failed to allocate memory for the list of input files");
+		filenames[*num_files] = strdup(filename);
+		(*num_files)++;
+	}
+#ifdef _WIN32
+	FindClose(file_handle);
+#else
+	closedir(dir);
+#endif
+
+	//Sort the files, so the edge database doesn't depend on the order the file system lists them in
+	if (filenames)
+		qsort(filenames, *num_files, sizeof(char *), compare_filenames);
+	return filenames;
+}
+
+/**
+ * This function writes the edges that were found in every iteration to one file per module, either as text
+ * or in binary.
+ * @param context - the trace_context holding the recorded edges
+ * @param output_file - the file to write the edges to, or the prefix of the files when recording each module
+ * @param num_iterations - the number of times the input was run
+ * @param binary_mode - whether to write the edges in binary rather than text
+ * @param module_names - the name of each module, or NULL entries when the edges aren't recorded per module
+ */
+static void write_edge_files(struct trace_context * context, char * output_file, int num_iterations, int binary_mode,
+	char ** module_names)
+{
+	instrumentation_edge_t *deterministic_edges;
+	size_t j, deterministic_edges_num_edges;
+	char filename_buffer[MAX_PATH];
+	int i;
+	FILE * fp;
+
+	//Reduce the list of edges to just the ones in every run, and store it
+	for (i = 0; i < context->num_modules; i++)
+	{
+		//Keep the edges that were found in all the iterations
+		deterministic_edges = edge_set_get_edges(context->all_runs[i], num_iterations, &deterministic_edges_num_edges);
+		if (!deterministic_edges && context->all_runs[i]->num_edges)
+			FATAL_MSG("Failed to allocate memory for the program edges");
+
+		if (!module_names[i])
+			snprintf(filename_buffer, sizeof(filename_buffer) - 1, "%s", output_file);
+		else
+			snprintf(filename_buffer, sizeof(filename_buffer) - 1, "%s_%s.%s", output_file, module_names[i], binary_mode ? "dat" : "txt");
+
+		fp = fopen(filename_buffer, "wb+");
+		if (fp == NULL)
+			FATAL_MSG("Couldn't open the file %s to write the edges to for %s", filename_buffer, module_names[i] ? module_names[i] : "the program");
+
+		for (j = 0; j < deterministic_edges_num_edges; j++)
 		{
-			if (this_run[j].to == edges->edges[i].to && this_run[j].from == edges->edges[i].from)
-			{
-				found = 1;
-				break;
-			}
+			if (binary_mode)
+				fwrite(&deterministic_edges[j], sizeof(instrumentation_edge_t), 1, fp);
+			else
+				fprintf(fp, "%016x:%016x\n", deterministic_edges[j].from, deterministic_edges[j].to);
 		}
-		if (found) //If we've already recorded this one, just skip it
-			continue;
+		fclose(fp);
 
-		//If we haven't recorded this edge for this run before, add it to the this_run list
-		this_run_num_edges++;
-		this_run = (instrumentation_edge_t *)realloc(this_run, this_run_num_edges * sizeof(instrumentation_edge_t));
-		this_run[this_run_num_edges - 1].to = edges->edges[i].to;
-		this_run[this_run_num_edges - 1].from = edges->edges[i].from;
+		free(deterministic_edges);
+	}
+}
 
-		//Now check to see if it's been recorded already in other runs
-		for (j = 0; j < *all_runs_num_edges; j++)
+/**
+ * This function traces one file from a corpus, and adds the edges that were found in every iteration to an
+ * edge database.  Files that can't be tested are recorded in the database with the EDGE_DB_FLAG_FAILED flag.
+ * @param driver - the driver to run the input with
+ * @param context - the trace_context holding the edge sets to record the edges in
+ * @param db - the edge database to add the edges to
+ * @param filename - the file holding the input to trace
+ * @param num_iterations - the number of times to run the input
+ */
+static void trace_corpus_input(driver_t * driver, struct trace_context * context, edge_db_writer_t * db, char * filename,
+	int num_iterations)
+{
+	instrumentation_edge_t *deterministic_edges;
+	size_t deterministic_edges_num_edges;
+	char * seed_buffer = NULL;
+	int i, seed_length, failed;
+
+	seed_length = read_file(filename, &seed_buffer);
+	failed = seed_length <= 0;
+	if (failed)
+		WARNING_MSG("Unable to read the input file \"%s\"", filename);
+	else
+	{
+		failed = trace_input(driver, context, seed_buffer, seed_length, num_iterations);
+		if (failed)
+			WARNING_MSG("Failed to test the input file \"%s\"", filename);
+	}
+	free(seed_buffer);
+
+	if (edge_db_add_input(db, filename))
+		FATAL_MSG("Failed to add the input file \"%s\" to the edge database", filename);
+	for (i = 0; i < context->num_modules; i++)
+	{
+		deterministic_edges = NULL;
+		deterministic_edges_num_edges = 0;
+		if (!failed)
 		{
-			if ((*all_runs)[j].edge.to == edges->edges[i].to && (*all_runs)[j].edge.from == edges->edges[i].from)
-			{
-				(*all_runs)[j].count++;
-				found = 1;
-				break;
-			}
+			deterministic_edges = edge_set_get_edges(context->all_runs[i], num_iterations, &deterministic_edges_num_edges);
+			if (!deterministic_edges && context->all_runs[i]->num_edges)
+				FATAL_MSG("Failed to allocate memory for the program edges");
 		}
+		if (edge_db_add_edges(db, deterministic_edges, deterministic_edges_num_edges, failed ? EDGE_DB_FLAG_FAILED : 0))
+			FATAL_MSG("Failed to write the edges for \"%s\" to the edge database", filename);
+		free(deterministic_edges);
+	}
+}
+
+/**
+ * This function traces every file in a list with the same driver, and writes the edges that were found
+ * in every iteration of each file to a single edge database.
+ * @param driver - the driver to run the inputs with
+ * @param context - the trace_context holding the edge sets to record the edges in
+ * @param filenames - the files holding the inputs to trace
+ * @param num_files - the number of files in the filenames parameter
+ * @param options - the trace_options holding the output file, number of iterations, and module names
+ */
+static void trace_corpus(driver_t * driver, struct trace_context * context, char ** filenames, int num_files,
+	struct trace_options * options)
+{
+	edge_db_writer_t * db;
+	int file_index;
+
+	db = edge_db_create(options->output_file, context->num_modules, options->module_names);
+	if (!db)
+		FATAL_MSG("Couldn't open the file %s to write the edge database to", options->output_file);
+
+	for (file_index = 0; file_index < num_files; file_index++)
+	{
+		INFO_MSG("Tracing file %d/%d '%s'", file_index + 1, num_files, filenames[file_index]);
+		trace_corpus_input(driver, context, db, filenames[file_index], options->num_iterations);
+	}
+
+	if (edge_db_close(db))
+		FATAL_MSG("Failed to write the edge database to %s", options->output_file);
+}
+
+#ifndef _WIN32
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////
+// Parallel Tracing //////////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////////////////////////////
 
-		//If we haven't found this edge before, add it to the all_runs list
-		if (!found)
+//Each worker is a separate process with its own driver and instrumentation, since the instrumentations
+//keep process wide state (such as the fork server's file descriptors).  Each worker writes its results
+//to its own temporary file, so the workers never wait on each other, and the parent process combines
+//the results in the same order that a single process would have recorded them.
+
+typedef void (*worker_function_t)(struct trace_options * options, int worker, void * arg);
+
+//The worker that traced an input, and that input's index in the worker's edge database
+struct corpus_owner
+{
+	uint32_t worker;
+	uint32_t index;
+};
+
+//Shared between the corpus workers in anonymous shared memory
+struct corpus_work
+{
+	uint32_t next_input;           //The next input to trace, which the workers claim with an atomic increment
+	struct corpus_owner owners[];  //The owner of each input
+};
+
+struct corpus_worker_arg
+{
+	char ** filenames;
+	int num_files;
+	struct corpus_work * work;
+};
+
+struct iterations_worker_arg
+{
+	char * seed_buffer;
+	int seed_length;
+};
+
+/**
+ * This function gets the name of the temporary file a worker writes its results to.
+ * @param options - the trace_options holding the output file
+ * @param worker - the index of the worker
+ * @param buffer - a buffer used to return the filename
+ * @param length - the length of the buffer parameter
+ */
+static void get_worker_filename(struct trace_options * options, int worker, char * buffer, size_t length)
+{
+	snprintf(buffer, length - 1, "%s.worker%d.tmp", options->output_file, worker);
+	buffer[length - 1] = 0;
+}
+
+/**
+ * This function runs a function in each of the worker processes, and waits for all of them to finish.
+ * @param options - the trace_options to pass to each worker
+ * @param function - the function to run in each worker
+ * @param arg - an argument to pass to each worker
+ */
+static void run_workers(struct trace_options * options, worker_function_t function, void * arg)
+{
+	pid_t * pids;
+	int i, status, failed = 0;
+
+	pids = (pid_t *)malloc(options->num_workers * sizeof(pid_t));
+	if (!pids)
+		FATAL_MSG("Failed to allocate memory for %d workers", options->num_workers);
+
+	//Otherwise anything still buffered would be written again by each worker when it exits
+	fflush(NULL);
+
+	for (i = 0; i < options->num_workers; i++)
+	{
+		pids[i] = fork();
+		if (pids[i] < 0)
+			FATAL_MSG("Failed to start tracer worker %d", i);
+		if (pids[i] == 0)
 		{
-			*all_runs_num_edges = *all_runs_num_edges + 1;
-			*all_runs = (struct edge_counts *)realloc(*all_runs, *all_runs_num_edges * sizeof(struct edge_counts));
-			(*all_runs)[*all_runs_num_edges - 1].edge.to = edges->edges[i].to;
-			(*all_runs)[*all_runs_num_edges - 1].edge.from = edges->edges[i].from;
-			(*all_runs)[*all_runs_num_edges - 1].count = 1;
+			function(options, i, arg);
+			exit(0);
 		}
 	}
-	free(this_run);
+
+	for (i = 0; i < options->num_workers; i++)
+	{
+		if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+		{
+			ERROR_MSG("Tracer worker %d failed", i);
+			failed = 1;
+		}
+	}
+	free(pids);
+	if (failed)
+		FATAL_MSG("Failed to trace the inputs");
 }
 
-#define MAX_MODULES 512
+/**
+ * This function traces corpus files in a worker process until there are none left, writing their edges to
+ * the worker's temporary edge database.
+ * @param options - the trace_options describing how to trace the files
+ * @param worker - the index of this worker
+ * @param arg - a corpus_worker_arg with the files to trace
+ */
+static void corpus_worker(struct trace_options * options, int worker, void * arg)
+{
+	struct corpus_worker_arg * corpus = (struct corpus_worker_arg *)arg;
+	instrumentation_t * instrumentation;
+	void * instrumentation_state;
+	driver_t * driver;
+	struct trace_context context;
+	edge_db_writer_t * db;
+	char filename[MAX_PATH];
+	uint32_t file_index, traced = 0;
 
-int main(int argc, char ** argv)
+	instrumentation = create_instrumentation(options, &instrumentation_state);
+	driver = create_driver(options, instrumentation, instrumentation_state);
+	setup_trace_context(&context, instrumentation, instrumentation_state, options->num_modules);
+
+	get_worker_filename(options, worker, filename, sizeof(filename));
+	db = edge_db_create(filename, options->num_modules, options->module_names);
+	if (!db)
+		FATAL_MSG("Couldn't open the file %s to write the edge database to", filename);
+
+	while ((file_index = __sync_fetch_and_add(&corpus->work->next_input, 1)) < (uint32_t)corpus->num_files)
+	{
+		INFO_MSG("Tracing file %u/%d '%s'", file_index + 1, corpus->num_files, corpus->filenames[file_index]);
+		trace_corpus_input(driver, &context, db, corpus->filenames[file_index], options->num_iterations);
+		corpus->work->owners[file_index].worker = (uint32_t)worker;
+		corpus->work->owners[file_index].index = traced++;
+	}
+
+	if (edge_db_close(db))
+		FATAL_MSG("Failed to write the edge database to %s", filename);
+	cleanup_trace_context(&context);
+	driver->cleanup(driver->state);
+	instrumentation->cleanup(instrumentation_state);
+	free(driver);
+	free(instrumentation);
+}
+
+/**
+ * This function traces the files in a corpus with several worker processes, and combines their results into a
+ * single edge database, identical to the one trace_corpus writes.
+ * @param filenames - the files holding the inputs to trace
+ * @param num_files - the number of files in the filenames parameter
+ * @param options - the trace_options describing how to trace the files
+ */
+static void trace_corpus_parallel(char ** filenames, int num_files, struct trace_options * options)
+{
+	struct corpus_worker_arg corpus;
+	edge_db_reader_t ** readers;
+	edge_db_writer_t * db;
+	edge_db_index_t entry;
+	const uint8_t * data;
+	char filename[MAX_PATH];
+	size_t work_size, length;
+	uint32_t worker, index;
+	int i, module;
+
+	work_size = sizeof(struct corpus_work) + num_files * sizeof(struct corpus_owner);
+	corpus.work = (struct corpus_work *)mmap(NULL, work_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (corpus.work == MAP_FAILED)
+		FATAL_MSG("Failed to allocate shared memory for the tracer workers");
+	corpus.work->next_input = 0;
+	corpus.filenames = filenames;
+	corpus.num_files = num_files;
+
+	run_workers(options, corpus_worker, &corpus);
+
+	readers = (edge_db_reader_t **)calloc(options->num_workers, sizeof(edge_db_reader_t *));
+	if (!readers)
+		FATAL_MSG("Failed to allocate memory for %d workers", options->num_workers);
+	for (i = 0; i < options->num_workers; i++)
+	{
+		get_worker_filename(options, i, filename, sizeof(filename));
+		readers[i] = edge_db_open(filename);
+		if (!readers[i])
+			FATAL_MSG("Failed to read the edge database written by tracer worker %d", i);
+		unlink(filename);
+	}
+
+	//Copy each input's already encoded edges from the worker that traced it, in the original order
+	db = edge_db_create(options->output_file, options->num_modules, options->module_names);
+	if (!db)
+		FATAL_MSG("Couldn't open the file %s to write the edge database to", options->output_file);
+	for (i = 0; i < num_files; i++)
+	{
+		worker = corpus.work->owners[i].worker;
+		index = corpus.work->owners[i].index;
+		if (worker >= (uint32_t)options->num_workers || edge_db_add_input(db, filenames[i]))
+			FATAL_MSG("Failed to add the input file \"%s\" to the edge database", filenames[i]);
+		for (module = 0; module < options->num_modules; module++)
+		{
+			if (edge_db_get_block(readers[worker], index, module, &data, &length, &entry)
+				|| edge_db_add_block(db, data, length, entry.num_edges, entry.flags))
+				FATAL_MSG("Failed to write the edges for \"%s\" to the edge database", filenames[i]);
+		}
+	}
+	if (edge_db_close(db))
+		FATAL_MSG("Failed to write the edge database to %s", options->output_file);
+
+	for (i = 0; i < options->num_workers; i++)
+		edge_db_reader_cleanup(readers[i]);
+	free(readers);
+	munmap(corpus.work, work_size);
+}
+
+/**
+ * This function runs a worker's share of the iterations of a single input, and writes the number of runs
+ * each edge was seen in to the worker's temporary file.
+ * @param options - the trace_options describing how to trace the input
+ * @param worker - the index of this worker
+ * @param arg - an iterations_worker_arg with the input to trace
+ */
+static void iterations_worker(struct trace_options * options, int worker, void * arg)
 {
+	struct iterations_worker_arg * input = (struct iterations_worker_arg *)arg;
+	instrumentation_t * instrumentation;
+	void * instrumentation_state;
 	driver_t * driver;
+	struct trace_context context;
+	char filename[MAX_PATH];
+	uint64_t num_edges;
+	int i, num_iterations;
+	FILE * fp;
+
+	//Split the iterations into contiguous blocks, so the first worker sees the edges in the same order a single
+	//process would have
+	num_iterations = (worker + 1) * options->num_iterations / options->num_workers
+		- worker * options->num_iterations / options->num_workers;
+
+	instrumentation = create_instrumentation(options, &instrumentation_state);
+	driver = create_driver(options, instrumentation, instrumentation_state);
+	setup_trace_context(&context, instrumentation, instrumentation_state, options->num_modules);
+
+	if (trace_input(driver, &context, input->seed_buffer, input->seed_length, num_iterations))
+		FATAL_MSG("Failed to test the input file");
+
+	get_worker_filename(options, worker, filename, sizeof(filename));
+	fp = fopen(filename, "wb+");
+	if (fp == NULL)
+		FATAL_MSG("Couldn't open the file %s to write the edges to", filename);
+	for (i = 0; i < context.num_modules; i++)
+	{
+		num_edges = context.all_runs[i]->num_edges;
+		if (fwrite(&num_edges, sizeof(num_edges), 1, fp) != 1
+			|| fwrite(context.all_runs[i]->edges, sizeof(struct edge_counts), num_edges, fp) != num_edges)
+			FATAL_MSG("Failed to write the edges to %s", filename);
+	}
+	if (fclose(fp))
+		FATAL_MSG("Failed to write the edges to %s", filename);
+
+	cleanup_trace_context(&context);
+	driver->cleanup(driver->state);
+	instrumentation->cleanup(instrumentation_state);
+	free(driver);
+	free(instrumentation);
+}
+
+/**
+ * This function runs the iterations of a single input across several worker processes, and combines the number
+ * of runs each edge was seen in into the given trace_context.
+ * @param context - the trace_context to combine the edges into
+ * @param seed_buffer - the input to trace
+ * @param seed_length - the length of the seed_buffer parameter
+ * @param options - the trace_options describing how to trace the input
+ */
+static void trace_iterations_parallel(struct trace_context * context, char * seed_buffer, int seed_length,
+	struct trace_options * options)
+{
+	struct iterations_worker_arg input;
+	struct edge_counts * counts;
+	char filename[MAX_PATH];
+	char * buffer;
+	size_t offset;
+	uint64_t j, num_edges;
+	int i, module, length;
+
+	input.seed_buffer = seed_buffer;
+	input.seed_length = seed_length;
+	run_workers(options, iterations_worker, &input);
+
+	//Combine the workers' counts in order, so the edges end up in the order a single process would have seen them
+	for (i = 0; i < options->num_workers; i++)
+	{
+		get_worker_filename(options, i, filename, sizeof(filename));
+		buffer = NULL;
+		length = read_file(filename, &buffer);
+		if (length < 0)
+			FATAL_MSG("Failed to read the edges written by tracer worker %d", i);
+		unlink(filename);
+
+		offset = 0;
+		for (module = 0; module < context->num_modules; module++)
+		{
+			if (length - offset < sizeof(num_edges))
+				FATAL_MSG("Failed to read the edges written by tracer worker %d", i);
+			memcpy(&num_edges, buffer + offset, sizeof(num_edges));
+			offset += sizeof(num_edges);
+			if ((length - offset) / sizeof(struct edge_counts) < num_edges)
+				FATAL_MSG("Failed to read the edges written by tracer worker %d", i);
+			counts = (struct edge_counts *)(buffer + offset);
+			for (j = 0; j < num_edges; j++)
+			{
+				if (edge_set_add_count(context->all_runs[module], &counts[j].edge, counts[j].count))
+					FATAL_MSG("Failed to allocate memory for the program edges");
+			}
+			offset += num_edges * sizeof(struct edge_counts);
+		}
+		free(buffer);
+	}
+}
+
+#endif //!_WIN32
+
+int main(int argc, char ** argv)
+{
+	driver_t * driver = NULL;
 	instrumentation_t * instrumentation;
-	char *driver_name, *driver_options = NULL,
-		*input_filename = NULL, *seed_buffer = NULL, *output_file = NULL,
-		*instrumentation_name = NULL, *instrumentation_options = NULL,
-		*logging_options = NULL;
+	char *input_filename = NULL, *logging_options = NULL, *seed_buffer = NULL;
+	char ** filenames;
 	void * instrumentation_state = NULL;
-	int seed_length, iteration;
-	instrumentation_edges_t * edges;
-	instrumentation_edge_t *deterministic_edges;
-	struct edge_counts * all_runs[MAX_MODULES];
-	int all_runs_num_edges[MAX_MODULES];
-	int i, j, deterministic_edges_num_edges, num_modules = 0;
+	struct trace_context context;
+	struct trace_options options;
+	int i, num_files, seed_length;
 	char * module_name = NULL;
 	char * module_names[MAX_MODULES];
-	char filename_buffer[MAX_PATH];
-	FILE * fp;
 
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 	// Parse Arguments ///////////////////////////////////////////////////////////////////////////////////
@@ -132,23 +751,35 @@ int main(int argc, char ** argv)
 
 	//Default options
 	int num_iterations = 5;
+	int num_workers = 1;
 	int binary_mode = 0;
 	int per_module_edges = 0;
+	int corpus_mode = 0;
 
 	if (argc < 5)
 	{
 		usage(argv[0]);
 	}
 
-	driver_name = argv[1];
-	instrumentation_name = argv[2];
-	input_filename = argv[3];
-	output_file = argv[4];
-	for (int i = 5; i < argc; i++)
+	memset(&options, 0, sizeof(options));
+	options.driver_name = argv[1];
+	options.instrumentation_name = argv[2];
+	i = 3;
+	if (!strcmp(argv[i], "-c"))
+	{
+		corpus_mode = 1;
+		i++;
+		if (argc < 6)
+			usage(argv[0]);
+	}
+	input_filename = argv[i++];
+	options.output_file = argv[i++];
+	for (; i < argc; i++)
 	{
 		IF_ARG_SET_TRUE("-b", binary_mode)
-		ELSE_IF_ARG_OPTION("-d", driver_options)
-		ELSE_IF_ARG_OPTION("-i", instrumentation_options)
+		ELSE_IF_ARG_OPTION("-d", options.driver_options)
+		ELSE_IF_ARG_OPTION("-i", options.instrumentation_options)
+		ELSE_IF_ARGINT_OPTION("-j", num_workers)
 		ELSE_IF_ARG_OPTION("-l", logging_options)
 		ELSE_IF_ARGINT_OPTION("-n", num_iterations)
 		ELSE_IF_ARG_SET_TRUE("-p", per_module_edges)
@@ -168,108 +799,92 @@ int main(int argc, char ** argv)
 
 	if (num_iterations < 1)
 		FATAL_MSG("Bad iteration number (%d).  Must have a iteration count 1 or greater.", num_iterations);
+	if (num_workers < 1)
+		FATAL_MSG("Bad worker count (%d).  Must have a worker count 1 or greater.", num_workers);
+#ifdef _WIN32
+	if (num_workers > 1)
+		FATAL_MSG("Tracing with multiple workers is not supported on Windows");
+#endif
+	//The workers' targets would all listen on (or connect to) the same port, and get each other's inputs
+	if (num_workers > 1 && (!strcmp(options.driver_name, "network_server") || !strcmp(options.driver_name, "network_client")))
+		FATAL_MSG("Tracing with multiple workers is not supported with the %s driver", options.driver_name);
+	//Without -c, the iterations are split between the workers, so more workers than iterations won't help
+	if (!corpus_mode && num_workers > num_iterations)
+		num_workers = num_iterations;
+	options.num_iterations = num_iterations;
+	options.num_workers = num_workers;
 
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 	// Ojbect Setup //////////////////////////////////////////////////////////////////////////////////////
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 
-	instrumentation = instrumentation_factory(instrumentation_name);
-	if (!instrumentation)
-		FATAL_MSG("Unknown instrumentation '%s'", instrumentation_name);
-	if (!instrumentation->get_edges)
-		FATAL_MSG("Instrumentation '%s' does not support the ability to get a list of edges", instrumentation_name);
-
-	if (instrumentation_options)
-		instrumentation_options = add_int_option_to_json(instrumentation_options, "edges", 1);
+	if (options.instrumentation_options)
+		options.instrumentation_options = add_int_option_to_json(options.instrumentation_options, "edges", 1);
 	else
-		instrumentation_options = "{\"edges\": 1}";
-
-	instrumentation_state = instrumentation->create(instrumentation_options, NULL);
-	if (!instrumentation_state)
-		FATAL_MSG("Bad options/state for instrumentation %s", instrumentation_name);
-
-	driver = driver_instrumentation_factory(driver_name, driver_options, instrumentation, instrumentation_state);
-	if (!driver)
-		FATAL_MSG("Unknown driver '%s' or bad options: %s", driver_name, driver_options ? driver_options : "none");
-
-	//////////////////////////////////////////////////////////////////////////////////////////////////////
-	// Main Test Loop ////////////////////////////////////////////////////////////////////////////////////
-	//////////////////////////////////////////////////////////////////////////////////////////////////////
+		options.instrumentation_options = "{\"edges\": 1}";
 
-	//Read the seed file
-	seed_length = read_file(input_filename, &seed_buffer);
-	if (seed_length <= 0) //Couldn't read file, or empty file
-		FATAL_MSG("Unable to open the input file \"%s\"", input_filename);
+	instrumentation = create_instrumentation(&options, &instrumentation_state);
 
-	memset(&all_runs, 0, sizeof(all_runs));
-	memset(&all_runs_num_edges, 0, sizeof(all_runs_num_edges));
 	memset(&module_names, 0, sizeof(module_names));
 	if (!per_module_edges)
 	{
-		num_modules = 1;
+		options.num_modules = 1;
 	}
 	else
 	{
-		while (!instrumentation->get_module_info(instrumentation_state, num_modules, NULL, &module_name, NULL, NULL))
+		while (!instrumentation->get_module_info(instrumentation_state, options.num_modules, NULL, &module_name, NULL, NULL))
 		{
-			if (num_modules >= MAX_MODULES)
-				FATAL_MSG("Too many modules specified, %d specified, %d maximum", num_modules, MAX_MODULES);
-			module_names[num_modules] = module_name;
-			num_modules++;
+			if (options.num_modules >= MAX_MODULES)
+				FATAL_MSG("Too many modules specified, %d specified, %d maximum", options.num_modules, MAX_MODULES);
+			module_names[options.num_modules] = module_name;
+			options.num_modules++;
 		}
 	}
+	options.module_names = per_module_edges ? module_names : NULL;
 
-	for (iteration = 0; iteration < num_iterations; iteration++)
-	{
-		driver->test_input(driver->state, seed_buffer, seed_length);
-		for (i = 0; i < num_modules; i++)
-		{
-			edges = instrumentation->get_edges(instrumentation_state, i);
-			if (!edges)
-				FATAL_MSG("Instrumentation failed to get the program edges from the tested process.");
-			record_edges(edges, &all_runs[i], &all_runs_num_edges[i]);
-		}
-	}
-	free(seed_buffer);
+	//The workers create their own drivers, so only create one here when tracing in this process
+	if (num_workers == 1)
+		driver = create_driver(&options, instrumentation, instrumentation_state);
+	setup_trace_context(&context, instrumentation, instrumentation_state, options.num_modules);
 
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
-	// Reduce the list of edges to just the ones in every run, and store it //////////////////////////////
+	// Main Test Loop ////////////////////////////////////////////////////////////////////////////////////
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 
-	for (i = 0; i < num_modules; i++)
+	if (corpus_mode)
 	{
-		deterministic_edges = NULL;
-		deterministic_edges_num_edges = 0;
-		for (j = 0; j < all_runs_num_edges[i]; j++)
-		{
-			if (all_runs[i][j].count == num_iterations) //if the edge was found in all the iterations
-			{
-				deterministic_edges_num_edges++;
-				deterministic_edges = (instrumentation_edge_t *)realloc(deterministic_edges, deterministic_edges_num_edges * sizeof(instrumentation_edge_t));
-				deterministic_edges[deterministic_edges_num_edges - 1].to = all_runs[i][j].edge.to;
-				deterministic_edges[deterministic_edges_num_edges - 1].from = all_runs[i][j].edge.from;
-			}
-		}
+		filenames = list_directory(input_filename, &num_files);
+		if (!filenames)
+			FATAL_MSG("Unable to list the files in the input directory \"%s\"", input_filename);
 
-		if (!module_names[i])
-			snprintf(filename_buffer, sizeof(filename_buffer) - 1, "%s", output_file);
+#ifndef _WIN32
+		if (num_workers > 1)
+			trace_corpus_parallel(filenames, num_files, &options);
 		else
-			snprintf(filename_buffer, sizeof(filename_buffer) - 1, "%s_%s.%s", output_file, module_names[i], binary_mode ? "dat" : "txt");
+#endif
+			trace_corpus(driver, &context, filenames, num_files, &options);
 
-		fp = fopen(filename_buffer, "wb+");
-		if (fp == NULL)
-			FATAL_MSG("Couldn't open the file %s to write the edges to for %s", filename_buffer, module_names[i] ? module_names[i] : "the program");
-
-		for (j = 0; j < deterministic_edges_num_edges; j++)
-		{
-			if (binary_mode)
-				fwrite(&deterministic_edges[j], sizeof(instrumentation_edge_t), 1, fp);
-			else
-				fprintf(fp, "%016x:%016x\n", deterministic_edges[j].from, deterministic_edges[j].to);
-		}
-		fclose(fp);
+		for (i = 0; i < num_files; i++)
+			free(filenames[i]);
+		free(filenames);
+	}
+	else
+	{
+		//Read the seed file
+		seed_length = read_file(input_filename, &seed_buffer);
+		if (seed_length <= 0) //Couldn't read file, or empty file
+			FATAL_MSG("Unable to open the input file \"%s\"", input_filename);
+
+#ifndef _WIN32
+		if (num_workers > 1)
+			trace_iterations_parallel(&context, seed_buffer, seed_length, &options);
+		else
+#endif
+		if (trace_input(driver, &context, seed_buffer, seed_length, num_iterations))
+			FATAL_MSG("Failed to test the input file \"%s\"", input_filename);
+		free(seed_buffer);
 
-		free(deterministic_edges);
+		write_edge_files(&context, options.output_file, num_iterations, binary_mode, module_names);
 	}
 
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -277,9 +892,13 @@ int main(int argc, char ** argv)
 	//////////////////////////////////////////////////////////////////////////////////////////////////////
 
 	//Cleanup the objects and exit
-	driver->cleanup(driver->state);
+	cleanup_trace_context(&context);
+	if (driver)
+	{
+		driver->cleanup(driver->state);
+		free(driver);
+	}
 	instrumentation->cleanup(instrumentation_state);
-	free(driver);
 	free(instrumentation);
 	return 0;
 }